@@ -119,3 +119,39 @@ static __host__ __device__ __inline__ unsigned int rot_seed( unsigned int seed,
 {
     return seed ^ frame;
 }
+
+// High and low 32 bits of the 64 bit product a*b
+static __host__ __device__ __inline__ unsigned int mulhilo32( unsigned int a, unsigned int b, unsigned int& hi )
+{
+#ifdef __CUDA_ARCH__
+  hi = __umulhi( a, b );
+  return a * b;
+#else
+  const unsigned long long product = static_cast<unsigned long long>( a ) * b;
+  hi = static_cast<unsigned int>( product >> 32 );
+  return static_cast<unsigned int>( product );
+#endif
+}
+
+// Philox-2x32-10 counter based generator (Salmon et al., "Parallel Random
+// Numbers: As Easy as 1, 2, 3", SC11).  Maps a 64 bit counter and a 32 bit key
+// to 64 random bits without any state, so launches can draw samples from their
+// launch index and frame number instead of a seed buffer.  The host and device
+// versions return the same bits.
+static __host__ __device__ __inline__ optix::uint2 philox2x32( optix::uint2 counter, unsigned int key )
+{
+  for( unsigned int n = 0; n < 10; n++ )
+  {
+    unsigned int hi;
+    const unsigned int lo = mulhilo32( 0xd256d193u, counter.x, hi );
+    counter = optix::make_uint2( hi ^ key ^ counter.y, lo );
+    key += 0x9e3779b9u;
+  }
+  return counter;
+}
+
+// A pair of lcg() seeds for rnd(), unique per (index, frame, stream)
+static __host__ __device__ __inline__ optix::uint2 counterSeeds( unsigned int index, unsigned int frame, unsigned int stream )
+{
+  return philox2x32( optix::make_uint2( index, frame ), stream );
+}
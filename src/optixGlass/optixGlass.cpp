@@ -48,7 +48,9 @@
 #include <sutil.h>
 #include "commonStructs.h"
 #include <Camera.h>
+#include <MeshBVH.h>
 #include <OptiXMesh.h>
+#include <Parallel.h>
 
 #include <imgui/imgui.h>
 #include <imgui/imgui_impl_glfw_gl2.h>
@@ -206,6 +208,7 @@ optix::Aabb createGeometry(
         const std::vector<optix::Matrix4x4>& xforms, 
         const Material glass_material,
         const Material ground_material,
+        unsigned int mesh_load_flags,
         // output: this is a Group with two GeometryGroup children, for toggling visibility later
         optix::Group& top_group
         )
@@ -232,7 +235,7 @@ optix::Aabb createGeometry(
             mesh.bounds = context->createProgramFromPTXFile( ptx_path, "mesh_bounds" );
             mesh.material = glass_material;
 
-            loadMesh( filenames[i], mesh, xforms[i] ); 
+            loadMesh( filenames[i], mesh, xforms[i], mesh_load_flags ); 
             geometry_group->addChild( mesh.geom_instance );
 
             aabb.include( mesh.bbox_min, mesh.bbox_max );
@@ -473,6 +476,86 @@ void glfwRun( GLFWwindow* window, sutil::Camera& camera, const optix::Group top_
 }
 
 
+//------------------------------------------------------------------------------
+//
+//  Host BVH benchmark
+//
+//------------------------------------------------------------------------------
+
+// Builds a MeshBVH for each mesh and traces one primary ray per pixel from the
+// default camera, then one shadow ray from each hit towards a fixed light.
+void runBvhBenchmark( const std::vector<std::string>& mesh_files, unsigned int mesh_load_flags )
+{
+    const int num_trials = 5;
+    for( size_t i = 0; i < mesh_files.size(); ++i )
+    {
+        HostMesh mesh( mesh_files[i], 0, mesh_load_flags );
+        const MeshBVH bvh( mesh );
+
+        const optix::Aabb aabb( make_float3( mesh.bbox_min[0], mesh.bbox_min[1], mesh.bbox_min[2] ),
+                                make_float3( mesh.bbox_max[0], mesh.bbox_max[1], mesh.bbox_max[2] ) );
+        const float3 eye = aabb.center() + make_float3( 0.0f, 1.5f*aabb.extent( 1 ), 1.5f*aabb.extent( 2 ) );
+        float3 U, V, W;
+        sutil::calculateCameraVariables( eye, aabb.center(), make_float3( 0.0f, 1.0f, 0.0f ), 45.0f,
+                                         static_cast<float>( WIDTH ) / static_cast<float>( HEIGHT ), U, V, W );
+        const float3 light_dir = normalize( make_float3( 1.0f, 2.0f, 0.5f ) );
+
+        std::vector<float3> hit_points( WIDTH*HEIGHT );
+        std::vector<char>   hit_mask( WIDTH*HEIGHT );
+        double primary_time = 0.0;
+        double shadow_time  = 0.0;
+        for( int trial = 0; trial < num_trials; ++trial )
+        {
+            double t0 = sutil::currentTime();
+            sutil::parallelFor( HEIGHT, [&]( size_t y )
+            {
+                for( unsigned int x = 0; x < WIDTH; ++x )
+                {
+                    const float2 d = make_float2( ( x + 0.5f ) / WIDTH, ( y + 0.5f ) / HEIGHT ) * 2.0f - 1.0f;
+                    const float3 dir = normalize( d.x*U + d.y*V + W );
+                    MeshRayHit hit;
+                    const size_t index = y*WIDTH + x;
+                    hit_mask[index] = bvh.intersect( &eye.x, &dir.x, 0.0f, RT_DEFAULT_MAX, hit );
+                    hit_points[index] = eye + hit.t*dir;
+                }
+            } );
+            double t1 = sutil::currentTime();
+            primary_time += t1 - t0;
+
+            t0 = sutil::currentTime();
+            sutil::parallelFor( HEIGHT, [&]( size_t y )
+            {
+                for( unsigned int x = 0; x < WIDTH; ++x )
+                {
+                    const size_t index = y*WIDTH + x;
+                    if( hit_mask[index] )
+                        hit_mask[index] += bvh.occluded( &hit_points[index].x, &light_dir.x, 1.e-3f*aabb.maxExtent(), RT_DEFAULT_MAX );
+                }
+            } );
+            t1 = sutil::currentTime();
+            shadow_time += t1 - t0;
+        }
+
+        size_t num_hits     = 0;
+        size_t num_occluded = 0;
+        for( size_t p = 0; p < hit_mask.size(); ++p )
+        {
+            num_hits     += hit_mask[p] ? 1 : 0;
+            num_occluded += hit_mask[p] == 2 ? 1 : 0;
+        }
+
+        const double num_primary = static_cast<double>( WIDTH*HEIGHT ) * num_trials;
+        const double num_shadow  = static_cast<double>( num_hits ) * num_trials;
+        std::cerr << mesh_files[i] << ": " << mesh.num_triangles << " triangles, "
+                  << bvh.nodes().size() << " nodes, built in " << bvh.buildTime()*1000.0 << " ms\n"
+                  << "  closest hit: " << num_primary / primary_time * 1.e-6 << " Mrays/s ("
+                  << num_hits << " of " << WIDTH*HEIGHT << " hit)\n"
+                  << "  any hit:     " << num_shadow / shadow_time * 1.e-6 << " Mrays/s ("
+                  << num_occluded << " occluded)" << std::endl;
+    }
+}
+
+
 //------------------------------------------------------------------------------
 //
 // Main
@@ -487,6 +570,9 @@ void printUsageAndExit( const std::string& argv0 )
         "  -h | --help                  Print this usage message and exit.\n"
         "  -f | --file <output_file>    Save image to file and exit.\n"
         "  -n | --nopbo                 Disable GL interop for display buffer.\n"
+        "  -w | --weld                  Merge duplicate mesh vertices after loading.\n"
+        "  -r | --reorder               Reorder mesh triangles and vertices for locality.\n"
+        "  -b | --bvh-bench             Time host BVH build and traversal on the meshes and exit.\n"
         "App Keystrokes:\n"
         "  q  Quit\n"
         "  s  Save image to '" << SAMPLE_NAME << ".png'\n"
@@ -502,6 +588,8 @@ void printUsageAndExit( const std::string& argv0 )
 int main( int argc, char** argv )
 {
     bool use_pbo  = true;
+    bool bvh_bench = false;
+    unsigned int mesh_load_flags = MESH_LOAD_DEFAULT;
     std::string out_file;
     std::vector<std::string> mesh_files;
     std::vector<optix::Matrix4x4> mesh_xforms;
@@ -526,6 +614,18 @@ int main( int argc, char** argv )
         {
             use_pbo = false;
         }
+        else if( arg == "-w" || arg == "--weld"  )
+        {
+            mesh_load_flags |= MESH_LOAD_WELD_VERTICES;
+        }
+        else if( arg == "-r" || arg == "--reorder"  )
+        {
+            mesh_load_flags |= MESH_LOAD_REORDER;
+        }
+        else if( arg == "-b" || arg == "--bvh-bench"  )
+        {
+            bvh_bench = true;
+        }
         else if( arg[0] == '-' )
         {
             std::cerr << "Unknown option '" << arg << "'\n";
@@ -540,6 +640,17 @@ int main( int argc, char** argv )
 
     try
     {
+        if( bvh_bench )
+        {
+            if( mesh_files.empty() )
+            {
+                mesh_files.push_back( std::string( sutil::samplesDir() ) + "/data/teapot_body.ply" );
+                mesh_files.push_back( std::string( sutil::samplesDir() ) + "/data/wedding-band.obj" );
+            }
+            runBvhBenchmark( mesh_files, mesh_load_flags );
+            return 0;
+        }
+
         GLFWwindow* window = glfwInitialize();
 
 #ifndef __APPLE__
@@ -567,7 +678,7 @@ int main( int argc, char** argv )
         Material glass_material = createGlassMaterial();
         Material ground_material = createDiffuseMaterial();
         optix::Group top_group;
-        const optix::Aabb aabb = createGeometry( mesh_files, mesh_xforms, glass_material, ground_material, top_group );
+        const optix::Aabb aabb = createGeometry( mesh_files, mesh_xforms, glass_material, ground_material, mesh_load_flags, top_group );
 
         // Note: lighting comes from miss program
 
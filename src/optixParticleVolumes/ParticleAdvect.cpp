@@ -0,0 +1,133 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "ParticleAdvect.h"
+
+#include <Parallel.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 1 )
+#  include <xmmintrin.h>
+#  define PARTICLE_ADVECT_SSE 1
+#endif
+
+using namespace optix;
+
+
+//------------------------------------------------------------------------------
+//
+// Helpers
+//
+//------------------------------------------------------------------------------
+
+namespace
+{
+
+// Particles per work item of the parallel passes, a multiple of 4
+const size_t ADVECT_BLOCK_SIZE = 1u << 15;
+
+
+inline void advectParticle( const float4& p, const float3& v, float dt, float4& out )
+{
+  out = make_float4( p.x + dt * v.x, p.y + dt * v.y, p.z + dt * v.z, p.w );
+}
+
+
+void advectBlock( const float4* positions, const float3* velocities, size_t begin, size_t end, float dt,
+                  float4* out )
+{
+  size_t i = begin;
+#if defined(PARTICLE_ADVECT_SSE)
+  // Four particles at a time.  Their 12 velocity floats are loaded as three
+  // vectors and shuffled into one vector per particle.  The last lane holds a
+  // component of a neighbor, which is masked out rather than multiplied by 0
+  // so that a neighbor's inf or NaN velocity cannot reach w.
+  const __m128 step = _mm_set1_ps( dt );
+  const __m128 xyz  = _mm_cmpneq_ps( _mm_set_ps( 0.0f, 1.0f, 1.0f, 1.0f ), _mm_setzero_ps() );
+  for( ; i + 4 <= end; i += 4 ) {
+    const float* v = &velocities[i].x;
+    const __m128 a = _mm_loadu_ps( v );                                     // x0 y0 z0 x1
+    const __m128 b = _mm_loadu_ps( v + 4 );                                 // y1 z1 x2 y2
+    const __m128 c = _mm_loadu_ps( v + 8 );                                 // z2 x3 y3 z3
+    const __m128 t  = _mm_shuffle_ps( a, b, _MM_SHUFFLE( 0, 0, 3, 3 ) );    // x1 x1 y1 y1
+    const __m128 v0 = _mm_and_ps( a, xyz );                                                     // x0 y0 z0 0
+    const __m128 v1 = _mm_and_ps( _mm_shuffle_ps( t, b, _MM_SHUFFLE( 3, 1, 2, 0 ) ), xyz );    // x1 y1 z1 0
+    const __m128 v2 = _mm_and_ps( _mm_shuffle_ps( b, c, _MM_SHUFFLE( 1, 0, 3, 2 ) ), xyz );    // x2 y2 z2 0
+    const __m128 v3 = _mm_and_ps( _mm_shuffle_ps( c, c, _MM_SHUFFLE( 0, 3, 2, 1 ) ), xyz );    // x3 y3 z3 0
+
+    const float* p = &positions[i].x;
+    float*       o = &out[i].x;
+    _mm_storeu_ps( o,      _mm_add_ps( _mm_loadu_ps( p ),      _mm_mul_ps( v0, step ) ) );
+    _mm_storeu_ps( o + 4,  _mm_add_ps( _mm_loadu_ps( p + 4 ),  _mm_mul_ps( v1, step ) ) );
+    _mm_storeu_ps( o + 8,  _mm_add_ps( _mm_loadu_ps( p + 8 ),  _mm_mul_ps( v2, step ) ) );
+    _mm_storeu_ps( o + 12, _mm_add_ps( _mm_loadu_ps( p + 12 ), _mm_mul_ps( v3, step ) ) );
+  }
+#endif
+  for( ; i < end; ++i )
+    advectParticle( positions[i], velocities[i], dt, out[i] );
+}
+
+} // namespace
+
+
+//------------------------------------------------------------------------------
+//
+// Advection
+//
+//------------------------------------------------------------------------------
+
+void advectParticles( const float4* positions, const float3* velocities, size_t count, float dt, float4* out )
+{
+  sutil::parallelFor( ( count + ADVECT_BLOCK_SIZE - 1 ) / ADVECT_BLOCK_SIZE, [&]( size_t block )
+  {
+    const size_t begin = block * ADVECT_BLOCK_SIZE;
+    advectBlock( positions, velocities, begin, std::min( count, begin + ADVECT_BLOCK_SIZE ), dt, out );
+  } );
+}
+
+
+float maxParticleSpeed( const float3* velocities, size_t count )
+{
+  const size_t num_blocks = ( count + ADVECT_BLOCK_SIZE - 1 ) / ADVECT_BLOCK_SIZE;
+  std::vector<float> partial( num_blocks, 0.0f );
+  sutil::parallelFor( num_blocks, [&]( size_t block )
+  {
+    const size_t end = std::min( count, ( block + 1 ) * ADVECT_BLOCK_SIZE );
+    float max_speed2 = 0.0f;
+    for( size_t i = block * ADVECT_BLOCK_SIZE; i < end; ++i )
+      max_speed2 = std::max( max_speed2, dot( velocities[i], velocities[i] ) );
+    partial[block] = max_speed2;
+  } );
+
+  float max_speed2 = 0.0f;
+  for( size_t block = 0; block < num_blocks; ++block )
+    max_speed2 = std::max( max_speed2, partial[block] );
+  return std::sqrt( max_speed2 );
+}
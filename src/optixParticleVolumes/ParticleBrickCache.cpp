@@ -0,0 +1,241 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "ParticleBrickCache.h"
+
+#include <algorithm>
+#include <chrono>
+
+
+//------------------------------------------------------------------------------
+//
+// Helpers
+//
+//------------------------------------------------------------------------------
+
+namespace
+{
+
+double currentTime()
+{
+  return std::chrono::duration<double>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+} // namespace
+
+
+//------------------------------------------------------------------------------
+//
+// ParticleBrickCache
+//
+//------------------------------------------------------------------------------
+
+ParticleBrickCache::ParticleBrickCache( LoadFunction load, size_t budget_bytes )
+  : m_load( load ),
+    m_budget( budget_bytes ),
+    m_loading( 0 ),
+    m_is_loading( false ),
+    m_stop( false )
+{
+  Counters zero = { 0, 0, 0, 0, 0.0, 0.0, 0.0, 0, 0 };
+  m_counters = zero;
+  m_worker = std::thread( &ParticleBrickCache::workerLoop, this );
+}
+
+
+ParticleBrickCache::~ParticleBrickCache()
+{
+  {
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_stop = true;
+    m_queue.clear();
+  }
+  m_cond.notify_all();
+  m_worker.join();
+}
+
+
+void ParticleBrickCache::request( const std::vector<int>& bricks )
+{
+  {
+    std::lock_guard<std::mutex> lock( m_mutex );
+    const double now = currentTime();
+    m_wanted = bricks;
+    m_wanted_set = std::set<int>( bricks.begin(), bricks.end() );
+    m_queue.clear();
+
+    // Latencies are measured from the first request of a brick that is still
+    // wanted
+    for( std::map<int, double>::iterator it = m_requested.begin(); it != m_requested.end(); )
+      if( !m_wanted_set.count( it->first ) && !( m_is_loading && m_loading == it->first ) )
+        m_requested.erase( it++ );
+      else
+        ++it;
+
+    // Wanted bricks become the most recently used, the first one first
+    for( size_t i = bricks.size(); i-- > 0; ) {
+      const int brick = bricks[i];
+      std::map<int, EntryList::iterator>::iterator it = m_entries.find( brick );
+      if( it != m_entries.end() )
+        m_lru.splice( m_lru.begin(), m_lru, it->second );
+      else if( !m_requested.count( brick ) )
+        m_requested[brick] = now;
+    }
+    for( size_t i = 0; i < bricks.size(); ++i )
+      if( !m_entries.count( bricks[i] ) && !m_failed.count( bricks[i] ) &&
+          !( m_is_loading && m_loading == bricks[i] ) )
+        m_queue.push_back( bricks[i] );
+
+    evict();
+  }
+  m_cond.notify_all();
+}
+
+
+void ParticleBrickCache::resident( std::vector<ResidentBrick>& bricks, bool wait )
+{
+  std::unique_lock<std::mutex> lock( m_mutex );
+  if( wait ) {
+    const std::vector<int> wanted = m_wanted;
+    for( size_t i = 0; i < wanted.size(); ++i ) {
+      const int brick = wanted[i];
+      m_cond.wait( lock, [&]() { return !m_is_loading || m_loading != brick; } );
+      if( m_entries.count( brick ) )
+        continue;
+
+      // Not resident: load it here, after taking it out of the worker's queue
+      m_queue.erase( std::remove( m_queue.begin(), m_queue.end(), brick ), m_queue.end() );
+      lock.unlock();
+
+      const double t0 = currentTime();
+      std::shared_ptr<ParticleFrameData> data( new ParticleFrameData );
+      m_load( brick, *data );
+      const double t1 = currentTime();
+
+      lock.lock();
+      m_failed.erase( brick );
+      insert( brick, data, t1 - t0 );
+    }
+    evict();
+  }
+
+  bricks.clear();
+  for( size_t i = 0; i < m_wanted.size(); ++i ) {
+    std::map<int, EntryList::iterator>::iterator it = m_entries.find( m_wanted[i] );
+    if( it != m_entries.end() )
+      bricks.push_back( ResidentBrick( m_wanted[i], it->second->data ) );
+  }
+}
+
+
+ParticleBrickCache::Counters ParticleBrickCache::counters()const
+{
+  std::lock_guard<std::mutex> lock( m_mutex );
+  return m_counters;
+}
+
+
+void ParticleBrickCache::workerLoop()
+{
+  std::unique_lock<std::mutex> lock( m_mutex );
+  for( ;; ) {
+    m_cond.wait( lock, [&]() { return m_stop || !m_queue.empty(); } );
+    if( m_stop )
+      return;
+
+    const int brick = m_queue.front();
+    m_queue.pop_front();
+    if( m_entries.count( brick ) )
+      continue;
+
+    m_loading    = brick;
+    m_is_loading = true;
+    lock.unlock();
+
+    const double t0 = currentTime();
+    std::shared_ptr<ParticleFrameData> data( new ParticleFrameData );
+    try
+    {
+      m_load( brick, *data );
+    }
+    catch( ... )
+    {
+      // Left to resident(), which reports the error if it waits for the brick
+      data.reset();
+    }
+    const double t1 = currentTime();
+
+    lock.lock();
+    m_is_loading = false;
+    if( data ) {
+      insert( brick, data, t1 - t0 );
+      evict();
+    } else {
+      ++m_counters.failed;
+      m_failed.insert( brick );
+      m_requested.erase( brick );
+    }
+    m_cond.notify_all();
+  }
+}
+
+
+void ParticleBrickCache::insert( int brick, const std::shared_ptr<ParticleFrameData>& data, double load_time )
+{
+  Entry entry = { brick, data, particleFrameBytes( *data ) };
+  m_lru.push_front( entry );
+  m_entries[brick] = m_lru.begin();
+  ++m_counters.loaded;
+  ++m_counters.resident_bricks;
+  m_counters.resident_bytes += entry.bytes;
+  m_counters.bytes_streamed += entry.bytes;
+  m_counters.load_time      += load_time;
+
+  std::map<int, double>::iterator it = m_requested.find( brick );
+  if( it != m_requested.end() ) {
+    const double latency = currentTime() - it->second;
+    m_counters.latency     += latency;
+    m_counters.max_latency  = std::max( m_counters.max_latency, latency );
+    m_requested.erase( it );
+  }
+}
+
+
+void ParticleBrickCache::evict()
+{
+  EntryList::iterator it = m_lru.end();
+  while( m_counters.resident_bytes > m_budget && it != m_lru.begin() ) {
+    --it;
+    if( m_wanted_set.count( it->brick ) )
+      continue;
+    m_counters.resident_bytes -= it->bytes;
+    --m_counters.resident_bricks;
+    ++m_counters.evicted;
+    m_entries.erase( it->brick );
+    it = m_lru.erase( it );
+  }
+}
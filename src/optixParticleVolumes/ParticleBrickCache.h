@@ -0,0 +1,133 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include "ParticleData.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+//-----------------------------------------------------------------------------
+//
+// Host cache of the bricks of a bricked particle dataset (see
+// ParticleBricks.h) with a byte budget and least recently used eviction.
+// request() names the bricks the current view needs, most important first,
+// and a worker thread streams in the ones that are not resident, in that
+// order.  The bricks of the last request are never evicted.
+//
+// Bricks are handed out as shared pointers and stay valid after eviction
+// until released.  request() and resident() are meant to be called from one
+// thread.
+//
+//-----------------------------------------------------------------------------
+
+class ParticleBrickCache
+{
+public:
+  // Loads a brick into an empty ParticleFrameData, throws on failure.  Called
+  // on the worker thread, or on the calling thread of resident() when it
+  // waits.
+  typedef std::function<void( int brick, ParticleFrameData& data )> LoadFunction;
+
+  typedef std::pair<int, std::shared_ptr<const ParticleFrameData> > ResidentBrick;
+
+  struct Counters
+  {
+    size_t            loaded;             // Bricks streamed in
+    size_t            evicted;
+    size_t            failed;             // Loads that threw on the worker thread
+    size_t            bytes_streamed;     // Bytes held by the bricks streamed in
+    double            load_time;          // Seconds spent in the load function
+    double            latency;            // Summed seconds from the first request of a brick until it was resident
+    double            max_latency;
+    size_t            resident_bricks;
+    size_t            resident_bytes;
+  };
+
+  ParticleBrickCache( LoadFunction load, size_t budget_bytes );
+  ~ParticleBrickCache();
+
+  // Replaces the wanted bricks and the worker queue with bricks.
+  void request( const std::vector<int>& bricks );
+
+  // The resident bricks of the last request, in its order.  If wait is true,
+  // first loads the missing ones on the calling thread and rethrows load
+  // errors.
+  void resident( std::vector<ResidentBrick>& bricks, bool wait );
+
+  Counters counters()const;
+  size_t   budget()const { return m_budget; }
+
+private:
+  struct Entry
+  {
+    int                                 brick;
+    std::shared_ptr<ParticleFrameData>  data;
+    size_t                              bytes;
+  };
+  typedef std::list<Entry> EntryList;
+
+  ParticleBrickCache( const ParticleBrickCache& );             // Not copyable
+  ParticleBrickCache& operator=( const ParticleBrickCache& );
+
+  void workerLoop();
+
+  // Requires m_mutex
+  void insert( int brick, const std::shared_ptr<ParticleFrameData>& data, double load_time );
+  void evict();
+
+  LoadFunction                          m_load;
+  const size_t                          m_budget;
+
+  mutable std::mutex                    m_mutex;
+  std::condition_variable               m_cond;
+  EntryList                             m_lru;              // Most recently used first
+  std::map<int, EntryList::iterator>    m_entries;
+  std::vector<int>                      m_wanted;           // Bricks of the last request()
+  std::set<int>                         m_wanted_set;
+  std::deque<int>                       m_queue;            // Wanted bricks the worker has yet to load
+  std::map<int, double>                 m_requested;        // Time of the first request of each missing brick
+  std::set<int>                         m_failed;           // Not requested from the worker again
+  int                                   m_loading;          // Brick the worker is loading
+  bool                                  m_is_loading;
+  bool                                  m_stop;
+  Counters                              m_counters;
+
+  std::thread                           m_worker;
+};
@@ -0,0 +1,474 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "ParticleBricks.h"
+#include "ParticleSort.h"
+
+#include <Parallel.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdio>
+#include <cstring>
+#include <sys/types.h>
+
+using namespace optix;
+
+
+const char* const PARTICLE_BRICK_FILE_EXTENSION = "bricks";
+
+
+//------------------------------------------------------------------------------
+//
+// Helpers
+//
+//------------------------------------------------------------------------------
+
+namespace
+{
+
+// Bump whenever the layout of the file changes
+const uint32_t BRICK_FILE_VERSION   = 1u;
+const char     BRICK_FILE_MAGIC[8]  = { 'P', 'B', 'R', 'I', 'C', 'K', 'S', '\0' };
+const uint64_t BRICK_FILE_ALIGNMENT = 64u;
+
+// Particles per work item of the parallel gather
+const size_t BRICK_BLOCK_SIZE = 1u << 16;
+
+// Depth of the Morton octree, 3 bits of the 63 bit key per level
+const int MORTON_LEVELS = 21;
+
+
+struct BrickFileHeader
+{
+  char                magic[8];
+  uint32_t            version;
+  uint32_t            header_size;          // sizeof( BrickFileHeader ), guards against padding changes
+
+  uint64_t            num_particles;
+  uint64_t            num_bricks;
+  uint32_t            channels;             // ParticleChannels of every brick
+  uint32_t            signed_attribute;
+
+  float               pmin[4];              // ParticleStats of the dataset, raw attribute range in w
+  float               pmax[4];
+  float               attribute_scale;
+  float               attribute_offset;
+
+  uint64_t            index_offset;         // Byte offset of num_bricks BrickRecords, after the brick data
+};
+
+
+struct BrickRecord
+{
+  float               pmin[4];              // Normalized attribute range in w
+  float               pmax[4];
+  uint64_t            num_particles;
+  uint64_t            offsets[4];
+};
+
+
+// Closes the file on scope exit
+struct FileCloser
+{
+  FILE* file;
+  ~FileCloser() { if( file ) fclose( file ); }
+};
+
+
+bool seekFile( FILE* fp, uint64_t offset )
+{
+#if defined( _WIN32 )
+  return _fseeki64( fp, static_cast<__int64>( offset ), SEEK_SET ) == 0;
+#else
+  return fseeko( fp, static_cast<off_t>( offset ), SEEK_SET ) == 0;
+#endif
+}
+
+
+uint64_t fileSize( FILE* fp )
+{
+#if defined( _WIN32 )
+  if( _fseeki64( fp, 0, SEEK_END ) != 0 )
+    return 0;
+  return static_cast<uint64_t>( _ftelli64( fp ) );
+#else
+  if( fseeko( fp, 0, SEEK_END ) != 0 )
+    return 0;
+  return static_cast<uint64_t>( ftello( fp ) );
+#endif
+}
+
+
+uint64_t alignOffset( uint64_t offset )
+{
+  return ( offset + BRICK_FILE_ALIGNMENT - 1 ) & ~( BRICK_FILE_ALIGNMENT - 1 );
+}
+
+
+bool writePadded( FILE* fp, const void* data, uint64_t size, uint64_t& offset, uint64_t target_offset )
+{
+  static const char zeros[BRICK_FILE_ALIGNMENT] = { 0 };
+  if( target_offset > offset &&
+      fwrite( zeros, 1, static_cast<size_t>( target_offset - offset ), fp ) != target_offset - offset )
+    return false;
+  offset = target_offset;
+
+  if( size && fwrite( data, 1, static_cast<size_t>( size ), fp ) != size )
+    return false;
+  offset += size;
+  return true;
+}
+
+
+uint64_t channelElementSize( int channel, unsigned int channels )
+{
+  switch( channel ) {
+    case 0:  return sizeof( float4 );
+    case 1:  return channels & PARTICLE_VELOCITIES ? sizeof( float3 ) : 0;
+    case 2:  return channels & PARTICLE_COLORS     ? sizeof( float3 ) : 0;
+    default: return channels & PARTICLE_RADII      ? sizeof( float )  : 0;
+  }
+}
+
+
+typedef std::pair<size_t, size_t> BrickRange;
+
+// Splits [begin, end) of the sorted Morton keys into ranges of at most
+// max_particles along the octree of the keys.  Consecutive children of a node
+// are grouped while they fit, children that don't fit are split further.
+// Ranges at the last level may exceed max_particles if particles coincide.
+void splitBricks( const std::vector<uint64_t>& keys, size_t begin, size_t end, int level, size_t max_particles,
+                  std::vector<BrickRange>& ranges )
+{
+  if( end - begin <= max_particles || level == MORTON_LEVELS ) {
+    ranges.push_back( BrickRange( begin, end ) );
+    return;
+  }
+
+  const int shift = 3 * ( MORTON_LEVELS - 1 - level );
+  size_t group_begin = begin;
+  size_t child_begin = begin;
+  for( uint64_t child = 0; child < 8; ++child ) {
+    const size_t child_end = std::partition_point( keys.begin() + child_begin, keys.begin() + end,
+        [&]( uint64_t key ) { return ( key >> shift & 7u ) <= child; } ) - keys.begin();
+
+    if( child_end - child_begin > max_particles ) {
+      if( child_begin > group_begin )
+        ranges.push_back( BrickRange( group_begin, child_begin ) );
+      splitBricks( keys, child_begin, child_end, level + 1, max_particles, ranges );
+      group_begin = child_end;
+    } else if( child_end - group_begin > max_particles ) {
+      ranges.push_back( BrickRange( group_begin, child_begin ) );
+      group_begin = child_begin;
+    }
+    child_begin = child_end;
+  }
+  if( end > group_begin )
+    ranges.push_back( BrickRange( group_begin, end ) );
+}
+
+
+// dst[i] = src[order[begin + i]] for a brick, on worker threads
+template<typename T>
+void gatherBrick( const T* src, const std::vector<uint32_t>& order, const BrickRange& range, std::vector<T>& dst )
+{
+  const size_t count = range.second - range.first;
+  dst.resize( src ? count : 0 );
+  if( !src )
+    return;
+  const uint32_t* indices = &order[range.first];
+  T* out = dst.data();
+  sutil::parallelFor( ( count + BRICK_BLOCK_SIZE - 1 ) / BRICK_BLOCK_SIZE, [&]( size_t block )
+  {
+    const size_t end = std::min( count, ( block + 1 ) * BRICK_BLOCK_SIZE );
+    for( size_t i = block * BRICK_BLOCK_SIZE; i < end; ++i )
+      out[i] = src[ indices[i] ];
+  } );
+}
+
+} // namespace
+
+
+//------------------------------------------------------------------------------
+//
+// Brick file I/O
+//
+//------------------------------------------------------------------------------
+
+bool writeParticleBrickFile( const std::string& filename, const ParticleFrameData& frame,
+                             size_t max_brick_particles )
+{
+  std::vector<uint32_t> order;
+  std::vector<uint64_t> keys;
+  mortonOrder( frame, order, &keys );
+
+  std::vector<BrickRange> ranges;
+  if( frame.num_particles > 0 )
+    splitBricks( keys, 0, frame.num_particles, 0, std::max<size_t>( max_brick_particles, 1 ), ranges );
+  std::vector<uint64_t>().swap( keys );
+
+  BrickFileHeader header;
+  memset( &header, 0, sizeof( header ) );
+  memcpy( header.magic, BRICK_FILE_MAGIC, sizeof( header.magic ) );
+  header.version          = BRICK_FILE_VERSION;
+  header.header_size      = sizeof( BrickFileHeader );
+  header.num_particles    = frame.num_particles;
+  header.num_bricks       = ranges.size();
+  header.channels         = frame.channels & ( PARTICLE_VELOCITIES | PARTICLE_COLORS | PARTICLE_RADII );
+  header.signed_attribute = frame.signed_attribute ? 1u : 0u;
+  memcpy( header.pmin, &frame.stats.pmin, sizeof( header.pmin ) );
+  memcpy( header.pmax, &frame.stats.pmax, sizeof( header.pmax ) );
+  header.attribute_scale  = frame.attribute_scale;
+  header.attribute_offset = frame.attribute_offset;
+
+  if( ( header.channels & PARTICLE_VELOCITIES && !frame.velocities ) ||
+      ( header.channels & PARTICLE_COLORS     && !frame.colors )     ||
+      ( header.channels & PARTICLE_RADII      && !frame.radii ) )
+    return false;
+
+  FileCloser closer = { fopen( filename.c_str(), "wb" ) };
+  if( !closer.file )
+    return false;
+
+  // The header is written again once the index offset is known
+  uint64_t offset = 0;
+  bool ok = writePadded( closer.file, &header, sizeof( header ), offset, 0 );
+
+  std::vector<BrickRecord> records( ranges.size() );
+  std::vector<float4> positions;
+  std::vector<float3> velocities;
+  std::vector<float3> colors;
+  std::vector<float>  radii;
+  for( size_t b = 0; b < ranges.size() && ok; ++b ) {
+    gatherBrick( frame.positions,  order, ranges[b], positions );
+    gatherBrick( header.channels & PARTICLE_VELOCITIES ? frame.velocities : 0, order, ranges[b], velocities );
+    gatherBrick( header.channels & PARTICLE_COLORS     ? frame.colors     : 0, order, ranges[b], colors );
+    gatherBrick( header.channels & PARTICLE_RADII      ? frame.radii      : 0, order, ranges[b], radii );
+
+    BrickRecord& record = records[b];
+    memset( &record, 0, sizeof( record ) );
+    const ParticleStats stats = computeParticleStats( positions.data(), positions.size() );
+    memcpy( record.pmin, &stats.pmin, sizeof( record.pmin ) );
+    memcpy( record.pmax, &stats.pmax, sizeof( record.pmax ) );
+    record.num_particles = positions.size();
+
+    const void* arrays[4] = { positions.data(), velocities.data(), colors.data(), radii.data() };
+    for( int i = 0; i < 4 && ok; ++i ) {
+      const uint64_t size = record.num_particles * channelElementSize( i, header.channels );
+      if( !size )
+        continue;
+      record.offsets[i] = alignOffset( offset );
+      ok = writePadded( closer.file, arrays[i], size, offset, record.offsets[i] );
+    }
+  }
+
+  header.index_offset = alignOffset( offset );
+  ok = ok && writePadded( closer.file, records.data(), records.size() * sizeof( BrickRecord ), offset,
+                          header.index_offset );
+  ok = ok && seekFile( closer.file, 0 ) && fwrite( &header, sizeof( header ), 1, closer.file ) == 1;
+  ok = fclose( closer.file ) == 0 && ok;
+  closer.file = 0;
+  if( !ok )
+    remove( filename.c_str() );
+  return ok;
+}
+
+
+bool readParticleBrickIndex( const std::string& filename, ParticleFrameData& frame,
+                             std::vector<ParticleBrick>& bricks, std::string& error )
+{
+  FileCloser closer = { fopen( filename.c_str(), "rb" ) };
+  if( !closer.file ) {
+    error = "can't open '" + filename + "'";
+    return false;
+  }
+
+  BrickFileHeader header;
+  if( fread( &header, sizeof( header ), 1, closer.file ) != 1 ||
+      memcmp( header.magic, BRICK_FILE_MAGIC, sizeof( header.magic ) ) != 0 ) {
+    error = "'" + filename + "' is not a particle brick file";
+    return false;
+  }
+  if( header.version != BRICK_FILE_VERSION || header.header_size != sizeof( BrickFileHeader ) ) {
+    error = "'" + filename + "' was written with a different brick file version";
+    return false;
+  }
+
+  const uint64_t size = fileSize( closer.file );
+  std::vector<BrickRecord> records;
+  bool ok = header.index_offset >= sizeof( header ) && header.index_offset <= size &&
+            header.num_bricks <= ( size - header.index_offset ) / sizeof( BrickRecord );
+  if( ok ) {
+    records.resize( static_cast<size_t>( header.num_bricks ) );
+    ok = seekFile( closer.file, header.index_offset ) &&
+         fread( records.data(), sizeof( BrickRecord ), records.size(), closer.file ) == records.size();
+  }
+
+  // Every array of every brick must lie before the index
+  uint64_t num_particles = 0;
+  for( size_t b = 0; b < records.size() && ok; ++b ) {
+    num_particles += records[b].num_particles;
+    for( int i = 0; i < 4 && ok; ++i ) {
+      const uint64_t element_size = channelElementSize( i, header.channels );
+      const uint64_t offset = records[b].offsets[i];
+      if( element_size )
+        ok = offset >= sizeof( header ) && offset % BRICK_FILE_ALIGNMENT == 0 && offset <= header.index_offset &&
+             records[b].num_particles <= ( header.index_offset - offset ) / element_size;
+    }
+  }
+  if( !ok || num_particles != header.num_particles ) {
+    error = "'" + filename + "' is truncated or corrupt";
+    return false;
+  }
+
+  bricks.resize( records.size() );
+  for( size_t b = 0; b < records.size(); ++b ) {
+    memcpy( &bricks[b].stats.pmin, records[b].pmin, sizeof( records[b].pmin ) );
+    memcpy( &bricks[b].stats.pmax, records[b].pmax, sizeof( records[b].pmax ) );
+    bricks[b].num_particles = static_cast<size_t>( records[b].num_particles );
+    memcpy( bricks[b].offsets, records[b].offsets, sizeof( bricks[b].offsets ) );
+  }
+
+  frame.num_particles    = static_cast<size_t>( header.num_particles );
+  frame.channels         = header.channels & ( PARTICLE_VELOCITIES | PARTICLE_COLORS | PARTICLE_RADII );
+  memcpy( &frame.stats.pmin, header.pmin, sizeof( header.pmin ) );
+  memcpy( &frame.stats.pmax, header.pmax, sizeof( header.pmax ) );
+  frame.attribute_scale  = header.attribute_scale;
+  frame.attribute_offset = header.attribute_offset;
+  frame.signed_attribute = header.signed_attribute != 0;
+  frame.morton_order     = true;
+  return true;
+}
+
+
+bool readParticleBrick( const std::string& filename, const ParticleBrick& brick, unsigned int channels,
+                        ParticleFrameData& frame, std::string& error )
+{
+  FileCloser closer = { fopen( filename.c_str(), "rb" ) };
+  if( !closer.file ) {
+    error = "can't open '" + filename + "'";
+    return false;
+  }
+
+  // Only channels the file has
+  const unsigned int stored = ( brick.offsets[1] ? unsigned( PARTICLE_VELOCITIES ) : 0u ) |
+                              ( brick.offsets[2] ? unsigned( PARTICLE_COLORS )     : 0u ) |
+                              ( brick.offsets[3] ? unsigned( PARTICLE_RADII )      : 0u );
+  channels &= stored;
+
+  const size_t n = brick.num_particles;
+  frame.position_storage.resize( n );
+  frame.velocity_storage.resize( channels & PARTICLE_VELOCITIES ? n : 0 );
+  frame.color_storage.resize( channels & PARTICLE_COLORS ? n : 0 );
+  frame.radius_storage.resize( channels & PARTICLE_RADII ? n : 0 );
+
+  void* arrays[4] = { frame.position_storage.data(), frame.velocity_storage.data(),
+                      frame.color_storage.data(), frame.radius_storage.data() };
+  for( int i = 0; i < 4; ++i ) {
+    const size_t size = n * static_cast<size_t>( channelElementSize( i, channels ) );
+    if( size && ( !seekFile( closer.file, brick.offsets[i] ) || fread( arrays[i], 1, size, closer.file ) != size ) ) {
+      error = "can't read a brick of '" + filename + "'";
+      return false;
+    }
+  }
+
+  frame.num_particles = n;
+  frame.channels      = channels;
+  frame.positions     = frame.position_storage.data();
+  frame.velocities    = channels & PARTICLE_VELOCITIES ? frame.velocity_storage.data() : 0;
+  frame.colors        = channels & PARTICLE_COLORS     ? frame.color_storage.data()    : 0;
+  frame.radii         = channels & PARTICLE_RADII      ? frame.radius_storage.data()   : 0;
+  frame.stats         = brick.stats;
+  frame.morton_order  = true;
+  return true;
+}
+
+
+size_t particleBrickBytes( const ParticleBrick& brick, unsigned int channels )
+{
+  size_t bytes = 0;
+  for( int i = 0; i < 4; ++i )
+    if( i == 0 || brick.offsets[i] )
+      bytes += brick.num_particles * static_cast<size_t>( channelElementSize( i, channels ) );
+  return bytes;
+}
+
+
+//------------------------------------------------------------------------------
+//
+// View selection
+//
+//------------------------------------------------------------------------------
+
+void selectParticleBricks( const std::vector<ParticleBrick>& bricks, const float3& eye, const float3& U,
+                           const float3& V, const float3& W, float radius, unsigned int channels,
+                           size_t budget_bytes, std::vector<int>& selected )
+{
+  // Outward normals of the four side planes through the eye
+  const float3 corners[4] = { W + U + V, W - U + V, W - U - V, W + U - V };
+  float3 planes[4];
+  for( int i = 0; i < 4; ++i ) {
+    planes[i] = normalize( cross( corners[i], corners[( i + 1 ) % 4] ) );
+    if( dot( planes[i], W ) > 0.0f )
+      planes[i] = -planes[i];
+  }
+  const float3 forward = normalize( W );
+
+  // Bounding spheres of the widened bricks against the frustum, with their
+  // solid angle as the screen coverage
+  std::vector<std::pair<float, int> > visible;
+  for( size_t b = 0; b < bricks.size(); ++b ) {
+    const ParticleStats& stats = bricks[b].stats;
+    if( bricks[b].num_particles == 0 || stats.pmax.w <= 0.0f )
+      continue;
+
+    const float3 center = 0.5f * ( make_float3( stats.pmin ) + make_float3( stats.pmax ) );
+    const float  r = 0.5f * length( make_float3( stats.pmax ) - make_float3( stats.pmin ) ) + radius;
+    const float3 d = center - eye;
+    bool inside = dot( d, forward ) >= -r;
+    for( int i = 0; i < 4 && inside; ++i )
+      inside = dot( d, planes[i] ) <= r;
+    if( !inside )
+      continue;
+
+    const float distance2 = dot( d, d );
+    const float coverage = distance2 > r * r ? r * r / ( distance2 - r * r ) : FLT_MAX;
+    visible.push_back( std::make_pair( -coverage, static_cast<int>( b ) ) );
+  }
+  std::sort( visible.begin(), visible.end() );
+
+  selected.clear();
+  size_t bytes = 0;
+  for( size_t i = 0; i < visible.size(); ++i ) {
+    const size_t brick_bytes = particleBrickBytes( bricks[visible[i].second], channels );
+    if( bytes + brick_bytes > budget_bytes )
+      continue;
+    bytes += brick_bytes;
+    selected.push_back( visible[i].second );
+  }
+}
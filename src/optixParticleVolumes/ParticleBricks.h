@@ -0,0 +1,97 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include "ParticleData.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+//-----------------------------------------------------------------------------
+//
+// Bricked particle datasets ("*.bricks") for data that does not fit in host
+// or device memory as one frame.  The particles are split along their Morton
+// curve into spatially compact bricks of a bounded particle count, and all
+// bricks are stored in one file behind an index of their bounds, attribute
+// ranges and channel offsets.  The sample reads the index once and then
+// streams only the bricks it needs (see ParticleBrickCache.h).
+//
+// The header carries the particle count, channels, stats and attribute
+// normalization of the whole dataset, as a particle file does (see
+// ParticleFile.h).  Each brick stores its arrays in the layout of the sample
+// buffers, each starting on a 64 byte boundary.
+//
+// particleConvert --bricks writes these files.
+//
+//-----------------------------------------------------------------------------
+
+// Extension that the sample recognizes as a brick file
+extern const char* const PARTICLE_BRICK_FILE_EXTENSION;
+
+
+struct ParticleBrick
+{
+  ParticleStats       stats;              // Bounds of the centers, normalized attribute range in w
+  size_t              num_particles;
+  uint64_t            offsets[4];         // Byte offsets of the positions, velocities, colors and radii, 0 if absent
+};
+
+
+// Splits frame, whose attributes must already be normalized, into bricks of
+// at most max_brick_particles and writes them with their index.  The frame
+// may point into a file mapping; besides the frame, only the Morton keys and
+// one brick are held in memory.  Returns false if the file can't be written.
+bool writeParticleBrickFile( const std::string& filename, const ParticleFrameData& frame,
+                             size_t max_brick_particles );
+
+// Reads the header and index of a brick file.  frame receives the particle
+// count, channels, stats and attribute normalization of the dataset but no
+// arrays.  Returns false with a message in error if the file can't be read,
+// was written with a different version, or is truncated.
+bool readParticleBrickIndex( const std::string& filename, ParticleFrameData& frame,
+                             std::vector<ParticleBrick>& bricks, std::string& error );
+
+// Reads the channels (ParticleChannels, positions are always read) of one
+// brick into empty frame, which owns the arrays.  Safe to call from several
+// threads.
+bool readParticleBrick( const std::string& filename, const ParticleBrick& brick, unsigned int channels,
+                        ParticleFrameData& frame, std::string& error );
+
+// Bytes read by readParticleBrick() for the given channels
+size_t particleBrickBytes( const ParticleBrick& brick, unsigned int channels );
+
+// Bricks seen from eye through the frustum spanned by U, V and W as set up by
+// sutil::calculateCameraVariables, ordered by decreasing screen coverage.
+// Bounds are widened by radius.  Bricks with no visible attribute (all w 0)
+// are skipped, and bricks are taken in order while their
+// particleBrickBytes() fit in budget_bytes.
+void selectParticleBricks( const std::vector<ParticleBrick>& bricks, const optix::float3& eye,
+                           const optix::float3& U, const optix::float3& V, const optix::float3& W, float radius,
+                           unsigned int channels, size_t budget_bytes, std::vector<int>& selected );
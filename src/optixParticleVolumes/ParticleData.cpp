@@ -0,0 +1,449 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "ParticleData.h"
+#include "ParticleFile.h"
+
+#include <Parallel.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+using namespace optix;
+
+
+//------------------------------------------------------------------------------
+//
+// Helpers
+//
+//------------------------------------------------------------------------------
+
+namespace
+{
+
+// Particles per work item of the parallel passes
+const size_t PARTICLE_BLOCK_SIZE = 1u << 16;
+
+// Bytes of text per work item of the text parser, extended to a line end
+const size_t TEXT_CHUNK_SIZE = 1u << 20;
+
+// Powers of ten that are exact in a double
+const double EXACT_POWERS_OF_10[] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+
+inline bool isDigit( char c )
+{
+  return c >= '0' && c <= '9';
+}
+
+
+// Parses a plain decimal number such as "-12.5e3" in [p, end) to the same
+// float as (float)atof.  With at most 19 significant digits, a mantissa below
+// 2^53 and a decimal exponent within +-22, the mantissa and the power of ten
+// are exact doubles and one multiply or divide rounds correctly, as strtod
+// does (Clinger's fast path).  Returns false for anything else, e.g. hex,
+// inf, nan, long mantissas or large exponents, or a number followed by other
+// characters.
+inline bool parseDecimal( const char* p, const char* end, float& value )
+{
+  bool negative = false;
+  if( p < end && ( *p == '-' || *p == '+' ) )
+    negative = *p++ == '-';
+
+  uint64_t mantissa = 0;
+  int      num_digits = 0;      // Significant digits in mantissa
+  int      exponent = 0;
+  bool     any_digits = false;
+  for( ; p < end && isDigit( *p ); ++p ) {
+    any_digits = true;
+    if( mantissa == 0 && *p == '0' )
+      continue;
+    if( num_digits == 19 )
+      return false;
+    mantissa = mantissa * 10 + static_cast<uint64_t>( *p - '0' );
+    ++num_digits;
+  }
+  if( p < end && *p == '.' ) {
+    for( ++p; p < end && isDigit( *p ); ++p ) {
+      any_digits = true;
+      --exponent;
+      if( mantissa == 0 && *p == '0' )
+        continue;
+      if( num_digits == 19 )
+        return false;
+      mantissa = mantissa * 10 + static_cast<uint64_t>( *p - '0' );
+      ++num_digits;
+    }
+  }
+  if( !any_digits )
+    return false;
+
+  if( p < end && ( *p == 'e' || *p == 'E' ) ) {
+    const char* q = p + 1;
+    bool negative_exponent = false;
+    if( q < end && ( *q == '-' || *q == '+' ) )
+      negative_exponent = *q++ == '-';
+    if( q < end && isDigit( *q ) ) {
+      int e = 0;
+      for( ; q < end && isDigit( *q ); ++q )
+        if( e < 10000 )
+          e = e * 10 + ( *q - '0' );
+      exponent += negative_exponent ? -e : e;
+      p = q;
+    }
+  }
+
+  if( p < end && *p != ' ' && *p != '\t' && *p != '\r' )
+    return false;
+  if( mantissa > ( 1ull << 53 ) || exponent < -22 || exponent > 22 )
+    return false;
+
+  double d = static_cast<double>( mantissa );
+  d = exponent < 0 ? d / EXACT_POWERS_OF_10[-exponent] : d * EXACT_POWERS_OF_10[exponent];
+  value = static_cast<float>( negative ? -d : d );
+  return true;
+}
+
+
+// Parses the next space separated field of the line ending at end, as
+// strspn, atof and strcspn on a NUL terminated copy of the line did.
+inline float parseFloat( const char*& token, const char* end )
+{
+  while( token < end && ( *token == ' ' || *token == '\t' ) )
+    ++token;
+
+  float f;
+  if( !parseDecimal( token, end, f ) ) {
+    char buf[256];
+    const size_t n = std::min( static_cast<size_t>( end - token ), sizeof( buf ) - 1 );
+    memcpy( buf, token, n );
+    buf[n] = '\0';
+    f = (float) atof( buf );
+  }
+
+  while( token < end && *token != ' ' && *token != '\t' && *token != '\r' )
+    ++token;
+  return f;
+}
+
+
+// Calls fn( token, line_end ) for every line of [begin, end) that is not
+// blank or a comment, with token at its first non-space character and a
+// trailing '\r' removed.
+template<typename Fn>
+void forEachParticleLine( const char* begin, const char* end, Fn fn )
+{
+  while( begin < end ) {
+    const char* newline  = static_cast<const char*>( memchr( begin, '\n', static_cast<size_t>( end - begin ) ) );
+    const char* line_end = newline ? newline : end;
+    const char* next     = newline ? newline + 1 : end;
+    if( line_end > begin && line_end[-1] == '\r' )
+      --line_end;
+
+    const char* token = begin;
+    while( token < line_end && ( *token == ' ' || *token == '\t' ) )
+      ++token;
+    if( token < line_end && *token != '#' )
+      fn( token, line_end );
+    begin = next;
+  }
+}
+
+
+inline ParticleStats emptyParticleStats()
+{
+  ParticleStats stats;
+  stats.pmin = make_float4(  1e16f );
+  stats.pmax = make_float4( -1e16f );
+  return stats;
+}
+
+
+inline void mergeParticleStats( ParticleStats& stats, const ParticleStats& other )
+{
+  stats.pmin = fminf( stats.pmin, other.pmin );
+  stats.pmax = fmaxf( stats.pmax, other.pmax );
+}
+
+
+// Checks the extension case-sensitively, as setParticlesBaseName does
+bool hasExtension( const std::string& filename, const std::string& extension )
+{
+  return filename.size() > extension.size() &&
+         filename.compare( filename.size() - extension.size() - 1, std::string::npos, "." + extension ) == 0;
+}
+
+} // namespace
+
+
+//------------------------------------------------------------------------------
+//
+// ParticleFrameData
+//
+//------------------------------------------------------------------------------
+
+ParticleFrameData::ParticleFrameData()
+  : num_particles( 0 ),
+    channels( 0 ),
+    positions( 0 ),
+    velocities( 0 ),
+    colors( 0 ),
+    radii( 0 ),
+    stats( emptyParticleStats() ),
+    attribute_scale( 1.0f ),
+    attribute_offset( 0.0f ),
+    signed_attribute( false ),
+    morton_order( false )
+{
+}
+
+
+size_t particleFrameBytes( const ParticleFrameData& frame )
+{
+  size_t bytes = frame.position_storage.capacity() * sizeof( float4 ) +
+                 frame.velocity_storage.capacity() * sizeof( float3 ) +
+                 frame.color_storage.capacity()    * sizeof( float3 ) +
+                 frame.radius_storage.capacity()   * sizeof( float ) +
+                 ( frame.file ? frame.file->size() : 0 );
+  for( size_t i = 0; i < frame.lod_levels.size(); ++i )
+    bytes += frame.lod_levels[i].positions.capacity()     * sizeof( float4 ) +
+             frame.lod_levels[i].radius_scales.capacity() * sizeof( float );
+  return bytes;
+}
+
+
+//------------------------------------------------------------------------------
+//
+// Statistics
+//
+//------------------------------------------------------------------------------
+
+ParticleStats computeParticleStats( const float4* positions, size_t num_particles )
+{
+  // One partial result per block, merged in order so the result does not
+  // depend on the thread count
+  const size_t num_blocks = ( num_particles + PARTICLE_BLOCK_SIZE - 1 ) / PARTICLE_BLOCK_SIZE;
+  std::vector<ParticleStats> partial( num_blocks, emptyParticleStats() );
+
+  sutil::parallelFor( num_blocks, [&]( size_t block )
+  {
+    const size_t begin = block * PARTICLE_BLOCK_SIZE;
+    const size_t end   = std::min( begin + PARTICLE_BLOCK_SIZE, num_particles );
+    float4 pmin = partial[block].pmin;
+    float4 pmax = partial[block].pmax;
+    for( size_t i = begin; i < end; ++i ) {
+      pmin = fminf( pmin, positions[i] );
+      pmax = fmaxf( pmax, positions[i] );
+    }
+    partial[block].pmin = pmin;
+    partial[block].pmax = pmax;
+  } );
+
+  ParticleStats stats = emptyParticleStats();
+  for( size_t block = 0; block < num_blocks; ++block )
+    mergeParticleStats( stats, partial[block] );
+  return stats;
+}
+
+
+void normalizeParticleAttributes( ParticleFrameData& frame )
+{
+  frame.stats = computeParticleStats( frame.position_storage.data(), frame.position_storage.size() );
+
+  const float4& pmin = frame.stats.pmin;
+  const float4& pmax = frame.stats.pmax;
+  frame.signed_attribute = pmin.w < 0.0f;
+  if( frame.signed_attribute ) {
+    frame.attribute_scale  = 0.5f / std::max( -pmin.w, pmax.w );
+    frame.attribute_offset = 0.5f;
+  } else {
+    frame.attribute_scale  = pmax.w > pmin.w ? float( 1.0 / double( pmax.w - pmin.w ) ) : 1.0f;
+    frame.attribute_offset = 0.0f;
+  }
+
+  float4* positions = frame.position_storage.data();
+  const size_t num_particles = frame.position_storage.size();
+  const float scale  = frame.attribute_scale;
+  const float offset = frame.attribute_offset;
+  sutil::parallelFor( ( num_particles + PARTICLE_BLOCK_SIZE - 1 ) / PARTICLE_BLOCK_SIZE, [&]( size_t block )
+  {
+    const size_t end = std::min( ( block + 1 ) * PARTICLE_BLOCK_SIZE, num_particles );
+    for( size_t i = block * PARTICLE_BLOCK_SIZE; i < end; ++i )
+      positions[i].w = positions[i].w * scale + offset;
+  } );
+}
+
+
+//------------------------------------------------------------------------------
+//
+// Readers
+//
+//------------------------------------------------------------------------------
+
+bool readParticles( const std::string& filename, const ParticleReadOptions& options,
+                    ParticleFrameData& frame, std::string& error )
+{
+  if( hasExtension( filename, PARTICLE_FILE_EXTENSION ) )
+    return readParticleFile( filename, options.max_particles, frame, error );
+
+  const bool ok = hasExtension( filename, "raw" ) ? readRawParticles( filename, options, frame, error )
+                                                  : readTextParticles( filename, options, frame, error );
+  if( ok )
+    normalizeParticleAttributes( frame );
+  return ok;
+}
+
+
+bool readRawParticles( const std::string& filename, const ParticleReadOptions& options,
+                       ParticleFrameData& frame, std::string& error )
+{
+  FILE* fp = fopen( filename.c_str(), "rb" );
+  if( !fp ) {
+    error = "can't open '" + filename + "'";
+    return false;
+  }
+  fseek( fp, 0L, SEEK_END );
+  const long sz = ftell( fp );
+  rewind( fp );
+
+  size_t num_particles = sz > 0 ? static_cast<size_t>( sz ) / sizeof( float4 ) : 0;
+  if( options.max_particles > 0 && num_particles > options.max_particles )
+    num_particles = options.max_particles;
+
+  frame.position_storage.resize( num_particles );
+  const size_t num_read = fread( frame.position_storage.data(), sizeof( float4 ), num_particles, fp );
+  fclose( fp );
+  if( num_read != num_particles ) {
+    frame.position_storage.clear();
+    error = "can't read '" + filename + "'";
+    return false;
+  }
+
+  frame.num_particles = num_particles;
+  frame.channels      = 0;
+  frame.positions     = frame.position_storage.data();
+  return true;
+}
+
+
+bool readTextParticles( const std::string& filename, const ParticleReadOptions& options,
+                        ParticleFrameData& frame, std::string& error )
+{
+  MappedFile file( filename );
+  if( file.failed() ) {
+    error = "can't map '" + filename + "' (missing or empty)";
+    return false;
+  }
+
+  // Split the text into chunks that start at line beginnings
+  const char* const text     = file.data();
+  const char* const text_end = text + file.size();
+  std::vector<const char*> chunks( 1, text );
+  while( static_cast<size_t>( text_end - chunks.back() ) > TEXT_CHUNK_SIZE ) {
+    const char* p = chunks.back() + TEXT_CHUNK_SIZE;
+    const char* newline = static_cast<const char*>( memchr( p, '\n', static_cast<size_t>( text_end - p ) ) );
+    if( !newline || newline + 1 == text_end )
+      break;
+    chunks.push_back( newline + 1 );
+  }
+  chunks.push_back( text_end );
+  const size_t num_chunks = chunks.size() - 1;
+
+  // Count the particle lines of each chunk to find where its particles go
+  std::vector<size_t> chunk_offsets( num_chunks + 1, 0 );
+  sutil::parallelFor( num_chunks, [&]( size_t c )
+  {
+    size_t count = 0;
+    forEachParticleLine( chunks[c], chunks[c+1], [&]( const char*, const char* ) { ++count; } );
+    chunk_offsets[c+1] = count;
+  } );
+  for( size_t c = 0; c < num_chunks; ++c )
+    chunk_offsets[c+1] += chunk_offsets[c];
+
+  size_t num_particles = chunk_offsets[num_chunks];
+  if( options.max_particles > 0 && num_particles > options.max_particles )
+    num_particles = options.max_particles;
+
+  // Colors and radii are only stored if the file has them; otherwise all
+  // particles share the default color and options.fixed_radius
+  frame.position_storage.resize( num_particles );
+  frame.velocity_storage.resize( num_particles );
+  frame.color_storage.resize( options.colors ? num_particles : 0 );
+  frame.radius_storage.resize( options.radii ? num_particles : 0 );
+  float4* positions  = frame.position_storage.data();
+  float3* velocities = frame.velocity_storage.data();
+  float3* colors     = options.colors ? frame.color_storage.data() : 0;
+  float*  radii      = options.radii ? frame.radius_storage.data() : 0;
+
+  // The expected format of a line is: position, velocity, color and radius
+  sutil::parallelFor( num_chunks, [&]( size_t c )
+  {
+    size_t i = chunk_offsets[c];
+    if( i >= num_particles )
+      return;
+    forEachParticleLine( chunks[c], chunks[c+1], [&]( const char* token, const char* line_end )
+    {
+      if( i >= num_particles )
+        return;
+
+      const float x  = parseFloat( token, line_end );
+      const float y  = parseFloat( token, line_end );
+      const float z  = parseFloat( token, line_end );
+
+      const float vx = parseFloat( token, line_end );
+      const float vy = parseFloat( token, line_end );
+      const float vz = parseFloat( token, line_end );
+      const float3 vel = make_float3( vx, vy, vz );
+
+      positions[i]  = make_float4( x, y, z, length( vel ) );
+      velocities[i] = vel;
+      if( colors ) {
+        colors[i].x = parseFloat( token, line_end );
+        colors[i].y = parseFloat( token, line_end );
+        colors[i].z = parseFloat( token, line_end );
+      }
+      if( radii )
+        radii[i] = parseFloat( token, line_end );
+      ++i;
+    } );
+  } );
+
+  frame.num_particles = num_particles;
+  frame.channels      = PARTICLE_VELOCITIES | ( colors ? unsigned( PARTICLE_COLORS ) : 0u ) |
+                        ( radii ? unsigned( PARTICLE_RADII ) : 0u );
+  frame.positions     = positions;
+  frame.velocities    = velocities;
+  frame.colors        = colors;
+  frame.radii         = radii;
+  return true;
+}
@@ -0,0 +1,158 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include <optixu/optixu_math_namespace.h>
+
+#include <MappedFile.h>
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+//-----------------------------------------------------------------------------
+//
+// Host side particle frames for optixParticleVolumes.  A frame holds one
+// float4 per particle with the position in xyz and the attribute in w,
+// normalized to [0,1] for the transfer function, and optionally a velocity,
+// color and radius per particle.
+//
+// Frames read from text or raw files own their arrays.  Frames read from a
+// binary particle file (see ParticleFile.h) point straight into the file
+// mapping, which the frame keeps open.  Either way each channel is one
+// tightly packed array in the layout of the RT_FORMAT_FLOAT4, FLOAT3 and
+// FLOAT buffers of the sample, so it is uploaded with a single memcpy.
+//
+//-----------------------------------------------------------------------------
+
+// Per particle channels stored besides the positions
+enum ParticleChannels
+{
+  PARTICLE_VELOCITIES = 1 << 0,
+  PARTICLE_COLORS     = 1 << 1,
+  PARTICLE_RADII      = 1 << 2
+};
+
+
+// Componentwise range of the positions and raw attribute of a set of particles
+struct ParticleStats
+{
+  optix::float4       pmin;
+  optix::float4       pmax;
+};
+
+
+// One coarser level of the level-of-detail hierarchy of a frame, in which the
+// particles of each grid cell are merged into one aggregate RBF (see
+// ParticleLod.h)
+struct ParticleLodLevel
+{
+  float                       cell_size;          // Edge of the merged cells
+  float                       mean_radius_scale;
+  std::vector<optix::float4>  positions;          // Aggregate centers and attributes
+  std::vector<float>          radius_scales;      // Aggregate radii relative to the particle radius
+};
+
+
+struct ParticleFrameData
+{
+  ParticleFrameData();
+
+  size_t                      num_particles;
+  unsigned int                channels;           // ParticleChannels in the arrays below
+  const optix::float4*        positions;
+  const optix::float3*        velocities;         // Null unless channels has the matching bit
+  const optix::float3*        colors;
+  const float*                radii;
+
+  ParticleStats               stats;              // Before the attribute was normalized
+  float                       attribute_scale;    // w = raw attribute * scale + offset
+  float                       attribute_offset;
+  bool                        signed_attribute;   // Raw attribute had negative values, 0.5 maps to 0
+  bool                        morton_order;       // Sorted along the Morton curve (see ParticleSort.h)
+
+  // Arrays of frames read from text or raw files
+  std::vector<optix::float4>  position_storage;
+  std::vector<optix::float3>  velocity_storage;
+  std::vector<optix::float3>  color_storage;
+  std::vector<float>          radius_storage;
+
+  // Mapping of frames read from a particle file
+  std::shared_ptr<MappedFile> file;
+
+  // Coarser levels, finest first, empty unless built by buildParticleLod()
+  std::vector<ParticleLodLevel> lod_levels;
+
+private:
+  ParticleFrameData( const ParticleFrameData& );             // Not copyable, the
+  ParticleFrameData& operator=( const ParticleFrameData& );  // arrays may point into the storage
+};
+
+static_assert( sizeof( optix::float3 ) == 3 * sizeof( float ), "float3 channels must be packed" );
+static_assert( sizeof( optix::float4 ) == 4 * sizeof( float ), "float4 channels must be packed" );
+
+
+struct ParticleReadOptions
+{
+  size_t              max_particles;      // Read only the first max_particles, 0 for all
+  bool                colors;             // Text files have r g b after the velocity
+  bool                radii;              // Text files have a radius after the color
+  float               fixed_radius;       // Radius shared by particles without one
+};
+
+
+// Host memory held by a frame: its owned arrays or its file mapping, and its
+// level-of-detail hierarchy
+size_t particleFrameBytes( const ParticleFrameData& frame );
+
+// Componentwise min and max over the positions, computed in one pass on
+// worker threads.
+ParticleStats computeParticleStats( const optix::float4* positions, size_t num_particles );
+
+// Fills in stats, attribute_scale, attribute_offset and signed_attribute of a
+// frame with owned arrays and normalizes the w of its positions.  Attributes
+// with negative values are mapped symmetrically so 0 lands on 0.5.
+void normalizeParticleAttributes( ParticleFrameData& frame );
+
+// Reads a binary particle file, a raw float4 file ("*.raw") or a text file
+// with one "x y z vx vy vz [r g b] [radius]" line per particle (anything
+// else), and normalizes the attributes of raw and text files.  frame must be
+// empty.  Returns false with a message in error if the file can't be read.
+bool readParticles( const std::string& filename, const ParticleReadOptions& options,
+                    ParticleFrameData& frame, std::string& error );
+
+// Text and raw readers used by readParticles, without normalization.  The
+// text reader maps the file, splits it into chunks at line ends and parses
+// the chunks on worker threads straight into the frame arrays.  Its floats
+// match (float)atof bit for bit.
+bool readRawParticles( const std::string& filename, const ParticleReadOptions& options,
+                       ParticleFrameData& frame, std::string& error );
+bool readTextParticles( const std::string& filename, const ParticleReadOptions& options,
+                        ParticleFrameData& frame, std::string& error );
@@ -0,0 +1,218 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "ParticleFile.h"
+
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+using namespace optix;
+
+
+const char* const PARTICLE_FILE_EXTENSION = "particles";
+
+
+//------------------------------------------------------------------------------
+//
+// Helpers
+//
+//------------------------------------------------------------------------------
+
+namespace
+{
+
+// Bump whenever the layout of the file changes
+const uint32_t PARTICLE_FILE_VERSION   = 2u;
+const char     PARTICLE_FILE_MAGIC[8]  = { 'P', 'A', 'R', 'T', 'I', 'C', 'L', 'E' };
+const uint64_t PARTICLE_FILE_ALIGNMENT = 64u;
+
+
+struct ParticleFileHeader
+{
+  char                magic[8];
+  uint32_t            version;
+  uint32_t            header_size;          // sizeof( ParticleFileHeader ), guards against padding changes
+
+  uint64_t            num_particles;
+  uint32_t            channels;             // ParticleChannels
+  uint32_t            signed_attribute;
+  uint32_t            morton_order;         // Particles sorted by sortParticles()
+  uint32_t            padding;
+
+  float               pmin[4];              // ParticleStats, raw attribute range in w
+  float               pmax[4];
+  float               attribute_scale;
+  float               attribute_offset;
+
+  // Byte offsets of the positions, velocities, colors and radii, 0 if absent
+  uint64_t            offsets[4];
+};
+
+
+// Closes the file on scope exit
+struct FileCloser
+{
+  FILE* file;
+  ~FileCloser() { if( file ) fclose( file ); }
+};
+
+
+uint64_t alignOffset( uint64_t offset )
+{
+  return ( offset + PARTICLE_FILE_ALIGNMENT - 1 ) & ~( PARTICLE_FILE_ALIGNMENT - 1 );
+}
+
+
+bool writePadded( FILE* fp, const void* data, uint64_t size, uint64_t& offset, uint64_t target_offset )
+{
+  static const char zeros[PARTICLE_FILE_ALIGNMENT] = { 0 };
+  if( target_offset > offset &&
+      fwrite( zeros, 1, static_cast<size_t>( target_offset - offset ), fp ) != target_offset - offset )
+    return false;
+  offset = target_offset;
+
+  if( size && fwrite( data, 1, static_cast<size_t>( size ), fp ) != size )
+    return false;
+  offset += size;
+  return true;
+}
+
+} // namespace
+
+
+//------------------------------------------------------------------------------
+//
+// Particle file I/O
+//
+//------------------------------------------------------------------------------
+
+bool writeParticleFile( const std::string& filename, const ParticleFrameData& frame )
+{
+  ParticleFileHeader header;
+  memset( &header, 0, sizeof( header ) );
+  memcpy( header.magic, PARTICLE_FILE_MAGIC, sizeof( header.magic ) );
+  header.version          = PARTICLE_FILE_VERSION;
+  header.header_size      = sizeof( ParticleFileHeader );
+  header.num_particles    = frame.num_particles;
+  header.channels         = frame.channels;
+  header.signed_attribute = frame.signed_attribute ? 1u : 0u;
+  header.morton_order     = frame.morton_order ? 1u : 0u;
+  memcpy( header.pmin, &frame.stats.pmin, sizeof( header.pmin ) );
+  memcpy( header.pmax, &frame.stats.pmax, sizeof( header.pmax ) );
+  header.attribute_scale  = frame.attribute_scale;
+  header.attribute_offset = frame.attribute_offset;
+
+  const void* arrays[4] = { frame.positions, frame.velocities, frame.colors, frame.radii };
+  const uint64_t sizes[4] = {
+    frame.num_particles * sizeof( float4 ),
+    frame.channels & PARTICLE_VELOCITIES ? frame.num_particles * sizeof( float3 ) : 0,
+    frame.channels & PARTICLE_COLORS     ? frame.num_particles * sizeof( float3 ) : 0,
+    frame.channels & PARTICLE_RADII      ? frame.num_particles * sizeof( float )  : 0 };
+  uint64_t end = sizeof( header );
+  for( int i = 0; i < 4; ++i ) {
+    if( !arrays[i] && sizes[i] )
+      return false;
+    if( i == 0 || sizes[i] ) {
+      header.offsets[i] = alignOffset( end );
+      end = header.offsets[i] + sizes[i];
+    }
+  }
+
+  FileCloser closer = { fopen( filename.c_str(), "wb" ) };
+  if( !closer.file )
+    return false;
+
+  uint64_t offset = 0;
+  bool ok = writePadded( closer.file, &header, sizeof( header ), offset, 0 );
+  for( int i = 0; i < 4 && ok; ++i )
+    if( header.offsets[i] )
+      ok = writePadded( closer.file, arrays[i], sizes[i], offset, header.offsets[i] );
+  ok = fclose( closer.file ) == 0 && ok;
+  closer.file = 0;
+  if( !ok )
+    remove( filename.c_str() );
+  return ok;
+}
+
+
+bool readParticleFile( const std::string& filename, size_t max_particles,
+                       ParticleFrameData& frame, std::string& error )
+{
+  std::shared_ptr<MappedFile> file( new MappedFile( filename ) );
+  if( file->failed() ) {
+    error = "can't map '" + filename + "'";
+    return false;
+  }
+
+  ParticleFileHeader header;
+  if( file->size() < sizeof( header ) ||
+      memcmp( file->data(), PARTICLE_FILE_MAGIC, sizeof( header.magic ) ) != 0 ) {
+    error = "'" + filename + "' is not a particle file";
+    return false;
+  }
+  memcpy( &header, file->data(), sizeof( header ) );
+  if( header.version != PARTICLE_FILE_VERSION || header.header_size != sizeof( ParticleFileHeader ) ) {
+    error = "'" + filename + "' was written with a different particle file version";
+    return false;
+  }
+
+  const uint64_t element_sizes[4] = {
+    sizeof( float4 ),
+    header.channels & PARTICLE_VELOCITIES ? sizeof( float3 ) : 0,
+    header.channels & PARTICLE_COLORS     ? sizeof( float3 ) : 0,
+    header.channels & PARTICLE_RADII      ? sizeof( float )  : 0 };
+  const char* arrays[4] = { 0, 0, 0, 0 };
+  for( int i = 0; i < 4; ++i ) {
+    if( !element_sizes[i] )
+      continue;
+    const uint64_t offset = header.offsets[i];
+    if( offset < sizeof( header ) || offset % PARTICLE_FILE_ALIGNMENT != 0 || offset > file->size() ||
+        header.num_particles > ( file->size() - offset ) / element_sizes[i] ) {
+      error = "'" + filename + "' is truncated or corrupt";
+      return false;
+    }
+    arrays[i] = file->data() + offset;
+  }
+
+  frame.num_particles = static_cast<size_t>( header.num_particles );
+  if( max_particles > 0 && frame.num_particles > max_particles )
+    frame.num_particles = max_particles;
+  frame.channels         = header.channels & ( PARTICLE_VELOCITIES | PARTICLE_COLORS | PARTICLE_RADII );
+  frame.positions        = reinterpret_cast<const float4*>( arrays[0] );
+  frame.velocities       = reinterpret_cast<const float3*>( arrays[1] );
+  frame.colors           = reinterpret_cast<const float3*>( arrays[2] );
+  frame.radii            = reinterpret_cast<const float*>( arrays[3] );
+  memcpy( &frame.stats.pmin, header.pmin, sizeof( header.pmin ) );
+  memcpy( &frame.stats.pmax, header.pmax, sizeof( header.pmax ) );
+  frame.attribute_scale  = header.attribute_scale;
+  frame.attribute_offset = header.attribute_offset;
+  frame.signed_attribute = header.signed_attribute != 0;
+  frame.morton_order     = header.morton_order != 0;
+  frame.file             = file;
+  return true;
+}
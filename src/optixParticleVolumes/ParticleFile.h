@@ -0,0 +1,62 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include "ParticleData.h"
+
+#include <string>
+
+
+//-----------------------------------------------------------------------------
+//
+// Self-describing binary particle file ("*.particles").  The header records
+// the particle count, the channels present, the range of the positions and
+// the attribute normalization, followed by the position, velocity, color and
+// radius arrays in host byte order, each starting on a 64 byte boundary.
+// Positions hold the normalized attribute in w, so a frame is loaded by
+// mapping the file and pointing at the arrays, without parsing or copying.
+// Files of sorted frames (see ParticleSort.h) are flagged as such, so they
+// are not sorted again on load.
+//
+// particleConvert writes these files from text and raw particle files.
+//
+//-----------------------------------------------------------------------------
+
+// Extension that readParticles() recognizes as a particle file
+extern const char* const PARTICLE_FILE_EXTENSION;
+
+// Writes frame, whose attributes must already be normalized.  Returns false
+// if the file can't be written.
+bool writeParticleFile( const std::string& filename, const ParticleFrameData& frame );
+
+// Maps a particle file into frame, which must be empty.  If max_particles is
+// nonzero only the first max_particles are used; stats still cover the whole
+// file.  Returns false with a message in error if the file can't be mapped,
+// was written with a different version, or is truncated.
+bool readParticleFile( const std::string& filename, size_t max_particles,
+                       ParticleFrameData& frame, std::string& error );
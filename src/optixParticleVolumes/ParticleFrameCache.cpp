@@ -0,0 +1,241 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "ParticleFrameCache.h"
+
+#include <algorithm>
+#include <chrono>
+
+
+//------------------------------------------------------------------------------
+//
+// Helpers
+//
+//------------------------------------------------------------------------------
+
+namespace
+{
+
+double currentTime()
+{
+  return std::chrono::duration<double>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+
+// Reads one byte per page of a mapped frame, so its pages are resident before
+// the render thread uploads it
+void touchMappedPages( const ParticleFrameData& data )
+{
+  if( !data.file )
+    return;
+  const size_t page_size = 4096;
+  const char* bytes = data.file->data();
+  unsigned int sum = 0;
+  for( size_t i = 0; i < data.file->size(); i += page_size )
+    sum += static_cast<unsigned char>( bytes[i] );
+  volatile unsigned int sink = sum;
+  (void)sink;
+}
+
+} // namespace
+
+
+//------------------------------------------------------------------------------
+//
+// ParticleFrameCache
+//
+//------------------------------------------------------------------------------
+
+ParticleFrameCache::ParticleFrameCache( LoadFunction load, size_t budget_bytes )
+  : m_load( load ),
+    m_budget( budget_bytes ),
+    m_current( 0 ),
+    m_has_current( false ),
+    m_loading( 0 ),
+    m_is_loading( false ),
+    m_last_frame_bytes( 0 ),
+    m_stop( false )
+{
+  Counters zero = { 0, 0, 0, 0, 0, 0.0, 0, 0 };
+  m_counters = zero;
+  m_worker = std::thread( &ParticleFrameCache::workerLoop, this );
+}
+
+
+ParticleFrameCache::~ParticleFrameCache()
+{
+  {
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_stop = true;
+    m_queue.clear();
+  }
+  m_cond.notify_all();
+  m_worker.join();
+}
+
+
+std::shared_ptr<const ParticleFrameData> ParticleFrameCache::acquire( int frame )
+{
+  const double t0 = currentTime();
+  std::unique_lock<std::mutex> lock( m_mutex );
+  m_current     = frame;
+  m_has_current = true;
+
+  if( m_is_loading && m_loading == frame ) {
+    ++m_counters.waits;
+    m_cond.wait( lock, [&]() { return !m_is_loading || m_loading != frame; } );
+  }
+
+  std::map<int, EntryList::iterator>::iterator it = m_entries.find( frame );
+  if( it != m_entries.end() ) {
+    m_lru.splice( m_lru.begin(), m_lru, it->second );
+    ++m_counters.hits;
+    m_counters.wait_time += currentTime() - t0;
+    return it->second->data;
+  }
+
+  // Not resident: load it here, after taking it out of the worker's queue
+  m_queue.erase( std::remove( m_queue.begin(), m_queue.end(), frame ), m_queue.end() );
+  lock.unlock();
+
+  std::shared_ptr<ParticleFrameData> data( new ParticleFrameData );
+  m_load( frame, *data );
+
+  lock.lock();
+  ++m_counters.misses;
+  insert( frame, data );
+  evict();
+  m_counters.wait_time += currentTime() - t0;
+  return data;
+}
+
+
+void ParticleFrameCache::prefetch( const std::vector<int>& frames )
+{
+  {
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_window = frames;
+    m_queue.clear();
+    for( size_t i = 0; i < frames.size(); ++i )
+      if( !m_entries.count( frames[i] ) && !( m_is_loading && m_loading == frames[i] ) )
+        m_queue.push_back( frames[i] );
+  }
+  m_cond.notify_all();
+}
+
+
+ParticleFrameCache::Counters ParticleFrameCache::counters()const
+{
+  std::lock_guard<std::mutex> lock( m_mutex );
+  return m_counters;
+}
+
+
+void ParticleFrameCache::workerLoop()
+{
+  std::unique_lock<std::mutex> lock( m_mutex );
+  for( ;; ) {
+    m_cond.wait( lock, [&]() { return m_stop || !m_queue.empty(); } );
+    if( m_stop )
+      return;
+
+    const int frame = m_queue.front();
+    m_queue.pop_front();
+    if( m_entries.count( frame ) )
+      continue;
+
+    // Stop at the first window frame that would not fit next to the current
+    // frame and the window frames already loaded
+    size_t pinned_bytes = 0;
+    for( EntryList::const_iterator e = m_lru.begin(); e != m_lru.end(); ++e )
+      if( pinned( e->frame ) )
+        pinned_bytes += e->bytes;
+    if( pinned_bytes + m_last_frame_bytes > m_budget ) {
+      m_queue.clear();
+      continue;
+    }
+
+    m_loading    = frame;
+    m_is_loading = true;
+    lock.unlock();
+
+    std::shared_ptr<ParticleFrameData> data( new ParticleFrameData );
+    try
+    {
+      m_load( frame, *data );
+      touchMappedPages( *data );
+    }
+    catch( ... )
+    {
+      // Left to acquire(), which reports the error if the frame is used
+      data.reset();
+    }
+
+    lock.lock();
+    m_is_loading = false;
+    if( data ) {
+      ++m_counters.prefetched;
+      insert( frame, data );
+      evict();
+    }
+    m_cond.notify_all();
+  }
+}
+
+
+void ParticleFrameCache::insert( int frame, const std::shared_ptr<ParticleFrameData>& data )
+{
+  Entry entry = { frame, data, particleFrameBytes( *data ) };
+  m_lru.push_front( entry );
+  m_entries[frame] = m_lru.begin();
+  m_last_frame_bytes = entry.bytes;
+  ++m_counters.resident_frames;
+  m_counters.resident_bytes += entry.bytes;
+}
+
+
+void ParticleFrameCache::evict()
+{
+  EntryList::iterator it = m_lru.end();
+  while( m_counters.resident_bytes > m_budget && it != m_lru.begin() ) {
+    --it;
+    if( pinned( it->frame ) )
+      continue;
+    m_counters.resident_bytes -= it->bytes;
+    --m_counters.resident_frames;
+    ++m_counters.evicted;
+    m_entries.erase( it->frame );
+    it = m_lru.erase( it );
+  }
+}
+
+
+bool ParticleFrameCache::pinned( int frame )const
+{
+  return ( m_has_current && frame == m_current ) ||
+         std::find( m_window.begin(), m_window.end(), frame ) != m_window.end();
+}
@@ -0,0 +1,128 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include "ParticleData.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+//-----------------------------------------------------------------------------
+//
+// Cache of the frames of a particle sequence with a byte budget and least
+// recently used eviction.  A worker thread loads the frames named by
+// prefetch() ahead of playback, so acquire() finds them resident instead of
+// reading them on the render thread.
+//
+// Frames are handed out as shared pointers and stay valid after eviction
+// until released.  The frame last acquired and the frames of the current
+// prefetch window are never evicted; prefetching stops early when the
+// window would not fit in the budget.  acquire() and prefetch() are meant to
+// be called from one thread.
+//
+//-----------------------------------------------------------------------------
+
+class ParticleFrameCache
+{
+public:
+  // Loads a frame into an empty ParticleFrameData, throws on failure.  Called
+  // on the worker thread for prefetches.
+  typedef std::function<void( int frame, ParticleFrameData& data )> LoadFunction;
+
+  struct Counters
+  {
+    size_t            hits;               // acquire() found the frame resident
+    size_t            misses;             // acquire() loaded the frame itself
+    size_t            waits;              // acquire() waited for the worker to finish the frame
+    size_t            prefetched;         // Frames loaded by the worker
+    size_t            evicted;
+    double            wait_time;          // Seconds spent in acquire() on misses and waits
+    size_t            resident_frames;
+    size_t            resident_bytes;
+  };
+
+  ParticleFrameCache( LoadFunction load, size_t budget_bytes );
+  ~ParticleFrameCache();
+
+  // Returns the frame, loading it on the calling thread if it is neither
+  // resident nor being loaded by the worker.  Rethrows load errors.
+  std::shared_ptr<const ParticleFrameData> acquire( int frame );
+
+  // Replaces the prefetch window with frames, loaded in order.
+  void prefetch( const std::vector<int>& frames );
+
+  Counters counters()const;
+  size_t   budget()const { return m_budget; }
+
+private:
+  struct Entry
+  {
+    int                                 frame;
+    std::shared_ptr<ParticleFrameData>  data;
+    size_t                              bytes;
+  };
+  typedef std::list<Entry> EntryList;
+
+  ParticleFrameCache( const ParticleFrameCache& );             // Not copyable
+  ParticleFrameCache& operator=( const ParticleFrameCache& );
+
+  void workerLoop();
+
+  // Requires m_mutex
+  void insert( int frame, const std::shared_ptr<ParticleFrameData>& data );
+  void evict();
+  bool pinned( int frame )const;
+
+  LoadFunction                          m_load;
+  const size_t                          m_budget;
+
+  mutable std::mutex                    m_mutex;
+  std::condition_variable               m_cond;
+  EntryList                             m_lru;              // Most recently used first
+  std::map<int, EntryList::iterator>    m_entries;
+  std::vector<int>                      m_window;           // Frames of the last prefetch()
+  std::deque<int>                       m_queue;            // Window frames the worker has yet to load
+  int                                   m_current;          // Frame of the last acquire()
+  bool                                  m_has_current;
+  int                                   m_loading;          // Frame the worker is loading
+  bool                                  m_is_loading;
+  size_t                                m_last_frame_bytes; // Size estimate for the next load
+  bool                                  m_stop;
+  Counters                              m_counters;
+
+  std::thread                           m_worker;
+};
@@ -0,0 +1,201 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "ParticleLod.h"
+#include "ParticleSort.h"
+
+#include <Parallel.h>
+
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+
+using namespace optix;
+
+
+//------------------------------------------------------------------------------
+//
+// Helpers
+//
+//------------------------------------------------------------------------------
+
+namespace
+{
+
+// Particles or cells per work item of the parallel passes
+const size_t LOD_BLOCK_SIZE = 1u << 14;
+
+// Bits per axis of the Morton grid
+const int    GRID_BITS = 21;
+
+// A level is kept only if it has at most this fraction of the primitives of
+// the previous one
+const double MIN_REDUCTION = 0.75;
+
+
+// Merges the particles [begin, end) into the Gaussian with the same weighted
+// mean and variance.  sigma2 is the variance of one particle's RBF.
+void mergeParticles( const float4* positions, size_t begin, size_t end, float attribute_offset, float sigma2,
+                     float4& aggregate, float& radius_scale )
+{
+  double weight = 0.0;
+  double sum    = 0.0;
+  double center[3] = { 0.0, 0.0, 0.0 };
+  for( size_t i = begin; i < end; ++i ) {
+    const double a = positions[i].w - attribute_offset;
+    const double w = std::fabs( a );
+    weight    += w;
+    sum       += a;
+    center[0] += w * positions[i].x;
+    center[1] += w * positions[i].y;
+    center[2] += w * positions[i].z;
+  }
+
+  // Plain mean if all attributes are at the offset
+  const bool uniform = weight <= 0.0;
+  const double total = uniform ? double( end - begin ) : weight;
+  if( uniform ) {
+    center[0] = center[1] = center[2] = 0.0;
+    for( size_t i = begin; i < end; ++i ) {
+      center[0] += positions[i].x;
+      center[1] += positions[i].y;
+      center[2] += positions[i].z;
+    }
+  }
+  for( int k = 0; k < 3; ++k )
+    center[k] /= total;
+
+  double variance = 0.0;
+  for( size_t i = begin; i < end; ++i ) {
+    const double w  = uniform ? 1.0 : std::fabs( positions[i].w - attribute_offset );
+    const double dx = positions[i].x - center[0];
+    const double dy = positions[i].y - center[1];
+    const double dz = positions[i].z - center[2];
+    variance += w * ( dx*dx + dy*dy + dz*dz );
+  }
+  variance /= 3.0 * total;
+
+  // Integral of the RBFs over that of one RBF of the aggregate's radius
+  const double scale = std::sqrt( 1.0 + variance / sigma2 );
+  aggregate = make_float4( float( center[0] ), float( center[1] ), float( center[2] ),
+                           float( attribute_offset + sum / ( scale * scale * scale ) ) );
+  radius_scale = float( scale );
+}
+
+} // namespace
+
+
+//------------------------------------------------------------------------------
+//
+// Level of detail
+//
+//------------------------------------------------------------------------------
+
+void buildParticleLod( ParticleFrameData& frame, float radius, int max_levels )
+{
+  frame.lod_levels.clear();
+
+  const size_t count = frame.num_particles;
+  const float3 pmin  = make_float3( frame.stats.pmin );
+  const float3 size  = make_float3( frame.stats.pmax ) - pmin;
+  const float extent = fmaxf( size.x, fmaxf( size.y, size.z ) );
+  if( count < 2 || max_levels <= 0 || !( extent > 0.0f ) || !( radius > 0.0f ) )
+    return;
+
+  // Particles in the order of a cubic Morton grid
+  std::vector<uint64_t> keys( count );
+  std::vector<uint32_t> order( count );
+  const float inv_extent = 1.0f / extent;
+  sutil::parallelFor( ( count + LOD_BLOCK_SIZE - 1 ) / LOD_BLOCK_SIZE, [&]( size_t block )
+  {
+    const size_t end = std::min( count, ( block + 1 ) * LOD_BLOCK_SIZE );
+    for( size_t i = block * LOD_BLOCK_SIZE; i < end; ++i ) {
+      const float3 p = ( make_float3( frame.positions[i] ) - pmin ) * inv_extent;
+      keys[i]  = mortonCode63( p.x, p.y, p.z );
+      order[i] = static_cast<uint32_t>( i );
+    }
+  } );
+  radixSortPairs( keys, order, 3 * GRID_BITS );
+
+  std::vector<float4> sorted( count );
+  sutil::parallelFor( ( count + LOD_BLOCK_SIZE - 1 ) / LOD_BLOCK_SIZE, [&]( size_t block )
+  {
+    const size_t end = std::min( count, ( block + 1 ) * LOD_BLOCK_SIZE );
+    for( size_t i = block * LOD_BLOCK_SIZE; i < end; ++i )
+      sorted[i] = frame.positions[ order[i] ];
+  } );
+
+  // Cells at least as wide as a particle, doubling per level
+  int bits = 0;
+  while( bits < GRID_BITS && extent / float( 1u << ( GRID_BITS - bits ) ) < radius )
+    ++bits;
+
+  const float sigma2 = radius * radius / 8.0f;   // exp( -(2d/r)^2 ) as a Gaussian
+  size_t previous = count;
+  std::vector<size_t> starts;
+  for( ; bits <= GRID_BITS && int( frame.lod_levels.size() ) < max_levels && previous > 1; ++bits ) {
+    const int shift = 3 * bits;
+    starts.clear();
+    for( size_t i = 0; i < count; ++i )
+      if( i == 0 || ( keys[i] >> shift ) != ( keys[i-1] >> shift ) )
+        starts.push_back( i );
+    const size_t num_cells = starts.size();
+    if( num_cells > MIN_REDUCTION * previous )
+      continue;
+    starts.push_back( count );
+
+    frame.lod_levels.push_back( ParticleLodLevel() );
+    ParticleLodLevel& level = frame.lod_levels.back();
+    level.cell_size = extent / float( 1u << ( GRID_BITS - bits ) );
+    level.positions.resize( num_cells );
+    level.radius_scales.resize( num_cells );
+    sutil::parallelFor( ( num_cells + LOD_BLOCK_SIZE - 1 ) / LOD_BLOCK_SIZE, [&]( size_t block )
+    {
+      const size_t end = std::min( num_cells, ( block + 1 ) * LOD_BLOCK_SIZE );
+      for( size_t c = block * LOD_BLOCK_SIZE; c < end; ++c )
+        mergeParticles( sorted.data(), starts[c], starts[c+1], frame.attribute_offset, sigma2,
+                        level.positions[c], level.radius_scales[c] );
+    } );
+
+    double scale_sum = 0.0;
+    for( size_t c = 0; c < num_cells; ++c )
+      scale_sum += level.radius_scales[c];
+    level.mean_radius_scale = float( scale_sum / double( num_cells ) );
+    previous = num_cells;
+  }
+}
+
+
+int selectParticleLod( const ParticleFrameData& frame, float distance, float pixel_size, float max_pixels )
+{
+  const float footprint = max_pixels * pixel_size * distance;
+  int level = 0;
+  for( size_t i = 0; i < frame.lod_levels.size(); ++i )
+    if( frame.lod_levels[i].cell_size <= footprint )
+      level = static_cast<int>( i ) + 1;
+  return level;
+}
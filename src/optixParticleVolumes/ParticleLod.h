@@ -0,0 +1,57 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include "ParticleData.h"
+
+
+//-----------------------------------------------------------------------------
+//
+// Level-of-detail hierarchy for distant views of a particle frame.  Each
+// level merges the particles in the cells of a cubic grid into one aggregate
+// RBF per cell, and each level's cells are twice the size of the previous
+// level's.  The grid is a Morton grid over the bounds of the frame, so after
+// one radix sort the cells of every level are runs of particles.
+//
+// An aggregate is the Gaussian that matches the first two moments of the
+// particles it replaces.  Its center is the attribute-weighted mean, and its
+// radius grows with their spread.  Its attribute keeps the integral of the
+// RBFs, so dense clusters stay as bright as their particles.  Attributes are
+// taken relative to attribute_offset, so signed data merges symmetrically.
+//
+//-----------------------------------------------------------------------------
+
+// Builds up to max_levels levels for particles of the given radius into
+// frame.lod_levels.  Levels that merge too few particles to be worth a
+// rebuild are skipped.
+void buildParticleLod( ParticleFrameData& frame, float radius, int max_levels );
+
+// Coarsest level whose cells are at most max_pixels pixels wide at the given
+// distance, where pixel_size is the size of a pixel at unit distance.
+// 0 is the full resolution frame, i > 0 is frame.lod_levels[i-1].
+int selectParticleLod( const ParticleFrameData& frame, float distance, float pixel_size, float max_pixels );
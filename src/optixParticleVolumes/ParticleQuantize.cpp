@@ -0,0 +1,115 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "ParticleQuantize.h"
+#include "commonStructs.h"
+
+#include <Parallel.h>
+
+#include <algorithm>
+
+using namespace optix;
+
+
+//------------------------------------------------------------------------------
+//
+// Helpers
+//
+//------------------------------------------------------------------------------
+
+namespace
+{
+
+// Blocks per work item of the parallel encoder
+const size_t QUANTIZE_ITEM_BLOCKS = 256;
+
+const float QUANTIZED_MAX = 65535.0f;
+
+
+inline unsigned short quantize16( float x, float origin, float inv_step )
+{
+  return static_cast<unsigned short>( std::min( std::max( ( x - origin ) * inv_step + 0.5f, 0.0f ), QUANTIZED_MAX ) );
+}
+
+
+void quantizeBlock( const float4* positions, size_t begin, size_t end, ushort4* quantized, float4* block )
+{
+  float4 pmin = positions[begin];
+  float4 pmax = positions[begin];
+  for( size_t i = begin + 1; i < end; ++i ) {
+    pmin = fminf( pmin, positions[i] );
+    pmax = fmaxf( pmax, positions[i] );
+  }
+
+  const float4 step = ( pmax - pmin ) * ( 1.0f / QUANTIZED_MAX );
+  const float4 inv_step = make_float4( step.x > 0.0f ? 1.0f / step.x : 0.0f, step.y > 0.0f ? 1.0f / step.y : 0.0f,
+                                       step.z > 0.0f ? 1.0f / step.z : 0.0f, step.w > 0.0f ? 1.0f / step.w : 0.0f );
+  block[0] = pmin;
+  block[1] = step;
+  for( size_t i = begin; i < end; ++i ) {
+    const float4& p = positions[i];
+    quantized[i] = make_ushort4( quantize16( p.x, pmin.x, inv_step.x ), quantize16( p.y, pmin.y, inv_step.y ),
+                                 quantize16( p.z, pmin.z, inv_step.z ), quantize16( p.w, pmin.w, inv_step.w ) );
+  }
+}
+
+} // namespace
+
+
+//------------------------------------------------------------------------------
+//
+// Quantization
+//
+//------------------------------------------------------------------------------
+
+size_t quantizedBlockCount( size_t count )
+{
+  return ( count + QUANTIZED_BLOCK_SIZE - 1 ) / QUANTIZED_BLOCK_SIZE;
+}
+
+
+void quantizeParticles( const float4* positions, size_t count, ushort4* quantized, float4* blocks )
+{
+  const size_t num_blocks = quantizedBlockCount( count );
+  sutil::parallelFor( ( num_blocks + QUANTIZE_ITEM_BLOCKS - 1 ) / QUANTIZE_ITEM_BLOCKS, [&]( size_t item )
+  {
+    const size_t end_block = std::min( num_blocks, ( item + 1 ) * QUANTIZE_ITEM_BLOCKS );
+    for( size_t b = item * QUANTIZE_ITEM_BLOCKS; b < end_block; ++b )
+      quantizeBlock( positions, b * QUANTIZED_BLOCK_SIZE, std::min( count, ( b + 1 ) * QUANTIZED_BLOCK_SIZE ),
+                     quantized, &blocks[2 * b] );
+  } );
+}
+
+
+float4 dequantizeParticle( const ushort4* quantized, const float4* blocks, size_t i )
+{
+  const ushort4 q      = quantized[i];
+  const float4  origin = blocks[2 * ( i / QUANTIZED_BLOCK_SIZE )];
+  const float4  step   = blocks[2 * ( i / QUANTIZED_BLOCK_SIZE ) + 1];
+  return make_float4( origin.x + step.x * float( q.x ), origin.y + step.y * float( q.y ),
+                      origin.z + step.z * float( q.z ), origin.w + step.w * float( q.w ) );
+}
@@ -0,0 +1,60 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include <optixu/optixu_math_namespace.h>
+
+#include <cstddef>
+
+
+//-----------------------------------------------------------------------------
+//
+// Quantized particle positions for the device.  Particles are encoded in
+// blocks of QUANTIZED_BLOCK_SIZE consecutive particles (see commonStructs.h).
+// Each block stores the origin and step of its bounds in xyz and attribute in
+// w as two float4s, and each particle stores its position and attribute as
+// 16 bit offsets from the origin in units of the step.  That is 8 bytes per
+// particle instead of 16, with an error of at most half a step per component.
+// The blocks are tight when the particles are sorted along a Morton curve
+// (see ParticleSort.h).
+//
+// particle_position() in particlePosition.h decodes them on the device the
+// way dequantizeParticle() does here.
+//
+//-----------------------------------------------------------------------------
+
+// Number of blocks, each of which has two float4s, for count particles
+size_t quantizedBlockCount( size_t count );
+
+// Encodes count positions into quantized and their blocks, origin first,
+// into blocks.  Runs on worker threads.
+void quantizeParticles( const optix::float4* positions, size_t count, optix::ushort4* quantized,
+                        optix::float4* blocks );
+
+// Decodes particle i
+optix::float4 dequantizeParticle( const optix::ushort4* quantized, const optix::float4* blocks, size_t i );
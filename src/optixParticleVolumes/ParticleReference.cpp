@@ -0,0 +1,375 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ParticleReference.h"
+#include "ParticleSort.h"
+#include "TransferFunctionTable.h"
+#include "commonStructs.h"
+
+#include <Parallel.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+using namespace optix;
+
+// tf_redshift() of the device, which expects the optix vector math in scope
+#include "transferFunction.h"
+
+
+//------------------------------------------------------------------------------
+//
+// Helpers
+//
+//------------------------------------------------------------------------------
+
+namespace
+{
+
+const uint32_t MAX_LEAF_SIZE = 4;
+const uint32_t MAX_DEPTH     = 60;      // Traversal stack has 64 entries
+const float    MAX_ALPHA     = 0.97f;   // Early termination of raygen.cu
+
+typedef std::chrono::steady_clock Clock;
+
+
+inline double seconds( Clock::time_point t0, Clock::time_point t1 )
+{
+  return std::chrono::duration<double>( t1 - t0 ).count();
+}
+
+
+// Builds node index over the range [begin, end) of keys, split where the
+// highest differing bit of the Morton codes changes, or at the median for
+// runs of equal codes.  The bounds of inner nodes are merged from their
+// children.
+void buildNode( const std::vector<uint64_t>& keys, const std::vector<float4>& spheres,
+                std::vector<ParticleBvh::Node>& nodes, uint32_t index, uint32_t begin, uint32_t end, uint32_t depth )
+{
+  if( end - begin <= MAX_LEAF_SIZE || depth >= MAX_DEPTH ) {
+    float3 lo = make_float3(  std::numeric_limits<float>::max() );
+    float3 hi = make_float3( -std::numeric_limits<float>::max() );
+    for( uint32_t i = begin; i < end; ++i ) {
+      const float3 center = make_float3( spheres[i] );
+      lo = fminf( lo, center - make_float3( spheres[i].w ) );
+      hi = fmaxf( hi, center + make_float3( spheres[i].w ) );
+    }
+    ParticleBvh::Node& node = nodes[index];
+    node.bbox_min[0] = lo.x;  node.bbox_min[1] = lo.y;  node.bbox_min[2] = lo.z;
+    node.bbox_max[0] = hi.x;  node.bbox_max[1] = hi.y;  node.bbox_max[2] = hi.z;
+    node.offset = begin;
+    node.count  = end - begin;
+    return;
+  }
+
+  uint32_t mid = begin + ( end - begin ) / 2;
+  const uint64_t first = keys[begin];
+  const uint64_t diff  = first ^ keys[end - 1];
+  if( diff ) {
+    // First key with the highest differing bit set
+    uint64_t bit = uint64_t( 1 ) << 63;
+    while( !( diff & bit ) )
+      bit >>= 1;
+    mid = static_cast<uint32_t>( std::partition_point( keys.begin() + begin, keys.begin() + end,
+                                                       [&]( uint64_t key ) { return !( key & bit ); } ) -
+                                 keys.begin() );
+  }
+
+  const uint32_t left = static_cast<uint32_t>( nodes.size() );
+  nodes.resize( nodes.size() + 2 );
+  buildNode( keys, spheres, nodes, left,     begin, mid, depth + 1 );
+  buildNode( keys, spheres, nodes, left + 1, mid,   end, depth + 1 );
+
+  ParticleBvh::Node& node = nodes[index];
+  for( int k = 0; k < 3; ++k ) {
+    node.bbox_min[k] = std::min( nodes[left].bbox_min[k], nodes[left + 1].bbox_min[k] );
+    node.bbox_max[k] = std::max( nodes[left].bbox_max[k], nodes[left + 1].bbox_max[k] );
+  }
+  node.offset = left;
+  node.count  = 0;
+}
+
+
+// Entry distance of the segment into a node, +inf on a miss.  Written so that
+// NaNs (0 * inf) leave the interval unchanged.
+inline float intersectBox( const ParticleBvh::Node& node, const float* origin, const float* inv_dir, float tmin,
+                           float tmax )
+{
+  for( int k = 0; k < 3; ++k ) {
+    float t0 = ( node.bbox_min[k] - origin[k] ) * inv_dir[k];
+    float t1 = ( node.bbox_max[k] - origin[k] ) * inv_dir[k];
+    if( t0 > t1 )
+      std::swap( t0, t1 );
+    tmin = t0 > tmin ? t0 : tmin;
+    tmax = t1 < tmax ? t1 : tmax;
+  }
+  return tmin <= tmax ? tmin : std::numeric_limits<float>::infinity();
+}
+
+
+// The "bubble sort" of raygen.cu, kept exactly as it runs on the device
+void deviceSort( ParticleHit* particles, int N )
+{
+  for( int i = 0; i < N; i++ )
+    for( int j = 0; j < N - i - 1; j++ ) {
+      const ParticleHit tmp = particles[i];
+      if( tmp.t < particles[j].t ) {
+        particles[i] = particles[j];
+        particles[j] = tmp;
+      }
+    }
+}
+
+
+// Per row counters, summed once all rows are done
+struct RowStats
+{
+  uint64_t  slabs;
+  uint64_t  samples;
+  uint64_t  overflows;
+  uint64_t  unsorted;
+  double    traversal_time;
+  double    sort_time;
+  double    integrate_time;
+};
+
+} // namespace
+
+
+//------------------------------------------------------------------------------
+//
+// ParticleBvh
+//
+//------------------------------------------------------------------------------
+
+ParticleBvh::ParticleBvh( const float4* positions, const float* radius_scales, size_t count, float radius )
+  : m_build_time( 0.0 )
+{
+  const Clock::time_point start = Clock::now();
+  if( count == 0 )
+    return;
+
+  // Morton order over the bounds of the centers
+  ParticleFrameData frame;
+  frame.num_particles = count;
+  frame.positions     = positions;
+  frame.stats.pmin    = positions[0];
+  frame.stats.pmax    = positions[0];
+  for( size_t i = 1; i < count; ++i ) {
+    frame.stats.pmin = fminf( frame.stats.pmin, positions[i] );
+    frame.stats.pmax = fmaxf( frame.stats.pmax, positions[i] );
+  }
+  std::vector<uint64_t> keys;
+  mortonOrder( frame, m_indices, &keys );
+
+  m_spheres.resize( count );
+  for( size_t i = 0; i < count; ++i ) {
+    const uint32_t j = m_indices[i];
+    m_spheres[i] = make_float4( make_float3( positions[j] ), radius_scales ? radius * radius_scales[j] : radius );
+  }
+
+  m_nodes.reserve( 2 * count / MAX_LEAF_SIZE + 1 );
+  m_nodes.resize( 1 );
+  buildNode( keys, m_spheres, m_nodes, 0, 0, static_cast<uint32_t>( count ), 0 );
+
+  m_build_time = seconds( start, Clock::now() );
+}
+
+
+uint32_t ParticleBvh::collect( const float3& origin, const float3& direction, float tmin, float tmax,
+                               ParticleHit* hits, uint32_t capacity, bool& overflow )const
+{
+  overflow = false;
+  if( m_nodes.empty() )
+    return 0;
+
+  const float org[3]     = { origin.x, origin.y, origin.z };
+  const float inv_dir[3] = { 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+  const float miss       = std::numeric_limits<float>::infinity();
+
+  uint32_t stack[64];
+  int      top = 0;
+  if( intersectBox( m_nodes[0], org, inv_dir, tmin, tmax ) != miss )
+    stack[top++] = 0;
+
+  uint32_t count = 0;
+  while( top > 0 ) {
+    const Node& node = m_nodes[stack[--top]];
+    if( node.count > 0 ) {
+      // particle_intersect() of geometry.cu
+      for( uint32_t i = node.offset; i < node.offset + node.count; ++i ) {
+        const float3 center = make_float3( m_spheres[i] );
+        const float  t      = length( center - origin );
+        if( !( t > tmin && t < tmax ) || !( length( center - ( origin + direction * t ) ) < m_spheres[i].w ) )
+          continue;
+        if( count == capacity ) {
+          overflow = true;
+          return count;
+        }
+        hits[count].t     = t;
+        hits[count].index = m_indices[i];
+        ++count;
+      }
+      continue;
+    }
+
+    // Push the farther child first so the nearer one is visited next
+    const float t_left  = intersectBox( m_nodes[node.offset],     org, inv_dir, tmin, tmax );
+    const float t_right = intersectBox( m_nodes[node.offset + 1], org, inv_dir, tmin, tmax );
+    const uint32_t near_child = t_left <= t_right ? node.offset : node.offset + 1;
+    const uint32_t far_child  = t_left <= t_right ? node.offset + 1 : node.offset;
+    if( std::max( t_left, t_right ) != miss )
+      stack[top++] = far_child;
+    if( std::min( t_left, t_right ) != miss )
+      stack[top++] = near_child;
+  }
+  return count;
+}
+
+
+//------------------------------------------------------------------------------
+//
+// Rendering
+//
+//------------------------------------------------------------------------------
+
+void renderParticleVolume( const ParticleBvh& bvh, const float4* positions, const float* radius_scales,
+                           const ParticleRenderSettings& settings, std::vector<float4>& image,
+                           ParticleRenderStats& stats )
+{
+  const Clock::time_point start = Clock::now();
+  const unsigned int width  = settings.width;
+  const unsigned int height = settings.height;
+  image.resize( size_t( width ) * height );
+
+  const float3 bbox_min = settings.bbox_min;
+  const float3 bbox_max = settings.bbox_max;
+  const float redshiftScale = settings.redshift / length( bbox_max - bbox_min );
+  const float slab_spacing = PARTICLE_BUFFER_SIZE * settings.particles_per_slab * settings.fixed_radius *
+                             settings.lod_radius_scale;
+  const float inv_fixed_radius_scale = 2.f / settings.fixed_radius;
+
+  std::vector<RowStats> rows( height );
+  sutil::parallelFor( height, [&]( size_t y )
+  {
+    RowStats row = RowStats();
+    for( unsigned int x = 0; x < width; ++x ) {
+      // raygen_program() of raygen.cu
+      const float2 d = make_float2( float( x ), float( y ) ) / make_float2( float( width ), float( height ) ) * 2.f - 1.f;
+      const float3 ray_origin    = settings.eye;
+      const float3 ray_direction = normalize( d.x * settings.U + d.y * settings.V + settings.W );
+
+      const float3 t0 = ( bbox_max - ray_origin ) / ray_direction;
+      const float3 t1 = ( bbox_min - ray_origin ) / ray_direction;
+      const float3 tmax = fmaxf( t0, t1 );
+      const float3 tmin = fminf( t0, t1 );
+      const float tenter = fmaxf( 0.f, fmaxf( tmin.x, fmaxf( tmin.y, tmin.z ) ) );
+      const float texit  = fminf( tmax.x, fminf( tmax.y, tmax.z ) );
+
+      float3 result = make_float3( 0 );
+      float result_alpha = 0.f;
+
+      if( tenter < texit ) {
+        float tbuffer = 0.f;
+        while( tbuffer < texit && result_alpha < MAX_ALPHA ) {
+          const float slab_min = fmaxf( tenter, tbuffer );
+          const float slab_max = fminf( texit, tbuffer + slab_spacing );
+
+          if( slab_max > tenter ) {
+            const Clock::time_point c0 = Clock::now();
+            ParticleHit particles[PARTICLE_BUFFER_SIZE];
+            bool overflow;
+            const int N = static_cast<int>(
+                bvh.collect( ray_origin, ray_direction, slab_min, slab_max, particles, PARTICLE_BUFFER_SIZE, overflow ) );
+
+            const Clock::time_point c1 = Clock::now();
+            if( settings.exact_sort )
+              std::sort( particles, particles + N,
+                         []( const ParticleHit& a, const ParticleHit& b ) { return a.t < b.t; } );
+            else
+              deviceSort( particles, N );
+
+            const Clock::time_point c2 = Clock::now();
+            for( int i = 0; i < N; i++ ) {
+              const float trbf = particles[i].t;
+              const int   idx  = particles[i].index;
+              const float3 hit_sample = ray_origin + ray_direction * trbf;
+
+              const float4 pos = positions[idx];
+              const float3 hit_normal = make_float3( pos.x, pos.y, pos.z ) - hit_sample;
+              float drbf = length( hit_normal ) * inv_fixed_radius_scale;
+              if( radius_scales )
+                drbf /= radius_scales[idx];
+              drbf = fmaxf( 0.f, fminf( 1.f, settings.w_scale * pos.w * expf( -drbf * drbf ) ) );
+              const float4 color_sample = tf_redshift(
+                  sampleTransferFunctionTable( settings.tf_table, TF_TABLE_SIZE, drbf ), trbf * redshiftScale );
+
+              const float alpha = color_sample.w * settings.opacity;
+              const float alpha_1msa = alpha * ( 1.0 - result_alpha );
+              result += make_float3( color_sample.x, color_sample.y, color_sample.z ) * alpha_1msa;
+              result_alpha += alpha_1msa;
+            }
+            const Clock::time_point c3 = Clock::now();
+
+            for( int i = 1; i < N; ++i )
+              if( particles[i].t < particles[i - 1].t ) {
+                ++row.unsorted;
+                break;
+              }
+            ++row.slabs;
+            row.samples   += N;
+            row.overflows += overflow;
+            row.traversal_time += seconds( c0, c1 );
+            row.sort_time      += seconds( c1, c2 );
+            row.integrate_time += seconds( c2, c3 );
+          }
+
+          tbuffer += slab_spacing;
+        }
+      }
+
+      image[y * width + x] = make_float4( result, result_alpha );
+    }
+    rows[y] = row;
+  } );
+
+  stats = ParticleRenderStats();
+  stats.rays = uint64_t( width ) * height;
+  for( unsigned int y = 0; y < height; ++y ) {
+    stats.slabs          += rows[y].slabs;
+    stats.samples        += rows[y].samples;
+    stats.overflows      += rows[y].overflows;
+    stats.unsorted       += rows[y].unsorted;
+    stats.traversal_time += rows[y].traversal_time;
+    stats.sort_time      += rows[y].sort_time;
+    stats.integrate_time += rows[y].integrate_time;
+  }
+  stats.render_time = seconds( start, Clock::now() );
+}
@@ -0,0 +1,148 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <optixu/optixu_math_namespace.h>
+
+#include <stdint.h>
+#include <vector>
+
+
+//-----------------------------------------------------------------------------
+//
+// CPU reference of the slab integrator of raygen.cu, for checking and
+// profiling it without a GPU.  Each ray is cut into slabs of
+// PARTICLE_BUFFER_SIZE * particles_per_slab radii.  For each slab the
+// particles whose RBF sample point (see geometry.cu) lies in it are collected
+// into a buffer of PARTICLE_BUFFER_SIZE, sorted by depth with the sort of
+// raygen.cu, and composited front to back through the transfer function until
+// the alpha reaches 0.97.
+//
+// The particles are held in a host BVH, a binary tree over their Morton order
+// (see ParticleSort.h).  Like the any-hit program of material.cu, traversal
+// stops collecting once the buffer is full.  Which particles make it into a
+// full buffer depends on the traversal order, which is nearest child first
+// here and unspecified on the device, so only slabs that overflow may differ.
+//
+// The sort of raygen.cu is its exchange sort: PARTICLE_BUFFER_SIZE is a
+// constant rather than a macro, so the #if never selects the bitonic sort.
+// It does not fully order the buffer, which renderParticleVolume() reproduces
+// and counts in ParticleRenderStats::unsorted.
+//
+//-----------------------------------------------------------------------------
+
+struct ParticleHit
+{
+  float     t;
+  uint32_t  index;
+};
+
+
+class ParticleBvh
+{
+public:
+  // 32 byte node as in sutil's MeshBVH.  Inner nodes have count 0 and their
+  // children at offset and offset+1; leaves hold count particles starting at
+  // offset of the leaf order.
+  struct Node
+  {
+    float             bbox_min[3];
+    uint32_t          offset;
+    float             bbox_max[3];
+    uint32_t          count;
+  };
+
+  // BVH over count particles of the given radius, scaled per particle by
+  // radius_scales unless that is null
+  ParticleBvh( const optix::float4* positions, const float* radius_scales, size_t count, float radius );
+
+  // Collects the particles whose sample point at t, the distance of their
+  // center from origin, is within their radius and t in (tmin, tmax), in
+  // traversal order and at most capacity of them.  Returns their number and
+  // sets overflow if more were hit.
+  uint32_t collect( const optix::float3& origin, const optix::float3& direction, float tmin, float tmax,
+                    ParticleHit* hits, uint32_t capacity, bool& overflow )const;
+
+  const std::vector<Node>& nodes()const     { return m_nodes; }
+  double                   buildTime()const { return m_build_time; }
+
+private:
+  ParticleBvh( const ParticleBvh& );
+  ParticleBvh& operator=( const ParticleBvh& );
+
+  std::vector<Node>           m_nodes;
+  std::vector<optix::float4>  m_spheres;    // Center and radius in leaf order
+  std::vector<uint32_t>       m_indices;    // Particle index in leaf order
+  double                      m_build_time; // Seconds
+};
+
+
+struct ParticleRenderSettings
+{
+  unsigned int          width;
+  unsigned int          height;
+  optix::float3         eye;                 // Camera as set by sutil::calculateCameraVariables
+  optix::float3         U;
+  optix::float3         V;
+  optix::float3         W;
+  optix::float3         bbox_min;            // Particle bounds grown by the radius
+  optix::float3         bbox_max;
+  float                 fixed_radius;
+  float                 lod_radius_scale;    // Mean radius scale, 1 at full detail
+  float                 particles_per_slab;
+  float                 w_scale;
+  float                 opacity;
+  float                 redshift;
+  const optix::float4*  tf_table;            // Row tf_type of the TF_TABLE_SIZE transfer function tables
+  bool                  exact_sort;          // Sort each slab exactly instead of with the sort of raygen.cu
+};
+
+
+struct ParticleRenderStats
+{
+  uint64_t  rays;
+  uint64_t  slabs;              // Slabs traced
+  uint64_t  samples;            // Particles composited
+  uint64_t  overflows;          // Slabs with more particles than PARTICLE_BUFFER_SIZE
+  uint64_t  unsorted;           // Slabs the sort left out of depth order
+  double    render_time;        // Seconds
+  double    traversal_time;     // Seconds summed over threads
+  double    sort_time;
+  double    integrate_time;
+};
+
+
+// Renders the particles of bvh into image, width * height colors and alphas
+// with row 0 at the bottom like the output buffer of the sample.  positions
+// and radius_scales must be the arrays bvh was built from.  Runs on worker
+// threads.
+void renderParticleVolume( const ParticleBvh& bvh, const optix::float4* positions, const float* radius_scales,
+                           const ParticleRenderSettings& settings, std::vector<optix::float4>& image,
+                           ParticleRenderStats& stats );
+
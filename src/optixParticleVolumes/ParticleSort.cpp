@@ -0,0 +1,219 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "ParticleSort.h"
+
+#include <Parallel.h>
+
+#include <algorithm>
+#include <cstring>
+
+using namespace optix;
+
+
+//------------------------------------------------------------------------------
+//
+// Helpers
+//
+//------------------------------------------------------------------------------
+
+namespace
+{
+
+// Particles per work item of the parallel passes
+const size_t SORT_BLOCK_SIZE = 1u << 16;
+
+// Bits of the key sorted per radix pass
+const int    RADIX_BITS    = 8;
+const size_t RADIX_BUCKETS = 1u << RADIX_BITS;
+
+
+// Spreads the lower 21 bits of v to every third bit
+inline uint64_t expandBits( uint64_t v )
+{
+  v &= 0x1fffffull;
+  v = ( v | v << 32 ) & 0x001f00000000ffffull;
+  v = ( v | v << 16 ) & 0x001f0000ff0000ffull;
+  v = ( v | v <<  8 ) & 0x100f00f00f00f00full;
+  v = ( v | v <<  4 ) & 0x10c30c30c30c30c3ull;
+  v = ( v | v <<  2 ) & 0x1249249249249249ull;
+  return v;
+}
+
+
+inline uint64_t quantize21( float x )
+{
+  return static_cast<uint64_t>( std::min( std::max( x * 2097152.0f, 0.0f ), 2097151.0f ) );
+}
+
+
+// dst[i] = src[order[i]], on worker threads
+template<typename T>
+void gather( const T* src, const std::vector<uint32_t>& order, std::vector<T>& dst )
+{
+  const size_t count = order.size();
+  dst.resize( count );
+  T* out = dst.data();
+  sutil::parallelFor( ( count + SORT_BLOCK_SIZE - 1 ) / SORT_BLOCK_SIZE, [&]( size_t block )
+  {
+    const size_t end = std::min( count, ( block + 1 ) * SORT_BLOCK_SIZE );
+    for( size_t i = block * SORT_BLOCK_SIZE; i < end; ++i )
+      out[i] = src[ order[i] ];
+  } );
+}
+
+
+// Replaces storage with the permuted array and returns its data, or null if
+// the channel is absent
+template<typename T>
+const T* permuteChannel( const T* array, const std::vector<uint32_t>& order, std::vector<T>& storage )
+{
+  if( !array )
+    return 0;
+  std::vector<T> sorted;
+  gather( array, order, sorted );
+  storage.swap( sorted );
+  return storage.data();
+}
+
+} // namespace
+
+
+//------------------------------------------------------------------------------
+//
+// Sorting
+//
+//------------------------------------------------------------------------------
+
+uint64_t mortonCode63( float x, float y, float z )
+{
+  return ( expandBits( quantize21( x ) ) << 2 ) | ( expandBits( quantize21( y ) ) << 1 ) |
+           expandBits( quantize21( z ) );
+}
+
+
+void radixSortPairs( std::vector<uint64_t>& keys, std::vector<uint32_t>& values, int key_bits )
+{
+  const size_t count = keys.size();
+  if( count < 2 )
+    return;
+
+  // Each block counts its digits, then scatters them after the same digits of
+  // the blocks before it, which keeps every pass stable
+  const size_t num_blocks = ( count + SORT_BLOCK_SIZE - 1 ) / SORT_BLOCK_SIZE;
+  std::vector<size_t>   offsets( num_blocks * RADIX_BUCKETS );
+  std::vector<uint64_t> key_temp( count );
+  std::vector<uint32_t> value_temp( count );
+
+  for( int shift = 0; shift < key_bits; shift += RADIX_BITS ) {
+    const uint64_t* src_keys   = keys.data();
+    const uint32_t* src_values = values.data();
+
+    sutil::parallelFor( num_blocks, [&]( size_t block )
+    {
+      size_t* histogram = &offsets[block * RADIX_BUCKETS];
+      std::fill( histogram, histogram + RADIX_BUCKETS, size_t( 0 ) );
+      const size_t end = std::min( count, ( block + 1 ) * SORT_BLOCK_SIZE );
+      for( size_t i = block * SORT_BLOCK_SIZE; i < end; ++i )
+        ++histogram[ ( src_keys[i] >> shift ) & ( RADIX_BUCKETS - 1 ) ];
+    } );
+
+    // Nothing to do if every key has the same digit
+    bool uniform = false;
+    for( size_t digit = 0; digit < RADIX_BUCKETS && !uniform; ++digit ) {
+      size_t total = 0;
+      for( size_t block = 0; block < num_blocks; ++block )
+        total += offsets[block * RADIX_BUCKETS + digit];
+      uniform = total == count;
+    }
+    if( uniform )
+      continue;
+
+    size_t sum = 0;
+    for( size_t digit = 0; digit < RADIX_BUCKETS; ++digit )
+      for( size_t block = 0; block < num_blocks; ++block ) {
+        const size_t n = offsets[block * RADIX_BUCKETS + digit];
+        offsets[block * RADIX_BUCKETS + digit] = sum;
+        sum += n;
+      }
+
+    uint64_t* dst_keys   = key_temp.data();
+    uint32_t* dst_values = value_temp.data();
+    sutil::parallelFor( num_blocks, [&]( size_t block )
+    {
+      size_t* offset = &offsets[block * RADIX_BUCKETS];
+      const size_t end = std::min( count, ( block + 1 ) * SORT_BLOCK_SIZE );
+      for( size_t i = block * SORT_BLOCK_SIZE; i < end; ++i ) {
+        const size_t o = offset[ ( src_keys[i] >> shift ) & ( RADIX_BUCKETS - 1 ) ]++;
+        dst_keys[o]   = src_keys[i];
+        dst_values[o] = src_values[i];
+      }
+    } );
+    keys.swap( key_temp );
+    values.swap( value_temp );
+  }
+}
+
+
+void mortonOrder( const ParticleFrameData& frame, std::vector<uint32_t>& order, std::vector<uint64_t>* sorted_keys )
+{
+  const size_t count = frame.num_particles;
+  const float3 pmin = make_float3( frame.stats.pmin );
+  const float3 extent = make_float3( frame.stats.pmax ) - pmin;
+  const float3 scale = make_float3( extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+                                    extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+                                    extent.z > 0.0f ? 1.0f / extent.z : 0.0f );
+
+  std::vector<uint64_t> keys( count );
+  order.resize( count );
+  sutil::parallelFor( ( count + SORT_BLOCK_SIZE - 1 ) / SORT_BLOCK_SIZE, [&]( size_t block )
+  {
+    const size_t end = std::min( count, ( block + 1 ) * SORT_BLOCK_SIZE );
+    for( size_t i = block * SORT_BLOCK_SIZE; i < end; ++i ) {
+      const float3 p = ( make_float3( frame.positions[i] ) - pmin ) * scale;
+      keys[i]  = mortonCode63( p.x, p.y, p.z );
+      order[i] = static_cast<uint32_t>( i );
+    }
+  } );
+  radixSortPairs( keys, order, 63 );
+  if( sorted_keys )
+    sorted_keys->swap( keys );
+}
+
+
+void sortParticles( ParticleFrameData& frame )
+{
+  std::vector<uint32_t> order;
+  mortonOrder( frame, order );
+
+  frame.positions  = permuteChannel( frame.positions,  order, frame.position_storage );
+  frame.velocities = permuteChannel( frame.velocities, order, frame.velocity_storage );
+  frame.colors     = permuteChannel( frame.colors,     order, frame.color_storage );
+  frame.radii      = permuteChannel( frame.radii,      order, frame.radius_storage );
+  frame.file.reset();
+  frame.morton_order = true;
+}
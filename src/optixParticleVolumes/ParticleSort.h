@@ -0,0 +1,66 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include "ParticleData.h"
+
+#include <stdint.h>
+#include <vector>
+
+
+//-----------------------------------------------------------------------------
+//
+// Spatial sorting of particle frames.  Particles are reordered along a 63 bit
+// Morton curve over the bounds of their positions, so particles that are
+// close in space are close in the buffers.  This gives the BVH builder and
+// the any-hit traversal of the sample much better locality than the order of
+// the simulation output.
+//
+// The keys are sorted with a parallel LSD radix sort, and all channels of the
+// frame are permuted the same way.
+//
+//-----------------------------------------------------------------------------
+
+// Morton code of a point given in [0,1]^3, 21 bits per axis with x in the
+// highest bit
+uint64_t mortonCode63( float x, float y, float z );
+
+// Sorts keys ascending and applies the same permutation to values.  Stable,
+// so equal keys keep their order.  Only the low key_bits of the keys are
+// compared.
+void radixSortPairs( std::vector<uint64_t>& keys, std::vector<uint32_t>& values, int key_bits = 64 );
+
+// Computes the order of the particles of frame along the Morton curve over
+// the xyz range in frame.stats: order[i] is the index of the particle that
+// goes to position i.  If keys is given it receives the sorted Morton codes.
+void mortonOrder( const ParticleFrameData& frame, std::vector<uint32_t>& order, std::vector<uint64_t>* keys = 0 );
+
+// Reorders all channels of frame along the Morton curve and sets
+// morton_order.  Frames that point into a file mapping get owned copies of
+// their arrays, and the mapping is released.
+void sortParticles( ParticleFrameData& frame );
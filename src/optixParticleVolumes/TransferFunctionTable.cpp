@@ -0,0 +1,139 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "TransferFunctionTable.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+using namespace optix;
+
+// tf_preset() of the device, which expects the optix vector math in scope
+#include "transferFunction.h"
+
+
+//------------------------------------------------------------------------------
+//
+// Tables
+//
+//------------------------------------------------------------------------------
+
+// Value sampled by entry i of a table, a table of one entry holds v = 0
+static float tableValue( int i, int size )
+{
+  return size > 1 ? float( i ) / float( size - 1 ) : 0.0f;
+}
+
+
+void buildTransferFunctionTable( int tf_type, int size, float4* table )
+{
+  for( int i = 0; i < size; ++i )
+    table[i] = tf_preset( tableValue( i, size ), tf_type );
+}
+
+
+void buildTransferFunctionTable( const std::vector<TransferFunctionPoint>& points, int size, float4* table )
+{
+  for( int i = 0; i < size; ++i )
+    table[i] = evaluateTransferFunction( points, tableValue( i, size ) );
+}
+
+
+float4 sampleTransferFunctionTable( const float4* table, int size, float v )
+{
+  if( size < 2 )
+    return table[0];
+
+  const float x = fminf( fmaxf( v, 0.0f ), 1.0f ) * float( size - 1 );
+  const int   i = std::min( int( x ), size - 2 );
+  return lerp4f( table[i], table[i + 1], x - float( i ) );
+}
+
+
+//------------------------------------------------------------------------------
+//
+// Control points
+//
+//------------------------------------------------------------------------------
+
+bool readTransferFunctionFile( const std::string& filename, std::vector<TransferFunctionPoint>& points,
+                               std::string& error )
+{
+  std::ifstream in( filename.c_str() );
+  if( !in ) {
+    error = "can't open '" + filename + "'";
+    return false;
+  }
+
+  points.clear();
+  std::string line;
+  for( int line_number = 1; std::getline( in, line ); ++line_number ) {
+    const size_t first = line.find_first_not_of( " \t\r" );
+    if( first == std::string::npos || line[first] == '#' )
+      continue;
+
+    std::istringstream fields( line );
+    TransferFunctionPoint point;
+    if( !( fields >> point.value >> point.color.x >> point.color.y >> point.color.z >> point.color.w ) ) {
+      std::ostringstream message;
+      message << "'" << filename << "' line " << line_number << ": expected \"value r g b a\"";
+      error = message.str();
+      return false;
+    }
+    if( !( point.value >= 0.0f && point.value <= 1.0f ) || ( !points.empty() && point.value < points.back().value ) ) {
+      std::ostringstream message;
+      message << "'" << filename << "' line " << line_number << ": values must ascend in [0, 1]";
+      error = message.str();
+      return false;
+    }
+    points.push_back( point );
+  }
+
+  if( points.empty() ) {
+    error = "'" + filename + "' has no control points";
+    return false;
+  }
+  return true;
+}
+
+
+float4 evaluateTransferFunction( const std::vector<TransferFunctionPoint>& points, float v )
+{
+  // First point beyond v; a step takes the color after it
+  const std::vector<TransferFunctionPoint>::const_iterator next = std::upper_bound(
+      points.begin(), points.end(), v,
+      []( float value, const TransferFunctionPoint& point ) { return value < point.value; } );
+  if( next == points.begin() )
+    return points.front().color;
+  if( next == points.end() )
+    return points.back().color;
+
+  const TransferFunctionPoint& prev = *( next - 1 );
+  return lerp4f( prev.color, next->color, ( v - prev.value ) / ( next->value - prev.value ) );
+}
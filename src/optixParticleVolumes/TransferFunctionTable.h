@@ -0,0 +1,75 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <optixu/optixu_math_namespace.h>
+
+#include <string>
+#include <vector>
+
+
+//-----------------------------------------------------------------------------
+//
+// Transfer function tables for the device.  Each table maps the value of a
+// sample in [0, 1] to a color and opacity at size equidistant entries, the
+// first at 0 and the last at 1, and the device interpolates them linearly
+// with its texture units instead of evaluating tf_preset() of
+// transferFunction.h per sample.  The depth dependent redshift is still
+// applied analytically, see tf_redshift().
+//
+// Besides the presets, a table can be resampled from a text file with one
+// control point "value r g b a" per line, values ascending in [0, 1].  The
+// colors are interpolated linearly between the control points and held
+// beyond the first and last one.  Two points with the same value make a
+// step.  Empty lines and lines starting with '#' are skipped.
+//
+//-----------------------------------------------------------------------------
+
+struct TransferFunctionPoint
+{
+  float         value;
+  optix::float4 color;
+};
+
+// Samples preset tf_type into size entries of table
+void buildTransferFunctionTable( int tf_type, int size, optix::float4* table );
+
+// Samples the control points into size entries of table
+void buildTransferFunctionTable( const std::vector<TransferFunctionPoint>& points, int size, optix::float4* table );
+
+// Reads the control points of a transfer function file
+bool readTransferFunctionFile( const std::string& filename, std::vector<TransferFunctionPoint>& points,
+                               std::string& error );
+
+// Color of the control points at v
+optix::float4 evaluateTransferFunction( const std::vector<TransferFunctionPoint>& points, float v );
+
+// Color of a table at v, interpolated the way the device samples it.  A table
+// of size 1 is constant.
+optix::float4 sampleTransferFunctionTable( const optix::float4* table, int size, float v );
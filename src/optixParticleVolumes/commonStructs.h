@@ -32,6 +32,16 @@
 
 const int PARTICLE_BUFFER_SIZE = 32;
 
+// Particles per block of quantized positions, which share an origin and step
+const int QUANTIZED_BLOCK_SIZE = 256;
+
+// Entries per transfer function table, which sample v in [0, 1] at steps of
+// 1/1024 so that the knots of the presets at 0.5 fall on an entry
+const int TF_TABLE_SIZE = 1025;
+
+// Transfer function presets, tf_type 0 to TF_PRESET_COUNT-1 (see transferFunction.h)
+const int TF_PRESET_COUNT = 4;
+
 struct BasicLight
 {
   optix::float3 pos;
@@ -29,24 +29,31 @@
 #include <optix.h>
 #include <optixu/optixu_math_namespace.h>
 #include <optixu/optixu_aabb_namespace.h>
+#include "particlePosition.h"
 
 using namespace optix;
 
-rtBuffer<float4>    positions_buffer;
+rtBuffer<float>     radius_scales_buffer;    // Per primitive, empty unless a coarser level of detail is used
 
 rtDeclareVariable(float2,       particle_rbf,    attribute particle_rbf, );
 rtDeclareVariable(optix::Ray,   ray,                rtCurrentRay, );
 rtDeclareVariable(float,        fixed_radius, ,  );
 
 
+static __device__ __inline__ float particle_radius( int primIdx )
+{
+    return radius_scales_buffer.size() ? fixed_radius * radius_scales_buffer[primIdx] : fixed_radius;
+}
+
+
 RT_PROGRAM void particle_intersect( int primIdx )
 {
-    const float4 pos = positions_buffer[primIdx];
+    const float4 pos = particle_position(primIdx);
     const float3 pos3 = make_float3(pos.x, pos.y, pos.z);
     const float t = length(pos3 - ray.origin);
     const float3 samplePos = ray.origin + ray.direction * t;
 
-    if( (length(pos3 - samplePos) < fixed_radius) && rtPotentialIntersection(t) )
+    if( (length(pos3 - samplePos) < particle_radius(primIdx)) && rtPotentialIntersection(t) )
     {
       particle_rbf.x = t;
       particle_rbf.y = __int_as_float(primIdx);
@@ -57,8 +64,8 @@ RT_PROGRAM void particle_intersect( int primIdx )
 //for accel build
 RT_PROGRAM void particle_bounds( int primIdx, float result[6] )
 {
-    const float4 position = positions_buffer[ primIdx ];
-    const float radius = fixed_radius;
+    const float4 position = particle_position( primIdx );
+    const float radius = particle_radius( primIdx );
 
     optix::Aabb *aabb = (optix::Aabb *) result;
 
@@ -52,6 +52,16 @@
 #include <sutil.h>
 #include <Camera.h>
 #include "commonStructs.h"
+#include "ParticleAdvect.h"
+#include "ParticleBrickCache.h"
+#include "ParticleBricks.h"
+#include "ParticleData.h"
+#include "ParticleFile.h"
+#include "ParticleFrameCache.h"
+#include "ParticleLod.h"
+#include "ParticleQuantize.h"
+#include "ParticleSort.h"
+#include "TransferFunctionTable.h"
 #include <Arcball.h>
 
 #include <cstring>
@@ -61,20 +71,11 @@
 #include <sstream>
 #include <algorithm>
 #include <stdint.h>
-#include <map>
+#include <memory>
+#include <vector>
 
 using namespace optix;
 
-struct ParticleFrameData {
-  std::vector<float4> positions;
-  std::vector<float3> velocities;
-  std::vector<float3> colors;
-  std::vector<float>  radii;
-  float3 bbox_min, bbox_max;
-};
-
-std::map<int, ParticleFrameData> dataCache;
-
 const char* const SAMPLE_NAME = "optixParticleVolumes";
 const unsigned int WIDTH  = 1024u;
 const unsigned int HEIGHT = 768u;
@@ -85,6 +86,9 @@ struct ParticlesBuffer
     Buffer      velocities;
     Buffer      colors;
     Buffer      radii;
+    Buffer      radius_scales;  // Of the aggregates of a coarser level of detail
+    Buffer      quantized_positions;
+    Buffer      quantized_blocks;
 };
 
 //------------------------------------------------------------------------------
@@ -103,11 +107,21 @@ bool            particles_file_radius = false;
 bool            particles_file_velocities = false;
 bool            camera_slow_rotate = true;
 size_t          max_particles = 0;
+bool            sort_particles = false;
+bool            quantize_positions = false;
+int             lod_levels = 0;
+float           lod_pixels = 1.f;
+int             lod_level = 0;
+int             interpolation_steps = 0;
+float           frame_dt = 1.f;
+float           refit_threshold = .5f;
 float           fixed_radius = 100.f;
 float           particlesPerSlab = 16.f;
 float           wScale = 3.5f;
 float           opacity = .5f;
 int             tf_type = 2;
+int             tf_tables = TF_PRESET_COUNT;
+std::string     tf_file;
 bool            play = false;
 unsigned int    iterations_per_animation_frame = 1;
 optix::Aabb     aabb;
@@ -129,6 +143,35 @@ std::string     particles_file_extension;
 std::string     particles_file_base;
 int             current_particle_frame = 1;
 int             max_particle_frames = 25;
+size_t          cache_budget_mb = 4096;
+int             prefetch_frames = 2;
+
+// Frames of the sequence, and the one currently in the buffers
+std::unique_ptr<ParticleFrameCache>         frame_cache;
+std::shared_ptr<const ParticleFrameData>    frame_data;
+
+// Bricked datasets: the index, the cache streaming the bricks in view and the
+// bricks currently in the buffers
+std::vector<ParticleBrick>                  bricks;
+std::unique_ptr<ParticleBrickCache>         brick_cache;
+std::vector<int>                            buffer_bricks;
+size_t          buffer_brick_particles = 0;
+size_t          bricks_in_view = 0;
+size_t          brick_budget_mb = 1024;
+
+// Host time spent filling the particle buffers
+double          upload_time = 0.0;
+unsigned int    num_uploads = 0;
+
+// Interpolation between keyframes: the step since the keyframe, the largest
+// particle speed of the keyframe and the time since it at the last BVH build
+int             interpolation_step = 0;
+float           keyframe_speed = 0.f;
+float           build_dt = 0.f;
+double          advect_time = 0.0;
+std::vector<float4> advected_positions;     // Encoded from here when the positions are quantized
+unsigned int    num_refits = 0;
+unsigned int    num_rebuilds = 0;
 
 // Accumulation frame
 unsigned int    accumulation_frame = 0;
@@ -282,15 +325,6 @@ void createContext( int usage_report_level, UsageReportLogger* logger )
 }
 
 
-static inline float parseFloat( const char *&token )
-{
-  token += strspn( token, " \t" );
-  float f = (float) atof( token );
-  token += strcspn( token, " \t\r" );
-  return f;
-}
-
-
 static inline float3 get_min(
     const float3 &v1,
     const float3 &v2)
@@ -315,52 +349,44 @@ static inline float3 get_max(
 }
 
 
-static void fillBuffers(
-    const std::vector<float4> &positions,
-    const std::vector<float3> &velocities,
-    const std::vector<float3> &colors,
-    const std::vector<float>  &radii)
+// Copies count elements of one channel into its buffer.  The frame channels
+// have the layout of the buffer formats, so this is a single memcpy.
+static void fillBuffer( Buffer buffer, const void* data, size_t count, size_t element_size )
 {
-    buffers.positions->setSize( positions.size() );
-    float *pos = reinterpret_cast<float*> ( buffers.positions->map() );
-    for ( int i=0, index = 0; i<static_cast<int>(positions.size()); ++i ) {
-        float4 p = positions[i];
-
-        pos[index++] = p.x;
-        pos[index++] = p.y;
-        pos[index++] = p.z;
-        pos[index++] = p.w;
-    }
-    buffers.positions->unmap();
+    buffer->setSize( count );
+    void* dst = buffer->map( 0, RT_BUFFER_MAP_WRITE_DISCARD );
+    if ( count )
+        memcpy( dst, data, count * element_size );
+    buffer->unmap();
+}
 
-    buffers.velocities->setSize( velocities.size() );
-    float *vel = reinterpret_cast<float*> ( buffers.velocities->map() );
-    for ( int i=0, index = 0; i<static_cast<int>(velocities.size()); ++i ) {
-        float3 v = velocities[i];
 
-        vel[index++] = v.x;
-        vel[index++] = v.y;
-        vel[index++] = v.z;
+// Fills the positions buffer, or with quantize_positions the quantized
+// positions and their blocks.  The other one stays empty.
+static void fillPositions( const float4* positions, size_t count )
+{
+    if ( !quantize_positions ) {
+        fillBuffer( buffers.positions, positions, count, sizeof( float4 ) );
+        return;
     }
-    buffers.velocities->unmap();
 
-    buffers.colors->setSize( colors.size() );
-    float *col = reinterpret_cast<float*> ( buffers.colors->map() );
-    for ( int i=0, index = 0; i<static_cast<int>(colors.size()); ++i ) {
-        float3 c = colors[i];
+    buffers.quantized_positions->setSize( count );
+    buffers.quantized_blocks->setSize( 2 * quantizedBlockCount( count ) );
+    ushort4* quantized = static_cast<ushort4*>( buffers.quantized_positions->map( 0, RT_BUFFER_MAP_WRITE_DISCARD ) );
+    float4*  blocks    = static_cast<float4*>( buffers.quantized_blocks->map( 0, RT_BUFFER_MAP_WRITE_DISCARD ) );
+    if ( count )
+        quantizeParticles( positions, count, quantized, blocks );
+    buffers.quantized_blocks->unmap();
+    buffers.quantized_positions->unmap();
+}
 
-        col[index++] = c.x;
-        col[index++] = c.y;
-        col[index++] = c.z;
-    }
-    buffers.colors->unmap();
 
-    buffers.radii->setSize( radii.size() );
-    float *rad = reinterpret_cast<float*> ( buffers.radii->map() );
-    for ( int i=0; i<static_cast<int>(radii.size()); ++i ) {
-        rad[i] = radii[i];
-    }
-    buffers.radii->unmap();
+// Only the positions are read on the device.  The velocities, colors and radii
+// stay on the host (advection uses them there) and their buffers stay empty,
+// so a frame costs 16 bytes per particle, or about 8 with quantize_positions.
+static void fillBuffers( const ParticleFrameData& frame )
+{
+    fillPositions( frame.positions, frame.num_particles );
 }
 
 
@@ -397,315 +423,443 @@ Program createIntersectionProgram( Context context )
   return context->createProgramFromPTXFile( ptxPath("geometry.cu"), "particle_intersect" );
 }
 
-void readFile( std::vector<float4>& positions, 
-               std::vector<float3>& velocities, 
-               std::vector<float3>& colors, 
-               std::vector<float>& radii, 
-               float3& bbox_min, 
-               float3& bbox_max )
+// Name of the particles file of a frame of a sequence
+std::string particlesFrameFilename( int frame )
 {
-	//read raw data file.
-    if (particles_file_extension == "raw")
-    {
-        std::cout << "Reading raw file" << particles_file << std::endl;
-
-        FILE* fp = fopen(particles_file.c_str(), "r");
-        fseek(fp, 0L, SEEK_END);
-        size_t sz = ftell(fp);
-        rewind(fp);
-
-        size_t numParticles = sz / 16;
-        std::cout << "# particles = " << numParticles << std::endl;
-
-        if (max_particles > 0 && numParticles > max_particles)
-        {
-          std::cout << "only reading " << max_particles << " particles." << std::endl;
-          numParticles = max_particles;
-        }
-
-        positions.resize(numParticles);
-        size_t b = fread(&positions[0], sizeof(float), numParticles, fp);
-        fclose(fp);
-
-        float4 pmin, pmax;
-
-        pmin.x = pmin.y = pmin.z = pmin.w = 1e16f;
-        pmax.x = pmax.y = pmax.z = pmax.w = -1e16f;
-
-        const float rd = fixed_radius;
-
-        #pragma omp parallel for
-        for(size_t i=0; i<numParticles; i++)
-        {
-            const float4& p = positions[i];
+    if ( frame <= 0 )
+        return particles_file_base;
 
-            pmin.x = fminf(pmin.x, p.x);
-            pmin.y = fminf(pmin.y, p.y);
-            pmin.z = fminf(pmin.z, p.z);
-            pmin.w = fminf(pmin.w, p.w);
+    std::ostringstream s;
+    s << frame;
 
-            pmax.x = fmaxf(pmax.x, p.x);
-            pmax.y = fmaxf(pmax.y, p.y);
-            pmax.z = fmaxf(pmax.z, p.z);
-            pmax.w = fmaxf(pmax.w, p.w);
-        }
-
-        std::cout << "Particle pmin = " << pmin << std::endl;
-        std::cout << "Particle pmax = " << pmax << std::endl;
-
-        bbox_min = make_float3(pmin.x - rd, pmin.y - rd, pmin.z - rd);
-        bbox_max = make_float3(pmax.x + rd, pmax.y + rd, pmax.z + rd);
+    if ( frame < 10 )
+        return particles_file_base + ".000" + s.str() + "." + particles_file_extension;
+    else
+        return particles_file_base + ".00" + s.str() + "." + particles_file_extension;
+}
 
-        if (fixed_radius == 0.f)
-          fixed_radius = length(bbox_max - bbox_min) / powf(float(numParticles), 0.33333f);  
 
-        std::cout << "Particle fixed_radius = " << fixed_radius << std::endl;
+// The frame shown i frames after the given one, wrapping at the end of the sequence
+int nextParticleFrame( int frame, int i )
+{
+    return ( frame - 1 + i ) % max_particle_frames + 1;
+}
 
-        float wRange, wOff;
-        if (pmin.w < 0.f)
-        {
-          if (-pmin.w > pmax.w)
-            wRange = float(0.5f / -pmin.w);
-          else
-            wRange = float(0.5f / pmax.w);
 
-          tf_type = 3;
-          wOff = .5f;
-        }
-        else
-        {
-          wRange = float( 1.0 / double(pmax.w - pmin.w) );
-          wOff = 0.f;
-        }
+// Clamps max_particle_frames to the files of the sequence that exist, counted
+// from the first one, so that playing does not wrap to a missing file.  A
+// sequence with gaps still fails to read, which stops playback.
+void countParticleFrames()
+{
+    if ( current_particle_frame <= 0 || particles_file_extension == "raw" )
+        return;
 
-        std::cout << "Transfer function tf_type = " << tf_type << std::endl;
+    int count = 0;
+    while ( count < max_particle_frames && std::ifstream( particlesFrameFilename( count + 1 ).c_str() ).good() )
+        ++count;
 
-        #pragma omp parallel for
-        for(size_t i=0; i<numParticles; i++)
-            positions[i].w = positions[i].w * wRange + wOff;
+    if ( count < max_particle_frames )
+        std::cout << "Found " << count << " of " << max_particle_frames << " particle frames" << std::endl;
+    max_particle_frames = std::max( count, current_particle_frame );
+}
 
-        float wmin = 1e16f;
-        float wmax = -1e16f;
-        for(size_t i=0; i<numParticles; i++){
-            wmin = fminf(wmin, positions[i].w);
-            wmax = fmaxf(wmax, positions[i].w);
-        }
-        std::cout << "Attribute range wmin = " << wmin << ", wmax = " << wmax << std::endl;
-    }
-     
-    //read txt data file
-    else
-    {
-        std::cout << "Reading txt file" << particles_file << std::endl;
 
-        std::string filename = particles_file_base;
+// Radius used when none is given, about the mean particle spacing
+float defaultParticleRadius( const ParticleFrameData& frame )
+{
+    const float3 extent = make_float3( frame.stats.pmax - frame.stats.pmin );
+    return length(extent) / powf(float(frame.num_particles), 0.333333f);
+}
 
-        if ( current_particle_frame > 0 ) {
-            std::ostringstream s;
-            s << current_particle_frame;
 
-            if ( current_particle_frame < 10 )
-                filename += ".000" + s.str() + ".txt";
-            else
-                filename += ".00" + s.str() + ".txt";
-        }
-        else
-            filename = particles_file_base;
+// Reads a frame for the frame cache, on its worker thread when prefetching
+void readFrame( int frame, const ParticleReadOptions& options, ParticleFrameData& data )
+{
+    // Raw files are read as a single frame
+    const std::string filename = particles_file_extension == "raw" ? particles_file : particlesFrameFilename( frame );
 
+    std::string error;
+    if ( !readParticles( filename, options, data, error ) )
+        throw Exception( "Failed to read particles: " + error );
 
-        std::ifstream ifs( filename.c_str() );
+    // sorted once here, the cache then keeps the sorted frame
+    if ( sort_particles && !data.morton_order )
+        sortParticles( data );
 
-        bbox_min.x = bbox_min.y = bbox_min.z = 1e16f;
-        bbox_max.x = bbox_max.y = bbox_max.z = -1e16f;
+    if ( lod_levels > 0 )
+        buildParticleLod( data, options.fixed_radius > 0.f ? options.fixed_radius : defaultParticleRadius( data ),
+                          lod_levels );
+}
 
-        int maxchars = 8192;
-        std::vector<char> buf(static_cast<size_t>(maxchars)); // Alloc enough size
 
-        float wmin = 1e16f;
-        float wmax = -1e16f;
+// Prints the stats of the first frame and derives the defaults from them
+void setupFirstFrame( const ParticleFrameData& frame, double read_time )
+{
+    const size_t numParticles = frame.num_particles;
+    std::cout << "# particles = " << numParticles << ", read in " << read_time << " s"
+              << ( frame.morton_order ? ", Morton order" : "" ) << std::endl;
 
-        while ( ifs.peek() != -1 ) {
-            ifs.getline( &buf[0], maxchars );
+    const float4 pmin = frame.stats.pmin;
+    const float4 pmax = frame.stats.pmax;
+    std::cout << "Particle pmin = " << pmin << std::endl;
+    std::cout << "Particle pmax = " << pmax << std::endl;
 
-            std::string linebuf(&buf[0]);
+    if (fixed_radius == 0.f)
+      fixed_radius = defaultParticleRadius(frame);
 
-            // Trim newline '\r\n' or '\n'
-            if ( linebuf.size() > 0 ) {
-                if ( linebuf[linebuf.size() - 1] == '\n' )
-                    linebuf.erase(linebuf.size() - 1);
-            }
+    std::cout << "Using fixed_radius = " << fixed_radius << std::endl;
 
-            if ( linebuf.size() > 0 ) {
-                if ( linebuf[linebuf.size() - 1] == '\r' )
-                    linebuf.erase( linebuf.size() - 1 );
-            }
+    if (frame.signed_attribute && tf_file.empty())
+    {
+      tf_type = 3;
+      std::cout << "Transfer function tf_type = " << tf_type << std::endl;
+    }
 
-            // Skip if empty line.
-            if ( linebuf.empty() ) {
-                continue;
-            }
+    const float wmin = pmin.w * frame.attribute_scale + frame.attribute_offset;
+    const float wmax = pmax.w * frame.attribute_scale + frame.attribute_offset;
+    std::cout << "Attribute range wmin = " << wmin << ", wmax = " << wmax << std::endl;
 
-            // Skip leading space.
-            const char *token = linebuf.c_str();
-            token += strspn( token, " \t" );
+    for ( size_t i = 0; i < frame.lod_levels.size(); ++i )
+        std::cout << "LOD level " << i+1 << ": " << frame.lod_levels[i].positions.size()
+                  << " primitives, cell size " << frame.lod_levels[i].cell_size << std::endl;
 
-            assert( token );
-            if ( token[0] == '\0' )
-                continue; // empty line
+    context[ "fixed_radius"     ]->setFloat(fixed_radius);
+    context[ "particlesPerSlab"     ]->setFloat(particlesPerSlab);
+    context[ "wScale" ] ->setFloat(wScale);
+    context[ "opacity" ] ->setFloat(opacity);
+    context[ "tf_type" ]->setInt(tf_type);
+}
 
-            if ( token[0] == '#' )
-                continue; // comment line
 
-            // meaningful line here. The expected format is: position, velocity, color and radius
+// Level of detail for the current camera: the coarsest level whose cells are
+// at most lod_pixels wide at the point of the bbox nearest to the eye
+int selectLodLevel( const ParticleFrameData& frame, unsigned int image_height )
+{
+    if ( frame.lod_levels.empty() )
+        return 0;
+
+    const float3 eye = context[ "eye" ]->getFloat3();
+    const float3 V   = context[ "V" ]->getFloat3();
+    const float3 W   = context[ "W" ]->getFloat3();
+    const float3 nearest = fmaxf( aabb.m_min, fminf( eye, aabb.m_max ) );
+    const float pixel_size = 2.f * length( V ) / ( length( W ) * float( image_height ) );
+    return selectParticleLod( frame, length( nearest - eye ), pixel_size, lod_pixels );
+}
 
-            // position
-            float x  = parseFloat( token );
-            float y  = parseFloat( token );
-            float z  = parseFloat( token );
 
-            // velocity
-            float vx = parseFloat( token );
-            float vy = parseFloat( token );
-            float vz = parseFloat( token );
+// Time since the keyframe of the current in-between frame
+float interpolationDt()
+{
+    return frame_dt * interpolation_step / ( interpolation_steps + 1 );
+}
 
-            float3 vel = make_float3(vx,vy,vz);
-            float vel_magnitude = length(vel);
 
-            wmin = fminf(wmin, vel_magnitude);
-            wmax = fmaxf(wmax, vel_magnitude);
+// Fills the positions buffer with the particles of the keyframe advected by dt
+void fillAdvectedPositions( const ParticleFrameData& frame, float dt )
+{
+    if ( quantize_positions ) {
+        advected_positions.resize( frame.num_particles );
+        advectParticles( frame.positions, frame.velocities, frame.num_particles, dt, advected_positions.data() );
+        fillPositions( advected_positions.data(), frame.num_particles );
+    } else {
+        buffers.positions->setSize( frame.num_particles );
+        float4* positions = static_cast<float4*>( buffers.positions->map( 0, RT_BUFFER_MAP_WRITE_DISCARD ) );
+        advectParticles( frame.positions, frame.velocities, frame.num_particles, dt, positions );
+        buffers.positions->unmap();
+    }
+}
 
-            float r,g,b;
-            r=g=b=.9f;
 
-            if (particles_file_colors)
-            {
-              // color
-              r  = parseFloat( token );
-              g  = parseFloat( token );
-              b  = parseFloat( token );
-            }
-            
-            float rd = fixed_radius;
-            if (particles_file_radius)
-            {
-              // radius
-              rd = parseFloat( token );
-            }
-
-            positions.push_back( make_float4( x, y, z, vel_magnitude ) );
-            velocities.push_back( make_float3( vx, vy, vz ) );
-            colors.push_back( make_float3( r, g, b ) );
-            radii.push_back( rd );
+// Fills the buffers with lod_level of the current frame and marks the BVH
+// for a rebuild.  Level 0 is advected to the current in-between frame, so
+// switching back to it from a coarser level does not jump to the keyframe.
+void updateParticleBuffers()
+{
+    const ParticleFrameData& frame = *frame_data;
+    lod_level = std::min( lod_level, (int) frame.lod_levels.size() );
+
+    const double t0 = sutil::currentTime();
+    size_t num_primitives = frame.num_particles;
+    float dt = 0.f;
+    if ( lod_level == 0 ) {
+        if ( interpolation_step > 0 && frame.velocities ) {
+            dt = interpolationDt();
+            fillAdvectedPositions( frame, dt );
+        } else {
+            fillBuffers( frame );
         }
+        fillBuffer( buffers.radius_scales, 0, 0, sizeof( float ) );
+        context[ "lod_radius_scale" ]->setFloat( 1.f );
+        if ( interpolation_steps > 0 && frame.velocities )
+            keyframe_speed = maxParticleSpeed( frame.velocities, frame.num_particles );
+    } else {
+        // only the positions and radii of the aggregates are used on the device
+        const ParticleLodLevel& level = frame.lod_levels[lod_level-1];
+        num_primitives = level.positions.size();
+        fillPositions( level.positions.data(), num_primitives );
+        fillBuffer( buffers.radius_scales, level.radius_scales.data(), num_primitives, sizeof( float ) );
+        context[ "lod_radius_scale" ]->setFloat( level.mean_radius_scale );
+    }
+    upload_time += sutil::currentTime() - t0;
+    ++num_uploads;
 
-        const size_t numParticles = positions.size();
-        std::cout << "# particles = " << numParticles << std::endl;
-
-        float4 pmin, pmax;
-        pmin.x = pmin.y = pmin.z = pmin.w = 1e16f;
-        pmax.x = pmax.y = pmax.z = pmax.w = -1e16f;
-
-        for(size_t i=0; i<numParticles; i++)
-        {
-            const float4& p = positions[i];
-
-            pmin.x = fminf(pmin.x, p.x);
-            pmin.y = fminf(pmin.y, p.y);
-            pmin.z = fminf(pmin.z, p.z);
-            pmin.w = fminf(pmin.w, p.w);
-
-            pmax.x = fmaxf(pmax.x, p.x);
-            pmax.y = fmaxf(pmax.y, p.y);
-            pmax.z = fmaxf(pmax.z, p.z);
-            pmax.w = fmaxf(pmax.w, p.w);
-        }
+    // all arrays have the same size
+    geometry->setPrimitiveCount( (int) num_primitives );
 
-        std::cout << "Particle pmin = " << pmin << std::endl;
-        std::cout << "Particle pmax = " << pmax << std::endl;
+    // builds the BVH (or re-builds it if already existing)
+    Acceleration accel = geometry_group->getAcceleration();
+    accel->setProperty( "refit", "0" );
+    accel->markDirty();
+    build_dt = dt;
+}
 
-        bbox_min = make_float3(pmin.x, pmin.y, pmin.z);
-        bbox_max = make_float3(pmax.x, pmax.y, pmax.z);
 
-        if (fixed_radius == 0.f)
-          fixed_radius = length(bbox_max - bbox_min) / powf(float(numParticles), 0.333333f);  
+// Moves the particles of the current keyframe along their velocities by dt.
+// The BVH is refit while no particle has moved more than refit_threshold
+// radii since the last build, and rebuilt otherwise.  Coarser levels of
+// detail have no velocities and keep showing the keyframe.
+void interpolateParticles( float dt )
+{
+    const ParticleFrameData& frame = *frame_data;
+    if ( !frame.velocities || lod_level != 0 )
+        return;
 
-        std::cout << "Using fixed_radius = " << fixed_radius << std::endl;
+    const double t0 = sutil::currentTime();
+    fillAdvectedPositions( frame, dt );
+    advect_time += sutil::currentTime() - t0;
 
-        bbox_min -= make_float3(fixed_radius);
-        bbox_max += make_float3(fixed_radius);
+    Acceleration accel = geometry_group->getAcceleration();
+    if ( keyframe_speed * fabsf( dt - build_dt ) < refit_threshold * fixed_radius ) {
+        accel->setProperty( "refit", "1" );
+        ++num_refits;
+    } else {
+        accel->setProperty( "refit", "0" );
+        build_dt = dt;
+        ++num_rebuilds;
+    }
+    accel->markDirty();
+}
 
-        std::cout << "Attribute range wmin = " << wmin << ", wmax = " << wmax << std::endl;
 
-        float wRange = float( 1.0 / double(wmax - wmin) );
+// Sets the bounding box of the volume from the stats of a frame
+void setParticleBounds( const ParticleFrameData& frame )
+{
+    float3 bbox_min = make_float3( frame.stats.pmin.x, frame.stats.pmin.y, frame.stats.pmin.z );
+    float3 bbox_max = make_float3( frame.stats.pmax.x, frame.stats.pmax.y, frame.stats.pmax.z );
+    bbox_min -= make_float3(fixed_radius);
+    bbox_max += make_float3(fixed_radius);
 
-        //#pragma omp parallel for
-        for(size_t i=0; i<positions.size(); i++)
-            positions[i].w = positions[i].w * wRange;
-    }
+    context[ "bbox_min"     ]->setFloat(bbox_min);
+    context[ "bbox_max"     ]->setFloat(bbox_max);
 
+    // the bounding box will actually be used only for the first frame
+    aabb.set( bbox_min, bbox_max );
 }
 
 
 // loads up the particles file corresponding to the current frame (if it is a sequence)
 void loadParticles()
 {
-    float3 bbox_min, bbox_max;
+    if ( !frame_cache )
+    {
+        std::cout << "Reading " << particles_file_extension << " file "
+                  << ( particles_file_extension == "raw" ? particles_file : particlesFrameFilename( current_particle_frame ) )
+                  << std::endl;
+
+        const ParticleReadOptions options = { max_particles, particles_file_colors, particles_file_radius, fixed_radius };
+        frame_cache.reset( new ParticleFrameCache(
+                    [options]( int frame, ParticleFrameData& data ) { readFrame( frame, options, data ); },
+                    cache_budget_mb << 20 ) );
+    }
 
-    std::map<int, ParticleFrameData>::iterator cacheIt = dataCache.find(current_particle_frame);
-    if(cacheIt == dataCache.end())
+    const bool first_frame = !frame_data;
+    const double t0 = sutil::currentTime();
+    std::shared_ptr<const ParticleFrameData> next_frame_data = frame_cache->acquire( current_particle_frame );
+    const double t1 = sutil::currentTime();
+
+    // Read the next frames of a sequence while this one is rendered
+    if ( current_particle_frame > 0 && prefetch_frames > 0 )
     {
-        ParticleFrameData newCacheEntry;
+        std::vector<int> frames;
+        for ( int i = 1; i <= prefetch_frames; ++i )
+            frames.push_back( nextParticleFrame( current_particle_frame, i ) );
+        frame_cache->prefetch( frames );
+    }
 
-        std::vector<float4>& positions = newCacheEntry.positions;
-        std::vector<float3>& velocities = newCacheEntry.velocities;
-        std::vector<float3>& colors = newCacheEntry.colors;
-        std::vector<float>&  radii = newCacheEntry.radii;
+    interpolation_step = 0;
 
-	    readFile(positions, velocities, colors, radii, bbox_min, bbox_max);
+    // nothing to upload or rebuild if the buffers already hold this frame,
+    // e.g. when a sequence of one frame is played
+    if ( next_frame_data == frame_data )
+        return;
+    frame_data = next_frame_data;
 
-        context[ "fixed_radius"     ]->setFloat(fixed_radius);
-        context[ "particlesPerSlab"     ]->setFloat(particlesPerSlab);
-        context[ "wScale" ] ->setFloat(wScale);
-        context[ "opacity" ] ->setFloat(opacity);
-        context[ "tf_type" ]->setInt(tf_type);
+    const ParticleFrameData& frame = *frame_data;
+    if ( first_frame )
+        setupFirstFrame( frame, t1 - t0 );
 
-        context[ "bbox_min"     ]->setFloat(bbox_min);
-        context[ "bbox_max"     ]->setFloat(bbox_max);
+    setParticleBounds( frame );
 
-        newCacheEntry.bbox_min = bbox_min;
-        newCacheEntry.bbox_max = bbox_max;
-        cacheIt = dataCache.insert(std::make_pair(current_particle_frame, newCacheEntry)).first;
-    }
+    // fills up the buffers
+    updateParticleBuffers();
+    if ( first_frame )
+        std::cout << "Buffers filled in " << upload_time << " s"
+                  << ( quantize_positions ? ", positions quantized to 16 bits" : "" ) << std::endl;
+}
 
-    ParticleFrameData& cacheEntry = cacheIt->second;
 
-    // all vectors have the same size
-    geometry->setPrimitiveCount( (int) cacheEntry.positions.size() );
+// Reads the index of a bricked dataset.  The bricks themselves are streamed
+// by updateParticleBricks() once the camera is set up.
+void loadParticleBricks()
+{
+    std::cout << "Reading brick file " << particles_file << std::endl;
+
+    const double t0 = sutil::currentTime();
+    std::shared_ptr<ParticleFrameData> index( new ParticleFrameData );
+    std::string error;
+    if ( !readParticleBrickIndex( particles_file, *index, bricks, error ) )
+        throw Exception( "Failed to read particle bricks: " + error );
+    frame_data = index;
+    current_particle_frame = 0;
+
+    setupFirstFrame( *index, sutil::currentTime() - t0 );
+    std::cout << bricks.size() << " bricks, up to " << brick_budget_mb << " MB of them in view" << std::endl;
+    setParticleBounds( *index );
+
+    // only the positions are used on the device
+    const std::string filename = particles_file;
+    brick_cache.reset( new ParticleBrickCache(
+                [filename]( int brick, ParticleFrameData& data ) {
+                    std::string error;
+                    if ( !readParticleBrick( filename, bricks[brick], 0, data, error ) )
+                        throw Exception( "Failed to read particle brick: " + error );
+                },
+                cache_budget_mb << 20 ) );
+}
 
-    // fills up the buffers
-    fillBuffers( cacheEntry.positions, cacheEntry.velocities, cacheEntry.colors, cacheEntry.radii );
 
-    // the bounding box will actually be used only for the first frame
-    aabb.set( cacheEntry.bbox_min, cacheEntry.bbox_max );
+// Requests the bricks in view, by decreasing screen coverage within
+// brick_budget_mb, and fills the buffers with the resident ones.  The BVH is
+// rebuilt only when they change.  With wait, all bricks in view are loaded
+// first.  Returns true if the buffers changed.
+bool updateParticleBricks( bool wait )
+{
+    std::vector<int> selected;
+    selectParticleBricks( bricks, context[ "eye" ]->getFloat3(), context[ "U" ]->getFloat3(),
+                          context[ "V" ]->getFloat3(), context[ "W" ]->getFloat3(), fixed_radius, 0,
+                          brick_budget_mb << 20, selected );
+    bricks_in_view = selected.size();
+    brick_cache->request( selected );
+
+    // kept in index order, so a new order of the same bricks is no change
+    std::vector<ParticleBrickCache::ResidentBrick> resident;
+    brick_cache->resident( resident, wait );
+    std::sort( resident.begin(), resident.end(),
+               []( const ParticleBrickCache::ResidentBrick& a, const ParticleBrickCache::ResidentBrick& b )
+               { return a.first < b.first; } );
+
+    std::vector<int> indices;
+    size_t num_particles = 0;
+    for ( size_t i = 0; i < resident.size(); ++i ) {
+        indices.push_back( resident[i].first );
+        num_particles += resident[i].second->num_particles;
+    }
+    if ( indices == buffer_bricks )
+        return false;
+
+    // quantized positions are encoded from the concatenated bricks
+    const double t0 = sutil::currentTime();
+    std::vector<float4> concatenated( quantize_positions ? num_particles : 0 );
+    char* dst = quantize_positions ? reinterpret_cast<char*>( concatenated.data() ) : 0;
+    if ( !quantize_positions ) {
+        buffers.positions->setSize( num_particles );
+        dst = static_cast<char*>( buffers.positions->map( 0, RT_BUFFER_MAP_WRITE_DISCARD ) );
+    }
+    for ( size_t i = 0; i < resident.size(); ++i ) {
+        const ParticleFrameData& brick = *resident[i].second;
+        memcpy( dst, brick.positions, brick.num_particles * sizeof( float4 ) );
+        dst += brick.num_particles * sizeof( float4 );
+    }
+    if ( quantize_positions )
+        fillPositions( concatenated.data(), num_particles );
+    else
+        buffers.positions->unmap();
+    upload_time += sutil::currentTime() - t0;
+    ++num_uploads;
+
+    buffer_bricks.swap( indices );
+    buffer_brick_particles = num_particles;
+    geometry->setPrimitiveCount( (int) num_particles );
 
-    // builds the BVH (or re-builds it if already existing)
     Acceleration accel = geometry_group->getAcceleration();
+    accel->setProperty( "refit", "0" );
     accel->markDirty();
+    return true;
 }
 
 
+// One row of TF_TABLE_SIZE entries per preset and one for tf_file, sampled
+// by raygen.cu in texel coordinates
+void setupTransferFunctions()
+{
+    std::vector<TransferFunctionPoint> points;
+    if ( !tf_file.empty() )
+    {
+        std::string error;
+        if ( !readTransferFunctionFile( tf_file, points, error ) )
+            throw Exception( "Failed to read transfer function: " + error );
+        std::cout << "Transfer function " << tf_file << ": " << points.size() << " control points, tf_type = "
+                  << TF_PRESET_COUNT << std::endl;
+        tf_type = TF_PRESET_COUNT;
+    }
+    tf_tables = TF_PRESET_COUNT + ( points.empty() ? 0 : 1 );
+    tf_type = std::min( std::max( tf_type, 0 ), tf_tables - 1 );
+
+    Buffer buffer = context->createBuffer( RT_BUFFER_INPUT, RT_FORMAT_FLOAT4, TF_TABLE_SIZE, tf_tables );
+    float4* table = static_cast<float4*>( buffer->map() );
+    for ( int i = 0; i < TF_PRESET_COUNT; ++i )
+        buildTransferFunctionTable( i, TF_TABLE_SIZE, table + i * TF_TABLE_SIZE );
+    if ( !points.empty() )
+        buildTransferFunctionTable( points, TF_TABLE_SIZE, table + TF_PRESET_COUNT * TF_TABLE_SIZE );
+    buffer->unmap();
+
+    TextureSampler sampler = context->createTextureSampler();
+    sampler->setWrapMode( 0, RT_WRAP_CLAMP_TO_EDGE );
+    sampler->setWrapMode( 1, RT_WRAP_CLAMP_TO_EDGE );
+    sampler->setWrapMode( 2, RT_WRAP_CLAMP_TO_EDGE );
+    sampler->setIndexingMode( RT_TEXTURE_INDEX_ARRAY_INDEX );
+    sampler->setReadMode( RT_TEXTURE_READ_ELEMENT_TYPE );
+    sampler->setMaxAnisotropy( 1.0f );
+    sampler->setMipLevelCount( 1u );
+    sampler->setArraySize( 1u );
+    sampler->setBuffer( 0u, 0u, buffer );
+    sampler->setFilteringModes( RT_FILTER_LINEAR, RT_FILTER_LINEAR, RT_FILTER_NONE );
+    context[ "tf_table" ]->setTextureSampler( sampler );
+    context[ "tf_type"  ]->setInt( tf_type );
+}
+
 void setupParticles()
 {
-    // the buffers will be set to the right size at a later stage
+    // the buffers will be set to the right size at a later stage; velocities,
+    // colors and radii are not read by any program and stay empty
     buffers.positions  = context->createBuffer( RT_BUFFER_INPUT, RT_FORMAT_FLOAT4, 0 );
     buffers.velocities = context->createBuffer( RT_BUFFER_INPUT, RT_FORMAT_FLOAT3, 0 );
     buffers.colors     = context->createBuffer( RT_BUFFER_INPUT, RT_FORMAT_FLOAT3, 0 );
     buffers.radii      = context->createBuffer( RT_BUFFER_INPUT, RT_FORMAT_FLOAT,  0 );
+    buffers.radius_scales = context->createBuffer( RT_BUFFER_INPUT, RT_FORMAT_FLOAT, 0 );
+    buffers.quantized_positions = context->createBuffer( RT_BUFFER_INPUT, RT_FORMAT_UNSIGNED_SHORT4, 0 );
+    buffers.quantized_blocks    = context->createBuffer( RT_BUFFER_INPUT, RT_FORMAT_FLOAT4, 0 );
 
     context[ "positions_buffer"  ]->setBuffer( buffers.positions );
+    context[ "quantized_positions_buffer" ]->setBuffer( buffers.quantized_positions );
+    context[ "quantized_blocks_buffer"    ]->setBuffer( buffers.quantized_blocks );
+    context[ "radius_scales_buffer" ]->setBuffer( buffers.radius_scales );
+    context[ "lod_radius_scale"  ]->setFloat( 1.f );
 
     geometry = context->createGeometry();
     geometry[ "positions_buffer"  ]->setBuffer( buffers.positions );
+    geometry[ "quantized_positions_buffer" ]->setBuffer( buffers.quantized_positions );
+    geometry[ "quantized_blocks_buffer"    ]->setBuffer( buffers.quantized_blocks );
 
     geometry[ "fixed_radius"      ]->setFloat(fixed_radius);
     geometry->setBoundingBoxProgram  ( createBoundingBoxProgram( context ) );
@@ -865,6 +1019,12 @@ void keyCallback( GLFWwindow* window, int key, int scancode, int action, int mod
                handled = true;
                break;
             }
+            case( GLFW_KEY_P ):
+            {
+               play = !play;
+               handled = true;
+               break;
+            }
 
         }
     }
@@ -929,6 +1089,7 @@ void glfwRun( GLFWwindow* window, sutil::Camera& camera, RenderBuffers& buffers
 
     unsigned int frame_count = 0;
     unsigned int accumulation_frame = 0;
+    unsigned int animation_iterations = 0;
     bool do_animate = true;
 
     double previous_time = sutil::currentTime();
@@ -968,6 +1129,42 @@ void glfwRun( GLFWwindow* window, sutil::Camera& camera, RenderBuffers& buffers
         if (camera_slow_rotate )
             camera.rotate(1.f, 0.f);
 
+        // stream the bricks of a bricked dataset as the camera moves
+        if ( brick_cache && updateParticleBricks( false ) )
+            accumulation_frame = 0;
+
+        // switch the level of detail as the camera moves
+        if ( lod_levels > 0 ) {
+            const int level = selectLodLevel( *frame_data, camera.height() );
+            if ( level != lod_level ) {
+                lod_level = level;
+                updateParticleBuffers();
+                accumulation_frame = 0;
+            }
+        }
+
+        // step through the particle sequence
+        if ( play && current_particle_frame > 0 && ++animation_iterations >= iterations_per_animation_frame ) {
+            animation_iterations = 0;
+            if ( interpolation_step < interpolation_steps ) {
+                // in-between frame advected from the keyframe
+                ++interpolation_step;
+                interpolateParticles( interpolationDt() );
+            } else {
+                // a frame that fails to read stops playback on the current one
+                const int frame = current_particle_frame;
+                current_particle_frame = nextParticleFrame( current_particle_frame, 1 );
+                try {
+                    loadParticles();
+                } catch( const Exception& e ) {
+                    std::cerr << e.getErrorString() << ", stopping playback" << std::endl;
+                    current_particle_frame = frame;
+                    play = false;
+                }
+            }
+            accumulation_frame = 0;
+        }
+
         // imgui pushes
         ImGui::PushStyleVar(ImGuiStyleVar_FramePadding,   ImVec2(0,0) );
         ImGui::PushStyleVar(ImGuiStyleVar_Alpha,          0.6f        );
@@ -1000,7 +1197,7 @@ void glfwRun( GLFWwindow* window, sutil::Camera& camera, RenderBuffers& buffers
               context[ "opacity"     ]->setFloat(opacity);
             }
 
-            if (ImGui::SliderInt( "transfer function preset", &tf_type, 1, 3 ) ) {
+            if (ImGui::SliderInt( "transfer function preset", &tf_type, 1, tf_tables - 1 ) ) {
               context[ "tf_type" ] ->setInt(tf_type);
             }
 
@@ -1012,6 +1209,41 @@ void glfwRun( GLFWwindow* window, sutil::Camera& camera, RenderBuffers& buffers
             if ( ImGui::Checkbox( "camera rotate", &camera_slow_rotate ) ) {
             }
 
+            if ( current_particle_frame > 0 ) {
+                ImGui::Checkbox( "play", &play );
+
+                const ParticleFrameCache::Counters c = frame_cache->counters();
+                ImGui::Text( "frame %d / %d", current_particle_frame, max_particle_frames );
+                ImGui::Text( "cache: %d frames, %d / %d MB", (int)c.resident_frames,
+                             (int)( c.resident_bytes >> 20 ), (int)( frame_cache->budget() >> 20 ) );
+                ImGui::Text( "hits %d, misses %d, waits %d, stalled %.2f s", (int)c.hits, (int)c.misses,
+                             (int)c.waits, c.wait_time );
+                ImGui::Text( "upload %.2f ms per frame", 1000.0 * upload_time / std::max( num_uploads, 1u ) );
+                if ( interpolation_steps > 0 )
+                    ImGui::Text( "interpolated %d / %d, advect %.2f ms, %d refits, %d rebuilds", interpolation_step,
+                                 interpolation_steps, 1000.0 * advect_time / std::max( num_refits + num_rebuilds, 1u ),
+                                 (int)num_refits, (int)num_rebuilds );
+            }
+
+            if ( brick_cache ) {
+                const ParticleBrickCache::Counters c = brick_cache->counters();
+                ImGui::Text( "bricks: %d in view, %d in buffers, %d particles", (int)bricks_in_view,
+                             (int)buffer_bricks.size(), (int)buffer_brick_particles );
+                ImGui::Text( "cache: %d / %d bricks, %d / %d MB", (int)c.resident_bricks, (int)bricks.size(),
+                             (int)( c.resident_bytes >> 20 ), (int)( brick_cache->budget() >> 20 ) );
+                ImGui::Text( "streamed %d bricks, %.1f MB, latency %.1f ms mean, %.1f ms max", (int)c.loaded,
+                             c.bytes_streamed / ( 1024.0 * 1024.0 ), 1000.0 * c.latency / std::max<size_t>( c.loaded, 1 ),
+                             1000.0 * c.max_latency );
+            }
+
+            if ( lod_levels > 0 ) {
+                const size_t num_primitives = lod_level == 0 ? frame_data->num_particles
+                                                             : frame_data->lod_levels[lod_level-1].positions.size();
+                ImGui::Text( "level of detail %d / %d: %d primitives", lod_level, (int)frame_data->lod_levels.size(),
+                             (int)num_primitives );
+                ImGui::SliderFloat( "lod pixels", &lod_pixels, 0.25f, 8.f );
+            }
+
             ImGui::End();
         }
 
@@ -1066,16 +1298,30 @@ void printUsageAndExit( const std::string& argv0 )
         "  -h | --help                         Print this usage message and exit.\n"
         "  -f | --file                         Save single frame to file and exit.\n"
         "  -n | --nopbo                        Disable GL interop for display buffer.\n"
-        "  -p | --particles <particles_file>   Specify path to particles file to be loaded.\n"
+        "  -p | --particles <particles_file>   Specify path to particles file to be loaded (text, '*.raw', '*.particles' or '*.bricks').\n"
         "  -r | --report <LEVEL>               Enable usage reporting and report level [1-3].\n"
         "  --no-rotate                         Disable camera rotation (default on).\n"
         "  --wScale <float>                    Rescale particle attribute range by a fixed multiple.\n"
         "  --opacity <float>                   Opacity scale (alpha) for each particle.\n"
         "  --fixed_radius <float>              Specify default (world space) radius of a particle.\n"
         "  --max_particles <int M>             Only read the first M particles of the dataset.\n"
+        "  --sort                              Sort particles along a Morton curve before building the BVH.\n"
+        "  --quantize                          Store positions and attributes on the device as 16 bit offsets (8 bytes per particle plus 32 per block of 256, instead of 16).\n"
+        "  --lod <int>                         Build up to this many coarser levels of detail for distant views.\n"
+        "  --lod_pixels <float>                Largest cell of merged particles, in pixels, for a level to be used (default 1).\n"
         "  --tf_type <int>                     Use preset transfer function (0,1,2 = unsigned data, 3 = signed data).\n"
+        "  --tf <tf_file>                      Use a transfer function of \"value r g b a\" control points (tf_type 4).\n"
+        "  --play                              Step through a particle sequence (toggle with 'P').\n"
+        "  --max_particle_frames <int>         Number of frames of a particle sequence (default 25).\n"
+        "  --interpolate <int>                 Frames advected along the particle velocities between two files of a sequence.\n"
+        "  --frame_dt <float>                  Time between two files of a sequence, in the units of the velocities (default 1).\n"
+        "  --refit_threshold <float>           Refit rather than rebuild the BVH while particles moved less than this many radii (default 0.5).\n"
+        "  --cache_mb <int>                    Memory budget for cached frames of a sequence or bricks of a bricked dataset, in MB (default 4096).\n"
+        "  --brick_mb <int>                    Memory budget for the bricks in view of a bricked dataset, in MB (default 1024).\n"
+        "  --prefetch <int>                    Frames of a sequence read ahead of playback (default 2).\n"
         "App Keystrokes:\n"
         "  q  Quit\n"
+        "  p  Play or pause a particle sequence\n"
         << std::endl;
 
     exit(1);
@@ -1127,6 +1373,108 @@ int main( int argc, char** argv )
             }
             tf_type = atoi(argv[++i]);
         }
+        else if( arg == "--tf"  )
+        {
+            if( i == argc-1 )
+            {
+                std::cout << "Option '" << argv[i] << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            tf_file = argv[++i];
+        }
+        else if( arg == "--play"  )
+        {
+            play = true;
+        }
+        else if( arg == "--sort"  )
+        {
+            sort_particles = true;
+        }
+        else if( arg == "--quantize"  )
+        {
+            quantize_positions = true;
+        }
+        else if( arg == "--interpolate"  )
+        {
+            if( i == argc-1 )
+            {
+                std::cout << "Option '" << argv[i] << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            interpolation_steps = std::max( 0, atoi(argv[++i]) );
+        }
+        else if( arg == "--frame_dt"  )
+        {
+            if( i == argc-1 )
+            {
+                std::cout << "Option '" << argv[i] << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            frame_dt = (float) atof(argv[++i]);
+        }
+        else if( arg == "--refit_threshold"  )
+        {
+            if( i == argc-1 )
+            {
+                std::cout << "Option '" << argv[i] << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            refit_threshold = (float) atof(argv[++i]);
+        }
+        else if( arg == "--lod"  )
+        {
+            if( i == argc-1 )
+            {
+                std::cout << "Option '" << argv[i] << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            lod_levels = atoi(argv[++i]);
+        }
+        else if( arg == "--lod_pixels"  )
+        {
+            if( i == argc-1 )
+            {
+                std::cout << "Option '" << argv[i] << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            lod_pixels = (float) atof(argv[++i]);
+        }
+        else if( arg == "--max_particle_frames"  )
+        {
+            if( i == argc-1 )
+            {
+                std::cout << "Option '" << argv[i] << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            max_particle_frames = std::max( 1, atoi(argv[++i]) );
+        }
+        else if( arg == "--cache_mb"  )
+        {
+            if( i == argc-1 )
+            {
+                std::cout << "Option '" << argv[i] << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            cache_budget_mb = atoi(argv[++i]);
+        }
+        else if( arg == "--brick_mb"  )
+        {
+            if( i == argc-1 )
+            {
+                std::cout << "Option '" << argv[i] << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            brick_budget_mb = atoi(argv[++i]);
+        }
+        else if( arg == "--prefetch"  )
+        {
+            if( i == argc-1 )
+            {
+                std::cout << "Option '" << argv[i] << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            prefetch_frames = atoi(argv[++i]);
+        }
         else if( arg == "--no_radius"  )
         {
             particles_file_radius = false;
@@ -1219,9 +1567,14 @@ int main( int argc, char** argv )
         RenderBuffers render_buffers;
 
         createContext( usage_report_level, &logger );
+        setupTransferFunctions();
         setupParticles();
         setParticlesBaseName( particles_file );
-        loadParticles();
+        countParticleFrames();
+        if ( particles_file_extension == PARTICLE_BRICK_FILE_EXTENSION )
+            loadParticleBricks();
+        else
+            loadParticles();
         setupCamera();
         setupLights();
 
@@ -1229,6 +1582,9 @@ int main( int argc, char** argv )
                 &camera_eye.x, &camera_lookat.x, &camera_up.x,
                 context["eye"], context["U"], context["V"], context["W"] );
 
+        if ( brick_cache )
+            updateParticleBricks( true );
+
         context->validate();
 
         if ( out_file.empty() )
@@ -1238,6 +1594,8 @@ int main( int argc, char** argv )
         else
         {
             updateCamera();
+            if ( brick_cache )
+                updateParticleBricks( true );
             context->launch( 0, width, height );
             sutil::writeBufferToFile( out_file.c_str(), getOutputBuffer() );
             std::cout << "Wrote " << out_file << std::endl;
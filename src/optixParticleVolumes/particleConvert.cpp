@@ -0,0 +1,922 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+//-----------------------------------------------------------------------------
+//
+// particleConvert: converts the text and raw particle files read by
+// optixParticleVolumes into binary particle files (see ParticleFile.h), which
+// the sample maps instead of parsing.  The attribute normalization and the
+// position and attribute ranges are computed once here and stored in the
+// header.  With --bricks it writes bricked files (see ParticleBricks.h) for
+// datasets that are streamed rather than loaded whole.  Needs no GPU.
+//
+//-----------------------------------------------------------------------------
+
+#include "ParticleBricks.h"
+#include "ParticleData.h"
+#include "ParticleFile.h"
+#include "ParticleLod.h"
+#include "ParticleQuantize.h"
+#include "ParticleReference.h"
+#include "ParticleSort.h"
+#include "TransferFunctionTable.h"
+#include "commonStructs.h"
+
+#include <optixu/optixu_math_namespace.h>
+
+#include <Parallel.h>
+#include <sutil.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace optix;
+
+// tf() of the device, which expects the optix vector math in scope
+#include "transferFunction.h"
+
+
+//------------------------------------------------------------------------------
+//
+//  Helpers
+//
+//------------------------------------------------------------------------------
+
+static double currentTime()
+{
+  return std::chrono::duration<double>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+
+// Maps the written file back and compares it with the frame it was written from
+static bool verifyParticleFile( const std::string& filename, const ParticleFrameData& frame )
+{
+  ParticleFrameData mapped;
+  std::string error;
+  if( !readParticleFile( filename, 0, mapped, error ) ) {
+    std::cerr << "Verification failed: " << error << std::endl;
+    return false;
+  }
+
+  const size_t n = frame.num_particles;
+  const bool ok =
+      mapped.num_particles == n && mapped.channels == frame.channels &&
+      mapped.signed_attribute == frame.signed_attribute && mapped.morton_order == frame.morton_order &&
+      mapped.attribute_scale == frame.attribute_scale && mapped.attribute_offset == frame.attribute_offset &&
+      memcmp( &mapped.stats, &frame.stats, sizeof( ParticleStats ) ) == 0 &&
+      memcmp( mapped.positions, frame.positions, n * sizeof( float4 ) ) == 0 &&
+      ( !frame.velocities || memcmp( mapped.velocities, frame.velocities, n * sizeof( float3 ) ) == 0 ) &&
+      ( !frame.colors     || memcmp( mapped.colors, frame.colors, n * sizeof( float3 ) ) == 0 ) &&
+      ( !frame.radii      || memcmp( mapped.radii, frame.radii, n * sizeof( float ) ) == 0 );
+  if( !ok )
+    std::cerr << "Verification failed: '" << filename << "' differs from the converted particles" << std::endl;
+  return ok;
+}
+
+
+// Order independent checksum of an array: the sum of its 32 bit words
+static uint64_t wordSum( const void* data, size_t bytes )
+{
+  const uint32_t* words = static_cast<const uint32_t*>( data );
+  uint64_t sum = 0;
+  for( size_t i = 0; i < bytes / sizeof( uint32_t ); ++i )
+    sum += words[i];
+  return sum;
+}
+
+
+// Reads the written brick file back and checks that its bricks hold the
+// particles of frame, each brick within its stored bounds
+static bool verifyParticleBrickFile( const std::string& filename, const ParticleFrameData& frame,
+                                     size_t& num_bricks )
+{
+  ParticleFrameData header;
+  std::vector<ParticleBrick> bricks;
+  std::string error;
+  if( !readParticleBrickIndex( filename, header, bricks, error ) ) {
+    std::cerr << "Verification failed: " << error << std::endl;
+    return false;
+  }
+  num_bricks = bricks.size();
+
+  const size_t n = frame.num_particles;
+  const unsigned int channels = PARTICLE_VELOCITIES | PARTICLE_COLORS | PARTICLE_RADII;
+  uint64_t sums[4] = { 0, 0, 0, 0 };
+  bool ok = header.num_particles == n && header.channels == frame.channels &&
+            memcmp( &header.stats, &frame.stats, sizeof( ParticleStats ) ) == 0;
+  for( size_t b = 0; b < bricks.size() && ok; ++b ) {
+    ParticleFrameData brick;
+    if( !readParticleBrick( filename, bricks[b], channels, brick, error ) ) {
+      std::cerr << "Verification failed: " << error << std::endl;
+      return false;
+    }
+    const ParticleStats stats = computeParticleStats( brick.positions, brick.num_particles );
+    ok = memcmp( &stats, &bricks[b].stats, sizeof( ParticleStats ) ) == 0 && brick.channels == frame.channels;
+    sums[0] += wordSum( brick.positions, brick.num_particles * sizeof( float4 ) );
+    sums[1] += brick.velocities ? wordSum( brick.velocities, brick.num_particles * sizeof( float3 ) ) : 0;
+    sums[2] += brick.colors     ? wordSum( brick.colors, brick.num_particles * sizeof( float3 ) )     : 0;
+    sums[3] += brick.radii      ? wordSum( brick.radii, brick.num_particles * sizeof( float ) )       : 0;
+  }
+  ok = ok && sums[0] == wordSum( frame.positions, n * sizeof( float4 ) ) &&
+       sums[1] == ( frame.velocities ? wordSum( frame.velocities, n * sizeof( float3 ) ) : 0 ) &&
+       sums[2] == ( frame.colors     ? wordSum( frame.colors, n * sizeof( float3 ) )     : 0 ) &&
+       sums[3] == ( frame.radii      ? wordSum( frame.radii, n * sizeof( float ) )       : 0 );
+  if( !ok )
+    std::cerr << "Verification failed: '" << filename << "' differs from the converted particles" << std::endl;
+  return ok;
+}
+
+
+// The serial getline/atof text reader that readTextParticles() replaced, kept
+// as the reference for --parse-bench.
+static void readTextParticlesReference( const std::string& filename, const ParticleReadOptions& options,
+                                        ParticleFrameData& frame )
+{
+  std::ifstream ifs( filename.c_str() );
+
+  std::vector<float4>& positions  = frame.position_storage;
+  std::vector<float3>& velocities = frame.velocity_storage;
+  std::vector<float3>& colors     = frame.color_storage;
+  std::vector<float>&  radii      = frame.radius_storage;
+
+  int maxchars = 8192;
+  std::vector<char> buf(static_cast<size_t>(maxchars)); // Alloc enough size
+
+  while ( ifs.peek() != -1 ) {
+    if ( options.max_particles > 0 && positions.size() >= options.max_particles )
+      break;
+
+    ifs.getline( &buf[0], maxchars );
+
+    std::string linebuf(&buf[0]);
+
+    if ( linebuf.size() > 0 && linebuf[linebuf.size() - 1] == '\r' )
+      linebuf.erase( linebuf.size() - 1 );
+
+    const char *token = linebuf.c_str();
+    token += strspn( token, " \t" );
+    if ( token[0] == '\0' || token[0] == '#' )
+      continue;
+
+    float f[10];
+    const int num_fields = 6 + ( options.colors ? 3 : 0 ) + ( options.radii ? 1 : 0 );
+    for ( int k = 0; k < num_fields; ++k ) {
+      token += strspn( token, " \t" );
+      f[k] = (float) atof( token );
+      token += strcspn( token, " \t\r" );
+    }
+
+    const float3 vel = make_float3( f[3], f[4], f[5] );
+    positions.push_back( make_float4( f[0], f[1], f[2], length( vel ) ) );
+    velocities.push_back( vel );
+    if ( options.colors )
+      colors.push_back( make_float3( f[6], f[7], f[8] ) );
+    if ( options.radii )
+      radii.push_back( f[num_fields-1] );
+  }
+
+  frame.num_particles = positions.size();
+  frame.channels      = PARTICLE_VELOCITIES | ( options.colors ? unsigned( PARTICLE_COLORS ) : 0u ) |
+                        ( options.radii ? unsigned( PARTICLE_RADII ) : 0u );
+  frame.positions     = positions.data();
+  frame.velocities    = velocities.data();
+  frame.colors        = options.colors ? colors.data() : 0;
+  frame.radii         = options.radii ? radii.data() : 0;
+}
+
+
+// Times readTextParticles() against the reference reader, reports the
+// throughput of both and checks that they produce identical particles.
+static bool benchmarkTextParser( const std::string& input, const ParticleReadOptions& options, int num_runs )
+{
+  double file_size = 0.0;
+  {
+    MappedFile file( input );
+    if( file.failed() ) {
+      std::cerr << "Error: can't map '" << input << "'" << std::endl;
+      return false;
+    }
+    file_size = static_cast<double>( file.size() );
+  }
+
+  double reference_time = 1e30;
+  double parallel_time  = 1e30;
+  bool identical = true;
+  size_t num_particles = 0;
+  for( int run = 0; run < num_runs; ++run ) {
+    ParticleFrameData reference;
+    double t0 = currentTime();
+    readTextParticlesReference( input, options, reference );
+    double t1 = currentTime();
+
+    ParticleFrameData frame;
+    std::string error;
+    if( !readTextParticles( input, options, frame, error ) ) {
+      std::cerr << "Error: " << error << std::endl;
+      return false;
+    }
+    double t2 = currentTime();
+    reference_time = std::min( reference_time, t1 - t0 );
+    parallel_time  = std::min( parallel_time, t2 - t1 );
+
+    const size_t n = reference.num_particles;
+    num_particles = n;
+    identical = identical && frame.num_particles == n && frame.channels == reference.channels &&
+                memcmp( frame.positions, reference.positions, n * sizeof( float4 ) ) == 0 &&
+                memcmp( frame.velocities, reference.velocities, n * sizeof( float3 ) ) == 0 &&
+                ( !frame.colors || memcmp( frame.colors, reference.colors, n * sizeof( float3 ) ) == 0 ) &&
+                ( !frame.radii  || memcmp( frame.radii, reference.radii, n * sizeof( float ) ) == 0 );
+  }
+
+  const double mb = file_size / ( 1024.0 * 1024.0 );
+  std::cerr << input << ": " << mb << " MB, " << num_particles << " particles, best of " << num_runs << "\n"
+            << "  getline/atof reader   " << reference_time << " s, " << mb / reference_time << " MB/s\n"
+            << "  readTextParticles     " << parallel_time << " s, " << mb / parallel_time << " MB/s ("
+            << sutil::numWorkerThreads() << " threads)\n"
+            << "  particles " << ( identical ? "identical" : "DIFFER" ) << std::endl;
+  return identical;
+}
+
+
+// Owned copy of the particles of src, with count particles taken from src
+// in tiles of 2x2x2 copies of its bounds
+static void makeTiledFrame( const ParticleFrameData& src, size_t count, ParticleFrameData& frame )
+{
+  const float3 extent = make_float3( src.stats.pmax - src.stats.pmin );
+  frame.position_storage.resize( count );
+  frame.velocity_storage.resize( count );
+  frame.color_storage.resize( count );
+  frame.radius_storage.resize( count );
+  for( size_t i = 0; i < count; ++i ) {
+    const size_t j    = i % src.num_particles;
+    const size_t tile = i / src.num_particles;
+    const float3 offset = extent * make_float3( float( tile & 1 ), float( tile >> 1 & 1 ), float( tile >> 2 & 1 ) );
+    frame.position_storage[i] = src.positions[j] + make_float4( offset, 0.0f );
+    frame.velocity_storage[i] = src.velocities ? src.velocities[j] : make_float3( 0.0f );
+    frame.color_storage[i]    = src.colors     ? src.colors[j]     : make_float3( 0.0f );
+    frame.radius_storage[i]   = src.radii      ? src.radii[j]      : 0.0f;
+  }
+  frame.num_particles = count;
+  frame.channels      = PARTICLE_VELOCITIES | PARTICLE_COLORS | PARTICLE_RADII;
+  frame.positions     = frame.position_storage.data();
+  frame.velocities    = frame.velocity_storage.data();
+  frame.colors        = frame.color_storage.data();
+  frame.radii         = frame.radius_storage.data();
+  frame.stats         = computeParticleStats( frame.positions, count );
+}
+
+
+// Mean distance between consecutive particles, a measure of the locality of
+// the order
+static double meanNeighbourDistance( const ParticleFrameData& frame )
+{
+  double sum = 0.0;
+  for( size_t i = 1; i < frame.num_particles; ++i )
+    sum += length( make_float3( frame.positions[i] - frame.positions[i-1] ) );
+  return frame.num_particles > 1 ? sum / double( frame.num_particles - 1 ) : 0.0;
+}
+
+
+// Times the Morton sort for doubling particle counts, from 64k up to 8 tiled
+// copies of the particles of input.  Compares the radix sort with
+// std::stable_sort on the same keys, and checks that both agree and that
+// every channel was permuted the same way.
+static bool benchmarkSort( const std::string& input, const ParticleReadOptions& options, int num_runs )
+{
+  ParticleFrameData source;
+  std::string error;
+  if( !readParticles( input, options, source, error ) ) {
+    std::cerr << "Error: " << error << std::endl;
+    return false;
+  }
+
+  std::cerr << input << ": " << source.num_particles << " particles, best of " << num_runs << ", "
+            << sutil::numWorkerThreads() << " threads\n"
+            << "  particles     order (ms)  stable_sort (ms)  sortParticles (ms)  ns/particle  neighbour distance\n";
+  bool ok = true;
+  for( size_t count = 1u << 16; count <= 8 * source.num_particles; count *= 2 ) {
+    ParticleFrameData tiled;
+    makeTiledFrame( source, count, tiled );
+
+    double order_time  = 1e30;
+    double stable_time = 1e30;
+    double sort_time   = 1e30;
+    double distance    = 0.0;
+    for( int run = 0; run < num_runs; ++run ) {
+      double t0 = currentTime();
+      std::vector<uint32_t> order;
+      mortonOrder( tiled, order );
+      double t1 = currentTime();
+
+      // Reference order from the same keys
+      const float3 pmin  = make_float3( tiled.stats.pmin );
+      const float3 scale = 1.0f / ( make_float3( tiled.stats.pmax ) - pmin );
+      std::vector<uint64_t> keys( count );
+      for( size_t i = 0; i < count; ++i ) {
+        const float3 p = ( make_float3( tiled.positions[i] ) - pmin ) * scale;
+        keys[i] = mortonCode63( p.x, p.y, p.z );
+      }
+      double t2 = currentTime();
+      std::vector<uint32_t> reference( count );
+      for( size_t i = 0; i < count; ++i )
+        reference[i] = static_cast<uint32_t>( i );
+      std::stable_sort( reference.begin(), reference.end(),
+                        [&]( uint32_t a, uint32_t b ) { return keys[a] < keys[b]; } );
+      double t3 = currentTime();
+
+      ParticleFrameData sorted;
+      makeTiledFrame( source, count, sorted );
+      double t4 = currentTime();
+      sortParticles( sorted );
+      double t5 = currentTime();
+
+      order_time  = std::min( order_time, t1 - t0 );
+      stable_time = std::min( stable_time, t3 - t2 );
+      sort_time   = std::min( sort_time, t5 - t4 );
+      distance    = meanNeighbourDistance( sorted );
+
+      ok = ok && order == reference;
+      for( size_t i = 0; i < count && ok; ++i ) {
+        const uint32_t j = order[i];
+        ok = memcmp( &sorted.positions[i], &tiled.positions[j], sizeof( float4 ) ) == 0 &&
+             memcmp( &sorted.velocities[i], &tiled.velocities[j], sizeof( float3 ) ) == 0 &&
+             memcmp( &sorted.colors[i], &tiled.colors[j], sizeof( float3 ) ) == 0 &&
+             sorted.radii[i] == tiled.radii[j];
+      }
+    }
+
+    char line[256];
+    snprintf( line, sizeof( line ), "  %9zu  %12.2f  %16.2f  %18.2f  %11.1f  %8.4g -> %.4g\n", count,
+              1000.0 * order_time, 1000.0 * stable_time, 1000.0 * sort_time, 1e9 * sort_time / count,
+              meanNeighbourDistance( tiled ), distance );
+    std::cerr << line;
+  }
+  std::cerr << "  orders " << ( ok ? "identical" : "DIFFER" ) << std::endl;
+  return ok;
+}
+
+
+// Quantizes count positions, decodes them again and checks that every
+// component is within half a step of its block, up to float rounding.
+// Prints the largest and mean position error relative to radius and the
+// largest attribute error.
+static bool testQuantization( const char* name, const float4* positions, size_t count, float radius )
+{
+  std::vector<ushort4> quantized( count );
+  std::vector<float4>  blocks( 2 * quantizedBlockCount( count ) );
+  const double t0 = currentTime();
+  quantizeParticles( positions, count, quantized.data(), blocks.data() );
+  const double t1 = currentTime();
+
+  bool ok = true;
+  float  max_error   = 0.0f;
+  float  max_w_error = 0.0f;
+  double sum_error   = 0.0;
+  for( size_t i = 0; i < count; ++i ) {
+    const float4 p = positions[i];
+    const float4 d = dequantizeParticle( quantized.data(), blocks.data(), i );
+    const float4 origin = blocks[2 * ( i / QUANTIZED_BLOCK_SIZE )];
+    const float4 step   = blocks[2 * ( i / QUANTIZED_BLOCK_SIZE ) + 1];
+    const float p_c[4] = { p.x, p.y, p.z, p.w };
+    const float d_c[4] = { d.x, d.y, d.z, d.w };
+    const float o_c[4] = { origin.x, origin.y, origin.z, origin.w };
+    const float s_c[4] = { step.x, step.y, step.z, step.w };
+    for( int c = 0; c < 4; ++c ) {
+      const float error = fabsf( d_c[c] - p_c[c] );
+      const float bound = 0.5f * s_c[c] + 4.0f * FLT_EPSILON * ( fabsf( o_c[c] ) + 65535.0f * s_c[c] );
+      ok = ok && error <= bound;
+      if( c < 3 )
+        max_error = std::max( max_error, error );
+      else
+        max_w_error = std::max( max_w_error, error );
+    }
+    sum_error += length( make_float3( d - p ) );
+  }
+
+  char line[256];
+  snprintf( line, sizeof( line ), "  %-14s %9zu  %12.3g  %13.3g  %12.3g  %10.1f  %s\n", name, count,
+            max_error / radius, sum_error / std::max<size_t>( count, 1 ) / radius, max_w_error,
+            count / std::max( t1 - t0, 1e-9 ) * 1e-6, ok ? "ok" : "EXCEEDS BOUND" );
+  std::cerr << line;
+  return ok;
+}
+
+
+// Checks the quantization error bounds for the particles of input in file
+// order, in Morton order and for the aggregates of its first level of detail,
+// whose attributes are not normalized.
+static bool testQuantization( const std::string& input, const ParticleReadOptions& options )
+{
+  ParticleFrameData frame;
+  std::string error;
+  if( !readParticles( input, options, frame, error ) ) {
+    std::cerr << "Error: " << error << std::endl;
+    return false;
+  }
+
+  const float radius = options.fixed_radius;
+  std::cerr << input << ": " << frame.num_particles << ( frame.morton_order ? " particles in Morton order" : " particles" )
+            << ", radius " << radius << ", blocks of " << QUANTIZED_BLOCK_SIZE << ", "
+            << 8.0 + 2.0 * sizeof( float4 ) / QUANTIZED_BLOCK_SIZE << " instead of " << sizeof( float4 )
+            << " bytes per particle\n"
+            << "  positions      particles  max error (r)  mean error (r)  max w error  M/s encode\n";
+  bool ok = testQuantization( "file order", frame.positions, frame.num_particles, radius );
+  sortParticles( frame );
+  ok = testQuantization( "Morton order", frame.positions, frame.num_particles, radius ) && ok;
+  buildParticleLod( frame, radius, 1 );
+  if( !frame.lod_levels.empty() )
+    ok = testQuantization( "LOD level 1", frame.lod_levels[0].positions.data(),
+                           frame.lod_levels[0].positions.size(), radius ) && ok;
+
+  // Degenerate blocks: coincident particles and a single particle
+  std::vector<float4> degenerate( QUANTIZED_BLOCK_SIZE + 1, make_float4( 1.0f, -2.0f, 3.0f, 0.5f ) );
+  ok = testQuantization( "coincident", degenerate.data(), degenerate.size(), radius ) && ok;
+  std::cerr << "  quantization " << ( ok ? "within bounds" : "EXCEEDS BOUNDS" ) << std::endl;
+  return ok;
+}
+
+
+// Largest and mean difference of the table of a transfer function from the
+// function itself over samples evenly spaced in [0, 1], and the largest at
+// the entries of the table, where they must agree up to rounding
+template <typename F>
+static void transferFunctionTableError( const std::vector<float4>& table, F function, float& max_error,
+                                        float& mean_error, float& entry_error )
+{
+  const int size    = static_cast<int>( table.size() );
+  const int samples = 1 << 20;
+  max_error   = 0.0f;
+  entry_error = 0.0f;
+  double sum  = 0.0;
+  for( int i = 0; i < samples; ++i ) {
+    const float  v = ( i + 0.5f ) / samples;
+    const float4 d = fabs( sampleTransferFunctionTable( table.data(), size, v ) - function( v ) );
+    const float  e = fmaxf( fmaxf( d.x, d.y ), fmaxf( d.z, d.w ) );
+    max_error = std::max( max_error, e );
+    sum += e;
+  }
+  for( int i = 0; i < size; ++i ) {
+    const float  v = float( i ) / float( size - 1 );
+    const float4 d = fabs( sampleTransferFunctionTable( table.data(), size, v ) - function( v ) );
+    entry_error = std::max( entry_error, fmaxf( fmaxf( d.x, d.y ), fmaxf( d.z, d.w ) ) );
+  }
+  mean_error = static_cast<float>( sum / samples );
+}
+
+
+// Compares the transfer function tables of the presets, and of tf_file if
+// given, with the functions they sample.  Times one thread evaluating the
+// color mapping against a table lookup, alone and followed by tf_redshift()
+// as in raygen.cu.
+static bool benchmarkTransferFunctions( const std::string& tf_file, int num_runs )
+{
+  std::vector<TransferFunctionPoint> points;
+  std::string error;
+  if( !tf_file.empty() && !readTransferFunctionFile( tf_file, points, error ) ) {
+    std::cerr << "Error: " << error << std::endl;
+    return false;
+  }
+
+  // Random samples, half of them without redshift
+  const size_t samples = 1 << 20;
+  std::vector<float2> vt( samples );
+  uint32_t seed = 1;
+  for( size_t i = 0; i < samples; ++i ) {
+    seed = seed * 1664525u + 1013904223u;
+    const float v = ( seed >> 8 ) * ( 1.0f / 16777216.0f );
+    vt[i] = make_float2( v, i % 2 ? 0.0f : 2.0f * v );
+  }
+
+  std::cerr << "Transfer function tables of " << TF_TABLE_SIZE << " entries, best of " << num_runs << ", 1 thread\n"
+            << "  tf_type  max error  mean error  entry error  mapping ns  lookup ns  tf() ns  table ns\n";
+  bool ok = true;
+  const int num_tables = TF_PRESET_COUNT + ( points.empty() ? 0 : 1 );
+  for( int tf_type = 0; tf_type < num_tables; ++tf_type ) {
+    std::vector<float4> table( TF_TABLE_SIZE );
+    const bool preset = tf_type < TF_PRESET_COUNT;
+    if( preset )
+      buildTransferFunctionTable( tf_type, TF_TABLE_SIZE, table.data() );
+    else
+      buildTransferFunctionTable( points, TF_TABLE_SIZE, table.data() );
+
+    float max_error, mean_error, entry_error;
+    if( preset )
+      transferFunctionTableError( table, [&]( float v ) { return tf_preset( v, tf_type ); }, max_error, mean_error,
+                                  entry_error );
+    else
+      transferFunctionTableError( table, [&]( float v ) { return evaluateTransferFunction( points, v ); },
+                                  max_error, mean_error, entry_error );
+    ok = ok && entry_error <= 1e-6f;
+
+    double times[4] = { 1e30, 1e30, 1e30, 1e30 };
+    float4 sum = make_float4( 0.0f );
+    for( int run = 0; run < num_runs; ++run ) {
+      for( int redshift = 0; redshift < 2; ++redshift ) {
+        double t0 = currentTime();
+        if( preset ) {
+          for( size_t i = 0; i < samples; ++i )
+            sum += tf_redshift( tf_preset( vt[i].x, tf_type ), redshift ? vt[i].y : 0.0f );
+        } else {
+          for( size_t i = 0; i < samples; ++i )
+            sum += tf_redshift( evaluateTransferFunction( points, vt[i].x ), redshift ? vt[i].y : 0.0f );
+        }
+        double t1 = currentTime();
+        for( size_t i = 0; i < samples; ++i )
+          sum += tf_redshift( sampleTransferFunctionTable( table.data(), TF_TABLE_SIZE, vt[i].x ),
+                              redshift ? vt[i].y : 0.0f );
+        double t2 = currentTime();
+        times[2 * redshift]     = std::min( times[2 * redshift], t1 - t0 );
+        times[2 * redshift + 1] = std::min( times[2 * redshift + 1], t2 - t1 );
+      }
+    }
+    // keeps the timed loops from being optimized away
+    volatile float checksum = sum.x + sum.y + sum.z + sum.w;
+    (void)checksum;
+
+    char line[256];
+    snprintf( line, sizeof( line ), "  %-7s  %9.3g  %10.3g  %11.3g  %10.2f  %9.2f  %7.2f  %8.2f\n",
+              preset ? std::to_string( tf_type ).c_str() : "file", max_error, mean_error, entry_error,
+              1e9 * times[0] / samples, 1e9 * times[1] / samples, 1e9 * times[2] / samples,
+              1e9 * times[3] / samples );
+    std::cerr << line;
+  }
+  std::cerr << "  tables " << ( ok ? "match at their entries" : "DIFFER at their entries" ) << std::endl;
+  return ok;
+}
+
+
+// Settings of the sample for the first frame of a file
+struct RenderOptions
+{
+  unsigned int  width;
+  unsigned int  height;
+  int           tf_type;       // -1 for the default of the sample
+  float         redshift;
+};
+
+
+static void writePPM( const std::string& filename, const std::vector<float4>& image, unsigned int width,
+                      unsigned int height )
+{
+  // Rows top to bottom, quantized like make_color() of helpers.h
+  std::vector<unsigned char> rgb( size_t( width ) * height * 3 );
+  for( unsigned int y = 0; y < height; ++y ) {
+    for( unsigned int x = 0; x < width; ++x ) {
+      const float4& c = image[size_t( height - 1 - y ) * width + x];
+      unsigned char* dst = &rgb[( size_t( y ) * width + x ) * 3];
+      dst[0] = static_cast<unsigned char>( fminf( fmaxf( c.x, 0.0f ), 1.0f ) * 255.99f );
+      dst[1] = static_cast<unsigned char>( fminf( fmaxf( c.y, 0.0f ), 1.0f ) * 255.99f );
+      dst[2] = static_cast<unsigned char>( fminf( fmaxf( c.z, 0.0f ), 1.0f ) * 255.99f );
+    }
+  }
+  std::ofstream out( filename.c_str(), std::ios::binary );
+  out << "P6\n" << width << " " << height << "\n255\n";
+  out.write( reinterpret_cast<const char*>( rgb.data() ), rgb.size() );
+}
+
+
+// Renders input from the initial camera of the sample with the CPU reference
+// of raygen.cu over num_runs runs and prints the time spent in each step.
+// Also renders with an exact depth sort and prints how far the sort of
+// raygen.cu is from it.  The image is written to output as a PPM file unless
+// that is empty.
+static bool renderReference( const std::string& input, const std::string& output, const ParticleReadOptions& options,
+                             const RenderOptions& render, int num_runs )
+{
+  ParticleFrameData frame;
+  std::string error;
+  if( !readParticles( input, options, frame, error ) ) {
+    std::cerr << "Error: " << error << std::endl;
+    return false;
+  }
+
+  // setParticleBounds(), setupCamera() and updateCamera() of the sample
+  const float radius = options.fixed_radius > 0.0f
+                           ? options.fixed_radius
+                           : length( make_float3( frame.stats.pmax - frame.stats.pmin ) ) /
+                                 powf( float( frame.num_particles ), 0.333333f );
+  ParticleRenderSettings settings;
+  settings.width              = render.width;
+  settings.height             = render.height;
+  settings.bbox_min           = make_float3( frame.stats.pmin ) - make_float3( radius );
+  settings.bbox_max           = make_float3( frame.stats.pmax ) + make_float3( radius );
+  settings.fixed_radius       = radius;
+  settings.lod_radius_scale   = 1.0f;
+  settings.particles_per_slab = 16.0f;
+  settings.w_scale            = 3.5f;
+  settings.opacity            = 0.5f;
+  settings.redshift           = render.redshift;
+  settings.exact_sort         = false;
+
+  const float3 center  = 0.5f * ( settings.bbox_min + settings.bbox_max );
+  const float3 extent  = settings.bbox_max - settings.bbox_min;
+  const float  max_dim = fmaxf( extent.x, extent.y );
+  settings.eye = center + make_float3( 0.0f, 0.0f, max_dim * 1.1f );
+  sutil::calculateCameraVariables( settings.eye, center, make_float3( 0.0f, 1.0f, 0.0f ), 35.0f,
+                                   float( render.width ) / float( render.height ), settings.U, settings.V,
+                                   settings.W, true );
+
+  const int tf_type = render.tf_type >= 0 ? render.tf_type : frame.signed_attribute ? 3 : 2;
+  std::vector<float4> table( TF_TABLE_SIZE );
+  buildTransferFunctionTable( tf_type, TF_TABLE_SIZE, table.data() );
+  settings.tf_table = table.data();
+
+  const ParticleBvh bvh( frame.positions, 0, frame.num_particles, radius );
+  std::cerr << input << ": " << frame.num_particles << " particles, radius " << radius << ", tf_type " << tf_type
+            << ", " << render.width << "x" << render.height << ", best of " << num_runs << ", "
+            << sutil::numWorkerThreads() << " threads\n"
+            << "  BVH of " << bvh.nodes().size() << " nodes built in " << 1000.0 * bvh.buildTime() << " ms\n";
+
+  std::vector<float4> image;
+  ParticleRenderStats stats;
+  for( int run = 0; run < num_runs; ++run ) {
+    ParticleRenderStats run_stats;
+    renderParticleVolume( bvh, frame.positions, 0, settings, image, run_stats );
+    if( run == 0 || run_stats.render_time < stats.render_time )
+      stats = run_stats;
+  }
+
+  // Shares of the thread time, which includes the timer calls
+  const double thread_time = stats.traversal_time + stats.sort_time + stats.integrate_time;
+  char line[512];
+  snprintf( line, sizeof( line ),
+            "  render %.1f ms, %.3g rays/s, %.3g samples/s\n"
+            "  %.3g slabs, %.2f samples per slab, %.2f%% of slabs overflow the buffer of %d\n"
+            "  traversal %.1f%% (%.3g samples/s per thread), sort %.1f%% (%.3g samples/s per thread), "
+            "integration %.1f%% of %.3g thread seconds\n",
+            1000.0 * stats.render_time, stats.rays / stats.render_time, stats.samples / stats.render_time,
+            double( stats.slabs ), double( stats.samples ) / std::max<uint64_t>( stats.slabs, 1 ),
+            100.0 * stats.overflows / std::max<uint64_t>( stats.slabs, 1 ), PARTICLE_BUFFER_SIZE,
+            100.0 * stats.traversal_time / thread_time, stats.samples / stats.traversal_time,
+            100.0 * stats.sort_time / thread_time, stats.samples / stats.sort_time,
+            100.0 * stats.integrate_time / thread_time, thread_time );
+  std::cerr << line;
+
+  // The same slabs sorted exactly
+  std::vector<float4> exact;
+  ParticleRenderStats exact_stats;
+  settings.exact_sort = true;
+  renderParticleVolume( bvh, frame.positions, 0, settings, exact, exact_stats );
+  double sum = 0.0;
+  float  max_difference = 0.0f;
+  for( size_t i = 0; i < image.size(); ++i ) {
+    const float4 d = fabs( image[i] - exact[i] );
+    const float  e = fmaxf( fmaxf( d.x, d.y ), d.z );
+    max_difference = std::max( max_difference, e );
+    sum += double( e ) * e;
+  }
+  snprintf( line, sizeof( line ),
+            "  sort of raygen.cu leaves %.2f%% of slabs out of depth order, "
+            "rgb differs from an exact sort by %.3g rms, %.3g max\n",
+            100.0 * stats.unsorted / std::max<uint64_t>( stats.slabs, 1 ),
+            std::sqrt( sum / std::max<size_t>( image.size(), 1 ) ), max_difference );
+  std::cerr << line;
+
+  if( !output.empty() ) {
+    writePPM( output, image, render.width, render.height );
+    std::cerr << "  wrote " << output << std::endl;
+  }
+  return true;
+}
+
+
+static bool hasExtension( const std::string& filename, const std::string& extension )
+{
+  return filename.size() > extension.size() &&
+         filename.compare( filename.size() - extension.size(), extension.size(), extension ) == 0;
+}
+
+
+static bool convert( const std::string& input, const std::string& output, const ParticleReadOptions& options,
+                     bool sort, size_t brick_particles )
+{
+  ParticleFrameData frame;
+  std::string error;
+
+  // Particle files are mapped, so a dataset converted once can be bricked
+  // without holding it in memory
+  double t0 = currentTime();
+  const bool mapped = hasExtension( input, std::string( "." ) + PARTICLE_FILE_EXTENSION );
+  const bool ok = mapped ? readParticleFile( input, options.max_particles, frame, error )
+                : hasExtension( input, ".raw" ) ? readRawParticles( input, options, frame, error )
+                                                : readTextParticles( input, options, frame, error );
+  if( !ok ) {
+    std::cerr << "Error: " << error << std::endl;
+    return false;
+  }
+  double t1 = currentTime();
+  if( !mapped )
+    normalizeParticleAttributes( frame );
+  if( sort && !brick_particles )
+    sortParticles( frame );
+  double t2 = currentTime();
+  const bool written = brick_particles ? writeParticleBrickFile( output, frame, brick_particles )
+                                       : writeParticleFile( output, frame );
+  if( !written ) {
+    std::cerr << "Error: can't write '" << output << "'" << std::endl;
+    return false;
+  }
+  double t3 = currentTime();
+  size_t num_bricks = 0;
+  if( brick_particles ? !verifyParticleBrickFile( output, frame, num_bricks ) : !verifyParticleFile( output, frame ) )
+    return false;
+  double t4 = currentTime();
+
+  const float4& pmin = frame.stats.pmin;
+  const float4& pmax = frame.stats.pmax;
+  std::cerr << input << " -> " << output << "\n"
+            << "  " << frame.num_particles << " particles"
+            << ( frame.channels & PARTICLE_VELOCITIES ? ", velocities" : "" )
+            << ( frame.channels & PARTICLE_COLORS     ? ", colors"     : "" )
+            << ( frame.channels & PARTICLE_RADII      ? ", radii"      : "" )
+            << ( frame.morton_order || brick_particles ? ", Morton order" : "" ) << "\n";
+  if( brick_particles )
+    std::cerr << "  " << num_bricks << " bricks of up to " << brick_particles << " particles\n";
+  std::cerr << "  pmin " << pmin.x << " " << pmin.y << " " << pmin.z << " " << pmin.w << "\n"
+            << "  pmax " << pmax.x << " " << pmax.y << " " << pmax.z << " " << pmax.w << "\n"
+            << "  attribute " << ( frame.signed_attribute ? "signed" : "unsigned" )
+            << ", w = a * " << frame.attribute_scale << " + " << frame.attribute_offset << "\n"
+            << "  read " << t1 - t0 << " s, statistics, normalization"
+            << ( sort && !brick_particles ? " and sort " : " " ) << t2 - t1 << " s (" << sutil::numWorkerThreads()
+            << " threads), " << ( brick_particles ? "sort and write " : "write " ) << t3 - t2
+            << " s, verify " << t4 - t3 << " s" << std::endl;
+  return true;
+}
+
+
+//------------------------------------------------------------------------------
+//
+// Main
+//
+//------------------------------------------------------------------------------
+
+void printUsageAndExit( const std::string& argv0 )
+{
+    std::cerr << "\nUsage: " << argv0 << " [options] <input> <output>\n"
+              << "       " << argv0 << " [options] --parse-bench <runs> <input>\n"
+              << "       " << argv0 << " [options] --sort-bench <runs> <input>\n"
+              << "       " << argv0 << " [options] --quantize-test <input>\n"
+              << "       " << argv0 << " --tf-bench <runs> [<tf_file>]\n"
+              << "       " << argv0 << " [options] --render <runs> <input> [<output.ppm>]\n";
+    std::cerr <<
+        "Converts a text or raw ('*.raw') particle file of optixParticleVolumes to a binary '*." << PARTICLE_FILE_EXTENSION << "' file,\n"
+        "or a text, raw or '*." << PARTICLE_FILE_EXTENSION << "' file to a bricked '*." << PARTICLE_BRICK_FILE_EXTENSION << "' file.\n"
+        "App Options:\n"
+        "  -h | --help                         Print this usage message and exit.\n"
+        "  --colors                            Text lines have r g b after the velocity.\n"
+        "  --radius                            Text lines end with a per particle radius.\n"
+        "  --fixed_radius <float>              Radius of particles without one for --quantize-test and --render\n"
+        "                                      (0 = that of the sample for --render). Default = 100.\n"
+        "  --max_particles <int M>             Only convert the first M particles of the dataset.\n"
+        "  --sort                              Store the particles sorted along a Morton curve.\n"
+        "  --bricks <int N>                    Write a bricked file of spatial bricks of at most N particles\n"
+        "                                      (always in Morton order).\n"
+        "  --parse-bench <int N>               Instead of converting, time the text parser over N runs on <input>.\n"
+        "  --quantize-test                     Instead of converting, check the error bounds of quantized positions.\n"
+        "  --sort-bench <int N>                Instead of converting, time the Morton sort over N runs for\n"
+        "                                      growing subsets and tiled copies of <input>.\n"
+        "  --tf-bench <int N>                  Instead of converting, check the transfer function tables of the presets\n"
+        "                                      and of an optional <tf_file>, and time them against tf() over N runs.\n"
+        "  --render <int N>                    Instead of converting, render <input> with the CPU reference of the\n"
+        "                                      sample over N runs, and time its traversal and sorting.\n"
+        "  --dim=<width>x<height>              Image size of --render. Default = 1024x768.\n"
+        "  --tf_type <int>                     Transfer function preset of --render. Default = that of the sample.\n"
+        "  --redshift <float>                  Redshift scale of --render. Default = 0.\n"
+        << std::endl;
+
+    exit(1);
+}
+
+
+int main( int argc, char** argv )
+{
+    ParticleReadOptions options = { 0, false, false, 100.f };
+    int parse_bench_runs = 0;
+    int sort_bench_runs = 0;
+    int tf_bench_runs = 0;
+    int render_runs = 0;
+    RenderOptions render = { 1024u, 768u, -1, 0.f };
+    bool quantize_test = false;
+    bool sort = false;
+    size_t brick_particles = 0;
+    std::vector<std::string> files;
+    for( int i=1; i<argc; ++i )
+    {
+        const std::string arg( argv[i] );
+
+        if( arg == "-h" || arg == "--help" )
+        {
+            printUsageAndExit( argv[0] );
+        }
+        else if( arg == "--colors" )
+        {
+            options.colors = true;
+        }
+        else if( arg == "--radius" )
+        {
+            options.radii = true;
+        }
+        else if( arg == "--sort" )
+        {
+            sort = true;
+        }
+        else if( arg == "--quantize-test" )
+        {
+            quantize_test = true;
+        }
+        else if( arg.compare( 0, 6, "--dim=" ) == 0 )
+        {
+            if( sscanf( arg.c_str() + 6, "%ux%u", &render.width, &render.height ) != 2 ||
+                render.width == 0 || render.height == 0 )
+            {
+                std::cerr << "Option '--dim' expects <width>x<height>.\n";
+                printUsageAndExit( argv[0] );
+            }
+        }
+        else if( arg == "--fixed_radius" || arg == "--max_particles" || arg == "--parse-bench" ||
+                 arg == "--sort-bench" || arg == "--bricks" || arg == "--tf-bench" || arg == "--render" ||
+                 arg == "--tf_type" || arg == "--redshift" )
+        {
+            if( i == argc-1 )
+            {
+                std::cerr << "Option '" << arg << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            if( arg == "--fixed_radius" )
+                options.fixed_radius = (float) atof( argv[++i] );
+            else if( arg == "--max_particles" )
+                options.max_particles = static_cast<size_t>( atoll( argv[++i] ) );
+            else if( arg == "--parse-bench" )
+                parse_bench_runs = std::max( 1, atoi( argv[++i] ) );
+            else if( arg == "--bricks" )
+                brick_particles = static_cast<size_t>( std::max( 1ll, atoll( argv[++i] ) ) );
+            else if( arg == "--tf-bench" )
+                tf_bench_runs = std::max( 1, atoi( argv[++i] ) );
+            else if( arg == "--render" )
+                render_runs = std::max( 1, atoi( argv[++i] ) );
+            else if( arg == "--tf_type" )
+                render.tf_type = std::min( std::max( atoi( argv[++i] ), 0 ), TF_PRESET_COUNT - 1 );
+            else if( arg == "--redshift" )
+                render.redshift = (float) atof( argv[++i] );
+            else
+                sort_bench_runs = std::max( 1, atoi( argv[++i] ) );
+        }
+        else if( arg.size() > 1 && arg[0] == '-' )
+        {
+            std::cerr << "Unknown option '" << arg << "'\n";
+            printUsageAndExit( argv[0] );
+        }
+        else
+        {
+            files.push_back( arg );
+        }
+    }
+    if( parse_bench_runs > 0 && files.size() == 1 )
+        return benchmarkTextParser( files[0], options, parse_bench_runs ) ? 0 : 1;
+    if( quantize_test && files.size() == 1 )
+        return testQuantization( files[0], options ) ? 0 : 1;
+    if( sort_bench_runs > 0 && files.size() == 1 )
+        return benchmarkSort( files[0], options, sort_bench_runs ) ? 0 : 1;
+    if( tf_bench_runs > 0 && files.size() <= 1 )
+        return benchmarkTransferFunctions( files.empty() ? std::string() : files[0], tf_bench_runs ) ? 0 : 1;
+    if( render_runs > 0 && ( files.size() == 1 || files.size() == 2 ) )
+        return renderReference( files[0], files.size() == 2 ? files[1] : std::string(), options, render,
+                                render_runs ) ? 0 : 1;
+    if( files.size() != 2 )
+        printUsageAndExit( argv[0] );
+
+    return convert( files[0], files[1], options, sort, brick_particles ) ? 0 : 1;
+}
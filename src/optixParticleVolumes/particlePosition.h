@@ -0,0 +1,54 @@
+/* 
+* Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+*  * Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+*  * Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*  * Neither the name of NVIDIA CORPORATION nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+* PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+* CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+* PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+* PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+* OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <optix.h>
+#include <optixu/optixu_math_namespace.h>
+#include "commonStructs.h"
+
+// Particle centers in xyz and attributes in w, either as floats or quantized
+// (see ParticleQuantize.h).  Exactly one of the two position buffers is
+// non-empty.
+rtBuffer<float4>    positions_buffer;
+rtBuffer<ushort4>   quantized_positions_buffer;
+rtBuffer<float4>    quantized_blocks_buffer;    // Origin and step of each block of QUANTIZED_BLOCK_SIZE particles
+
+
+static __device__ __inline__ optix::float4 particle_position( int idx )
+{
+    if( quantized_positions_buffer.size() == 0 )
+        return positions_buffer[idx];
+
+    const ushort4 q = quantized_positions_buffer[idx];
+    const int block = 2 * ( idx / QUANTIZED_BLOCK_SIZE );
+    const optix::float4 origin = quantized_blocks_buffer[block];
+    const optix::float4 step   = quantized_blocks_buffer[block + 1];
+    return optix::make_float4( origin.x + step.x * float( q.x ), origin.y + step.y * float( q.y ),
+                               origin.z + step.z * float( q.z ), origin.w + step.w * float( q.w ) );
+}
@@ -32,11 +32,12 @@
 #include "random.h"
 #include "commonStructs.h"
 #include "transferFunction.h"
+#include "particlePosition.h"
 
 
 using namespace optix;
 
-rtBuffer<float4>    positions_buffer;
+rtBuffer<float>     radius_scales_buffer;    // Per primitive, empty unless a coarser level of detail is used
 
 rtDeclareVariable(float3,        eye, , );
 rtDeclareVariable(float3,        U, , );
@@ -52,7 +53,9 @@ rtDeclareVariable(unsigned int,  frame, , );
 rtDeclareVariable(uint2,         launch_index, rtLaunchIndex, );
 
 rtDeclareVariable(int,           tf_type, ,  );
+rtTextureSampler<float4, 2>      tf_table;                // Row tf_type is sampled instead of tf_preset()
 rtDeclareVariable(float,         fixed_radius, ,  );
+rtDeclareVariable(float,         lod_radius_scale, ,  );    // Mean radius_scales_buffer, 1 at full detail
 rtDeclareVariable(float3,        bbox_min, , );
 rtDeclareVariable(float3,        bbox_max, , );
 
@@ -90,7 +93,8 @@ RT_PROGRAM void raygen_program()
   float tenter = fmaxf(0.f, fmaxf(tmin.x, fmaxf(tmin.y, tmin.z)));
   float texit = fminf(tmax.x, fminf(tmax.y, tmax.z));
 
-  float slab_spacing = PARTICLE_BUFFER_SIZE * particlesPerSlab * fixed_radius;
+  float slab_spacing = PARTICLE_BUFFER_SIZE * particlesPerSlab * fixed_radius * lod_radius_scale;
+  const bool lod = radius_scales_buffer.size() > 0;
 
   float3 result = make_float3(0);
   float result_alpha = 0.f;
@@ -168,11 +172,14 @@ RT_PROGRAM void raygen_program()
           int idx = __float_as_int(prd.particles[i].y);
           float3 hit_sample = ray.origin + ray.direction * trbf;
 
-          float4 pos = positions_buffer[idx];
+          float4 pos = particle_position(idx);
           float3 hit_normal = make_float3(pos.x, pos.y, pos.z) - hit_sample;
           float drbf = length(hit_normal) * inv_fixed_radius_scale;
+          if (lod)
+            drbf /= radius_scales_buffer[idx];
           drbf = fmaxf(0.f, fminf(1.f, wScale * pos.w * exp(-drbf*drbf)));
-          float4 color_sample = tf(drbf, trbf * redshiftScale, tf_type);
+          float4 color_sample = tf_redshift(tex2D(tf_table, drbf * (TF_TABLE_SIZE - 1) + 0.5f, tf_type + 0.5f),
+                                            trbf * redshiftScale);
 
           float alpha = color_sample.w * opacity;
           float alpha_1msa = alpha * (1.0 - result_alpha);
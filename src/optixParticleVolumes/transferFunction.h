@@ -3,17 +3,19 @@
 
 #include <optixu/optixu_math_namespace.h>
 
-inline __device__ float4 lerp4f(float4 a, float4 b, float c)
+inline RT_HOSTDEVICE float4 lerp4f(float4 a, float4 b, float c)
 {
     return a * (1.f - c) + b * c;
 }
 
-inline __device__ float lerp1f(float a, float b, float c)
+inline RT_HOSTDEVICE float lerp1f(float a, float b, float c)
 {
     return a * (1.f - c) + b * c;
 }
 
-inline __device__ float4 tf(float v, float t, const int tf_type)
+// Preset color mapping of tf_type for v in [0, 1].  The device samples it from
+// the tables built by TransferFunctionTable.h rather than evaluating it.
+inline RT_HOSTDEVICE float4 tf_preset(float v, const int tf_type)
 {
   float4 color;
 
@@ -45,6 +47,12 @@ inline __device__ float4 tf(float v, float t, const int tf_type)
     color = lerp4f( make_float4(0,0,1,0), make_float4(1,0,0,1), v);
   }
 
+  return color;
+}
+
+// Shifts the rgb of color for depth t, keeping its alpha
+inline RT_HOSTDEVICE float4 tf_redshift(float4 color, float t)
+{
   //redshift
 #if 1
   if (t > 0.f)
@@ -60,5 +68,9 @@ inline __device__ float4 tf(float v, float t, const int tf_type)
 #endif
 
   return color;
+}
 
+inline RT_HOSTDEVICE float4 tf(float v, float t, const int tf_type)
+{
+  return tf_redshift(tf_preset(v, tf_type), t);
 }
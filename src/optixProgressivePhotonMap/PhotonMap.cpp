@@ -0,0 +1,720 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "PhotonMap.h"
+#include "select.h"
+
+#include <Parallel.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <vector>
+
+using namespace optix;
+
+
+//------------------------------------------------------------------------------
+//
+//  Helpers
+//
+//------------------------------------------------------------------------------
+
+// Seconds since an arbitrary epoch.  Not sutil::currentTime, so that host only
+// tools can use this file without linking sutil.
+static double currentTime()
+{
+  return std::chrono::duration<double>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+
+static int max_component(float3 a)
+{
+  if(a.x > a.y) {
+    if(a.x > a.z) {
+      return 0;
+    } else {
+      return 2;
+    }
+  } else {
+    if(a.y > a.z) {
+      return 1;
+    } else {
+      return 2;
+    }
+  }
+}
+
+
+// Photons per work item for the parallel loops of the photon map build.
+const int KD_CHUNK_SIZE = 16384;
+
+static int numChunks( int count )
+{
+  return ( count + KD_CHUNK_SIZE - 1 ) / KD_CHUNK_SIZE;
+}
+
+
+unsigned int collectValidPhotons( PhotonRecord* photons, unsigned int num_photons, PhotonRecord** valid )
+{
+  const int num_chunks = numChunks( static_cast<int>( num_photons ) );
+  std::vector<unsigned int> chunk_valid( num_chunks );
+  sutil::parallelFor( num_chunks, [&]( size_t c )
+  {
+    const unsigned int chunk_end = std::min( num_photons, static_cast<unsigned int>( ( c + 1 ) * KD_CHUNK_SIZE ) );
+    unsigned int n = 0;
+    for( unsigned int i = static_cast<unsigned int>( c * KD_CHUNK_SIZE ); i < chunk_end; ++i ) {
+      if( photons[i].energy != 0u ) ++n;
+    }
+    chunk_valid[c] = n;
+  } );
+  unsigned int valid_photons = 0;
+  for( int c = 0; c < num_chunks; ++c ) {
+    const unsigned int n = chunk_valid[c];
+    chunk_valid[c] = valid_photons;
+    valid_photons += n;
+  }
+  sutil::parallelFor( num_chunks, [&]( size_t c )
+  {
+    const unsigned int chunk_end = std::min( num_photons, static_cast<unsigned int>( ( c + 1 ) * KD_CHUNK_SIZE ) );
+    unsigned int n = chunk_valid[c];
+    for( unsigned int i = static_cast<unsigned int>( c * KD_CHUNK_SIZE ); i < chunk_end; ++i ) {
+      if( photons[i].energy != 0u ) {
+        valid[n++] = &photons[i];
+      }
+    }
+  } );
+  return valid_photons;
+}
+
+
+void computePhotonBounds( PhotonRecord** photons, unsigned int num_photons, float3& bbmin, float3& bbmax )
+{
+  const int num_chunks = numChunks( static_cast<int>( num_photons ) );
+  std::vector<float3> chunk_bounds( 2 * num_chunks );
+  sutil::parallelFor( num_chunks, [&]( size_t c )
+  {
+    const unsigned int chunk_end = std::min( num_photons, static_cast<unsigned int>( ( c + 1 ) * KD_CHUNK_SIZE ) );
+    float3 chunk_min = make_float3(  std::numeric_limits<float>::max() );
+    float3 chunk_max = make_float3( -std::numeric_limits<float>::max() );
+    for( unsigned int i = static_cast<unsigned int>( c * KD_CHUNK_SIZE ); i < chunk_end; ++i ) {
+      float3 position = (*photons[i]).position;
+      chunk_min = fminf(chunk_min, position);
+      chunk_max = fmaxf(chunk_max, position);
+    }
+    chunk_bounds[2*c+0] = chunk_min;
+    chunk_bounds[2*c+1] = chunk_max;
+  } );
+  bbmin = make_float3(  std::numeric_limits<float>::max() );
+  bbmax = make_float3( -std::numeric_limits<float>::max() );
+  for( int c = 0; c < num_chunks; ++c ) {
+    bbmin = fminf(bbmin, chunk_bounds[2*c+0]);
+    bbmax = fmaxf(bbmax, chunk_bounds[2*c+1]);
+  }
+}
+
+
+//------------------------------------------------------------------------------
+//
+//  kd-tree
+//
+//------------------------------------------------------------------------------
+
+void clearKDTree( PhotonRecord* kd_tree, unsigned int size )
+{
+  sutil::parallelFor( numChunks( static_cast<int>( size ) ), [&]( size_t c )
+  {
+    const unsigned int chunk_end = std::min( size, static_cast<unsigned int>( ( c + 1 ) * KD_CHUNK_SIZE ) );
+    for( unsigned int i = static_cast<unsigned int>( c * KD_CHUNK_SIZE ); i < chunk_end; ++i ) {
+      kd_tree[i].energy = 0u;
+    }
+  } );
+}
+
+
+bool photonCmpX( PhotonRecord* r1, PhotonRecord* r2 ) { return r1->position.x < r2->position.x; }
+bool photonCmpY( PhotonRecord* r1, PhotonRecord* r2 ) { return r1->position.y < r2->position.y; }
+bool photonCmpZ( PhotonRecord* r1, PhotonRecord* r2 ) { return r1->position.z < r2->position.z; }
+
+// Subtrees with fewer photons than this are always built on a single thread.
+const int KD_MIN_TASK_SIZE = 4096;
+
+// Buckets used to narrow down the median in parallelSelect.
+const int KD_SELECT_BINS = 1024;
+
+
+// Running mean and sum of squared differences (Welford), mergeable so that
+// chunks of a large node can be accumulated in parallel.
+struct PhotonMoments
+{
+  float  n;
+  float3 mean;
+  float3 diff2;
+};
+
+static PhotonMoments photonMoments( PhotonRecord** photons, int start, int end )
+{
+  float3 mean  = make_float3( 0.0f ); 
+  float3 diff2 = make_float3( 0.0f );
+  for(int i = start; i < end; ++i) {
+    float3 x     = photons[i]->position;
+    float3 delta = x - mean;
+    float3 n_inv = make_float3( 1.0f / ( static_cast<float>( i - start ) + 1.0f ) );
+    mean = mean + delta * n_inv;
+    diff2 += delta*( x - mean );
+  }
+  PhotonMoments m = { static_cast<float>( end - start ), mean, diff2 };
+  return m;
+}
+
+static PhotonMoments mergeMoments( const PhotonMoments& a, const PhotonMoments& b )
+{
+  if( a.n == 0.0f ) return b;
+  if( b.n == 0.0f ) return a;
+  const float  n     = a.n + b.n;
+  const float3 delta = b.mean - a.mean;
+  PhotonMoments m = { n, a.mean + delta * ( b.n / n ), a.diff2 + b.diff2 + delta*delta * ( a.n * b.n / n ) };
+  return m;
+}
+
+
+static int chooseSplitAxis( PhotonRecord** photons, int start, int end, int depth, SplitChoice split_choice,
+                            float3 bbmin, float3 bbmax, bool parallel )
+{
+  int axis;
+  switch(split_choice) {
+  case RoundRobin:
+    {
+      axis = depth%3;
+    }
+    break;
+  case HighestVariance:
+    {
+      PhotonMoments moments;
+      const int num_chunks = numChunks( end - start );
+      if( parallel && num_chunks > 1 ) {
+        std::vector<PhotonMoments> chunk_moments( num_chunks );
+        sutil::parallelFor( num_chunks, [&]( size_t c )
+        {
+          const int chunk_start = start + static_cast<int>( c ) * KD_CHUNK_SIZE;
+          chunk_moments[c] = photonMoments( photons, chunk_start, std::min( end, chunk_start + KD_CHUNK_SIZE ) );
+        } );
+        moments = chunk_moments[0];
+        for( int c = 1; c < num_chunks; ++c )
+          moments = mergeMoments( moments, chunk_moments[c] );
+      } else {
+        moments = photonMoments( photons, start, end );
+      }
+      float3 n_inv = make_float3( 1.0f / ( static_cast<float>(end-start) - 1.0f ) );
+      float3 variance = moments.diff2 * n_inv;
+      axis = max_component(variance);
+    }
+    break;
+  case LongestDim:
+    {
+      float3 diag = bbmax-bbmin;
+      axis = max_component(diag);
+    }
+    break;
+  default:
+    axis = -1;
+    std::cerr << "Unknown SplitChoice " << split_choice << " at "<<__FILE__<<":"<<__LINE__<<"\n";
+    exit(2);
+    break;
+  }
+  return axis;
+}
+
+
+// Same contract as select<>() from select.h for the range [start, end): on
+// return photons[median] is the photon that sorts to that position along
+// 'axis', with no larger photons before it and no smaller ones after it.
+// Large ranges are first bucketed by coordinate in parallel, then the bucket
+// holding the median is moved to the middle and finished with select<>().
+template<int axis>
+static void parallelSelect( PhotonRecord** photons, int start, int end, int median, PhotonRecord** scratch )
+{
+  const int count      = end - start;
+  const int num_chunks = numChunks( count );
+  if( num_chunks <= 1 ) {
+    select<PhotonRecord*, axis>( &photons[start], 0, count-1, median-start );
+    return;
+  }
+
+  // Coordinate range
+  std::vector<float2> chunk_range( num_chunks );
+  sutil::parallelFor( num_chunks, [&]( size_t c )
+  {
+    const int chunk_start = start + static_cast<int>( c ) * KD_CHUNK_SIZE;
+    const int chunk_end   = std::min( end, chunk_start + KD_CHUNK_SIZE );
+    float2 range = make_float2( std::numeric_limits<float>::max(), -std::numeric_limits<float>::max() );
+    for( int i = chunk_start; i < chunk_end; ++i ) {
+      range.x = fminf( range.x, ElemIndex( photons[i], axis ) );
+      range.y = fmaxf( range.y, ElemIndex( photons[i], axis ) );
+    }
+    chunk_range[c] = range;
+  } );
+  float lo = chunk_range[0].x;
+  float hi = chunk_range[0].y;
+  for( int c = 1; c < num_chunks; ++c ) {
+    lo = fminf( lo, chunk_range[c].x );
+    hi = fmaxf( hi, chunk_range[c].y );
+  }
+  if( !( hi > lo ) )
+    return;  // All coordinates are equal, any order is sorted
+
+  // Bucket histogram per chunk.  Buckets are monotonic in the coordinate, so
+  // every photon in a lower bucket is strictly smaller than any in a higher one.
+  const float scale = KD_SELECT_BINS / ( hi - lo );
+  auto bucket = [&]( const PhotonRecord* p )
+  {
+    return std::min( KD_SELECT_BINS-1, static_cast<int>( ( ElemIndex( p, axis ) - lo ) * scale ) );
+  };
+  std::vector<int> histograms( num_chunks * KD_SELECT_BINS, 0 );
+  sutil::parallelFor( num_chunks, [&]( size_t c )
+  {
+    const int chunk_start = start + static_cast<int>( c ) * KD_CHUNK_SIZE;
+    const int chunk_end   = std::min( end, chunk_start + KD_CHUNK_SIZE );
+    int* histogram = &histograms[c * KD_SELECT_BINS];
+    for( int i = chunk_start; i < chunk_end; ++i )
+      ++histogram[ bucket( photons[i] ) ];
+  } );
+
+  // Bucket containing the median
+  const int k = median - start;
+  int median_bucket = 0;
+  int num_below     = 0;
+  for( ;; ++median_bucket ) {
+    int n = 0;
+    for( int c = 0; c < num_chunks; ++c )
+      n += histograms[c * KD_SELECT_BINS + median_bucket];
+    if( num_below + n > k )
+      break;
+    num_below += n;
+  }
+
+  // Three way partition (below, in and above the median bucket) into scratch,
+  // keeping the chunk order so the result does not depend on the thread count
+  std::vector<int> offsets( 3 * num_chunks );
+  int below = 0, inside = num_below, above = 0;
+  for( int c = 0; c < num_chunks; ++c ) {
+    const int* histogram = &histograms[c * KD_SELECT_BINS];
+    int n_below = 0;
+    for( int b = 0; b < median_bucket; ++b )
+      n_below += histogram[b];
+    const int n_chunk = std::min( end, start + ( c + 1 ) * KD_CHUNK_SIZE ) - ( start + c * KD_CHUNK_SIZE );
+    offsets[3*c+0] = below;
+    offsets[3*c+1] = inside;
+    offsets[3*c+2] = above;
+    below  += n_below;
+    inside += histogram[median_bucket];
+    above  += n_chunk - n_below - histogram[median_bucket];
+  }
+  const int num_inside = inside - num_below;
+  for( int c = 0; c < num_chunks; ++c )
+    offsets[3*c+2] += inside;
+
+  sutil::parallelFor( num_chunks, [&]( size_t c )
+  {
+    const int chunk_start = start + static_cast<int>( c ) * KD_CHUNK_SIZE;
+    const int chunk_end   = std::min( end, chunk_start + KD_CHUNK_SIZE );
+    int offset[3] = { offsets[3*c+0], offsets[3*c+1], offsets[3*c+2] };
+    for( int i = chunk_start; i < chunk_end; ++i ) {
+      const int b = bucket( photons[i] );
+      const int part = b < median_bucket ? 0 : ( b == median_bucket ? 1 : 2 );
+      scratch[ offset[part]++ ] = photons[i];
+    }
+  } );
+  sutil::parallelFor( num_chunks, [&]( size_t c )
+  {
+    const int chunk_start = static_cast<int>( c ) * KD_CHUNK_SIZE;
+    const int chunk_end   = std::min( count, chunk_start + KD_CHUNK_SIZE );
+    std::copy( scratch + chunk_start, scratch + chunk_end, photons + start + chunk_start );
+  } );
+
+  select<PhotonRecord*, axis>( &photons[start + num_below], 0, num_inside-1, k - num_below );
+}
+
+
+// Places the median photon along 'axis' at photons[median] and sets its axis
+// flag.  scratch is only needed when parallel is set.
+static void selectMedian( PhotonRecord** photons, int start, int end, int median, int axis,
+                          bool parallel, PhotonRecord** scratch )
+{
+  PhotonRecord** start_addr = &(photons[start]);
+
+  switch( axis ) {
+  case 0:
+    if( parallel )
+      parallelSelect<0>( photons, start, end, median, scratch );
+    else
+      select<PhotonRecord*, 0>( start_addr, 0, end-start-1, median-start );
+    photons[median]->axis = PPM_X;
+    break;
+  case 1:
+    if( parallel )
+      parallelSelect<1>( photons, start, end, median, scratch );
+    else
+      select<PhotonRecord*, 1>( start_addr, 0, end-start-1, median-start );
+    photons[median]->axis = PPM_Y;
+    break;
+  case 2:
+    if( parallel )
+      parallelSelect<2>( photons, start, end, median, scratch );
+    else
+      select<PhotonRecord*, 2>( start_addr, 0, end-start-1, median-start );
+    photons[median]->axis = PPM_Z;
+    break;
+  }
+}
+
+
+// Child bounds for LongestDim, which splits the node bounds at the median.
+static void splitBounds( SplitChoice split_choice, int axis, float3 mid_point, float3 bbmin, float3 bbmax,
+                         float3& leftMax, float3& rightMin )
+{
+  rightMin = bbmin;
+  leftMax  = bbmax;
+  if(split_choice == LongestDim) {
+    switch( axis ) {
+      case 0:
+        rightMin.x = mid_point.x;
+        leftMax.x  = mid_point.x;
+        break;
+      case 1:
+        rightMin.y = mid_point.y;
+        leftMax.y  = mid_point.y;
+        break;
+      case 2:
+        rightMin.z = mid_point.z;
+        leftMax.z  = mid_point.z;
+        break;
+    }
+  }
+}
+
+
+void buildKDTree( PhotonRecord** photons, int start, int end, int depth, PhotonRecord* kd_tree, int current_root,
+                  SplitChoice split_choice, float3 bbmin, float3 bbmax)
+{
+  // If we have zero photons, this is a NULL node
+  if( end - start == 0 ) {
+    kd_tree[current_root].axis = PPM_NULL;
+    kd_tree[current_root].energy = 0u;
+    return;
+  }
+
+  // If we have a single photon
+  if( end - start == 1 ) {
+    photons[start]->axis = PPM_LEAF;
+    kd_tree[current_root] = *(photons[start]);
+    return;
+  }
+
+  // Choose axis to split on
+  int axis = chooseSplitAxis( photons, start, end, depth, split_choice, bbmin, bbmax, false );
+
+  int median = (start+end) / 2;
+  selectMedian( photons, start, end, median, axis, false, 0 );
+
+  float3 rightMin, leftMax;
+  splitBounds( split_choice, axis, photons[median]->position, bbmin, bbmax, leftMax, rightMin );
+
+  kd_tree[current_root] = *(photons[median]);
+  buildKDTree( photons, start, median, depth+1, kd_tree, 2*current_root+1, split_choice, bbmin,  leftMax );
+  buildKDTree( photons, median+1, end, depth+1, kd_tree, 2*current_root+2, split_choice, rightMin, bbmax );
+}
+
+
+// A subtree of the kd-tree still to be built
+struct KDTask
+{
+  int    start;
+  int    end;
+  int    depth;
+  int    root;
+  float3 bbmin;
+  float3 bbmax;
+};
+
+
+// Builds the same implicit kd-tree (children of node i at 2*i+1 and 2*i+2) as
+// buildKDTree.  Nodes with many photons are split one at a time with the
+// median select and axis statistics spread over all threads; once subtrees
+// are small enough to balance across threads, each is built by buildKDTree
+// as an independent task.
+void buildKDTreeParallel( PhotonRecord** photons, int num_photons, PhotonRecord* kd_tree,
+                          SplitChoice split_choice, float3 bbmin, float3 bbmax )
+{
+  if( sutil::numWorkerThreads() == 1 ) {
+    buildKDTree( photons, 0, num_photons, 0, kd_tree, 0, split_choice, bbmin, bbmax );
+    return;
+  }
+
+  const int task_size = std::max( KD_MIN_TASK_SIZE, num_photons / static_cast<int>( sutil::numWorkerThreads() * 2 ) );
+
+  std::vector<PhotonRecord*> scratch;
+  std::vector<KDTask> tasks;
+  std::vector<KDTask> level( 1 );
+  const KDTask root = { 0, num_photons, 0, 0, bbmin, bbmax };
+  level[0] = root;
+  while( !level.empty() ) {
+    std::vector<KDTask> next_level;
+    for( size_t i = 0; i < level.size(); ++i ) {
+      const KDTask& task = level[i];
+      if( task.end - task.start <= task_size ) {
+        tasks.push_back( task );
+        continue;
+      }
+
+      if( scratch.empty() )
+        scratch.resize( num_photons );
+
+      const int axis = chooseSplitAxis( photons, task.start, task.end, task.depth, split_choice,
+                                        task.bbmin, task.bbmax, true );
+      const int median = (task.start+task.end) / 2;
+      selectMedian( photons, task.start, task.end, median, axis, true, &scratch[0] );
+
+      float3 rightMin, leftMax;
+      splitBounds( split_choice, axis, photons[median]->position, task.bbmin, task.bbmax, leftMax, rightMin );
+
+      kd_tree[task.root] = *(photons[median]);
+      const KDTask left  = { task.start, median,   task.depth+1, 2*task.root+1, task.bbmin, leftMax   };
+      const KDTask right = { median+1,   task.end, task.depth+1, 2*task.root+2, rightMin,   task.bbmax };
+      next_level.push_back( left );
+      next_level.push_back( right );
+    }
+    level.swap( next_level );
+  }
+
+  // Largest subtrees first for better load balance
+  std::sort( tasks.begin(), tasks.end(), []( const KDTask& a, const KDTask& b )
+  {
+    return a.end - a.start > b.end - b.start;
+  } );
+  sutil::parallelFor( tasks.size(), [&]( size_t i )
+  {
+    const KDTask& task = tasks[i];
+    buildKDTree( photons, task.start, task.end, task.depth, kd_tree, task.root, split_choice, task.bbmin, task.bbmax );
+  } );
+}
+
+
+KDTreeLayout kdTreeLayoutForSize( unsigned int kd_tree_size, unsigned int block_height )
+{
+  return makeKDTreeLayout( kdFloorLog2( kd_tree_size + 1 ), block_height );
+}
+
+
+void layoutKDTree( const PhotonRecord* bfs_tree, const KDTreeLayout& layout, PhotonRecord* kd_tree )
+{
+  const unsigned int size = ( 1u << layout.height ) - 1u;
+  sutil::parallelFor( numChunks( static_cast<int>( size ) ), [&]( size_t c )
+  {
+    const unsigned int chunk_end = std::min( size, static_cast<unsigned int>( ( c + 1 ) * KD_CHUNK_SIZE ) );
+    for( unsigned int i = static_cast<unsigned int>( c * KD_CHUNK_SIZE ); i < chunk_end; ++i )
+      kd_tree[ kdNodeOffset( i, layout ) ] = bfs_tree[i];
+  } );
+}
+
+
+//------------------------------------------------------------------------------
+//
+//  Hash grid
+//
+//------------------------------------------------------------------------------
+
+// Cells per axis are limited so that grid coordinates stay far from int overflow.
+const float GRID_MAX_CELLS_PER_AXIS = static_cast<float>( 1 << 20 );
+
+void buildPhotonGrid( PhotonRecord** photons, unsigned int num_photons, float max_radius2, unsigned int hash_size,
+                      PhotonRecord* grid_photons, unsigned int* cell_starts, PhotonGrid& grid )
+{
+  float3 bbmin, bbmax;
+  computePhotonBounds( photons, num_photons, bbmin, bbmax );
+  if( num_photons == 0 )
+    bbmin = bbmax = make_float3( 0.0f );
+
+  const float3 extent = bbmax - bbmin;
+  float cell_size = 2.0f * sqrtf( max_radius2 );
+  cell_size = fmaxf( cell_size, fmaxf( extent ) / GRID_MAX_CELLS_PER_AXIS );
+  if( !( cell_size > 0.0f ) )
+    cell_size = 1.0f;
+
+  grid.origin        = bbmin;
+  grid.inv_cell_size = 1.0f / cell_size;
+  grid.hash_mask     = hash_size - 1;
+
+  //
+  // Stable counting sort by bucket: count, scan, then scatter.  The photons
+  // are split into one contiguous slice per worker, and each slice counts
+  // into and scatters from its own row of counts.  The scan runs over
+  // buckets, then slices, so every bucket holds its photons in input order
+  // whatever the number of slices or the thread timing.
+  //
+  const unsigned int num_slices = std::max( 1u, std::min( sutil::numWorkerThreads(),
+                                                          static_cast<unsigned int>( numChunks( static_cast<int>( num_photons ) ) ) ) );
+  std::unique_ptr<unsigned int[]> counts( new unsigned int[ static_cast<size_t>( num_slices ) * hash_size ] );
+  std::vector<unsigned int> buckets( num_photons );
+  auto sliceBegin = [&]( size_t s ) {
+    return static_cast<unsigned int>( static_cast<unsigned long long>( num_photons ) * s / num_slices );
+  };
+  sutil::parallelFor( num_slices, [&]( size_t s )
+  {
+    unsigned int* slice_counts = counts.get() + s * hash_size;
+    std::fill( slice_counts, slice_counts + hash_size, 0u );
+    const unsigned int slice_end = sliceBegin( s + 1 );
+    for( unsigned int i = sliceBegin( s ); i < slice_end; ++i ) {
+      const float3 p = photons[i]->position;
+      const optix::uint bucket = photonGridHash( photonGridCoord( p.x, grid.origin.x, grid.inv_cell_size ),
+                                                 photonGridCoord( p.y, grid.origin.y, grid.inv_cell_size ),
+                                                 photonGridCoord( p.z, grid.origin.z, grid.inv_cell_size ),
+                                                 grid.hash_mask );
+      buckets[i] = bucket;
+      ++slice_counts[bucket];
+    }
+  } );
+
+  // Exclusive scan of the counts in chunks of buckets: chunk sums, their
+  // prefix, then the chunk local scans.  Leaves counts holding the scatter
+  // cursor of each slice in each bucket.
+  const int num_scan_chunks = numChunks( static_cast<int>( hash_size ) );
+  std::vector<unsigned int> chunk_offsets( num_scan_chunks );
+  sutil::parallelFor( num_scan_chunks, [&]( size_t c )
+  {
+    const unsigned int chunk_end = std::min( hash_size, static_cast<unsigned int>( ( c + 1 ) * KD_CHUNK_SIZE ) );
+    unsigned int sum = 0;
+    for( unsigned int s = 0; s < num_slices; ++s ) {
+      const unsigned int* slice_counts = counts.get() + static_cast<size_t>( s ) * hash_size;
+      for( unsigned int i = static_cast<unsigned int>( c * KD_CHUNK_SIZE ); i < chunk_end; ++i )
+        sum += slice_counts[i];
+    }
+    chunk_offsets[c] = sum;
+  } );
+  unsigned int total = 0;
+  for( int c = 0; c < num_scan_chunks; ++c ) {
+    const unsigned int sum = chunk_offsets[c];
+    chunk_offsets[c] = total;
+    total += sum;
+  }
+  sutil::parallelFor( num_scan_chunks, [&]( size_t c )
+  {
+    const unsigned int chunk_end = std::min( hash_size, static_cast<unsigned int>( ( c + 1 ) * KD_CHUNK_SIZE ) );
+    unsigned int offset = chunk_offsets[c];
+    for( unsigned int i = static_cast<unsigned int>( c * KD_CHUNK_SIZE ); i < chunk_end; ++i ) {
+      cell_starts[i] = offset;
+      for( unsigned int s = 0; s < num_slices; ++s ) {
+        unsigned int& count = counts[ static_cast<size_t>( s ) * hash_size + i ];
+        const unsigned int n = count;
+        count = offset;
+        offset += n;
+      }
+    }
+  } );
+  cell_starts[hash_size] = total;
+
+  sutil::parallelFor( num_slices, [&]( size_t s )
+  {
+    unsigned int* cursors = counts.get() + s * hash_size;
+    const unsigned int slice_end = sliceBegin( s + 1 );
+    for( unsigned int i = sliceBegin( s ); i < slice_end; ++i )
+      grid_photons[ cursors[ buckets[i] ]++ ] = *photons[i];
+  } );
+}
+
+
+//------------------------------------------------------------------------------
+//
+//  Complete builds
+//
+//------------------------------------------------------------------------------
+
+unsigned int buildPhotonMapData( PhotonRecord* photons_data, unsigned int num_photons, PhotonRecord* photon_map_data,
+                                 unsigned int photon_map_size, SplitChoice split_choice, const KDTreeLayout& layout,
+                                 PhotonMapTimings& timings )
+{
+  double t0 = currentTime();
+
+  // The build writes the breadth-first layout, other layouts are copied from it
+  std::vector<PhotonRecord> bfs_tree;
+  PhotonRecord* kd_tree = photon_map_data;
+  if( layout.block_height != 0 ) {
+    bfs_tree.resize( photon_map_size );
+    kd_tree = bfs_tree.data();
+  }
+  clearKDTree( kd_tree, photon_map_size );
+
+  // Push all valid photons to front of list
+  std::vector<PhotonRecord*> temp_photons( num_photons );
+  const unsigned int valid_photons = collectValidPhotons( photons_data, num_photons, temp_photons.data() );
+
+  // Make sure we aren't at most 1 less than power of 2
+  const unsigned int num_tree_photons = std::min( valid_photons, photon_map_size );
+
+  float3 bbmin = make_float3(0.0f);
+  float3 bbmax = make_float3(0.0f);
+  if( split_choice == LongestDim ) {
+    // Compute the bounds of the photons
+    computePhotonBounds( temp_photons.data(), num_tree_photons, bbmin, bbmax );
+  }
+
+  double t1 = currentTime();
+  timings.prepare = t1 - t0;
+  t0 = t1;
+
+  // Now build KD tree
+  buildKDTreeParallel( temp_photons.data(), num_tree_photons, kd_tree, split_choice, bbmin, bbmax );
+  if( layout.block_height != 0 )
+    layoutKDTree( kd_tree, layout, photon_map_data );
+
+  timings.build = currentTime() - t0;
+  return valid_photons;
+}
+
+
+unsigned int buildPhotonGridData( PhotonRecord* photons_data, unsigned int num_photons, PhotonRecord* photon_grid_data,
+                                  unsigned int* cell_starts, unsigned int num_cells, float max_radius2,
+                                  PhotonGrid& grid, PhotonMapTimings& timings )
+{
+  double t0 = currentTime();
+
+  std::vector<PhotonRecord*> temp_photons( num_photons );
+  const unsigned int valid_photons = collectValidPhotons( photons_data, num_photons, temp_photons.data() );
+
+  double t1 = currentTime();
+  timings.prepare = t1 - t0;
+  t0 = t1;
+
+  buildPhotonGrid( temp_photons.data(), valid_photons, max_radius2, num_cells - 1, photon_grid_data, cell_starts, grid );
+
+  timings.build = currentTime() - t0;
+  return valid_photons;
+}
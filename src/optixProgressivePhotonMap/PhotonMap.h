@@ -0,0 +1,217 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "kd_layout.h"
+#include "ppm.h"
+
+#include <optixu/optixu_math_namespace.h>
+
+#include <algorithm>
+#include <cmath>
+
+
+//-----------------------------------------------------------------------------
+//
+// Host side photon map construction and queries.  The kd-tree and the hash
+// grid built here are uploaded as-is and traversed by gather() and
+// gather_grid() in ppm_gather.cu; the query functions mirror those programs.
+//
+//-----------------------------------------------------------------------------
+
+enum SplitChoice {
+  RoundRobin,
+  HighestVariance,
+  LongestDim
+};
+
+
+// Host time spent in each stage of a photon map build, in seconds
+struct PhotonMapTimings
+{
+  double map;         // Mapping the photon buffers
+  double prepare;     // Clearing the map, gathering valid photons and bounds
+  double build;       // kd-tree or grid build
+  double unmap;       // Unmapping (uploading) the photon map
+};
+
+// Fills valid with pointers to the photons with nonzero energy, in their
+// original order, and returns how many there are.
+unsigned int collectValidPhotons( PhotonRecord* photons, unsigned int num_photons, PhotonRecord** valid );
+
+// Bounds of the photon positions.
+void computePhotonBounds( PhotonRecord** photons, unsigned int num_photons, optix::float3& bbmin, optix::float3& bbmax );
+
+
+//
+// Balanced kd-tree with the children of node i at 2*i+1 and 2*i+2
+//
+
+// Marks every node of kd_tree[0, size) as empty.
+void clearKDTree( PhotonRecord* kd_tree, unsigned int size );
+
+// Builds the subtree rooted at kd_tree[current_root] from photons[start, end)
+// on the calling thread.  bbmin/bbmax are only used by LongestDim.
+void buildKDTree( PhotonRecord** photons, int start, int end, int depth, PhotonRecord* kd_tree, int current_root,
+                  SplitChoice split_choice, optix::float3 bbmin, optix::float3 bbmax );
+
+// Builds the same tree as buildKDTree using all worker threads.
+void buildKDTreeParallel( PhotonRecord** photons, int num_photons, PhotonRecord* kd_tree,
+                          SplitChoice split_choice, optix::float3 bbmin, optix::float3 bbmax );
+
+// Layout of a tree of kd_tree_size ( 2^height-1 ) nodes, see kd_layout.h.
+KDTreeLayout kdTreeLayoutForSize( unsigned int kd_tree_size, unsigned int block_height );
+
+// Copies a tree built in the breadth-first layout to kd_tree in layout.
+void layoutKDTree( const PhotonRecord* bfs_tree, const KDTreeLayout& layout, PhotonRecord* kd_tree );
+
+struct KDNoVisit
+{
+  void operator()( unsigned int ) const {}
+};
+
+// Calls fn( photon ) for every photon within radius2 of position and returns
+// the number of nodes visited.  Same traversal as gather().  visit( offset )
+// is called with the offset in kd_tree of every node visited.
+template<typename Fn, typename Visit = KDNoVisit>
+unsigned int queryKDTree( const PhotonRecord* kd_tree, const KDTreeLayout& layout, const optix::float3& position,
+                          float radius2, Fn fn, Visit visit = Visit() )
+{
+  unsigned int stack[32];
+  unsigned int stack_current = 0;
+  unsigned int node = 0;
+  unsigned int num_visited = 0;
+
+  stack[stack_current++] = 0;
+  do {
+    const unsigned int offset = kdNodeOffset( node, layout );
+    const PhotonRecord& photon = kd_tree[offset];
+    visit( offset );
+    ++num_visited;
+
+    const optix::uint axis = photon.axis;
+    if( !( axis & PPM_NULL ) ) {
+      const optix::float3 diff = position - photon.position;
+      if( optix::dot( diff, diff ) <= radius2 )
+        fn( photon );
+
+      if( !( axis & PPM_LEAF ) ) {
+        const float d = ( axis & PPM_X ) ? diff.x : ( ( axis & PPM_Y ) ? diff.y : diff.z );
+        const unsigned int selector = d < 0.0f ? 0 : 1;
+        if( d*d < radius2 )
+          stack[stack_current++] = ( node<<1 ) + 2 - selector;
+        node = ( node<<1 ) + 1 + selector;
+      } else {
+        node = stack[--stack_current];
+      }
+    } else {
+      node = stack[--stack_current];
+    }
+  } while( node );
+
+  return num_visited;
+}
+
+
+//
+// Uniform grid hashed into a power of two number of buckets
+//
+
+struct PhotonGrid
+{
+  optix::float3 origin;
+  float         inv_cell_size;
+  optix::uint   hash_mask;
+};
+
+// Sorts photons into grid_photons by bucket, keeping their order within a
+// bucket, and writes the start of each bucket to cell_starts[0, hash_size],
+// with hash_size a power of two.  Cells are at least twice the radius of
+// max_radius2, so a query no larger than that touches at most 2x2x2 cells.
+void buildPhotonGrid( PhotonRecord** photons, unsigned int num_photons, float max_radius2, unsigned int hash_size,
+                      PhotonRecord* grid_photons, unsigned int* cell_starts, PhotonGrid& grid );
+
+// Calls fn( photon ) for every photon within radius2 of position and returns
+// the number of photons tested.  Same lookup as gather_grid().  radius2 must
+// not exceed the max_radius2 the grid was built with.
+template<typename Fn>
+unsigned int queryPhotonGrid( const PhotonGrid& grid, const PhotonRecord* grid_photons, const unsigned int* cell_starts,
+                              const optix::float3& position, float radius2, Fn fn )
+{
+  const float radius = sqrtf( radius2 );
+  const int x0 = photonGridCoord( position.x - radius, grid.origin.x, grid.inv_cell_size );
+  const int y0 = photonGridCoord( position.y - radius, grid.origin.y, grid.inv_cell_size );
+  const int z0 = photonGridCoord( position.z - radius, grid.origin.z, grid.inv_cell_size );
+  const int x1 = std::min( x0 + 1, photonGridCoord( position.x + radius, grid.origin.x, grid.inv_cell_size ) );
+  const int y1 = std::min( y0 + 1, photonGridCoord( position.y + radius, grid.origin.y, grid.inv_cell_size ) );
+  const int z1 = std::min( z0 + 1, photonGridCoord( position.z + radius, grid.origin.z, grid.inv_cell_size ) );
+
+  // Distinct cells can share a bucket, which must only be searched once
+  optix::uint buckets[8];
+  unsigned int num_buckets = 0;
+  unsigned int num_tested  = 0;
+  for( int z = z0; z <= z1; ++z ) {
+    for( int y = y0; y <= y1; ++y ) {
+      for( int x = x0; x <= x1; ++x ) {
+        const optix::uint bucket = photonGridHash( x, y, z, grid.hash_mask );
+        bool seen = false;
+        for( unsigned int i = 0; i < num_buckets; ++i )
+          seen = seen || buckets[i] == bucket;
+        if( seen )
+          continue;
+        buckets[num_buckets++] = bucket;
+
+        for( unsigned int i = cell_starts[bucket]; i < cell_starts[bucket+1]; ++i ) {
+          const optix::float3 diff = position - grid_photons[i].position;
+          if( optix::dot( diff, diff ) <= radius2 )
+            fn( grid_photons[i] );
+        }
+        num_tested += cell_starts[bucket+1] - cell_starts[bucket];
+      }
+    }
+  }
+  return num_tested;
+}
+
+
+//
+// Complete builds from a photon pass
+//
+
+// Builds the kd-tree of photon_map_size nodes from the valid photons of a
+// photon pass in the given layout, as createPhotonMap does, and fills in the
+// prepare and build timings.  Returns the number of valid photons.
+unsigned int buildPhotonMapData( PhotonRecord* photons_data, unsigned int num_photons, PhotonRecord* photon_map_data,
+                                 unsigned int photon_map_size, SplitChoice split_choice, const KDTreeLayout& layout,
+                                 PhotonMapTimings& timings );
+
+// Hash grid counterpart of buildPhotonMapData, with num_cells-1 buckets.
+unsigned int buildPhotonGridData( PhotonRecord* photons_data, unsigned int num_photons, PhotonRecord* photon_grid_data,
+                                  unsigned int* cell_starts, unsigned int num_cells, float max_radius2,
+                                  PhotonGrid& grid, PhotonMapTimings& timings );
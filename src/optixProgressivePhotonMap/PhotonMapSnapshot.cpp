@@ -0,0 +1,145 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "PhotonMapSnapshot.h"
+
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+
+//------------------------------------------------------------------------------
+//
+// Helpers 
+//
+//------------------------------------------------------------------------------
+
+namespace
+{
+
+// Bump whenever the layout of the snapshot file changes
+const uint32_t SNAPSHOT_VERSION  = 1u;
+const char     SNAPSHOT_MAGIC[8] = { 'P', 'P', 'M', 'S', 'N', 'A', 'P', '\0' };
+
+
+struct SnapshotHeader
+{
+  char                magic[8];
+  uint32_t            version;
+  uint32_t            header_size;          // sizeof( SnapshotHeader ), guards against padding changes
+  uint32_t            photon_record_size;   // sizeof( PhotonRecord )
+  uint32_t            hit_record_size;      // sizeof( HitRecord )
+
+  uint32_t            num_photons;
+  uint32_t            hit_width;
+  uint32_t            hit_height;
+  uint32_t            frame;
+};
+
+
+// Closes the file on scope exit
+struct FileCloser
+{
+  FILE* file;
+  ~FileCloser() { if( file ) fclose( file ); }
+};
+
+} // namespace
+
+
+//------------------------------------------------------------------------------
+//
+// Snapshot I/O
+//
+//------------------------------------------------------------------------------
+
+bool writePhotonMapSnapshot( const std::string& filename, const PhotonRecord* photons, unsigned int num_photons,
+                             const HitRecord* hits, unsigned int hit_width, unsigned int hit_height,
+                             unsigned int frame )
+{
+  SnapshotHeader header;
+  memset( &header, 0, sizeof( header ) );
+  memcpy( header.magic, SNAPSHOT_MAGIC, sizeof( header.magic ) );
+  header.version            = SNAPSHOT_VERSION;
+  header.header_size        = sizeof( SnapshotHeader );
+  header.photon_record_size = sizeof( PhotonRecord );
+  header.hit_record_size    = sizeof( HitRecord );
+  header.num_photons        = num_photons;
+  header.hit_width          = hit_width;
+  header.hit_height         = hit_height;
+  header.frame              = frame;
+
+  FileCloser closer = { fopen( filename.c_str(), "wb" ) };
+  if( !closer.file )
+    return false;
+
+  const size_t num_hits = static_cast<size_t>( hit_width ) * hit_height;
+  bool ok = fwrite( &header, sizeof( header ), 1, closer.file ) == 1;
+  ok = ok && fwrite( photons, sizeof( PhotonRecord ), num_photons, closer.file ) == num_photons;
+  ok = ok && fwrite( hits, sizeof( HitRecord ), num_hits, closer.file ) == num_hits;
+  ok = fclose( closer.file ) == 0 && ok;
+  closer.file = 0;
+  if( !ok )
+    remove( filename.c_str() );
+  return ok;
+}
+
+
+bool readPhotonMapSnapshot( const std::string& filename, PhotonMapSnapshot& snapshot, std::string& error )
+{
+  FileCloser closer = { fopen( filename.c_str(), "rb" ) };
+  if( !closer.file ) {
+    error = "can't open '" + filename + "'";
+    return false;
+  }
+
+  SnapshotHeader header;
+  if( fread( &header, sizeof( header ), 1, closer.file ) != 1 ||
+      memcmp( header.magic, SNAPSHOT_MAGIC, sizeof( header.magic ) ) != 0 ) {
+    error = "'" + filename + "' is not a photon map snapshot";
+    return false;
+  }
+  if( header.version != SNAPSHOT_VERSION || header.header_size != sizeof( SnapshotHeader ) ||
+      header.photon_record_size != sizeof( PhotonRecord ) || header.hit_record_size != sizeof( HitRecord ) ) {
+    error = "'" + filename + "' was written with a different snapshot version or record layout";
+    return false;
+  }
+
+  const size_t num_hits = static_cast<size_t>( header.hit_width ) * header.hit_height;
+  snapshot.photons.resize( header.num_photons );
+  snapshot.hits.resize( num_hits );
+  snapshot.hit_width  = header.hit_width;
+  snapshot.hit_height = header.hit_height;
+  snapshot.frame      = header.frame;
+  if( fread( snapshot.photons.data(), sizeof( PhotonRecord ), header.num_photons, closer.file ) != header.num_photons ||
+      fread( snapshot.hits.data(), sizeof( HitRecord ), num_hits, closer.file ) != num_hits ) {
+    error = "'" + filename + "' is truncated";
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,63 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "ppm.h"
+
+#include <string>
+#include <vector>
+
+
+//-----------------------------------------------------------------------------
+//
+// Binary snapshot of one photon pass and the rtpass hit records it is
+// gathered into, so the photon map build and the gather traversal can be
+// replayed and profiled on the host without an OptiX context (see
+// ppmReplay.cpp).  Records are stored as raw PhotonRecord and HitRecord
+// arrays in host byte order.
+//
+//-----------------------------------------------------------------------------
+
+struct PhotonMapSnapshot
+{
+  std::vector<PhotonRecord> photons;        // Raw photon pass, including empty records
+  std::vector<HitRecord>    hits;           // rtpass_output_buffer, hit_width*hit_height
+  unsigned int              hit_width;
+  unsigned int              hit_height;
+  unsigned int              frame;          // Accumulation frame that would gather the photons
+};
+
+// Returns false if the file can't be written.
+bool writePhotonMapSnapshot( const std::string& filename, const PhotonRecord* photons, unsigned int num_photons,
+                             const HitRecord* hits, unsigned int hit_width, unsigned int hit_height,
+                             unsigned int frame );
+
+// Returns false with a message in error if the file can't be read or was
+// written with a different version or record layout.
+bool readPhotonMapSnapshot( const std::string& filename, PhotonMapSnapshot& snapshot, std::string& error );
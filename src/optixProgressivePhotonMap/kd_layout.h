@@ -0,0 +1,107 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <optixu/optixu_math_namespace.h>
+
+
+//-----------------------------------------------------------------------------
+//
+// Memory layouts of the photon kd-tree, shared by the host build and gather().
+//
+// The tree is complete with height levels, and nodes are numbered breadth
+// first (children of node i at 2*i+1 and 2*i+2).  In the breadth-first layout
+// that number is also the offset in photon_map.  The blocked layout instead
+// stores every subtree of block_height levels whose root depth is a multiple
+// of block_height contiguously, breadth first inside the block, and orders the
+// blocks breadth first as well.  A traversal then touches one block per
+// block_height levels rather than one distant node per level.  The last row
+// of blocks is cut to the remaining levels, so both layouts use the same
+// 2^height-1 nodes.
+//
+//-----------------------------------------------------------------------------
+
+struct KDTreeLayout
+{
+  optix::uint height;         // Levels in the tree
+  optix::uint block_height;   // Levels per block, 0 for the breadth-first layout
+  optix::uint block_rcp;      // ceil( 2^16 / block_height ), to divide depths by block_height
+};
+
+
+static __host__ __device__ __inline__ KDTreeLayout makeKDTreeLayout( optix::uint height, optix::uint block_height )
+{
+  KDTreeLayout layout;
+  layout.height       = height;
+  layout.block_height = block_height < height ? block_height : 0;   // One block is breadth first too
+  layout.block_rcp    = layout.block_height ? ( 65536u + layout.block_height - 1u ) / layout.block_height : 0;
+  return layout;
+}
+
+
+// floor( log2( x ) ) for x > 0
+static __host__ __device__ __inline__ optix::uint kdFloorLog2( optix::uint x )
+{
+#if defined(__CUDA_ARCH__)
+  return 31u - __clz( x );
+#elif defined(__GNUC__)
+  return 31u - __builtin_clz( x );
+#else
+  optix::uint r = 0;
+  if( x >= 1u<<16 ) { x >>= 16; r += 16; }
+  if( x >= 1u<<8  ) { x >>= 8;  r += 8;  }
+  if( x >= 1u<<4  ) { x >>= 4;  r += 4;  }
+  if( x >= 1u<<2  ) { x >>= 2;  r += 2;  }
+  if( x >= 1u<<1  ) {           r += 1;  }
+  return r;
+#endif
+}
+
+
+// Offset in photon_map of the node with breadth-first number node.
+static __host__ __device__ __inline__ optix::uint kdNodeOffset( optix::uint node, const KDTreeLayout& layout )
+{
+  if( layout.block_height == 0 )
+    return node;
+
+  // 1-based numbering: the bits below the leading one are the path from the root.
+  // depth < 32, so the reciprocal gives depth / block_height exactly.
+  const optix::uint n          = node + 1;
+  const optix::uint depth      = kdFloorLog2( n );
+  const optix::uint row_depth  = ( ( depth * layout.block_rcp ) >> 16 ) * layout.block_height;
+  const optix::uint r          = depth - row_depth;             // Depth inside the block
+  const optix::uint block_root = n >> r;
+  const optix::uint levels     = layout.height - row_depth < layout.block_height ? layout.height - row_depth
+                                                                                 : layout.block_height;
+
+  // Every row of blocks above holds complete trees, which add up to 2^row_depth-1 nodes
+  return ( ( 1u << row_depth ) - 1u )
+       + ( block_root - ( 1u << row_depth ) ) * ( ( 1u << levels ) - 1u )
+       + ( 1u << r ) - 1u + ( n & ( ( 1u << r ) - 1u ) );
+}
@@ -48,21 +48,27 @@
 // from sutil
 #include <sutil.h>
 #include <Camera.h>
+#include <Parallel.h>
 
 #include "Mesh.h"
 #include "ppm.h"
+#include "PhotonMap.h"
+#include "PhotonMapSnapshot.h"
 #include "random.h"
-#include "select.h"
 
 #include <imgui/imgui.h>
 #include <imgui/imgui_impl_glfw_gl2.h>
 
 #include <algorithm>
+#include <cmath>
 #include <cstdlib>
 #include <cstring>
+#include <exception>
 #include <iostream>
 #include <limits>
 #include <stdint.h>
+#include <thread>
+#include <vector>
 
 using namespace optix;
 
@@ -74,10 +80,9 @@ const unsigned int PHOTON_LAUNCH_DIM = 512u;
 const float LIGHT_THETA = 1.15f;
 const float LIGHT_PHI = 2.19f;
 
-enum SplitChoice {
-  RoundRobin,
-  HighestVariance,
-  LongestDim
+enum PhotonMapBackend {
+  KDTreeBackend,
+  HashGridBackend
 };
 
 //------------------------------------------------------------------------------
@@ -90,6 +95,13 @@ Context      context = 0;
 
 bool s_display_debug_buffer = false;
 bool s_print_timings = false;
+SplitChoice s_split_choice = LongestDim;
+PhotonMapBackend s_photon_map_backend = KDTreeBackend;
+float s_grid_radius2 = 0.0f;    // Largest gather radius2 the photon grid must support
+bool s_pipeline_photon_maps = false;
+unsigned int s_kd_block_height = 0;   // Blocked kd-tree layout, 0 for breadth first
+KDTreeLayout s_kd_layout = { 0, 0, 0 };
+unsigned int s_photon_pass_index = 0;   // Photon passes traced so far, keys their samples
 
 
 //------------------------------------------------------------------------------
@@ -111,23 +123,6 @@ static unsigned int pow2roundup(unsigned int x)
   return x+1;
 }
 
-static int max_component(float3 a)
-{
-  if(a.x > a.y) {
-    if(a.x > a.z) {
-      return 0;
-    } else {
-      return 2;
-    }
-  } else {
-    if(a.y > a.z) {
-      return 1;
-    } else {
-      return 2;
-    }
-  }
-}
-
 static float3 sphericalToCartesian( float theta, float phi )
 {
   float cos_theta = cosf( theta );
@@ -170,6 +165,7 @@ enum ProgramEnum {
     rtpass,
     ppass,
     gather,
+    rng_check,
     NUM_PROGRAMS
 };
 
@@ -221,15 +217,6 @@ void createContext( bool use_pbo, unsigned int photon_launch_dim, Buffer& photon
     rtpass_buffer->setElementSize( sizeof( HitRecord ) );
     context["rtpass_output_buffer"]->set( rtpass_buffer );
 
-    // RTPass pixel sample buffers
-    Buffer image_rnd_seeds = context->createBuffer( RT_BUFFER_INPUT_OUTPUT | RT_BUFFER_GPU_LOCAL, RT_FORMAT_UNSIGNED_INT2, WIDTH, HEIGHT );
-    context["image_rnd_seeds"]->set( image_rnd_seeds );
-    uint2* seeds = reinterpret_cast<uint2*>( image_rnd_seeds->map() );
-    for ( unsigned int i = 0; i < WIDTH*HEIGHT; ++i ) {
-        seeds[i] = random2u();
-    }
-    image_rnd_seeds->unmap();
-
     // RTPass ray gen program
     {
         const std::string ptx_path = ptxPath( "ppm_rtpass.cu" );
@@ -255,30 +242,42 @@ void createContext( bool use_pbo, unsigned int photon_launch_dim, Buffer& photon
         Program ray_gen_program = context->createProgramFromPTXFile( ptx_path, "ppass_camera" );
         context->setRayGenerationProgram( ppass, ray_gen_program );
 
-        Buffer photon_rnd_seeds = context->createBuffer( RT_BUFFER_INPUT,
-                RT_FORMAT_UNSIGNED_INT2,
-                photon_launch_dim,
-                photon_launch_dim );
-        uint2* seeds = reinterpret_cast<uint2*>( photon_rnd_seeds->map() );
-        for ( unsigned int i = 0; i < photon_launch_dim*photon_launch_dim; ++i ) {
-            seeds[i] = random2u();
-        }
-        photon_rnd_seeds->unmap();
-        context["photon_rnd_seeds"]->set( photon_rnd_seeds );
+        // Photon samples are drawn from the launch index and pass index with
+        // counterSeeds(), so no seed buffer is needed
+        context["photon_pass_index"]->setUint( 0u );
+
+        // Random number check, resized by checkDeviceRandom()
+        context->setRayGenerationProgram( rng_check, context->createProgramFromPTXFile( ptx_path, "rng_check" ) );
+        Buffer rng_check_buffer = context->createBuffer( RT_BUFFER_OUTPUT, RT_FORMAT_UNSIGNED_INT4, 1, 1 );
+        context["rng_check_buffer"]->set( rng_check_buffer );
     }
 
     // Gather phase
     {
         const std::string ptx_path = ptxPath( "ppm_gather.cu" );
-        Program gather_program = context->createProgramFromPTXFile( ptx_path, "gather" );
+        const bool use_grid = s_photon_map_backend == HashGridBackend;
+        Program gather_program = context->createProgramFromPTXFile( ptx_path, use_grid ? "gather_grid" : "gather" );
         context->setRayGenerationProgram( gather, gather_program );
         Program exception_program = context->createProgramFromPTXFile( ptx_path, "gather_exception" );
         context->setExceptionProgram( gather, exception_program );
 
-        unsigned int photon_map_size = pow2roundup( num_photons ) - 1;
-        photon_map_buffer = context->createBuffer( RT_BUFFER_INPUT, RT_FORMAT_USER, photon_map_size );
-        photon_map_buffer->setElementSize( sizeof( PhotonRecord ) );
-        context["photon_map"]->set( photon_map_buffer );
+        if( use_grid ) {
+            photon_map_buffer = context->createBuffer( RT_BUFFER_INPUT, RT_FORMAT_USER, num_photons );
+            photon_map_buffer->setElementSize( sizeof( PhotonRecord ) );
+            context["photon_grid"]->set( photon_map_buffer );
+
+            Buffer cells_buffer = context->createBuffer( RT_BUFFER_INPUT, RT_FORMAT_UNSIGNED_INT,
+                                                         pow2roundup( num_photons ) + 1 );
+            context["photon_grid_cells"]->set( cells_buffer );
+        } else {
+            unsigned int photon_map_size = pow2roundup( num_photons ) - 1;
+            photon_map_buffer = context->createBuffer( RT_BUFFER_INPUT, RT_FORMAT_USER, photon_map_size );
+            photon_map_buffer->setElementSize( sizeof( PhotonRecord ) );
+            context["photon_map"]->set( photon_map_buffer );
+
+            s_kd_layout = kdTreeLayoutForSize( photon_map_size, s_kd_block_height );
+            context["photon_map_layout"]->setUserData( sizeof( KDTreeLayout ), &s_kd_layout );
+        }
     }
 
 }
@@ -433,159 +432,569 @@ void createLight( PPMLight& light )
 //
 //------------------------------------------------------------------------------
 
-bool photonCmpX( PhotonRecord* r1, PhotonRecord* r2 ) { return r1->position.x < r2->position.x; }
-bool photonCmpY( PhotonRecord* r1, PhotonRecord* r2 ) { return r1->position.y < r2->position.y; }
-bool photonCmpZ( PhotonRecord* r1, PhotonRecord* r2 ) { return r1->position.z < r2->position.z; }
+// Reports the fraction of the photon pass that reached a surface.
+void printValidPhotons( unsigned int valid_photons, unsigned int num_photons )
+{
+  if ( s_display_debug_buffer ) {
+    std::cerr << " ** valid_photon/m_num_photons =  " 
+              << valid_photons<<"/"<<num_photons
+              <<" ("<<valid_photons/static_cast<float>(num_photons)<<")\n";
+  }
+}
 
 
-void buildKDTree( PhotonRecord** photons, int start, int end, int depth, PhotonRecord* kd_tree, int current_root,
-                  SplitChoice split_choice, float3 bbmin, float3 bbmax)
+void setPhotonGridVariables( const PhotonGrid& grid )
 {
-  // If we have zero photons, this is a NULL node
-  if( end - start == 0 ) {
-    kd_tree[current_root].axis = PPM_NULL;
-    kd_tree[current_root].energy = make_float3( 0.0f );
-    return;
-  }
+  context["photon_grid_origin"]->setFloat( grid.origin );
+  context["photon_grid_inv_cell_size"]->setFloat( grid.inv_cell_size );
+  context["photon_grid_hash_mask"]->setUint( grid.hash_mask );
+}
+
+
+void createPhotonMap( Buffer photons_buffer, Buffer photon_map_buffer, SplitChoice split_choice, PhotonMapTimings& timings )
+{
+  double t0 = sutil::currentTime();
+
+  PhotonRecord* photons_data    = reinterpret_cast<PhotonRecord*>( photons_buffer->map() );
+  PhotonRecord* photon_map_data = reinterpret_cast<PhotonRecord*>( photon_map_buffer->map() );
+
+  timings.map = sutil::currentTime() - t0;
+
+  RTsize num_photons, photon_map_size;
+  photons_buffer->getSize( num_photons );
+  photon_map_buffer->getSize( photon_map_size );
+  printValidPhotons( buildPhotonMapData( photons_data, static_cast<unsigned int>( num_photons ), photon_map_data,
+                                         static_cast<unsigned int>( photon_map_size ), split_choice, s_kd_layout,
+                                         timings ),
+                     static_cast<unsigned int>( num_photons ) );
+
+  t0 = sutil::currentTime();
+
+  photon_map_buffer->unmap();
+  photons_buffer->unmap();
+
+  timings.unmap = sutil::currentTime() - t0;
+}
+
+
+// Hash grid counterpart of createPhotonMap.  photon_grid_buffer holds the
+// photons sorted by bucket, the cell starts go to photon_grid_cells.
+void createPhotonGrid( Buffer photons_buffer, Buffer photon_grid_buffer, float max_radius2, PhotonMapTimings& timings )
+{
+  double t0 = sutil::currentTime();
+
+  Buffer cells_buffer = context["photon_grid_cells"]->getBuffer();
+  PhotonRecord* photons_data     = reinterpret_cast<PhotonRecord*>( photons_buffer->map() );
+  PhotonRecord* photon_grid_data = reinterpret_cast<PhotonRecord*>( photon_grid_buffer->map() );
+  unsigned int* cell_starts      = reinterpret_cast<unsigned int*>( cells_buffer->map() );
+
+  timings.map = sutil::currentTime() - t0;
+
+  RTsize num_photons, num_cells;
+  photons_buffer->getSize( num_photons );
+  cells_buffer->getSize( num_cells );
+  PhotonGrid grid;
+  printValidPhotons( buildPhotonGridData( photons_data, static_cast<unsigned int>( num_photons ), photon_grid_data,
+                                          cell_starts, static_cast<unsigned int>( num_cells ), max_radius2, grid, timings ),
+                     static_cast<unsigned int>( num_photons ) );
+  setPhotonGridVariables( grid );
+
+  t0 = sutil::currentTime();
+
+  cells_buffer->unmap();
+  photon_grid_buffer->unmap();
+  photons_buffer->unmap();
+
+  timings.unmap = sutil::currentTime() - t0;
+}
+
+
+//
+// Pipelined photon map builds.  OptiX host calls are not thread safe and a
+// context cannot launch with buffers mapped, so the two photon map slots live
+// in host memory: the main thread copies a photon pass into one slot and a
+// worker thread builds its map there, while the main thread uploads the map
+// of the other slot and launches.
+//
+
+struct PhotonMapSlot
+{
+  std::vector<PhotonRecord> photons;      // Copy of one photon pass
+  std::vector<PhotonRecord> photon_map;   // kd-tree, or photons sorted by grid bucket
+  std::vector<unsigned int> cells;        // Grid bucket starts
+  PhotonGrid                grid;
+  PhotonMapTimings          timings;      // prepare and build are filled in by the worker
+};
+
 
-  // If we have a single photon
-  if( end - start == 1 ) {
-    photons[start]->axis = PPM_LEAF;
-    kd_tree[current_root] = *(photons[start]);
-    return;
+class PhotonMapPipeline
+{
+public:
+  ~PhotonMapPipeline()
+  {
+    if( m_thread.joinable() )
+      m_thread.join();
   }
 
-  // Choose axis to split on
-  int axis;
-  switch(split_choice) {
-  case RoundRobin:
-    {
-      axis = depth%3;
+  // Copies the photon pass to slot and starts building its photon map on the
+  // worker thread.  Any previous build must have been waited for.
+  void start( Buffer photons_buffer, Buffer photon_map_buffer, unsigned int slot, PhotonMapBackend backend,
+              SplitChoice split_choice, float max_radius2 )
+  {
+    double t0 = sutil::currentTime();
+
+    PhotonMapSlot& s = m_slots[slot];
+    RTsize num_photons, photon_map_size;
+    photons_buffer->getSize( num_photons );
+    photon_map_buffer->getSize( photon_map_size );
+    s.photons.resize( num_photons );
+    s.photon_map.resize( photon_map_size );
+    if( backend == HashGridBackend ) {
+      RTsize num_cells;
+      context["photon_grid_cells"]->getBuffer()->getSize( num_cells );
+      s.cells.resize( num_cells );
     }
-    break;
-  case HighestVariance:
+    memcpy( s.photons.data(), photons_buffer->map(), num_photons*sizeof( PhotonRecord ) );
+    photons_buffer->unmap();
+
+    s.timings.map = sutil::currentTime() - t0;
+
+    m_thread = std::thread( [this, &s, backend, split_choice, max_radius2]()
     {
-      float3 mean  = make_float3( 0.0f ); 
-      float3 diff2 = make_float3( 0.0f );
-      for(int i = start; i < end; ++i) {
-        float3 x     = photons[i]->position;
-        float3 delta = x - mean;
-        float3 n_inv = make_float3( 1.0f / ( static_cast<float>( i - start ) + 1.0f ) );
-        mean = mean + delta * n_inv;
-        diff2 += delta*( x - mean );
+      try
+      {
+        const unsigned int num_photons = static_cast<unsigned int>( s.photons.size() );
+        unsigned int valid_photons;
+        if( backend == HashGridBackend )
+          valid_photons = buildPhotonGridData( s.photons.data(), num_photons, s.photon_map.data(), s.cells.data(),
+                                               static_cast<unsigned int>( s.cells.size() ), max_radius2, s.grid,
+                                               s.timings );
+        else
+          valid_photons = buildPhotonMapData( s.photons.data(), num_photons, s.photon_map.data(),
+                                              static_cast<unsigned int>( s.photon_map.size() ), split_choice,
+                                              s_kd_layout, s.timings );
+        printValidPhotons( valid_photons, num_photons );
       }
-      float3 n_inv = make_float3( 1.0f / ( static_cast<float>(end-start) - 1.0f ) );
-      float3 variance = diff2 * n_inv;
-      axis = max_component(variance);
-    }
-    break;
-  case LongestDim:
-    {
-      float3 diag = bbmax-bbmin;
-      axis = max_component(diag);
-    }
-    break;
-  default:
-    axis = -1;
-    std::cerr << "Unknown SplitChoice " << split_choice << " at "<<__FILE__<<":"<<__LINE__<<"\n";
-    exit(2);
-    break;
+      catch( ... )
+      {
+        m_error = std::current_exception();
+      }
+    } );
   }
 
-  int median = (start+end) / 2;
-  PhotonRecord** start_addr = &(photons[start]);
-
-  switch( axis ) {
-  case 0:
-    select<PhotonRecord*, 0>( start_addr, 0, end-start-1, median-start );
-    photons[median]->axis = PPM_X;
-    break;
-  case 1:
-    select<PhotonRecord*, 1>( start_addr, 0, end-start-1, median-start );
-    photons[median]->axis = PPM_Y;
-    break;
-  case 2:
-    select<PhotonRecord*, 2>( start_addr, 0, end-start-1, median-start );
-    photons[median]->axis = PPM_Z;
-    break;
+  // Waits for the build started last, if any, and rethrows its errors.
+  void wait()
+  {
+    if( m_thread.joinable() )
+      m_thread.join();
+    if( m_error ) {
+      std::exception_ptr error = m_error;
+      m_error = std::exception_ptr();
+      std::rethrow_exception( error );
+    }
   }
 
-  float3 rightMin = bbmin;
-  float3 leftMax  = bbmax;
-  if(split_choice == LongestDim) {
-    float3 midPoint = (*photons[median]).position;
-    switch( axis ) {
-      case 0:
-        rightMin.x = midPoint.x;
-        leftMax.x  = midPoint.x;
-        break;
-      case 1:
-        rightMin.y = midPoint.y;
-        leftMax.y  = midPoint.y;
-        break;
-      case 2:
-        rightMin.z = midPoint.z;
-        leftMax.z  = midPoint.z;
-        break;
+  // Copies the finished photon map of slot to the device.
+  void upload( Buffer photon_map_buffer, unsigned int slot, PhotonMapBackend backend )
+  {
+    double t0 = sutil::currentTime();
+
+    PhotonMapSlot& s = m_slots[slot];
+    memcpy( photon_map_buffer->map(), s.photon_map.data(), s.photon_map.size()*sizeof( PhotonRecord ) );
+    photon_map_buffer->unmap();
+    if( backend == HashGridBackend ) {
+      Buffer cells_buffer = context["photon_grid_cells"]->getBuffer();
+      memcpy( cells_buffer->map(), s.cells.data(), s.cells.size()*sizeof( unsigned int ) );
+      cells_buffer->unmap();
+      setPhotonGridVariables( s.grid );
     }
+
+    s.timings.unmap = sutil::currentTime() - t0;
   }
 
-  kd_tree[current_root] = *(photons[median]);
-  buildKDTree( photons, start, median, depth+1, kd_tree, 2*current_root+1, split_choice, bbmin,  leftMax );
-  buildKDTree( photons, median+1, end, depth+1, kd_tree, 2*current_root+2, split_choice, rightMin, bbmax );
+  const PhotonMapTimings& timings( unsigned int slot )const { return m_slots[slot].timings; }
+
+private:
+  PhotonMapSlot      m_slots[2];
+  std::thread        m_thread;
+  std::exception_ptr m_error;
+};
+
+PhotonMapPipeline s_photon_map_pipeline;
+
+
+// Largest radius2 of the rtpass hit points.  Radii only shrink between
+// passes, so this bounds the gather radius until the next rtpass.
+float maxHitRadius2()
+{
+  Buffer hit_records = context["rtpass_output_buffer"]->getBuffer();
+  RTsize width, height;
+  hit_records->getSize( width, height );
+  const HitRecord* hit_record_data = reinterpret_cast<const HitRecord*>( hit_records->map() );
+  std::vector<float> row_max( height, 0.0f );
+  sutil::parallelFor( height, [&]( size_t j )
+  {
+    for( RTsize i = 0; i < width; ++i ) {
+      const HitRecord& rec = hit_record_data[j*width+i];
+      if( rec.flags & PPM_HIT )
+        row_max[j] = fmaxf( row_max[j], rec.radius2 );
+    }
+  } );
+  hit_records->unmap();
+  return *std::max_element( row_max.begin(), row_max.end() );
 }
 
-void createPhotonMap( Buffer photons_buffer, Buffer photon_map_buffer )
+
+//------------------------------------------------------------------------------
+//
+//  Photon record encoding check
+//
+//------------------------------------------------------------------------------
+
+// Round trips random directions and energies through the PhotonRecord
+// encoding (see ppm.h) and checks the worst errors against their bounds.
+bool checkPhotonEncoding()
 {
-  const SplitChoice split_choice = LongestDim;
+  const unsigned int num_samples = 1u << 22;
+  const float max_angle_bound  = 7.e-5f;      // radians
+  const float max_energy_bound = 1.0f/255.0f;  // relative to the largest channel
+
+  unsigned int seed = 1234u;
+  float max_angle = 0.0f;
+  for( unsigned int i = 0; i < num_samples; ++i ) {
+    float3 v;
+    if( i < 6 ) {
+      // Axes, which land on the corners and edges of the octahedron
+      v = make_float3( 0.0f );
+      (&v.x)[i/2] = ( i & 1 ) ? -1.0f : 1.0f;
+    } else {
+      const float z   = 2.0f * rnd( seed ) - 1.0f;
+      const float phi = 2.0f * M_PIf * rnd( seed );
+      const float r   = sqrtf( fmaxf( 0.0f, 1.0f - z*z ) );
+      v = make_float3( r * cosf( phi ), r * sinf( phi ), z );
+    }
+    const float3 d = decodeOctahedral( encodeOctahedral( v ) );
+    max_angle = fmaxf( max_angle, atan2f( length( cross( v, d ) ), dot( v, d ) ) );
+  }
 
-  PhotonRecord* photons_data    = reinterpret_cast<PhotonRecord*>( photons_buffer->map() );
-  PhotonRecord* photon_map_data = reinterpret_cast<PhotonRecord*>( photon_map_buffer->map() );
+  float max_energy_error = 0.0f;
+  unsigned int num_lost = 0;
+  for( unsigned int i = 0; i < num_samples; ++i ) {
+    // Random colors over 2^-90 .. 2^100, some with zero or tiny channels
+    const float scale = ldexpf( 1.0f, static_cast<int>( lcg( seed ) % 191u ) - 90 );
+    float3 c = make_float3( rnd( seed ), rnd( seed ), rnd( seed ) ) * scale;
+    if( i % 7 == 0 ) c.y = 0.0f;
+    if( i % 11 == 0 ) c.z *= 1.e-6f;
+    if( fmaxf( c ) == 0.0f )
+      continue;
+    const unsigned int bits = encodeRGBE( c );
+    num_lost += bits == 0u;
+    const float3 d = decodeRGBE( bits );
+    const float3 e = make_float3( fabsf( d.x - c.x ), fabsf( d.y - c.y ), fabsf( d.z - c.z ) );
+    max_energy_error = fmaxf( max_energy_error, fmaxf( e ) / fmaxf( c ) );
+  }
+  const bool zero_ok = encodeRGBE( make_float3( 0.0f ) ) == 0u && fmaxf( decodeRGBE( 0u ) ) == 0.0f;
+
+  // Largest channels around 2^127*(1-2^-9), where rounding reaches the top
+  // exponent, and infinite or NaN channels
+  const float below_limit = ldexpf( 1.0f - ldexpf( 1.0f, -8 ), 127 );
+  const float at_limit    = ldexpf( 1.0f - ldexpf( 1.0f, -9 ), 127 );
+  const float inf         = std::numeric_limits<float>::infinity();
+  const float nan         = std::numeric_limits<float>::quiet_NaN();
+  const float3 d_below    = decodeRGBE( encodeRGBE( make_float3( below_limit, 1.0f, 0.0f ) ) );
+  const bool limit_ok =
+    fabsf( d_below.x - below_limit ) <= max_energy_bound * below_limit &&
+    encodeRGBE( make_float3( at_limit, 0.0f, 0.0f ) ) == PPM_RGBE_MAX &&
+    encodeRGBE( make_float3( std::numeric_limits<float>::max(), 0.0f, 0.0f ) ) == PPM_RGBE_MAX &&
+    encodeRGBE( make_float3( 0.0f, inf, 1.0f ) ) == PPM_RGBE_MAX &&
+    encodeRGBE( make_float3( nan, nan, nan ) ) == 0u &&
+    decodeRGBE( PPM_RGBE_MAX ).x > ldexpf( 1.0f, 126 );
+
+  const bool ok = max_angle <= max_angle_bound && max_energy_error <= max_energy_bound && num_lost == 0 && zero_ok &&
+                  limit_ok;
+  std::cerr << "PhotonRecord size " << sizeof( PhotonRecord ) << " bytes\n"
+            << "  direction: max error " << max_angle << " radians (bound " << max_angle_bound << ")\n"
+            << "  energy:    max error " << max_energy_error << " of largest channel (bound " << max_energy_bound << "), "
+            << num_lost << " nonzero energies lost, "
+            << ( limit_ok ? "saturates at 2^127" : "overflows near 2^127" ) << "\n"
+            << ( ok ? "Photon encoding OK" : "Photon encoding FAILED" ) << std::endl;
+  return ok;
+}
 
-  RTsize photon_map_size;
-  photon_map_buffer->getSize( photon_map_size );
-  for( unsigned int i = 0; i < (unsigned int)photon_map_size; ++i ) {
-    photon_map_data[i].energy = make_float3( 0.0f );
+
+//------------------------------------------------------------------------------
+//
+//  Random number checks
+//
+//------------------------------------------------------------------------------
+
+// Checks philox2x32 against the Random123 known answers and runs simple
+// statistical tests on counterSeeds() over consecutive launch indices and
+// frames: 256 bin chi-square of each word, per bit frequencies, and the
+// correlation of first samples between neighboring indices and frames.
+bool checkRandom()
+{
+  const unsigned int kat[3][5] = {
+    { 0x00000000u, 0x00000000u, 0x00000000u, 0xff1dae59u, 0x6cd10df2u },
+    { 0xffffffffu, 0xffffffffu, 0xffffffffu, 0x2c3f628bu, 0xab4fd7adu },
+    { 0x243f6a88u, 0x85a308d3u, 0x13198a2eu, 0xdd7ce038u, 0xf62a4c12u } };
+  bool kat_ok = true;
+  for( unsigned int i = 0; i < 3; ++i ) {
+    const uint2 r = philox2x32( make_uint2( kat[i][0], kat[i][1] ), kat[i][2] );
+    kat_ok = kat_ok && r.x == kat[i][3] && r.y == kat[i][4];
   }
 
-  // Push all valid photons to front of list
-  RTsize num_photons;
-  photons_buffer->getSize( num_photons );
-  unsigned int valid_photons = 0;
-  PhotonRecord** temp_photons = new PhotonRecord*[num_photons];
-  for( unsigned int i = 0; i < (unsigned int)num_photons; ++i ) {
-    if( fmaxf( photons_data[i].energy ) > 0.0f ) {
-      temp_photons[valid_photons++] = &photons_data[i];
+  const unsigned int width = 1024;           // Launch indices per frame
+  const unsigned int num_frames = 1024;
+  const double n = static_cast<double>( width ) * num_frames;
+
+  std::vector<double> bins( 2*256, 0.0 );
+  std::vector<double> ones( 2*32, 0.0 );
+  std::vector<float>  prev_frame( width );
+  double sum = 0.0, sum2 = 0.0, sum_index = 0.0, sum_frame = 0.0;
+  for( unsigned int frame = 0; frame < num_frames; ++frame ) {
+    float prev_index = 0.0f;
+    for( unsigned int index = 0; index < width; ++index ) {
+      uint2 seed = counterSeeds( index, frame, PPM_RNG_PHOTON_PASS );
+      for( unsigned int w = 0; w < 2; ++w ) {
+        const unsigned int word = w ? seed.y : seed.x;
+        bins[w*256 + ( word >> 24 )] += 1.0;
+        for( unsigned int b = 0; b < 32; ++b )
+          ones[w*32 + b] += ( word >> b ) & 1u;
+      }
+      const float x = rnd( seed.x ) - 0.5f;
+      sum  += x;
+      sum2 += x*x;
+      if( index > 0 ) sum_index += x * prev_index;
+      if( frame > 0 ) sum_frame += x * prev_frame[index];
+      prev_index = x;
+      prev_frame[index] = x;
     }
   }
-  if ( s_display_debug_buffer ) {
-    std::cerr << " ** valid_photon/m_num_photons =  " 
-              << valid_photons<<"/"<<num_photons
-              <<" ("<<valid_photons/static_cast<float>(num_photons)<<")\n";
+
+  // 255 degrees of freedom: mean 255, standard deviation 22.6
+  const double min_chi2 = 255.0 - 5.0*22.6;   // Too even is as suspect as too uneven
+  const double max_chi2 = 255.0 + 5.0*22.6;
+  double chi2[2] = { 0.0, 0.0 };
+  for( unsigned int i = 0; i < 2*256; ++i ) {
+    const double e = n / 256.0;
+    chi2[i/256] += ( bins[i] - e )*( bins[i] - e ) / e;
   }
 
-  // Make sure we aren't at most 1 less than power of 2
-  valid_photons = (valid_photons >= (unsigned int) photon_map_size) ? (unsigned int) photon_map_size : valid_photons;
-
-  float3 bbmin = make_float3(0.0f);
-  float3 bbmax = make_float3(0.0f);
-  if( split_choice == LongestDim ) {
-    bbmin = make_float3(  std::numeric_limits<float>::max() );
-    bbmax = make_float3( -std::numeric_limits<float>::max() );
-    // Compute the bounds of the photons
-    for(unsigned int i = 0; i < valid_photons; ++i) {
-      float3 position = (*temp_photons[i]).position;
-      bbmin = fminf(bbmin, position);
-      bbmax = fmaxf(bbmax, position);
+  // Five standard deviations of a fair coin, and of a correlation coefficient
+  const double max_bit_bias = 5.0 * 0.5 / sqrt( n );
+  double bit_bias = 0.0;
+  for( unsigned int i = 0; i < 2*32; ++i )
+    bit_bias = std::max( bit_bias, fabs( ones[i] / n - 0.5 ) );
+
+  const double variance = sum2 / n - ( sum / n )*( sum / n );
+  const double max_correlation = 5.0 / sqrt( n );
+  const double index_correlation = sum_index / ( n - num_frames ) / variance;
+  const double frame_correlation = sum_frame / ( n - width ) / variance;
+
+  const bool ok = kat_ok && chi2[0] >= min_chi2 && chi2[0] <= max_chi2 &&
+                  chi2[1] >= min_chi2 && chi2[1] <= max_chi2 && bit_bias <= max_bit_bias &&
+                  fabs( index_correlation ) <= max_correlation && fabs( frame_correlation ) <= max_correlation &&
+                  fabs( sum / n ) <= max_correlation * sqrt( 1.0/12.0 );
+  std::cerr << "philox2x32 known answers " << ( kat_ok ? "match" : "DO NOT match" ) << "\n"
+            << "counterSeeds over " << width << " indices x " << num_frames << " frames:\n"
+            << "  chi-square (255 dof) " << chi2[0] << ", " << chi2[1] << " (bounds " << min_chi2 << ", " << max_chi2 << ")\n"
+            << "  max bit bias " << bit_bias << " (bound " << max_bit_bias << ")\n"
+            << "  first sample mean " << sum / n + 0.5 << ", variance " << variance << " (1/12 = " << 1.0/12.0 << ")\n"
+            << "  correlation with next index " << index_correlation
+            << ", next frame " << frame_correlation << " (bound " << max_correlation << ")\n"
+            << ( ok ? "Random numbers OK" : "Random numbers FAILED" ) << std::endl;
+  return ok;
+}
+
+
+// Launches rng_check over the photon launch grid for a few photon pass
+// indices and compares the seeds and first samples with the host versions bit
+// for bit.
+bool checkDeviceRandom( unsigned int photon_launch_dim )
+{
+  const unsigned int pass_indices[] = { 0u, 1u, 17u, 0xffffffffu };
+  const unsigned int num_passes = sizeof( pass_indices ) / sizeof( pass_indices[0] );
+
+  Buffer rng_check_buffer = context["rng_check_buffer"]->getBuffer();
+  sutil::resizeBuffer( rng_check_buffer, photon_launch_dim, photon_launch_dim );
+
+  unsigned int num_mismatches = 0;
+  for( unsigned int p = 0; p < num_passes; ++p ) {
+    context["photon_pass_index"]->setUint( pass_indices[p] );
+    context->launch( rng_check, photon_launch_dim, photon_launch_dim );
+
+    const uint4* device = reinterpret_cast<const uint4*>( rng_check_buffer->map() );
+    for( unsigned int i = 0; i < photon_launch_dim*photon_launch_dim; ++i ) {
+      uint2 seed = counterSeeds( i, pass_indices[p], PPM_RNG_PHOTON_PASS );
+      const uint2 bits = seed;
+      const float sx = rnd( seed.x );
+      const float sy = rnd( seed.y );
+      if( device[i].x != bits.x || device[i].y != bits.y ||
+          memcmp( &device[i].z, &sx, sizeof( float ) ) != 0 || memcmp( &device[i].w, &sy, sizeof( float ) ) != 0 )
+        ++num_mismatches;
     }
+    rng_check_buffer->unmap();
   }
+  context["photon_pass_index"]->setUint( s_photon_pass_index );
+  sutil::resizeBuffer( rng_check_buffer, 1, 1 );
 
-  // Now build KD tree
-  buildKDTree( temp_photons, 0, valid_photons, 0, photon_map_data, 0, split_choice, bbmin, bbmax );
+  std::cerr << "Device random numbers: " << num_mismatches << " of "
+            << num_passes*photon_launch_dim*photon_launch_dim << " launch indices differ from the host\n"
+            << ( num_mismatches == 0 ? "Device random numbers OK" : "Device random numbers FAILED" ) << std::endl;
+  return num_mismatches == 0;
+}
 
-  delete[] temp_photons;
-  photon_map_buffer->unmap();
+
+//------------------------------------------------------------------------------
+//
+//  Photon map benchmark
+//
+//------------------------------------------------------------------------------
+
+// Builds both photon map backends on the host from one photon pass and runs a
+// radius query at every rtpass hit point against each.  Returns false if the
+// two disagree on the photons found.
+bool comparePhotonMaps( PhotonRecord* photons, unsigned int num_photons,
+                        const HitRecord* hits, unsigned int num_hits, SplitChoice split_choice )
+{
+  const int num_runs = 5;
+
+  std::vector<unsigned int> queries;
+  float max_radius2 = 0.0f;
+  for( unsigned int i = 0; i < num_hits; ++i ) {
+    if( ( hits[i].flags & PPM_HIT ) && !( hits[i].flags & PPM_OVERFLOW ) ) {
+      queries.push_back( i );
+      max_radius2 = fmaxf( max_radius2, hits[i].radius2 );
+    }
+  }
+  const size_t num_queries = queries.size();
+  const size_t query_chunk = 1024;
+  const size_t num_query_chunks = ( num_queries + query_chunk - 1 ) / query_chunk;
+
+  std::vector<PhotonRecord*> valid( num_photons );
+  const unsigned int num_valid = collectValidPhotons( photons, num_photons, valid.data() );
+
+  // kd-tree
+  const unsigned int kd_size = pow2roundup( num_photons ) - 1;
+  const KDTreeLayout kd_layout = kdTreeLayoutForSize( kd_size, 0 );
+  std::vector<PhotonRecord> kd_tree( kd_size );
+  double kd_build = std::numeric_limits<double>::max();
+  for( int run = 0; run < num_runs; ++run ) {
+    const double t0 = sutil::currentTime();
+    clearKDTree( kd_tree.data(), kd_size );
+    unsigned int n = collectValidPhotons( photons, num_photons, valid.data() );
+    n = std::min( n, kd_size );
+    float3 bbmin = make_float3( 0.0f );
+    float3 bbmax = make_float3( 0.0f );
+    if( split_choice == LongestDim )
+      computePhotonBounds( valid.data(), n, bbmin, bbmax );
+    buildKDTreeParallel( valid.data(), n, kd_tree.data(), split_choice, bbmin, bbmax );
+    kd_build = std::min( kd_build, sutil::currentTime() - t0 );
+  }
+
+  // Hash grid
+  const unsigned int hash_size = pow2roundup( num_photons );
+  std::vector<PhotonRecord> grid_photons( num_photons );
+  std::vector<unsigned int> cell_starts( hash_size + 1 );
+  PhotonGrid grid;
+  double grid_build = std::numeric_limits<double>::max();
+  for( int run = 0; run < num_runs; ++run ) {
+    const double t0 = sutil::currentTime();
+    const unsigned int n = std::min( collectValidPhotons( photons, num_photons, valid.data() ), kd_size );
+    buildPhotonGrid( valid.data(), n, max_radius2, hash_size, grid_photons.data(), cell_starts.data(), grid );
+    grid_build = std::min( grid_build, sutil::currentTime() - t0 );
+  }
+
+  // Queries.  Each backend reports the number and energy sum of the photons
+  // found per query, which must match exactly.
+  std::vector<unsigned int> kd_found( num_queries ), grid_found( num_queries );
+  std::vector<unsigned long long> kd_energy( num_queries ), grid_energy( num_queries );
+  std::vector<unsigned long long> kd_visited( num_query_chunks ), grid_tested( num_query_chunks );
+  double kd_query = std::numeric_limits<double>::max();
+  double grid_query = std::numeric_limits<double>::max();
+  for( int run = 0; run < num_runs; ++run ) {
+    double t0 = sutil::currentTime();
+    sutil::parallelFor( num_query_chunks, [&]( size_t c )
+    {
+      unsigned long long visited = 0;
+      for( size_t q = c * query_chunk; q < std::min( num_queries, ( c + 1 ) * query_chunk ); ++q ) {
+        const HitRecord& hit = hits[ queries[q] ];
+        unsigned int found = 0;
+        unsigned long long energy = 0;
+        visited += queryKDTree( kd_tree.data(), kd_layout, hit.position, hit.radius2,
+                                [&]( const PhotonRecord& photon ) { ++found; energy += photon.energy; } );
+        kd_found[q]  = found;
+        kd_energy[q] = energy;
+      }
+      kd_visited[c] = visited;
+    } );
+    kd_query = std::min( kd_query, sutil::currentTime() - t0 );
+
+    t0 = sutil::currentTime();
+    sutil::parallelFor( num_query_chunks, [&]( size_t c )
+    {
+      unsigned long long tested = 0;
+      for( size_t q = c * query_chunk; q < std::min( num_queries, ( c + 1 ) * query_chunk ); ++q ) {
+        const HitRecord& hit = hits[ queries[q] ];
+        unsigned int found = 0;
+        unsigned long long energy = 0;
+        tested += queryPhotonGrid( grid, grid_photons.data(), cell_starts.data(), hit.position, hit.radius2,
+                                   [&]( const PhotonRecord& photon ) { ++found; energy += photon.energy; } );
+        grid_found[q]  = found;
+        grid_energy[q] = energy;
+      }
+      grid_tested[c] = tested;
+    } );
+    grid_query = std::min( grid_query, sutil::currentTime() - t0 );
+  }
+
+  unsigned long long total_found = 0, total_visited = 0, total_tested = 0;
+  size_t num_mismatches = 0;
+  for( size_t q = 0; q < num_queries; ++q ) {
+    total_found += kd_found[q];
+    num_mismatches += kd_found[q] != grid_found[q] || kd_energy[q] != grid_energy[q];
+  }
+  for( size_t c = 0; c < num_query_chunks; ++c ) {
+    total_visited += kd_visited[c];
+    total_tested  += grid_tested[c];
+  }
+
+  const double inv_queries = num_queries ? 1.0 / num_queries : 0.0;
+  std::cerr << num_valid << " photons, " << num_queries << " queries, max radius2 " << max_radius2
+            << ", " << sutil::numWorkerThreads() << " threads, best of " << num_runs << "\n"
+            << "  kd_tree:   build " << kd_build * 1000.0 << " ms, "
+            << num_queries / kd_query * 1.e-6 << " Mqueries/s, "
+            << total_visited * inv_queries << " nodes visited/query\n"
+            << "  hash grid: build " << grid_build * 1000.0 << " ms, "
+            << num_queries / grid_query * 1.e-6 << " Mqueries/s, "
+            << total_tested * inv_queries << " photons tested/query\n"
+            << "  " << total_found * inv_queries << " photons found/query, "
+            << num_mismatches << " mismatching queries" << std::endl;
+  return num_mismatches == 0;
+}
+
+
+// Runs one rtpass and photon pass and compares the photon map backends on the
+// result with comparePhotonMaps.
+bool runPhotonMapBenchmark( const sutil::Camera& camera, unsigned int photon_launch_dim, Buffer photons_buffer )
+{
+  context["frame_number"]->setFloat( 0.0f );
+  context->launch( rtpass, camera.width(), camera.height() );
+  context->launch( ppass, photon_launch_dim, photon_launch_dim );
+
+  Buffer hit_records = context["rtpass_output_buffer"]->getBuffer();
+  RTsize width, height, num_photons;
+  hit_records->getSize( width, height );
+  photons_buffer->getSize( num_photons );
+
+  PhotonRecord* photons = reinterpret_cast<PhotonRecord*>( photons_buffer->map() );
+  const HitRecord* hits = reinterpret_cast<const HitRecord*>( hit_records->map() );
+  const bool ok = comparePhotonMaps( photons, static_cast<unsigned int>( num_photons ),
+                                     hits, static_cast<unsigned int>( width*height ), s_split_choice );
+  hit_records->unmap();
   photons_buffer->unmap();
+  return ok;
 }
 
 
@@ -659,7 +1068,6 @@ void windowSizeCallback( GLFWwindow* window, int w, int h )
 
     sutil::resizeBuffer( context[ "debug_buffer" ]->getBuffer(), width, height );
     sutil::resizeBuffer( context[ "rtpass_output_buffer" ]->getBuffer(), width, height );
-    sutil::resizeBuffer( context[ "image_rnd_seeds" ]->getBuffer(), width, height );
 
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
@@ -688,6 +1096,33 @@ GLFWwindow* glfwInitialize( )
 }
 
 
+// Traces a photon pass with the next photon_pass_index, returns the launch time.
+double tracePhotons( unsigned int photon_launch_dim )
+{
+    if (s_print_timings) std::cerr << "Starting photon pass   ... ";
+
+    context["photon_pass_index"]->setUint( s_photon_pass_index++ );
+    double t0 = sutil::currentTime();
+
+    context->launch( ppass, photon_launch_dim, photon_launch_dim );
+
+    double t1 = sutil::currentTime();
+    if (s_print_timings) std::cerr << "finished. " << t1 - t0 << std::endl;
+    return t1 - t0;
+}
+
+
+// Updates the gather radius bound of the photon grid.  Gather radii only
+// shrink, so the bound is refreshed every power of two frames.
+void updateGridRadius2( unsigned int accumulation_frame )
+{
+    if ( accumulation_frame == 1 )
+        s_grid_radius2 = context["rtpass_default_radius2"]->getFloat();
+    else if ( ( accumulation_frame & ( accumulation_frame - 1 ) ) == 0 )
+        s_grid_radius2 = maxHitRadius2();
+}
+
+
 void launch_all( const sutil::Camera& camera, unsigned int photon_launch_dim, unsigned int accumulation_frame, 
     Buffer photons_buffer, Buffer photon_map_buffer )
 {
@@ -705,39 +1140,96 @@ void launch_all( const sutil::Camera& camera, unsigned int photon_launch_dim, un
         context["total_emitted"]->setFloat(  0.0f );
     }
 
-    // Trace photons
-    {
-        if (s_print_timings) std::cerr << "Starting photon pass   ... ";
-
-        Buffer photon_rnd_seeds = context["photon_rnd_seeds"]->getBuffer();
-        uint2* seeds = reinterpret_cast<uint2*>( photon_rnd_seeds->map() );
-        for ( unsigned int i = 0; i < photon_launch_dim*photon_launch_dim; ++i ) {
-            seeds[i] = random2u();
+    if ( s_pipeline_photon_maps ) {
+        // The map gathered in frame k is built in slot k%2 on the worker thread
+        // while photon pass k+1 is traced, then the worker moves on to map k+1
+        // during the upload and gather of map k.
+        const unsigned int slot = accumulation_frame & 1u;
+        if ( accumulation_frame == 1 ) {
+            // Restarting: drop any build in flight and start map 1 right away
+            s_photon_map_pipeline.wait();
+            tracePhotons( photon_launch_dim );
+            updateGridRadius2( accumulation_frame );
+            s_photon_map_pipeline.start( photons_buffer, photon_map_buffer, slot, s_photon_map_backend,
+                                         s_split_choice, s_grid_radius2 );
         }
-        photon_rnd_seeds->unmap();
+
+        const double trace_time = tracePhotons( photon_launch_dim );
+
         double t0 = sutil::currentTime();
+        s_photon_map_pipeline.wait();
+        const double wait_time = sutil::currentTime() - t0;
+
+        if ( s_photon_map_backend == HashGridBackend )
+            updateGridRadius2( accumulation_frame );
+        s_photon_map_pipeline.start( photons_buffer, photon_map_buffer, 1u - slot, s_photon_map_backend,
+                                     s_split_choice, s_grid_radius2 );
+        s_photon_map_pipeline.upload( photon_map_buffer, slot, s_photon_map_backend );
+
+        context["total_emitted"]->setFloat( static_cast<float>((unsigned long long)accumulation_frame*photon_launch_dim*photon_launch_dim) );
 
-        context->launch( ppass, photon_launch_dim, photon_launch_dim );
+        if (s_print_timings) std::cerr << "Starting gather pass   ... ";
+        t0 = sutil::currentTime();
+
+        context->launch( gather, camera.width(), camera.height() );
 
         double t1 = sutil::currentTime();
-        if (s_print_timings) std::cerr << "finished. " << t1 - t0 << std::endl;
+        if (s_print_timings) {
+            const PhotonMapTimings& timings = s_photon_map_pipeline.timings( slot );
+            const double build_time = timings.prepare + timings.build;
+            std::cerr << "finished. " << t1 - t0 << std::endl
+                      << "Pipelined frame " << accumulation_frame << ": photon pass " << trace_time
+                      << ", wait " << wait_time
+                      << ", copy photons " << s_photon_map_pipeline.timings( 1u - slot ).map
+                      << ", upload " << timings.unmap
+                      << ", gather " << t1 - t0
+                      << "; worker build " << build_time
+                      << " (prepare " << timings.prepare << "), "
+                      << std::max( 0.0, build_time - wait_time ) << " hidden" << std::endl;
+        }
+        return;
     }
 
+    // Trace photons
+    tracePhotons( photon_launch_dim );
+
     // By computing the total number of photons as an unsigned long long we avoid 32 bit
     // floating point addition errors when the number of photons gets sufficiently large
     // (the error of adding two floating point numbers when the mantissa bits no longer
     // overlap).
     context["total_emitted"]->setFloat( static_cast<float>((unsigned long long)accumulation_frame*photon_launch_dim*photon_launch_dim) );
 
-    // Build KD tree
-    {
+    // Build KD tree or hash grid
+    if ( s_photon_map_backend == HashGridBackend ) {
+        updateGridRadius2( accumulation_frame );
+
+        if (s_print_timings) std::cerr << "Starting hash grid build ... ";
+        double t0 = sutil::currentTime();
+
+        PhotonMapTimings timings;
+        createPhotonGrid( photons_buffer, photon_map_buffer, s_grid_radius2, timings );
+
+        double t1 = sutil::currentTime();
+        if (s_print_timings) std::cerr << "finished. " << t1 - t0
+                                       << " (map " << timings.map
+                                       << ", prepare " << timings.prepare
+                                       << ", build " << timings.build
+                                       << ", unmap " << timings.unmap
+                                       << ", " << sutil::numWorkerThreads() << " threads)" << std::endl;
+    } else {
         if (s_print_timings) std::cerr << "Starting kd_tree build ... ";
         double t0 = sutil::currentTime();
 
-        createPhotonMap( photons_buffer, photon_map_buffer );
+        PhotonMapTimings timings;
+        createPhotonMap( photons_buffer, photon_map_buffer, s_split_choice, timings );
 
         double t1 = sutil::currentTime();
-        if (s_print_timings) std::cerr << "finished. " << t1 - t0 << std::endl;
+        if (s_print_timings) std::cerr << "finished. " << t1 - t0
+                                       << " (map " << timings.map
+                                       << ", prepare " << timings.prepare
+                                       << ", build " << timings.build
+                                       << ", unmap " << timings.unmap
+                                       << ", " << sutil::numWorkerThreads() << " threads)" << std::endl;
     }
 
 
@@ -754,6 +1246,39 @@ void launch_all( const sutil::Camera& camera, unsigned int photon_launch_dim, un
 
 }
 
+// Accumulates numframes frames, then traces one more photon pass and saves it
+// with the current hit records for ppmReplay.
+bool writeSnapshot( const std::string& filename, const sutil::Camera& camera, unsigned int photon_launch_dim,
+                    Buffer photons_buffer, Buffer photon_map_buffer )
+{
+    const unsigned int numframes = 16;
+    std::cerr << "Accumulating " << numframes << " frames ..." << std::endl;
+    for ( unsigned int frame = 0; frame < numframes; ++frame ) {
+        context["frame_number"]->setFloat( static_cast<float>( frame ) );
+        launch_all( camera, photon_launch_dim, frame+1, photons_buffer, photon_map_buffer );
+    }
+    tracePhotons( photon_launch_dim );
+
+    Buffer hit_records = context["rtpass_output_buffer"]->getBuffer();
+    RTsize width, height, num_photons;
+    hit_records->getSize( width, height );
+    photons_buffer->getSize( num_photons );
+
+    const PhotonRecord* photons = reinterpret_cast<const PhotonRecord*>( photons_buffer->map() );
+    const HitRecord* hits = reinterpret_cast<const HitRecord*>( hit_records->map() );
+    const bool ok = writePhotonMapSnapshot( filename, photons, static_cast<unsigned int>( num_photons ), hits,
+                                            static_cast<unsigned int>( width ), static_cast<unsigned int>( height ),
+                                            numframes + 1 );
+    hit_records->unmap();
+    photons_buffer->unmap();
+
+    if ( ok )
+        std::cerr << "Wrote " << filename << std::endl;
+    else
+        std::cerr << "Failed to write " << filename << std::endl;
+    return ok;
+}
+
 void glfwRun( GLFWwindow* window, sutil::Camera& camera, PPMLight& light, unsigned int photon_launch_dim, Buffer photons_buffer, Buffer photon_map_buffer )
 {
     // Initialize GL state
@@ -920,6 +1445,14 @@ void printUsageAndExit( const std::string& argv0 )
         "         --photon-dim <n>        Width and height of photon launch grid. Default = " << PHOTON_LAUNCH_DIM << ".\n"
         "  -ddb | --display-debug-buffer  Display debug buffer information to the shell.\n"
         "  -pt  | --print-timings         Print timing information.\n"
+        "         --check-encoding        Check photon record encoding round trips and exit.\n"
+        "         --check-rng             Check the random number generator on the host and against the device and exit.\n"
+        "         --kd-split <mode>       Photon kd-tree split axis: 'longest' (default), 'variance' or 'round-robin'.\n"
+        "         --kd-block-height <k>   Store the photon kd-tree in blocks of k levels. Default = 0 (breadth first).\n"
+        "         --photon-map <type>     Photon map used by the gather pass: 'kd' (default) or 'grid'.\n"
+        "         --pipeline              Build each photon map on a worker thread while the next photon pass and the gather run.\n"
+        "         --write-snapshot <file> Accumulate 16 frames, then save the next photon pass and the hit records for ppmReplay and exit.\n"
+        "         --photon-map-bench      Compare kd-tree and hash grid builds and queries on the host and exit.\n"
         "App Keystrokes:\n"
         "  q  Quit\n"
         "  s  Save image to '" << SAMPLE_NAME << ".png'\n"
@@ -935,7 +1468,10 @@ int main( int argc, char** argv )
 {
     bool use_pbo = true;
     unsigned int photon_launch_dim = PHOTON_LAUNCH_DIM;
+    bool photon_map_bench = false;
+    bool check_rng = false;
     std::string out_file;
+    std::string snapshot_file;
     for( int i=1; i<argc; ++i )
     {
         const std::string arg( argv[i] );
@@ -975,6 +1511,79 @@ int main( int argc, char** argv )
             int tmp = atoi( argv[++i] );
             if (tmp > 0) photon_launch_dim = static_cast<unsigned int>(tmp);
         }
+        else if( arg == "--check-encoding" )
+        {
+            return checkPhotonEncoding() ? 0 : 1;
+        }
+        else if( arg == "--check-rng" )
+        {
+            check_rng = true;
+        }
+        else if( arg == "--kd-block-height" )
+        {
+            if( i == argc-1 )
+            {
+                std::cerr << "Option '" << arg << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            int tmp = atoi( argv[++i] );
+            if (tmp >= 0) s_kd_block_height = static_cast<unsigned int>(tmp);
+        }
+        else if( arg == "--kd-split" )
+        {
+            if( i == argc-1 )
+            {
+                std::cerr << "Option '" << arg << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            const std::string mode( argv[++i] );
+            if( mode == "longest" )
+                s_split_choice = LongestDim;
+            else if( mode == "variance" )
+                s_split_choice = HighestVariance;
+            else if( mode == "round-robin" )
+                s_split_choice = RoundRobin;
+            else
+            {
+                std::cerr << "Unknown kd-tree split mode '" << mode << "'\n";
+                printUsageAndExit( argv[0] );
+            }
+        }
+        else if( arg == "--photon-map" )
+        {
+            if( i == argc-1 )
+            {
+                std::cerr << "Option '" << arg << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            const std::string type( argv[++i] );
+            if( type == "kd" )
+                s_photon_map_backend = KDTreeBackend;
+            else if( type == "grid" )
+                s_photon_map_backend = HashGridBackend;
+            else
+            {
+                std::cerr << "Unknown photon map type '" << type << "'\n";
+                printUsageAndExit( argv[0] );
+            }
+        }
+        else if( arg == "--pipeline" )
+        {
+            s_pipeline_photon_maps = true;
+        }
+        else if( arg == "--write-snapshot" )
+        {
+            if( i == argc-1 )
+            {
+                std::cerr << "Option '" << arg << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            snapshot_file = argv[++i];
+        }
+        else if( arg == "--photon-map-bench" )
+        {
+            photon_map_bench = true;
+        }
         else
         {
             std::cerr << "Unknown option '" << arg << "'\n";
@@ -1014,7 +1623,26 @@ int main( int argc, char** argv )
 
         context->validate();
         
-        if ( out_file.empty() )
+        if ( !snapshot_file.empty() )
+        {
+            const bool ok = writeSnapshot( snapshot_file, camera, photon_launch_dim, photons_buffer, photon_map_buffer );
+            destroyContext();
+            return ok ? 0 : 1;
+        }
+        else if ( check_rng )
+        {
+            const bool host_ok = checkRandom();
+            const bool device_ok = checkDeviceRandom( photon_launch_dim );
+            destroyContext();
+            return host_ok && device_ok ? 0 : 1;
+        }
+        else if ( photon_map_bench )
+        {
+            const bool ok = runPhotonMapBenchmark( camera, photon_launch_dim, photons_buffer );
+            destroyContext();
+            return ok ? 0 : 1;
+        }
+        else if ( out_file.empty() )
         {
             glfwRun( window, camera, light, photon_launch_dim, photons_buffer, photon_map_buffer );
         }
@@ -26,6 +26,8 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#pragma once
+
 #include <optixu/optixu_math_namespace.h>
 
 #define  PPM_X         ( 1 << 0 )
@@ -38,6 +40,11 @@
 #define  PPM_OVERFLOW  ( 1 << 6 )
 #define  PPM_HIT       ( 1 << 7 )
 
+// Keys of the counterSeeds() streams (see random.h) drawn by each pass
+#define  PPM_RNG_RTPASS      0u
+#define  PPM_RNG_PHOTON_PASS 1u
+#define  PPM_RNG_GATHER      2u
+
 enum RayTypes
 {
     rtpass_ray_type,
@@ -93,26 +100,104 @@ struct HitPRD
 };
 
 
+// 32 bytes.  Directions and energy are stored with the encode/decode
+// functions below; an energy of 0 marks an empty photon slot.
 struct PhotonRecord
 {
   optix::float3 position;
-  optix::float3 normal;      // Pack this into 4 bytes
-  optix::float3 ray_dir;
-  optix::float3 energy;
+  optix::uint   normal;      // encodeOctahedral
+  optix::uint   ray_dir;     // encodeOctahedral
+  optix::uint   energy;      // encodeRGBE
   optix::uint   axis;
-  optix::float3 pad;
+  optix::uint   pad;
 };
 
 
 struct PackedPhotonRecord
 {
-  optix::float4 a;   // position.x, position.y, position.z, normal.x
-  optix::float4 b;   // normal.y,   normal.z,   ray_dir.x,  ray_dir.y
-  optix::float4 c;   // ray_dir.z,  energy.x,   energy.y,   energy.z
-  optix::float4 d;   // axis,       padding,    padding,    padding
+  optix::float4 a;   // position.x, position.y, position.z, normal
+  optix::uint4  b;   // ray_dir,    energy,     axis,       padding
 };
 
 
+//
+// Photon record encoding
+//
+
+// Unit vector to 16:16 snorm octahedral coordinates.  Decoding is within
+// 7e-5 radians of the input.
+static __host__ __device__ __inline__ optix::uint encodeOctahedral( const optix::float3& v )
+{
+  const float inv_l1 = 1.0f / ( fabsf( v.x ) + fabsf( v.y ) + fabsf( v.z ) );
+  float x = v.x * inv_l1;
+  float y = v.y * inv_l1;
+  if( v.z < 0.0f ) {
+    const float fx = x;
+    x = ( 1.0f - fabsf( y ) ) * ( fx >= 0.0f ? 1.0f : -1.0f );
+    y = ( 1.0f - fabsf( fx ) ) * ( y >= 0.0f ? 1.0f : -1.0f );
+  }
+  const int qx = static_cast<int>( floorf( optix::clamp( x, -1.0f, 1.0f ) * 32767.0f + 0.5f ) );
+  const int qy = static_cast<int>( floorf( optix::clamp( y, -1.0f, 1.0f ) * 32767.0f + 0.5f ) );
+  return ( static_cast<optix::uint>( qx ) & 0xffffu ) | ( static_cast<optix::uint>( qy ) << 16 );
+}
+
+static __host__ __device__ __inline__ optix::float3 decodeOctahedral( optix::uint bits )
+{
+  float x = static_cast<float>( static_cast<short>( bits & 0xffffu ) ) * ( 1.0f / 32767.0f );
+  float y = static_cast<float>( static_cast<short>( bits >> 16 ) )    * ( 1.0f / 32767.0f );
+  const float z = 1.0f - fabsf( x ) - fabsf( y );
+  if( z < 0.0f ) {
+    const float fx = x;
+    x = ( 1.0f - fabsf( y ) ) * ( fx >= 0.0f ? 1.0f : -1.0f );
+    y = ( 1.0f - fabsf( fx ) ) * ( y >= 0.0f ? 1.0f : -1.0f );
+  }
+  return optix::normalize( optix::make_float3( x, y, z ) );
+}
+
+// Non-negative color to 8 bit mantissas with a shared exponent (Ward's RGBE,
+// rounded to nearest).  The error of each channel is at most 1/255 of the
+// largest channel while it rounds below 2^127, i.e. is below 2^127*(1-2^-9).
+// Larger and infinite colors saturate to PPM_RGBE_MAX, NaN channels encode as 0,
+// and colors whose largest channel is below 2^-118 encode as 0.
+#define  PPM_RGBE_MAX  0xffffffffu
+
+static __host__ __device__ __inline__ optix::uint encodeRGBE( const optix::float3& c )
+{
+  const float r = fmaxf( c.x, 0.0f );
+  const float g = fmaxf( c.y, 0.0f );
+  const float b = fmaxf( c.z, 0.0f );
+  const float m = fmaxf( r, fmaxf( g, b ) );
+  // m < 2^e, from the exponent bits of m
+  int e = ( ( optix::float_as_int( m ) >> 23 ) & 0xff ) - 126;
+  if( e < -117 )
+    return 0u;
+  if( e > 127 )
+    return PPM_RGBE_MAX;                                      // inf
+  float scale = optix::int_as_float( ( 127 + 8 - e ) << 23 );   // 2^(8-e)
+  if( floorf( m * scale + 0.5f ) >= 256.0f ) {
+    if( e == 127 )
+      return PPM_RGBE_MAX;
+    ++e;
+    scale *= 0.5f;
+  }
+  const optix::uint qr = static_cast<optix::uint>( floorf( r * scale + 0.5f ) );
+  const optix::uint qg = static_cast<optix::uint>( floorf( g * scale + 0.5f ) );
+  const optix::uint qb = static_cast<optix::uint>( floorf( b * scale + 0.5f ) );
+  return qr | ( qg << 8 ) | ( qb << 16 ) | ( static_cast<optix::uint>( e + 128 ) << 24 );
+}
+
+static __host__ __device__ __inline__ optix::float3 decodeRGBE( optix::uint bits )
+{
+  if( bits == 0u )
+    return optix::make_float3( 0.0f );
+  const int   e     = static_cast<int>( bits >> 24 ) - 128;
+  const float scale = optix::int_as_float( ( 127 - 8 + e ) << 23 );   // 2^(e-8)
+  return optix::make_float3( static_cast<float>(   bits         & 0xffu ),
+                             static_cast<float>( ( bits >> 8  ) & 0xffu ),
+                             static_cast<float>( ( bits >> 16 ) & 0xffu ) ) * scale;
+}
+
+
 struct PhotonPRD
 {
   optix::float3 energy;
@@ -127,3 +212,22 @@ struct ShadowPRD
 {
   float attenuation;
 };
+
+
+//
+// Photon hash grid
+//
+
+// Bucket of the grid cell containing a point, shared by the host build and
+// gather_grid().  mask is the bucket count minus one (a power of two minus one).
+static __host__ __device__ __inline__ optix::uint photonGridHash( int x, int y, int z, optix::uint mask )
+{
+  return ( static_cast<optix::uint>( x ) * 73856093u ^
+           static_cast<optix::uint>( y ) * 19349663u ^
+           static_cast<optix::uint>( z ) * 83492791u ) & mask;
+}
+
+static __host__ __device__ __inline__ int photonGridCoord( float x, float origin, float inv_cell_size )
+{
+  return static_cast<int>( floorf( ( x - origin ) * inv_cell_size ) );
+}
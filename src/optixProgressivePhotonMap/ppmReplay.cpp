@@ -0,0 +1,443 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//-----------------------------------------------------------------------------
+//
+// ppmReplay: host only replay of photon map snapshots written by
+// optixProgressivePhotonMap --write-snapshot.  Rebuilds the photon map of each
+// snapshot as launch_all() does and runs the gather traversal of
+// ppm_gather.cu on the CPU for every hit record, reporting build time, nodes
+// visited per query and queries per second.  Needs no GPU.
+//
+//-----------------------------------------------------------------------------
+
+#include "PhotonMap.h"
+#include "PhotonMapSnapshot.h"
+
+#include <optixu/optixu_math_namespace.h>
+
+#include <Parallel.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace optix;
+
+
+//------------------------------------------------------------------------------
+//
+//  Helpers
+//
+//------------------------------------------------------------------------------
+
+// Queries per parallelFor item
+const size_t GATHER_CHUNK_SIZE = 1024;
+
+// Blocked kd-tree layout compared against breadth first by default
+const unsigned int KD_BLOCK_HEIGHT = 2;
+
+static double currentTime()
+{
+  return std::chrono::duration<double>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+
+// Finds the smallest power of 2 greater or equal to x.
+static unsigned int pow2roundup( unsigned int x )
+{
+  --x;
+  x |= x >> 1;
+  x |= x >> 2;
+  x |= x >> 4;
+  x |= x >> 8;
+  x |= x >> 16;
+  return x+1;
+}
+
+
+// Photon contribution test and flux of accumulatePhoton() in ppm_gather.cu
+struct GatherResult
+{
+  unsigned long long num_visited;   // kd nodes visited or grid photons tested
+  unsigned long long num_gathered;  // Photons accepted by the normal test
+  double             flux_sum;      // Sum of all flux channels, as a checksum
+};
+
+struct PhotonAccumulator
+{
+  float3       normal;
+  float3       atten_Kd;
+  unsigned int num_new_photons;
+  float3       flux_M;
+
+  void operator()( const PhotonRecord& photon )
+  {
+    const float3 photon_normal = decodeOctahedral( photon.normal );
+    if( dot( photon_normal, normal ) > 0.01f ) {
+      num_new_photons++;
+      flux_M += decodeRGBE( photon.energy ) * atten_Kd;
+    }
+  }
+};
+
+
+// Gathers every valid hit record of the snapshot, with the traversal chosen by
+// query( hit, accumulator ) returning the nodes visited.
+template<typename Query>
+GatherResult gatherAll( const PhotonMapSnapshot& snapshot, const std::vector<unsigned int>& queries, Query query )
+{
+  const size_t num_chunks = ( queries.size() + GATHER_CHUNK_SIZE - 1 ) / GATHER_CHUNK_SIZE;
+  std::vector<GatherResult> chunk_results( num_chunks );
+  sutil::parallelFor( num_chunks, [&]( size_t c )
+  {
+    GatherResult result = { 0, 0, 0.0 };
+    const size_t end = std::min( queries.size(), ( c + 1 ) * GATHER_CHUNK_SIZE );
+    for( size_t q = c * GATHER_CHUNK_SIZE; q < end; ++q ) {
+      const HitRecord& hit = snapshot.hits[ queries[q] ];
+      PhotonAccumulator acc = { hit.normal, hit.attenuated_Kd, 0u, make_float3( 0.0f ) };
+      result.num_visited  += query( hit, acc );
+      result.num_gathered += acc.num_new_photons;
+      result.flux_sum     += acc.flux_M.x + acc.flux_M.y + acc.flux_M.z;
+    }
+    chunk_results[c] = result;
+  } );
+
+  // Summed in chunk order so the checksum doesn't depend on the thread count
+  GatherResult total = { 0, 0, 0.0 };
+  for( size_t c = 0; c < num_chunks; ++c ) {
+    total.num_visited  += chunk_results[c].num_visited;
+    total.num_gathered += chunk_results[c].num_gathered;
+    total.flux_sum     += chunk_results[c].flux_sum;
+  }
+  return total;
+}
+
+
+void printResult( const char* name, double build_time, double prepare_time, double gather_time,
+                  size_t num_queries, const GatherResult& result, const char* visited_name )
+{
+  const double inv_queries = num_queries ? 1.0 / num_queries : 0.0;
+  std::cerr << "  " << name << ": build " << build_time * 1000.0 << " ms (prepare " << prepare_time * 1000.0
+            << " ms), " << result.num_visited * inv_queries << " " << visited_name << "/query, "
+            << num_queries / gather_time * 1.e-6 << " Mqueries/s, "
+            << result.num_gathered * inv_queries << " photons gathered/query, flux sum "
+            << result.flux_sum << std::endl;
+}
+
+
+//------------------------------------------------------------------------------
+//
+//  Replay
+//
+//------------------------------------------------------------------------------
+
+struct ReplayOptions
+{
+  bool         kd_tree;
+  bool         grid;
+  SplitChoice  split_choice;
+  unsigned int kd_block_height;   // Blocked layout compared against breadth first, 0 for none
+  unsigned int cache_size;        // Bytes, for the kd-tree traffic estimate
+  int          num_runs;
+};
+
+
+// Set associative LRU cache of 64 byte lines, to estimate the memory traffic of
+// a stream of kd-tree node reads.
+class CacheModel
+{
+public:
+  static const unsigned int LINE_SIZE = 64;
+  static const unsigned int WAYS      = 16;
+
+  CacheModel( unsigned int size )
+    : m_num_sets( std::max( 1u, size / ( LINE_SIZE * WAYS ) ) ),
+      m_tags( m_num_sets * WAYS, ~0ull ),
+      m_misses( 0 )
+  {
+  }
+
+  void access( unsigned long long address )
+  {
+    const unsigned long long line = address / LINE_SIZE;
+    unsigned long long* set = &m_tags[ ( line % m_num_sets ) * WAYS ];
+    unsigned int way = 0;
+    while( way < WAYS - 1 && set[way] != line )
+      ++way;
+    if( set[way] != line )
+      ++m_misses;
+
+    // Move to the front, most recently used first
+    for( ; way > 0; --way )
+      set[way] = set[way-1];
+    set[0] = line;
+  }
+
+  unsigned long long misses()const { return m_misses; }
+
+private:
+  unsigned int                    m_num_sets;
+  std::vector<unsigned long long> m_tags;
+  unsigned long long              m_misses;
+};
+
+
+// Replays the gather traversal against the kd-tree of the snapshot in the given
+// layout.  Besides timing, reports the distinct cache lines each query touches
+// and the lines read through a CacheModel with queries in launch order.
+void replayKDTree( const PhotonMapSnapshot& snapshot, std::vector<PhotonRecord>& photons,
+                   const std::vector<unsigned int>& queries, const ReplayOptions& options,
+                   const KDTreeLayout& layout, unsigned int& valid_photons )
+{
+  const unsigned int num_photons     = static_cast<unsigned int>( photons.size() );
+  const unsigned int photon_map_size = ( 1u << layout.height ) - 1u;
+  std::vector<PhotonRecord> kd_tree( photon_map_size );
+  PhotonMapTimings best = { 0.0, std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), 0.0 };
+  for( int run = 0; run < options.num_runs; ++run ) {
+    PhotonMapTimings timings;
+    valid_photons = buildPhotonMapData( photons.data(), num_photons, kd_tree.data(), photon_map_size,
+                                        options.split_choice, layout, timings );
+    if( timings.prepare + timings.build < best.prepare + best.build )
+      best = timings;
+  }
+
+  GatherResult result = { 0, 0, 0.0 };
+  double gather_time = std::numeric_limits<double>::max();
+  for( int run = 0; run < options.num_runs; ++run ) {
+    const double t0 = currentTime();
+    result = gatherAll( snapshot, queries, [&]( const HitRecord& hit, PhotonAccumulator& acc )
+    {
+      return queryKDTree( kd_tree.data(), layout, hit.position, hit.radius2,
+                          [&acc]( const PhotonRecord& photon ) { acc( photon ); } );
+    } );
+    gather_time = std::min( gather_time, currentTime() - t0 );
+  }
+
+  // Memory traffic, on one thread since the cache model is sequential
+  CacheModel cache( options.cache_size );
+  unsigned long long num_lines = 0;
+  std::vector<unsigned long long> query_lines;
+  for( size_t q = 0; q < queries.size(); ++q ) {
+    const HitRecord& hit = snapshot.hits[ queries[q] ];
+    query_lines.clear();
+    queryKDTree( kd_tree.data(), layout, hit.position, hit.radius2, []( const PhotonRecord& ) {},
+                 [&]( unsigned int offset )
+                 {
+                   const unsigned long long address = static_cast<unsigned long long>( offset ) * sizeof( PhotonRecord );
+                   query_lines.push_back( address / CacheModel::LINE_SIZE );
+                   cache.access( address );
+                 } );
+    std::sort( query_lines.begin(), query_lines.end() );
+    num_lines += std::unique( query_lines.begin(), query_lines.end() ) - query_lines.begin();
+  }
+
+  std::string name = "kd_tree  ";
+  if( layout.block_height != 0 ) {
+    std::ostringstream oss;
+    oss << "kd_tree (blocks of " << layout.block_height << " levels)";
+    name = oss.str();
+  }
+  const double inv_queries = queries.empty() ? 0.0 : 1.0 / queries.size();
+  printResult( name.c_str(), best.prepare + best.build, best.prepare, gather_time, queries.size(), result,
+               "nodes visited" );
+  std::cerr << "    " << num_lines * inv_queries << " cache lines/query, "
+            << cache.misses() * CacheModel::LINE_SIZE * inv_queries << " bytes/query missing a "
+            << options.cache_size / 1024 << " KB cache (" << cache.misses() * CacheModel::LINE_SIZE / ( 1024.0*1024.0 )
+            << " MB total)" << std::endl;
+}
+
+
+bool replaySnapshot( const std::string& filename, const ReplayOptions& options )
+{
+  PhotonMapSnapshot snapshot;
+  std::string error;
+  if( !readPhotonMapSnapshot( filename, snapshot, error ) ) {
+    std::cerr << "Error: " << error << std::endl;
+    return false;
+  }
+
+  // The hit records gather() would shade, and the largest radius among them
+  std::vector<unsigned int> queries;
+  float max_radius2 = 0.0f;
+  for( size_t i = 0; i < snapshot.hits.size(); ++i ) {
+    const HitRecord& hit = snapshot.hits[i];
+    if( ( hit.flags & PPM_HIT ) && !( hit.flags & PPM_OVERFLOW ) ) {
+      queries.push_back( static_cast<unsigned int>( i ) );
+      max_radius2 = std::max( max_radius2, hit.radius2 );
+    }
+  }
+
+  const unsigned int num_photons = static_cast<unsigned int>( snapshot.photons.size() );
+  std::vector<PhotonRecord> photons( snapshot.photons );
+  unsigned int valid_photons = 0;
+
+  std::cerr << filename << ": " << num_photons << " photons, " << queries.size() << " queries ("
+            << snapshot.hit_width << "x" << snapshot.hit_height << " frame " << snapshot.frame
+            << "), max radius2 " << max_radius2 << ", " << sutil::numWorkerThreads() << " threads, best of "
+            << options.num_runs << std::endl;
+
+  if( options.kd_tree ) {
+    const unsigned int photon_map_size = pow2roundup( num_photons ) - 1;
+    replayKDTree( snapshot, photons, queries, options, kdTreeLayoutForSize( photon_map_size, 0 ), valid_photons );
+    if( options.kd_block_height != 0 )
+      replayKDTree( snapshot, photons, queries, options,
+                    kdTreeLayoutForSize( photon_map_size, options.kd_block_height ), valid_photons );
+  }
+
+  if( options.grid ) {
+    const unsigned int num_cells = pow2roundup( num_photons ) + 1;
+    std::vector<PhotonRecord> grid_photons( num_photons );
+    std::vector<unsigned int> cell_starts( num_cells );
+    PhotonGrid grid;
+    PhotonMapTimings best = { 0.0, std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), 0.0 };
+    for( int run = 0; run < options.num_runs; ++run ) {
+      PhotonMapTimings timings;
+      valid_photons = buildPhotonGridData( photons.data(), num_photons, grid_photons.data(), cell_starts.data(),
+                                           num_cells, max_radius2, grid, timings );
+      if( timings.prepare + timings.build < best.prepare + best.build )
+        best = timings;
+    }
+
+    GatherResult result = { 0, 0, 0.0 };
+    double gather_time = std::numeric_limits<double>::max();
+    for( int run = 0; run < options.num_runs; ++run ) {
+      const double t0 = currentTime();
+      result = gatherAll( snapshot, queries, [&]( const HitRecord& hit, PhotonAccumulator& acc )
+      {
+        return queryPhotonGrid( grid, grid_photons.data(), cell_starts.data(), hit.position, hit.radius2,
+                                [&acc]( const PhotonRecord& photon ) { acc( photon ); } );
+      } );
+      gather_time = std::min( gather_time, currentTime() - t0 );
+    }
+    printResult( "hash grid", best.prepare + best.build, best.prepare, gather_time, queries.size(), result,
+                 "photons tested" );
+  }
+
+  std::cerr << "  " << valid_photons << " valid photons" << std::endl;
+  return true;
+}
+
+
+//------------------------------------------------------------------------------
+//
+// Main
+//
+//------------------------------------------------------------------------------
+
+void printUsageAndExit( const std::string& argv0 )
+{
+    std::cerr << "\nUsage: " << argv0 << " [options] <snapshot> [<snapshot> ...]\n";
+    std::cerr <<
+        "Replays photon map snapshots written by optixProgressivePhotonMap --write-snapshot on the host.\n"
+        "App Options:\n"
+        "  -h   | --help                  Print this usage message and exit.\n"
+        "         --photon-map <type>     Photon map to replay: 'kd', 'grid' or 'both' (default).\n"
+        "         --kd-split <mode>       Photon kd-tree split axis: 'longest' (default), 'variance' or 'round-robin'.\n"
+        "         --kd-block-height <k>   Compare the breadth-first kd-tree with blocks of k levels, 0 to skip. Default = " << KD_BLOCK_HEIGHT << ".\n"
+        "         --cache-kb <n>          Cache size for the kd-tree memory traffic estimate. Default = 2048.\n"
+        "         --runs <n>              Report the best of n builds and gathers. Default = 5.\n"
+        << std::endl;
+
+    exit(1);
+}
+
+
+int main( int argc, char** argv )
+{
+    ReplayOptions options = { true, true, LongestDim, KD_BLOCK_HEIGHT, 2u<<20, 5 };
+    std::vector<std::string> files;
+    for( int i=1; i<argc; ++i )
+    {
+        const std::string arg( argv[i] );
+
+        if( arg == "-h" || arg == "--help" )
+        {
+            printUsageAndExit( argv[0] );
+        }
+        else if( arg == "--photon-map" || arg == "--kd-split" || arg == "--kd-block-height" || arg == "--cache-kb" ||
+                 arg == "--runs" )
+        {
+            if( i == argc-1 )
+            {
+                std::cerr << "Option '" << arg << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            const std::string value( argv[++i] );
+            if( arg == "--runs" )
+            {
+                options.num_runs = std::max( 1, atoi( value.c_str() ) );
+            }
+            else if( arg == "--kd-block-height" )
+            {
+                options.kd_block_height = static_cast<unsigned int>( std::max( 0, atoi( value.c_str() ) ) );
+            }
+            else if( arg == "--cache-kb" )
+            {
+                options.cache_size = static_cast<unsigned int>( std::max( 1, atoi( value.c_str() ) ) ) * 1024u;
+            }
+            else if( arg == "--photon-map" && ( value == "kd" || value == "grid" || value == "both" ) )
+            {
+                options.kd_tree = value != "grid";
+                options.grid    = value != "kd";
+            }
+            else if( arg == "--kd-split" && value == "longest" )
+                options.split_choice = LongestDim;
+            else if( arg == "--kd-split" && value == "variance" )
+                options.split_choice = HighestVariance;
+            else if( arg == "--kd-split" && value == "round-robin" )
+                options.split_choice = RoundRobin;
+            else
+            {
+                std::cerr << "Unknown value '" << value << "' for option '" << arg << "'\n";
+                printUsageAndExit( argv[0] );
+            }
+        }
+        else if( arg.size() > 1 && arg[0] == '-' )
+        {
+            std::cerr << "Unknown option '" << arg << "'\n";
+            printUsageAndExit( argv[0] );
+        }
+        else
+        {
+            files.push_back( arg );
+        }
+    }
+    if( files.empty() )
+        printUsageAndExit( argv[0] );
+
+    bool ok = true;
+    for( size_t i = 0; i < files.size(); ++i )
+        ok = replaySnapshot( files[i], options ) && ok;
+    return ok ? 0 : 1;
+}
@@ -29,6 +29,7 @@
 #include <optix.h>
 #include <optixu/optixu_math_namespace.h>
 #include "ppm.h"
+#include "kd_layout.h"
 #include "helpers.h"
 #include "random.h"
 
@@ -42,8 +43,8 @@ rtDeclareVariable(rtObject,      top_object, , );
 rtBuffer<float4, 2>              output_buffer;
 rtBuffer<float4, 2>              debug_buffer;
 rtBuffer<PackedPhotonRecord, 1>  photon_map;
+rtDeclareVariable(KDTreeLayout,  photon_map_layout, , );
 rtBuffer<PackedHitRecord, 2>     rtpass_output_buffer;
-rtBuffer<uint2, 2>               image_rnd_seeds;
 rtDeclareVariable(float,         scene_epsilon, , );
 rtDeclareVariable(float,         alpha, , );
 rtDeclareVariable(float,         total_emitted, , );
@@ -52,6 +53,7 @@ rtDeclareVariable(float3,        ambient_light , , );
 rtDeclareVariable(uint,          use_debug_buffer, , );
 rtDeclareVariable(PPMLight,      light , , );
 rtDeclareVariable(uint2, launch_index, rtLaunchIndex, );
+rtDeclareVariable(uint2, launch_dim,   rtLaunchDim, );
 rtDeclareVariable(ShadowPRD, shadow_prd, rtPayload, );
 
 
@@ -61,17 +63,99 @@ void accumulatePhoton( const PackedPhotonRecord& photon,
                        const float3& rec_atten_Kd,
                        uint& num_new_photons, float3& flux_M )
 {
-  float3 photon_energy = make_float3( photon.c.y, photon.c.z, photon.c.w );
-  float3 photon_normal = make_float3( photon.a.w, photon.b.x, photon.b.y );
+  float3 photon_normal = decodeOctahedral( __float_as_uint( photon.a.w ) );
   float p_dot_hit = dot(photon_normal, rec_normal);
   if (p_dot_hit > 0.01f) { // Fudge factor for imperfect cornell box geom
-    float3 photon_ray_dir = make_float3( photon.b.z, photon.b.w, photon.c.x );
+    float3 photon_energy = decodeRGBE( photon.b.y );
     float3 flux = photon_energy * rec_atten_Kd; // * -dot(photon_ray_dir, rec_normal);
     num_new_photons++;
     flux_M += flux;
   }
 }
 
+// Updates the hit record with the photons found by a gather program and
+// writes the final color.
+static __device__ __inline__
+void finishGather( PackedHitRecord& rec, uint num_new_photons, const float3& flux_M, uint loop_iter )
+{
+  float3 rec_position = make_float3( rec.a.x, rec.a.y, rec.a.z );
+  float3 rec_normal   = make_float3( rec.a.w, rec.b.x, rec.b.y );
+  float3 rec_atten_Kd = make_float3( rec.b.z, rec.b.w, rec.c.x );
+  uint   rec_flags    = __float_as_int( rec.c.y );
+  float  rec_radius2  = rec.c.z;
+  float  rec_photon_count = rec.c.w;
+  float3 rec_flux     = make_float3( rec.d.x, rec.d.y, rec.d.z );
+  float  rec_accum_atten = rec.d.w;
+
+  // Compute new N,R
+  float R2 = rec_radius2;
+  float N = rec_photon_count;
+  float M = static_cast<float>( num_new_photons ) ;
+  float new_N = N + alpha*M;
+  rec.c.w = new_N;  // set rec.photon_count
+
+  float reduction_factor2 = 1.0f;
+  float new_R2 = R2;
+  if( M != 0 ) {
+    reduction_factor2 = ( N + alpha*M ) / ( N + M );
+    new_R2 = R2*( reduction_factor2 ); 
+    rec.c.z = new_R2; // set rec.radius2
+  }
+
+  // Compute indirectflux
+  float3 new_flux = ( rec_flux + flux_M ) * reduction_factor2;
+  rec.d = make_float4( new_flux ); // set rec.flux
+  float3 indirect_flux = 1.0f / ( M_PIf * new_R2 ) * new_flux / total_emitted;
+
+  // Compute direct
+  float3 point_on_light;
+  float dist_scale;
+  if( light.is_area_light ) {
+    uint2  seed   = counterSeeds( launch_index.y * launch_dim.x + launch_index.x,
+                                  static_cast<uint>( frame_number ), PPM_RNG_GATHER );
+    float2 sample = make_float2( rnd( seed.x ), rnd( seed.y ) ); 
+    point_on_light = light.anchor + sample.x*light.v1 + sample.y*light.v2; 
+    dist_scale = 1.0f;
+  } else {
+    point_on_light = light.position;
+    dist_scale = light.radius / ( M_PIf * 0.5f); 
+  }
+  float3 to_light    = point_on_light - rec_position;
+  float  light_dist  = length( to_light );
+  to_light = to_light / light_dist;
+  float  n_dot_l     = fmaxf( 0.0f, dot( rec_normal, to_light ) );
+  float  light_atten = n_dot_l;
+  
+  // TODO Should clip direct light to photon emiting code -- but we will ignore this for demo 
+  //if( !light.is_area_light && acosf( dot( -to_light, light.direction )  ) > light.radius ) {
+  //  light_atten = 0.0f;
+  //}
+
+  // PPM_IN_SHADOW will be set if this is a point light and we have already performed an occluded shadow query 
+  if( rec_flags & PPM_IN_SHADOW ) {
+    light_atten = 0.0f;
+  }
+  if ( light_atten > 0.0f ) {
+    ShadowPRD prd;
+    prd.attenuation = 1.0f;
+    optix::Ray shadow_ray( rec_position, to_light, shadow_ray_type, scene_epsilon, light_dist - scene_epsilon );
+    rtTrace( top_object, shadow_ray, prd );
+    light_atten *= prd.attenuation * dot( -to_light, light.direction );
+    rec.c.y = __int_as_float(  prd.attenuation == 0.0f && !light.is_area_light ? rec_flags|PPM_IN_SHADOW : rec_flags ); 
+  } 
+  light_atten /= dist_scale*light_dist*light_dist;
+  if( light_atten < 0.0f ) light_atten = 0.0f;   // TODO Shouldnt be needed but we get acne near light w/out it
+  rec.d.w = rec_accum_atten + light_atten;
+  float avg_atten = rec.d.w / (frame_number+1.0f);
+  float3 direct_flux = light.power * avg_atten *rec_atten_Kd;
+  
+  rtpass_output_buffer[launch_index] = rec;
+  float3 final_color = direct_flux + indirect_flux + ambient_light*rec_atten_Kd; 
+  output_buffer[launch_index] = make_float4(final_color);
+  if(use_debug_buffer == 1)
+    debug_buffer[launch_index] = make_float4( loop_iter, new_R2, new_N, M );
+}
+
 #if 0
 #define check( condition, color ) \
 { \
@@ -96,9 +180,6 @@ RT_PROGRAM void gather()
   float3 rec_atten_Kd = make_float3( rec.b.z, rec.b.w, rec.c.x );
   uint   rec_flags    = __float_as_int( rec.c.y );
   float  rec_radius2  = rec.c.z;
-  float  rec_photon_count = rec.c.w;
-  float3 rec_flux     = make_float3( rec.d.x, rec.d.y, rec.d.z );
-  float  rec_accum_atten = rec.d.w;
 
   // Check if this is hit point lies on an emitter or hit background 
   if( !(rec_flags & PPM_HIT) || rec_flags & PPM_OVERFLOW ) {
@@ -123,9 +204,9 @@ RT_PROGRAM void gather()
   do {
 
     check( node < photon_map_size, make_float3( 1,0,0 ) );
-    PackedPhotonRecord& photon = photon_map[ node ];
+    PackedPhotonRecord& photon = photon_map[ kdNodeOffset( node, photon_map_layout ) ];
 
-    uint axis = __float_as_int( photon.d.x );
+    uint axis = photon.b.z;
     if( !( axis & PPM_NULL ) ) {
 
       float3 photon_position = make_float3( photon.a );
@@ -161,73 +242,75 @@ RT_PROGRAM void gather()
     loop_iter++;
   } while ( node );
 
-  // Compute new N,R
-  float R2 = rec_radius2;
-  float N = rec_photon_count;
-  float M = static_cast<float>( num_new_photons ) ;
-  float new_N = N + alpha*M;
-  rec.c.w = new_N;  // set rec.photon_count
+  finishGather( rec, num_new_photons, flux_M, loop_iter );
+}
 
-  float reduction_factor2 = 1.0f;
-  float new_R2 = R2;
-  if( M != 0 ) {
-    reduction_factor2 = ( N + alpha*M ) / ( N + M );
-    new_R2 = R2*( reduction_factor2 ); 
-    rec.c.z = new_R2; // set rec.radius2
-  }
 
-  // Compute indirectflux
-  float3 new_flux = ( rec_flux + flux_M ) * reduction_factor2;
-  rec.d = make_float4( new_flux ); // set rec.flux
-  float3 indirect_flux = 1.0f / ( M_PIf * new_R2 ) * new_flux / total_emitted;
+//
+// Uniform hash grid variant of gather(), see PhotonMap.h
+//
 
-  // Compute direct
-  float3 point_on_light;
-  float dist_scale;
-  if( light.is_area_light ) {
-    uint2  seed   = image_rnd_seeds[launch_index];
-    float2 sample = make_float2( rnd( seed.x ), rnd( seed.y ) ); 
-    image_rnd_seeds[launch_index] = seed;
-    point_on_light = light.anchor + sample.x*light.v1 + sample.y*light.v2; 
-    dist_scale = 1.0f;
-  } else {
-    point_on_light = light.position;
-    dist_scale = light.radius / ( M_PIf * 0.5f); 
+rtBuffer<PackedPhotonRecord, 1>  photon_grid;
+rtBuffer<uint, 1>                photon_grid_cells;
+rtDeclareVariable(float3,        photon_grid_origin, , );
+rtDeclareVariable(float,         photon_grid_inv_cell_size, , );
+rtDeclareVariable(uint,          photon_grid_hash_mask, , );
+
+RT_PROGRAM void gather_grid()
+{
+  PackedHitRecord rec = rtpass_output_buffer[launch_index];
+  float3 rec_position = make_float3( rec.a.x, rec.a.y, rec.a.z );
+  float3 rec_normal   = make_float3( rec.a.w, rec.b.x, rec.b.y );
+  float3 rec_atten_Kd = make_float3( rec.b.z, rec.b.w, rec.c.x );
+  uint   rec_flags    = __float_as_int( rec.c.y );
+  float  rec_radius2  = rec.c.z;
+
+  // Check if this is hit point lies on an emitter or hit background 
+  if( !(rec_flags & PPM_HIT) || rec_flags & PPM_OVERFLOW ) {
+    output_buffer[launch_index] = make_float4(rec_atten_Kd);
+    return;
   }
-  float3 to_light    = point_on_light - rec_position;
-  float  light_dist  = length( to_light );
-  to_light = to_light / light_dist;
-  float  n_dot_l     = fmaxf( 0.0f, dot( rec_normal, to_light ) );
-  float  light_atten = n_dot_l;
-  
-  // TODO Should clip direct light to photon emiting code -- but we will ignore this for demo 
-  //if( !light.is_area_light && acosf( dot( -to_light, light.direction )  ) > light.radius ) {
-  //  light_atten = 0.0f;
-  //}
 
-  // PPM_IN_SHADOW will be set if this is a point light and we have already performed an occluded shadow query 
-  if( rec_flags & PPM_IN_SHADOW ) {
-    light_atten = 0.0f;
+  // Cells are at least twice the radius wide, so at most two per axis
+  float radius = sqrtf( rec_radius2 );
+  int x0 = photonGridCoord( rec_position.x - radius, photon_grid_origin.x, photon_grid_inv_cell_size );
+  int y0 = photonGridCoord( rec_position.y - radius, photon_grid_origin.y, photon_grid_inv_cell_size );
+  int z0 = photonGridCoord( rec_position.z - radius, photon_grid_origin.z, photon_grid_inv_cell_size );
+  int x1 = min( x0 + 1, photonGridCoord( rec_position.x + radius, photon_grid_origin.x, photon_grid_inv_cell_size ) );
+  int y1 = min( y0 + 1, photonGridCoord( rec_position.y + radius, photon_grid_origin.y, photon_grid_inv_cell_size ) );
+  int z1 = min( z0 + 1, photonGridCoord( rec_position.z + radius, photon_grid_origin.z, photon_grid_inv_cell_size ) );
+
+  uint buckets[8];
+  uint num_buckets = 0u;
+  uint num_new_photons = 0u;
+  float3 flux_M = make_float3( 0.0f, 0.0f, 0.0f );
+  uint loop_iter = 0;
+  for( int z = z0; z <= z1; ++z ) {
+    for( int y = y0; y <= y1; ++y ) {
+      for( int x = x0; x <= x1; ++x ) {
+        // Distinct cells can hash to the same bucket
+        uint bucket = photonGridHash( x, y, z, photon_grid_hash_mask );
+        bool seen = false;
+        for( uint i = 0; i < num_buckets; ++i )
+          seen = seen || buckets[i] == bucket;
+        if( seen )
+          continue;
+        buckets[num_buckets++] = bucket;
+
+        uint end = photon_grid_cells[bucket+1];
+        for( uint i = photon_grid_cells[bucket]; i < end; ++i ) {
+          PackedPhotonRecord& photon = photon_grid[i];
+          float3 diff = rec_position - make_float3( photon.a );
+          if( dot( diff, diff ) <= rec_radius2 ) {
+            accumulatePhoton(photon, rec_normal, rec_atten_Kd, num_new_photons, flux_M);
+          }
+          loop_iter++;
+        }
+      }
+    }
   }
-  if ( light_atten > 0.0f ) {
-    ShadowPRD prd;
-    prd.attenuation = 1.0f;
-    optix::Ray shadow_ray( rec_position, to_light, shadow_ray_type, scene_epsilon, light_dist - scene_epsilon );
-    rtTrace( top_object, shadow_ray, prd );
-    light_atten *= prd.attenuation * dot( -to_light, light.direction );
-    rec.c.y = __int_as_float(  prd.attenuation == 0.0f && !light.is_area_light ? rec_flags|PPM_IN_SHADOW : rec_flags ); 
-  } 
-  light_atten /= dist_scale*light_dist*light_dist;
-  if( light_atten < 0.0f ) light_atten = 0.0f;   // TODO Shouldnt be needed but we get acne near light w/out it
-  rec.d.w = rec_accum_atten + light_atten;
-  float avg_atten = rec.d.w / (frame_number+1.0f);
-  float3 direct_flux = light.power * avg_atten *rec_atten_Kd;
-  
-  rtpass_output_buffer[launch_index] = rec;
-  float3 final_color = direct_flux + indirect_flux + ambient_light*rec_atten_Kd; 
-  output_buffer[launch_index] = make_float4(final_color);
-  if(use_debug_buffer == 1)
-    debug_buffer[launch_index] = make_float4( loop_iter, new_R2, new_N, M );
+
+  finishGather( rec, num_new_photons, flux_M, loop_iter );
 }
 
 RT_PROGRAM void gather_any_hit()
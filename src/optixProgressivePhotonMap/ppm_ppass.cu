@@ -45,12 +45,13 @@ rtDeclareVariable(rtObject,      top_object, , );
 // Ray generation program
 //
 rtBuffer<PhotonRecord, 1>        ppass_output_buffer;
-rtBuffer<uint2, 2>               photon_rnd_seeds;
+rtDeclareVariable(uint,          photon_pass_index, , );
 rtDeclareVariable(uint,          max_depth, , );
 rtDeclareVariable(uint,          max_photon_count, , );
 rtDeclareVariable(PPMLight,      light , , );
 
 rtDeclareVariable(uint2, launch_index, rtLaunchIndex, );
+rtDeclareVariable(uint2, launch_dim,   rtLaunchDim, );
 
 
 static __device__ __inline__ float2 rnd_from_uint2( uint2& prev )
@@ -137,13 +138,13 @@ static __device__ __inline__ void generateSpotLightPhoton( const PPMLight& light
 
 RT_PROGRAM void ppass_camera()
 {
-  size_t2 size     = photon_rnd_seeds.size();
-  uint    pm_index = (launch_index.y * size.x + launch_index.x) * max_photon_count;
-  uint2   seed     = photon_rnd_seeds[launch_index]; // No need to reset since we dont reuse this seed
+  uint    index    = launch_index.y * launch_dim.x + launch_index.x;
+  uint    pm_index = index * max_photon_count;
+  uint2   seed     = counterSeeds( index, photon_pass_index, PPM_RNG_PHOTON_PASS );
 
   float2 direction_sample = make_float2(
-      ( static_cast<float>( launch_index.x ) + rnd( seed.x ) ) / static_cast<float>( size.x ),
-      ( static_cast<float>( launch_index.y ) + rnd( seed.y ) ) / static_cast<float>( size.y ) );
+      ( static_cast<float>( launch_index.x ) + rnd( seed.x ) ) / static_cast<float>( launch_dim.x ),
+      ( static_cast<float>( launch_index.y ) + rnd( seed.y ) ) / static_cast<float>( launch_dim.y ) );
   float3 ray_origin, ray_direction;
   if( light.is_area_light ) {
     generateAreaLightPhoton( light, direction_sample, ray_origin, ray_direction );
@@ -155,7 +156,7 @@ RT_PROGRAM void ppass_camera()
 
   // Initialize our photons
   for(unsigned int i = 0; i < max_photon_count; ++i) {
-    ppass_output_buffer[i+pm_index].energy = make_float3(0.0f);
+    ppass_output_buffer[i+pm_index].energy = 0u;
   }
 
   PhotonPRD prd;
@@ -195,9 +196,9 @@ RT_PROGRAM void ppass_closest_hit()
     if( hit_record.ray_depth > 0 ) {
       PhotonRecord& rec = ppass_output_buffer[hit_record.pm_index + hit_record.num_deposits];
       rec.position = hit_point;
-      rec.normal = ffnormal;
-      rec.ray_dir = ray.direction;
-      rec.energy = hit_record.energy;
+      rec.normal = encodeOctahedral( ffnormal );
+      rec.ray_dir = encodeOctahedral( ray.direction );
+      rec.energy = encodeRGBE( hit_record.energy );
       hit_record.num_deposits++;
     }
 
@@ -220,3 +221,17 @@ RT_PROGRAM void ppass_closest_hit()
   rtTrace(top_object, new_ray, hit_record);
 }
 
+
+//
+// Writes the photon pass seeds and first samples for checkDeviceRandom()
+//
+rtBuffer<uint4, 2>               rng_check_buffer;
+
+RT_PROGRAM void rng_check()
+{
+  uint  index = launch_index.y * launch_dim.x + launch_index.x;
+  uint2 seed  = counterSeeds( index, photon_pass_index, PPM_RNG_PHOTON_PASS );
+  uint2 bits  = seed;
+  float2 sample = make_float2( rnd( seed.x ), rnd( seed.y ) );
+  rng_check_buffer[launch_index] = make_uint4( bits.x, bits.y, __float_as_uint( sample.x ), __float_as_uint( sample.y ) );
+}
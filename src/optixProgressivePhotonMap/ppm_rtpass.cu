@@ -44,7 +44,6 @@ rtDeclareVariable(rtObject,      top_object, , );
 // Ray generation program
 //
 rtBuffer<HitRecord, 2>           rtpass_output_buffer;
-rtBuffer<uint2, 2>               image_rnd_seeds;
 rtDeclareVariable(float,         rtpass_default_radius2, , );
 rtDeclareVariable(float3,        rtpass_eye, , );
 rtDeclareVariable(float3,        rtpass_U, , );
@@ -57,9 +56,9 @@ RT_PROGRAM void rtpass_camera()
 {
   float2 screen = make_float2( rtpass_output_buffer.size() );
   /*
-  uint   seed   = image_rnd_seeds[index];                       // If we start writing into this buffer here we will
-  float2 sample = make_float2( rnd(seed.x), rnd(seed.y) );      // need to make it an INPUT_OUTPUT buffer.  For now it
-  image_rnd_seeds[index] = seed;                                // is just INPUT
+  uint2  seed   = counterSeeds( launch_index.y * screen.x + launch_index.x,   // Jittering would need the rtpass
+                                frame_number, PPM_RNG_RTPASS );              // traced every frame.  For now it
+  float2 sample = make_float2( rnd(seed.x), rnd(seed.y) );                   // is traced on restarts only
   */
   float2 sample = make_float2( 0.5f, 0.5f ); 
 
@@ -0,0 +1,132 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "MappedFile.h"
+
+#if defined(_WIN32)
+#  ifndef WIN32_LEAN_AND_MEAN
+#    define WIN32_LEAN_AND_MEAN 1
+#  endif
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+
+//-----------------------------------------------------------------------------
+//  
+//  MappedFile class definition
+//
+//-----------------------------------------------------------------------------
+
+#if defined(_WIN32)
+
+MappedFile::MappedFile( const std::string& filename )
+  : m_data( 0 ), m_size( 0 ), m_file( INVALID_HANDLE_VALUE ), m_mapping( 0 )
+{
+  m_file = CreateFileA( filename.c_str(), GENERIC_READ, FILE_SHARE_READ, 0,
+                        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0 );
+  if( m_file == INVALID_HANDLE_VALUE )
+    return;
+
+  LARGE_INTEGER file_size;
+  if( !GetFileSizeEx( m_file, &file_size ) || file_size.QuadPart == 0 )
+    return;
+
+  m_mapping = CreateFileMappingA( m_file, 0, PAGE_READONLY, 0, 0, 0 );
+  if( !m_mapping )
+    return;
+
+  m_data = static_cast<const char*>( MapViewOfFile( m_mapping, FILE_MAP_READ, 0, 0, 0 ) );
+  if( m_data )
+    m_size = static_cast<size_t>( file_size.QuadPart );
+}
+
+
+MappedFile::~MappedFile()
+{
+  if( m_data )
+    UnmapViewOfFile( m_data );
+  if( m_mapping )
+    CloseHandle( m_mapping );
+  if( m_file != INVALID_HANDLE_VALUE )
+    CloseHandle( m_file );
+}
+
+#else // Apple and Linux both use this
+
+MappedFile::MappedFile( const std::string& filename )
+  : m_data( 0 ), m_size( 0 ), m_fd( -1 )
+{
+  m_fd = open( filename.c_str(), O_RDONLY );
+  if( m_fd < 0 )
+    return;
+
+  struct stat st;
+  if( fstat( m_fd, &st ) != 0 || st.st_size == 0 )
+    return;
+
+  void* ptr = mmap( 0, static_cast<size_t>( st.st_size ), PROT_READ, MAP_PRIVATE, m_fd, 0 );
+  if( ptr == MAP_FAILED )
+    return;
+
+  m_data = static_cast<const char*>( ptr );
+  m_size = static_cast<size_t>( st.st_size );
+}
+
+
+MappedFile::~MappedFile()
+{
+  if( m_data )
+    munmap( const_cast<char*>( m_data ), m_size );
+  if( m_fd >= 0 )
+    close( m_fd );
+}
+
+#endif
+
+
+bool MappedFile::failed()const
+{
+  return m_data == 0;
+}
+
+
+const char* MappedFile::data()const
+{
+  return m_data;
+}
+
+
+size_t MappedFile::size()const
+{
+  return m_size;
+}
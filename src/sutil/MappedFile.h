@@ -0,0 +1,65 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <sutilapi.h>
+
+#include <cstddef>
+#include <string>
+
+
+//------------------------------------------------------------------------------
+//
+// Read-only memory mapping of a whole file.  The mapping stays valid for the
+// lifetime of the MappedFile object.
+//
+//------------------------------------------------------------------------------
+class MappedFile
+{
+public:
+  SUTILAPI MappedFile( const std::string& filename );
+  SUTILAPI ~MappedFile();
+
+  SUTILAPI bool          failed()const;
+  SUTILAPI const char*   data()const;
+  SUTILAPI size_t        size()const;
+
+private:
+  MappedFile( const MappedFile& );             // Not copyable
+  MappedFile& operator=( const MappedFile& );
+
+  const char*    m_data;
+  size_t         m_size;
+#if defined( _WIN32 )
+  void*          m_file;
+  void*          m_mapping;
+#else
+  int            m_fd;
+#endif
+};
@@ -31,15 +31,27 @@
 #include <optixu/optixu_math_stream_namespace.h>
 
 #include "Mesh.h" 
+#include "MeshCache.h"
+#include "MeshProcessing.h"
+#include "ObjParser.h"
+#include "PlyReader.h"
 #include "rply-1.01/rply.h"
 #include "tinyobjloader/tiny_obj_loader.h"
 #include <algorithm>
+#include <cstdlib>
 #include <iostream>
 #include <locale>
+#include <new>
 #include <stdexcept>
 #include <stdint.h>
 #include <vector>
 
+#if defined(_WIN32)
+#  include <malloc.h>
+#else
+#  include <sys/mman.h>
+#endif
+
 //------------------------------------------------------------------------------
 //
 // Helpers 
@@ -49,6 +61,99 @@
 namespace
 {
 
+bool s_mesh_cache_enabled = true;
+
+
+//
+// Arena blocks.  A header in front of the returned pointer records how the
+// block was allocated.
+//
+const size_t ARENA_ALIGNMENT      = 64;
+const size_t HUGE_PAGE_SIZE       = 2u << 20;
+const size_t HUGE_PAGE_MIN_ARENA  = 8u << 20;   // Smaller blocks would waste too much of a page
+
+struct ArenaHeader
+{
+  uint64_t  block_size;
+  uint32_t  mapped;       // Allocated with mmap rather than the heap
+};
+
+
+inline size_t alignArena( size_t size )
+{
+  return ( size + ARENA_ALIGNMENT - 1 ) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+}
+
+
+char* allocArena( size_t size, bool huge_pages )
+{
+  size_t block_size = size + ARENA_ALIGNMENT;
+  char*  block      = 0;
+  bool   mapped     = false;
+
+#if defined(_WIN32)
+  // Large pages need SeLockMemoryPrivilege on Windows, so stay on the heap
+  (void)huge_pages;
+  block = static_cast<char*>( _aligned_malloc( block_size, ARENA_ALIGNMENT ) );
+#else
+  if( huge_pages && block_size >= HUGE_PAGE_MIN_ARENA )
+  {
+    const size_t mapped_size = ( block_size + HUGE_PAGE_SIZE - 1 ) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    void* p = MAP_FAILED;
+#  if defined(MAP_HUGETLB)
+    // Explicit huge pages only succeed if the system has reserved some
+    p = mmap( 0, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+#  endif
+    if( p == MAP_FAILED )
+    {
+      p = mmap( 0, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+#  if defined(MADV_HUGEPAGE)
+      if( p != MAP_FAILED )
+        madvise( p, mapped_size, MADV_HUGEPAGE );
+#  endif
+    }
+    if( p != MAP_FAILED )
+    {
+      block      = static_cast<char*>( p );
+      block_size = mapped_size;
+      mapped     = true;
+    }
+  }
+  if( !block )
+  {
+    void* p = 0;
+    if( posix_memalign( &p, ARENA_ALIGNMENT, block_size ) == 0 )
+      block = static_cast<char*>( p );
+  }
+#endif
+
+  if( !block )
+    throw std::bad_alloc();
+
+  ArenaHeader* header = reinterpret_cast<ArenaHeader*>( block );
+  header->block_size = block_size;
+  header->mapped     = mapped ? 1u : 0u;
+  return block + ARENA_ALIGNMENT;
+}
+
+
+void freeArena( void* arena )
+{
+  char*              block  = static_cast<char*>( arena ) - ARENA_ALIGNMENT;
+  const ArenaHeader* header = reinterpret_cast<const ArenaHeader*>( block );
+
+#if defined(_WIN32)
+  (void)header;
+  _aligned_free( block );
+#else
+  if( header->mapped )
+    munmap( block, header->block_size );
+  else
+    free( block );
+#endif
+}
+
+
 void clearMesh( Mesh& mesh )
 {
   memset( &mesh, 0, sizeof( mesh ) );
@@ -312,9 +417,11 @@ private:
   };
   std::string                         m_filename;
   FileType                            m_filetype;
+
+  std::unique_ptr<MeshCache>          m_cache;      // Non-null if a valid cache sidecar exists
   
-  std::vector<tinyobj::shape_t>       m_shapes;
-  std::vector<tinyobj::material_t>    m_materials;
+  std::unique_ptr<ObjParser>          m_obj;        // Parsed OBJ, kept between scanMesh and loadMesh
+  std::unique_ptr<PlyReader>          m_ply;        // Non-null if the PLY layout allows bulk loading
 };
 
 
@@ -327,6 +434,20 @@ MeshLoader::Impl::Impl( const std::string& filename )
      m_filetype = PLY;
    else 
      m_filetype = UNKNOWN;
+
+   if( s_mesh_cache_enabled && m_filetype != UNKNOWN )
+   {
+     m_cache.reset( new MeshCache( m_filename ) );
+     if( !m_cache->valid() )
+       m_cache.reset();
+   }
+
+   if( !m_cache && m_filetype == PLY )
+   {
+     m_ply.reset( new PlyReader( m_filename ) );
+     if( !m_ply->valid() )
+       m_ply.reset();
+   }
 }
 
 
@@ -334,7 +455,9 @@ void MeshLoader::Impl::scanMesh( Mesh& mesh )
 {
   clearMesh( mesh );
 
-  if( m_filetype == OBJ )
+  if( m_cache )
+    m_cache->scanMesh( mesh );
+  else if( m_filetype == OBJ )
     scanMeshOBJ( mesh );
   else if( m_filetype == PLY )
     scanMeshPLY( mesh );
@@ -356,19 +479,34 @@ void MeshLoader::Impl::loadMesh( Mesh& mesh, const float* load_xform )
   mesh.bbox_min[0] = mesh.bbox_min[1] = mesh.bbox_min[2] =  1e16f;
   mesh.bbox_max[0] = mesh.bbox_max[1] = mesh.bbox_max[2] = -1e16f;
 
-  if( m_filetype == OBJ )
+  if( m_cache )
+    m_cache->loadMesh( mesh );
+  else if( m_filetype == OBJ )
     loadMeshOBJ( mesh );
   else if( m_filetype == PLY )
     loadMeshPLY( mesh );
   else
     throw std::runtime_error( "MeshLoader: Unsupported file type for '" + m_filename + "'" );
 
+  // The cache holds the mesh as stored in the file, so write it before the load transform
+  // The material libraries of an OBJ are part of the cache key
+  if( !m_cache && s_mesh_cache_enabled &&
+      !writeMeshCache( m_filename, mesh, m_obj ? m_obj->mtllibs() : std::vector<std::string>() ) )
+    std::cerr << "MeshLoader - WARNING: unable to write mesh cache '"
+              << meshCacheFilename( m_filename ) << "'" << std::endl;
+
   applyLoadXForm( mesh, load_xform );
 }
 
 
 void MeshLoader::Impl::scanMeshPLY( Mesh& mesh )
 {
+  if( m_ply )
+  {
+    m_ply->scanMesh( mesh );
+    return;
+  }
+
   p_ply ply = ply_open( m_filename.c_str(), 0 );                       
 
   if( !ply )
@@ -392,28 +530,32 @@ void MeshLoader::Impl::scanMeshPLY( Mesh& mesh )
 
 void MeshLoader::Impl::loadMeshPLY( Mesh& mesh )
 {
-  p_ply ply = ply_open( m_filename.c_str(), 0 );                       
+  // Fall back to rply for layouts the bulk reader does not handle
+  if( !m_ply || !m_ply->loadMesh( mesh ) )
+  {
+    p_ply ply = ply_open( m_filename.c_str(), 0 );                       
 
-  if( !ply )
-    throw std::runtime_error( "MeshLoader: Unable to open '" + m_filename + "'" );
+    if( !ply )
+      throw std::runtime_error( "MeshLoader: Unable to open '" + m_filename + "'" );
 
-  if( !ply_read_header( ply ) )
-    throw std::runtime_error( "MeshLoader: Unable to read PLY header '" + m_filename + "'" );
-  
-  PlyData ply_data = {0};
-  ply_data.mesh = &mesh;
-
-  ply_set_read_cb( ply, "vertex", "x",  plyLoadVertex, &ply_data, 0 );
-  ply_set_read_cb( ply, "vertex", "y",  plyLoadVertex, &ply_data, 1 );
-  ply_set_read_cb( ply, "vertex", "z",  plyLoadVertex, &ply_data, 2 );
-  ply_set_read_cb( ply, "vertex", "nx", plyLoadVertex, &ply_data, 3 );
-  ply_set_read_cb( ply, "vertex", "ny", plyLoadVertex, &ply_data, 4 );
-  ply_set_read_cb( ply, "vertex", "nz", plyLoadVertex, &ply_data, 5 );
-  ply_set_read_cb( ply, "face", "vertex_indices", plyLoadFace, &ply_data, 0);
-
-  if( !ply_read( ply ) ) 
-    throw std::runtime_error( "MeshLoader: Error parsing ply file (" + m_filename + ")" );
-  ply_close( ply );
+    if( !ply_read_header( ply ) )
+      throw std::runtime_error( "MeshLoader: Unable to read PLY header '" + m_filename + "'" );
+    
+    PlyData ply_data = {0};
+    ply_data.mesh = &mesh;
+
+    ply_set_read_cb( ply, "vertex", "x",  plyLoadVertex, &ply_data, 0 );
+    ply_set_read_cb( ply, "vertex", "y",  plyLoadVertex, &ply_data, 1 );
+    ply_set_read_cb( ply, "vertex", "z",  plyLoadVertex, &ply_data, 2 );
+    ply_set_read_cb( ply, "vertex", "nx", plyLoadVertex, &ply_data, 3 );
+    ply_set_read_cb( ply, "vertex", "ny", plyLoadVertex, &ply_data, 4 );
+    ply_set_read_cb( ply, "vertex", "nz", plyLoadVertex, &ply_data, 5 );
+    ply_set_read_cb( ply, "face", "vertex_indices", plyLoadFace, &ply_data, 0);
+
+    if( !ply_read( ply ) ) 
+      throw std::runtime_error( "MeshLoader: Error parsing ply file (" + m_filename + ")" );
+    ply_close( ply );
+  }
 
 
   // Fill in default white matte material
@@ -434,42 +576,41 @@ void MeshLoader::Impl::loadMeshPLY( Mesh& mesh )
 
 void MeshLoader::Impl::scanMeshOBJ( Mesh& mesh )
 {
-  if( m_shapes.empty() )
+  if( !m_obj )
   {
+    std::unique_ptr<ObjParser> obj( new ObjParser( m_filename, directoryOfFilePath( m_filename ) ) );
+
     std::string err;
-    bool ret = tinyobj::LoadObj( 
-        m_shapes,
-        m_materials,
-        err, 
-        m_filename.c_str(),
-        directoryOfFilePath( m_filename ).c_str()
-        );
+    bool ret = obj->parse( err );
 
     if( !err.empty() )
       std::cerr << err << std::endl;
 
     if( !ret )
       throw std::runtime_error( "MeshLoader: " + err );
+
+    m_obj = std::move( obj );
   }
 
   //
   // Iterate over all shapes and sum up number of vertices and triangles
   //
+  const std::vector<ObjParser::Shape>& shapes = m_obj->shapes();
   uint64_t num_groups_with_normals   = 0;
   uint64_t num_groups_with_texcoords = 0;
-  for( std::vector<tinyobj::shape_t>::const_iterator it = m_shapes.begin();
-       it < m_shapes.end();
+  for( std::vector<ObjParser::Shape>::const_iterator it = shapes.begin();
+       it < shapes.end();
        ++it )
   {
-    const tinyobj::shape_t & shape = *it;
+    const ObjParser::Shape& shape = *it;
 
-    mesh.num_triangles += static_cast<int32_t>(shape.mesh.indices.size()) / 3;
-    mesh.num_vertices  += static_cast<int32_t>(shape.mesh.positions.size()) / 3;
+    mesh.num_triangles += static_cast<int32_t>( shape.num_triangles );
+    mesh.num_vertices  += static_cast<int32_t>( shape.num_vertices );
 
-    if( !shape.mesh.normals.empty() )
+    if( shape.num_normals != 0 )
       ++num_groups_with_normals; 
 
-    if( !shape.mesh.texcoords.empty() )
+    if( shape.num_texcoords != 0 )
       ++num_groups_with_texcoords; 
   }
 
@@ -479,7 +620,7 @@ void MeshLoader::Impl::scanMeshOBJ( Mesh& mesh )
 
   if( num_groups_with_normals != 0 )
   {
-    if( num_groups_with_normals != m_shapes.size() )
+    if( num_groups_with_normals != shapes.size() )
       std::cerr << "MeshLoader - WARNING: mesh '" << m_filename 
                 << "' has normals for some groups but not all.  "
                 << "Ignoring all normals." << std::endl;
@@ -490,7 +631,7 @@ void MeshLoader::Impl::scanMeshOBJ( Mesh& mesh )
   
   if( num_groups_with_texcoords != 0 )
   {
-    if( num_groups_with_texcoords != m_shapes.size() )
+    if( num_groups_with_texcoords != shapes.size() )
       std::cerr << "MeshLoader - WARNING: mesh '" << m_filename 
                 << "' has texcoords for some groups but not all.  "
                 << "Ignoring all texcoords." << std::endl;
@@ -498,86 +639,41 @@ void MeshLoader::Impl::scanMeshOBJ( Mesh& mesh )
       mesh.has_texcoords = true;
   }
 
-  mesh.num_materials = (int32_t) m_materials.size();
+  mesh.num_materials = (int32_t) m_obj->materials().size();
 }
 
 
 void MeshLoader::Impl::loadMeshOBJ( Mesh& mesh )
 {
-  uint32_t vrt_offset = 0;
-  uint32_t tri_offset = 0;
-  for( std::vector<tinyobj::shape_t>::const_iterator it = m_shapes.begin();
-       it < m_shapes.end();
-       ++it )
-  {
-    const tinyobj::shape_t & shape = *it;
-    for( uint64_t i = 0; i < shape.mesh.positions.size() / 3; ++i )
-    {
-      const float x = shape.mesh.positions[i*3+0];
-      const float y = shape.mesh.positions[i*3+1];
-      const float z = shape.mesh.positions[i*3+2];
-
-      mesh.bbox_min[0] = std::min<float>( mesh.bbox_min[0], x );
-      mesh.bbox_min[1] = std::min<float>( mesh.bbox_min[1], y );
-      mesh.bbox_min[2] = std::min<float>( mesh.bbox_min[2], z );
+  m_obj->loadMesh( mesh );
 
-      mesh.bbox_max[0] = std::max<float>( mesh.bbox_max[0], x );
-      mesh.bbox_max[1] = std::max<float>( mesh.bbox_max[1], y );
-      mesh.bbox_max[2] = std::max<float>( mesh.bbox_max[2], z );
-
-      mesh.positions[ vrt_offset*3 + i*3+0 ] = x; 
-      mesh.positions[ vrt_offset*3 + i*3+1 ] = y; 
-      mesh.positions[ vrt_offset*3 + i*3+2 ] = z; 
-    }
-
-    if( mesh.has_normals )
-      for( uint64_t i = 0; i < shape.mesh.normals.size(); ++i )
-        mesh.normals[ vrt_offset*3 + i ] = shape.mesh.normals[i];
-    
-    if( mesh.has_texcoords )
-      for( uint64_t i = 0; i < shape.mesh.texcoords.size(); ++i )
-        mesh.texcoords[ vrt_offset*2 + i ] = shape.mesh.texcoords[i];
-    
-    for( uint64_t i = 0; i < shape.mesh.indices.size() / 3; ++i )
-    {
-      mesh.tri_indices[ tri_offset*3 + i*3+0 ] = shape.mesh.indices[i*3+0] + vrt_offset;
-      mesh.tri_indices[ tri_offset*3 + i*3+1 ] = shape.mesh.indices[i*3+1] + vrt_offset;
-      mesh.tri_indices[ tri_offset*3 + i*3+2 ] = shape.mesh.indices[i*3+2] + vrt_offset;
-      mesh.mat_indices[ tri_offset + i ] = shape.mesh.material_ids[i] >= 0 ? 
-                                           shape.mesh.material_ids[i]      :
-                                           0; 
-    }
-
-    vrt_offset += static_cast<uint32_t>(shape.mesh.positions.size()) / 3;
-    tri_offset += static_cast<uint32_t>(shape.mesh.indices.size()) / 3;
-  }
-
-  for( uint64_t i = 0; i < m_materials.size(); ++i )
+  const std::vector<tinyobj::material_t>& materials = m_obj->materials();
+  for( uint64_t i = 0; i < materials.size(); ++i )
   {
     MaterialParams mat_params;
 
-    mat_params.name   = m_materials[i].name;
+    mat_params.name   = materials[i].name;
 
-    mat_params.Kd_map = m_materials[i].diffuse_texname.empty() ? "" :
-                        directoryOfFilePath( m_filename ) + m_materials[i].diffuse_texname;
+    mat_params.Kd_map = materials[i].diffuse_texname.empty() ? "" :
+                        directoryOfFilePath( m_filename ) + materials[i].diffuse_texname;
 
-    mat_params.Kd[0]  = m_materials[i].diffuse[0];
-    mat_params.Kd[1]  = m_materials[i].diffuse[1];
-    mat_params.Kd[2]  = m_materials[i].diffuse[2];
+    mat_params.Kd[0]  = materials[i].diffuse[0];
+    mat_params.Kd[1]  = materials[i].diffuse[1];
+    mat_params.Kd[2]  = materials[i].diffuse[2];
     
-    mat_params.Ks[0]  = m_materials[i].specular[0];
-    mat_params.Ks[1]  = m_materials[i].specular[1];
-    mat_params.Ks[2]  = m_materials[i].specular[2];
+    mat_params.Ks[0]  = materials[i].specular[0];
+    mat_params.Ks[1]  = materials[i].specular[1];
+    mat_params.Ks[2]  = materials[i].specular[2];
 
-    mat_params.Ka[0]  = m_materials[i].ambient[0];
-    mat_params.Ka[1]  = m_materials[i].ambient[1];
-    mat_params.Ka[2]  = m_materials[i].ambient[2];
+    mat_params.Ka[0]  = materials[i].ambient[0];
+    mat_params.Ka[1]  = materials[i].ambient[1];
+    mat_params.Ka[2]  = materials[i].ambient[2];
 
-    mat_params.Kr[0]  = m_materials[i].specular[0];
-    mat_params.Kr[1]  = m_materials[i].specular[1];
-    mat_params.Kr[2]  = m_materials[i].specular[2];
+    mat_params.Kr[0]  = materials[i].specular[0];
+    mat_params.Kr[1]  = materials[i].specular[1];
+    mat_params.Kr[2]  = materials[i].specular[2];
 
-    mat_params.exp    = m_materials[i].shininess;
+    mat_params.exp    = materials[i].shininess;
 
     mesh.mat_params[i] = mat_params;
   }
@@ -666,14 +762,60 @@ SUTILAPI void allocMesh( Mesh& mesh )
 }
 
 
+SUTILAPI void allocMeshArena( Mesh& mesh, bool huge_pages )
+{
+  if( mesh.num_vertices == 0 || mesh.num_triangles == 0 )
+  {
+    clearMesh( mesh );
+    return;
+  }
+
+  const size_t num_vertices  = static_cast<size_t>( mesh.num_vertices );
+  const size_t num_triangles = static_cast<size_t>( mesh.num_triangles );
+
+  size_t offsets[6];
+  size_t size = 0;
+  offsets[0] = size; size += alignArena( 3*num_vertices*sizeof( float ) );
+  offsets[1] = size; size += mesh.has_normals   ? alignArena( 3*num_vertices*sizeof( float ) ) : 0;
+  offsets[2] = size; size += mesh.has_texcoords ? alignArena( 2*num_vertices*sizeof( float ) ) : 0;
+  offsets[3] = size; size += alignArena( 3*num_triangles*sizeof( int32_t ) );
+  offsets[4] = size; size += alignArena( 1*num_triangles*sizeof( int32_t ) );
+  offsets[5] = size; size += alignArena( mesh.num_materials*sizeof( MaterialParams ) );
+
+  char* arena = allocArena( size, huge_pages );
+
+  mesh.positions   = reinterpret_cast<float*>  ( arena + offsets[0] );
+  mesh.normals     = mesh.has_normals   ? reinterpret_cast<float*>( arena + offsets[1] ) : 0;
+  mesh.texcoords   = mesh.has_texcoords ? reinterpret_cast<float*>( arena + offsets[2] ) : 0;
+  mesh.tri_indices = reinterpret_cast<int32_t*>( arena + offsets[3] );
+  mesh.mat_indices = reinterpret_cast<int32_t*>( arena + offsets[4] );
+
+  mesh.mat_params  = reinterpret_cast<MaterialParams*>( arena + offsets[5] );
+  for( int32_t i = 0; i < mesh.num_materials; ++i )
+    new( &mesh.mat_params[i] ) MaterialParams();
+
+  mesh.arena       = arena;
+  mesh.arena_size  = size;
+}
+
+
 SUTILAPI void freeMesh( Mesh& mesh )
 {
-  delete [] mesh.positions;
-  delete [] mesh.normals;
-  delete [] mesh.texcoords;
-  delete [] mesh.tri_indices;
-  delete [] mesh.mat_indices;
-  delete [] mesh.mat_params;
+  if( mesh.arena )
+  {
+    for( int32_t i = 0; i < mesh.num_materials; ++i )
+      mesh.mat_params[i].~MaterialParams();
+    freeArena( mesh.arena );
+  }
+  else
+  {
+    delete [] mesh.positions;
+    delete [] mesh.normals;
+    delete [] mesh.texcoords;
+    delete [] mesh.tri_indices;
+    delete [] mesh.mat_indices;
+    delete [] mesh.mat_params;
+  }
 
   clearMesh( mesh );
 }
@@ -715,10 +857,34 @@ void MeshLoader::loadMesh( Mesh& mesh, const float* load_xform )
 //------------------------------------------------------------------------------
 
 
-void loadMesh( const std::string& filename, Mesh& mesh, const float* xform )
+void setMeshCacheEnabled( bool enabled )
+{
+  s_mesh_cache_enabled = enabled;
+}
+
+
+void loadMesh( const std::string& filename, Mesh& mesh, const float* xform, unsigned int flags )
 {
     MeshLoader loader( filename );
     loader.scanMesh( mesh );
-    allocMesh( mesh );
+    if( flags & MESH_LOAD_ARENA )
+        allocMeshArena( mesh );
+    else
+        allocMesh( mesh );
     loader.loadMesh( mesh, xform );
+
+    if( flags & MESH_LOAD_WELD_VERTICES )
+    {
+        std::cerr << filename << ": ";
+        printMeshWeldStats( weldMesh( mesh ), std::cerr );
+    }
+
+    if( flags & MESH_LOAD_REORDER )
+    {
+        std::cerr << filename << ": before reordering: ";
+        printMeshLocalityStats( computeMeshLocality( mesh ), std::cerr );
+        reorderMesh( mesh );
+        std::cerr << filename << ": after reordering:  ";
+        printMeshLocalityStats( computeMeshLocality( mesh ), std::cerr );
+    }
 }
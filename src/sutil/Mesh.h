@@ -82,6 +82,9 @@ struct Mesh
 
   int32_t             num_materials;
   MaterialParams*     mat_params;     // Material params
+
+  void*               arena;          // Single block holding all of the above arrays
+  uint64_t            arena_size;     //   if allocated with allocMeshArena, else null/0
 };
 
 //------------------------------------------------------------------------------
@@ -94,7 +97,15 @@ struct Mesh
 // Assumes num_vertices, has_normals, has_texcoords, num_triangles initialized.
 SUTILAPI void allocMesh( Mesh& mesh );
 
-// Calls std lib delete on non-null arrays in mesh
+// Allocates all arrays of mesh from one block, in the order positions,
+// normals, texcoords, tri_indices, mat_indices, mat_params, each aligned to 64
+// bytes.  mesh.arena and mesh.arena_size describe the block so it can be
+// copied or uploaded as one range.  Large blocks are mapped with huge pages
+// where the OS allows it, unless huge_pages is false.
+// Assumes num_vertices, has_normals, has_texcoords, num_triangles initialized.
+SUTILAPI void allocMeshArena( Mesh& mesh, bool huge_pages=true );
+
+// Releases the arrays of a mesh from allocMesh or allocMeshArena
 SUTILAPI void freeMesh( Mesh& mesh );
 
 SUTILAPI void printMaterialInfo( const MaterialParams& mat, std::ostream& out = std::cout );
@@ -127,27 +138,71 @@ private:
 //------------------------------------------------------------------------------
 
 
-// Load mesh using std lib new for allocations
-SUTILAPI void loadMesh( const std::string& filename, Mesh& mesh, const float* load_xform=0 );
+// Enable or disable the binary mesh cache (see MeshCache.h).  When enabled
+// (the default), MeshLoader reads "<filename>.meshcache" if it is up to date
+// and writes it after parsing the source file otherwise.
+SUTILAPI void setMeshCacheEnabled( bool enabled );
+
+// Optional passes run after loading (see MeshProcessing.h)
+enum MeshLoadFlags
+{
+  MESH_LOAD_DEFAULT        = 0,
+  MESH_LOAD_WELD_VERTICES  = 1 << 0,  // Merge identical vertices across shapes
+  MESH_LOAD_REORDER        = 1 << 1,  // Sort triangles and vertices for locality
+  MESH_LOAD_ARENA          = 1 << 2   // Allocate with allocMeshArena instead of allocMesh
+};
+
+// Load mesh using std lib new (or allocMeshArena with MESH_LOAD_ARENA) for
+// allocations.  flags is a combination of MeshLoadFlags.
+SUTILAPI void loadMesh( const std::string& filename, Mesh& mesh, const float* load_xform=0,
+                        unsigned int flags=MESH_LOAD_DEFAULT );
 
 
 
 //------------------------------------------------------------------------------
 //
-// Host mesh with RAII resource control of vertex/index arrays
+// Host mesh with RAII resource control of vertex/index arrays.  The arrays live
+// in a single arena block owned by the HostMesh, which can be moved but not
+// copied.
 //
 //------------------------------------------------------------------------------
 
 class HostMesh : public Mesh
 {
 public:
-  HostMesh( const std::string& filename, const float* xform=0 )
+  HostMesh()
+  {
+    memset( static_cast<Mesh*>( this ), 0, sizeof( Mesh ) );
+  }
+
+  HostMesh( const std::string& filename, const float* xform=0, unsigned int flags=MESH_LOAD_DEFAULT )
   { 
-    loadMesh( filename, *this, xform ); 
+    loadMesh( filename, *this, xform, flags | MESH_LOAD_ARENA ); 
+  }
+
+  HostMesh( HostMesh&& other )
+    : Mesh( other )
+  {
+    memset( static_cast<Mesh*>( &other ), 0, sizeof( Mesh ) );
+  }
+
+  HostMesh& operator=( HostMesh&& other )
+  {
+    if( this != &other )
+    {
+      freeMesh( *this );
+      static_cast<Mesh&>( *this ) = other;
+      memset( static_cast<Mesh*>( &other ), 0, sizeof( Mesh ) );
+    }
+    return *this;
   }
 
   ~HostMesh()
   {
     freeMesh( *this );
   }
+
+private:
+  HostMesh( const HostMesh& );
+  HostMesh& operator=( const HostMesh& );
 };
@@ -0,0 +1,610 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "MeshBVH.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 1 )
+#  include <xmmintrin.h>
+#  define MESH_BVH_SSE 1
+#endif
+
+
+//------------------------------------------------------------------------------
+//
+// Helpers
+//
+//------------------------------------------------------------------------------
+
+namespace
+{
+
+const int      NUM_BINS          = 16;
+const uint32_t MAX_LEAF_SIZE     = 16;
+const uint32_t PACKET_SIZE       = 4;
+const int      MAX_DEPTH         = 56;     // Traversal stack has 64 entries
+const float    TRAVERSAL_COST    = 1.0f;   // Relative to testing one packet
+const size_t   PARALLEL_BINNING  = 1u << 16;
+
+
+struct Box
+{
+  float lo[3];
+  float hi[3];
+
+  void reset()
+  {
+    lo[0] = lo[1] = lo[2] =  std::numeric_limits<float>::max();
+    hi[0] = hi[1] = hi[2] = -std::numeric_limits<float>::max();
+  }
+
+  void grow( const float* p )
+  {
+    for( int k = 0; k < 3; ++k )
+    {
+      lo[k] = std::min( lo[k], p[k] );
+      hi[k] = std::max( hi[k], p[k] );
+    }
+  }
+
+  void grow( const Box& b )
+  {
+    for( int k = 0; k < 3; ++k )
+    {
+      lo[k] = std::min( lo[k], b.lo[k] );
+      hi[k] = std::max( hi[k], b.hi[k] );
+    }
+  }
+
+  float halfArea()const
+  {
+    if( lo[0] > hi[0] )
+      return 0.0f;
+    const float dx = hi[0] - lo[0];
+    const float dy = hi[1] - lo[1];
+    const float dz = hi[2] - lo[2];
+    return dx*dy + dy*dz + dz*dx;
+  }
+};
+
+
+struct Bin
+{
+  Box      box;
+  uint32_t count;
+};
+
+
+inline uint32_t numPackets( uint32_t count )
+{
+  return ( count + PACKET_SIZE - 1 ) / PACKET_SIZE;
+}
+
+
+// Per triangle bounds and centroids, and the triangle order being built
+struct BuildState
+{
+  std::vector<Box>       boxes;
+  std::vector<float>     centroids;    // 3 per triangle
+  std::vector<uint32_t>  refs;
+};
+
+
+//
+// Recursive binned SAH build of the range [begin, end) of refs into node
+// 'index' of 'nodes'.  Ranges no larger than task_size are not built but
+// appended to 'tasks' when tasks is non-null, to be finished in parallel.
+//
+struct Task
+{
+  uint32_t node;
+  uint32_t begin;
+  uint32_t end;
+  uint32_t depth;
+};
+
+
+void binRange( const BuildState& s, uint32_t begin, uint32_t end, const Box& cbox, int axis, Bin* bins )
+{
+  const float extent = cbox.hi[axis] - cbox.lo[axis];
+  const float scale  = NUM_BINS / extent * 0.9999f;
+  for( int b = 0; b < NUM_BINS; ++b )
+  {
+    bins[b].box.reset();
+    bins[b].count = 0;
+  }
+  for( uint32_t i = begin; i < end; ++i )
+  {
+    const uint32_t t = s.refs[i];
+    const int b = std::min( NUM_BINS - 1, static_cast<int>( ( s.centroids[3*t + axis] - cbox.lo[axis] ) * scale ) );
+    bins[b].box.grow( s.boxes[t] );
+    ++bins[b].count;
+  }
+}
+
+
+void buildNode( BuildState& s, std::vector<MeshBVH::Node>& nodes, uint32_t index,
+                uint32_t begin, uint32_t end, uint32_t depth,
+                std::vector<Task>* tasks, uint32_t task_size )
+{
+  if( tasks && end - begin <= task_size )
+  {
+    const Task task = { index, begin, end, depth };
+    tasks->push_back( task );
+    return;
+  }
+
+  const uint32_t count = end - begin;
+  const bool     large = tasks && count >= PARALLEL_BINNING;
+
+  // Node and centroid bounds
+  Box box, cbox;
+  box.reset();
+  cbox.reset();
+  for( uint32_t i = begin; i < end; ++i )
+  {
+    const uint32_t t = s.refs[i];
+    box.grow( s.boxes[t] );
+    cbox.grow( &s.centroids[3*t] );
+  }
+
+  MeshBVH::Node& node = nodes[index];
+  for( int k = 0; k < 3; ++k )
+  {
+    node.bbox_min[k] = box.lo[k];
+    node.bbox_max[k] = box.hi[k];
+  }
+
+  //
+  // Find the cheapest split over all axes
+  //
+  const float leaf_cost = static_cast<float>( numPackets( count ) );
+  float best_cost = std::numeric_limits<float>::max();
+  int   best_axis = -1;
+  int   best_bin  = 0;
+  if( count > PACKET_SIZE && depth < MAX_DEPTH )
+  {
+    for( int axis = 0; axis < 3; ++axis )
+    {
+      if( !( cbox.hi[axis] > cbox.lo[axis] ) )
+        continue;
+
+      Bin bins[NUM_BINS];
+      if( large )
+      {
+        // Bin chunks of the range in parallel and merge
+        const size_t num_chunks = ( count + PARALLEL_BINNING - 1 ) / PARALLEL_BINNING;
+        std::vector<Bin> chunk_bins( num_chunks * NUM_BINS );
+        sutil::parallelFor( num_chunks, [&]( size_t c )
+        {
+          const uint32_t b = begin + static_cast<uint32_t>( c * PARALLEL_BINNING );
+          binRange( s, b, std::min<uint32_t>( end, b + static_cast<uint32_t>( PARALLEL_BINNING ) ), cbox, axis,
+                    &chunk_bins[c * NUM_BINS] );
+        } );
+        binRange( s, begin, begin, cbox, axis, bins );
+        for( size_t c = 0; c < num_chunks; ++c )
+        {
+          for( int b = 0; b < NUM_BINS; ++b )
+          {
+            bins[b].box.grow( chunk_bins[c * NUM_BINS + b].box );
+            bins[b].count += chunk_bins[c * NUM_BINS + b].count;
+          }
+        }
+      }
+      else
+        binRange( s, begin, end, cbox, axis, bins );
+
+      // Sweep from the right, then evaluate splits from the left
+      float    right_area[NUM_BINS];
+      uint32_t right_count[NUM_BINS];
+      Box      acc;
+      acc.reset();
+      uint32_t n = 0;
+      for( int b = NUM_BINS - 1; b > 0; --b )
+      {
+        acc.grow( bins[b].box );
+        n += bins[b].count;
+        right_area[b]  = acc.halfArea();
+        right_count[b] = n;
+      }
+
+      acc.reset();
+      n = 0;
+      for( int b = 0; b < NUM_BINS - 1; ++b )
+      {
+        acc.grow( bins[b].box );
+        n += bins[b].count;
+        if( n == 0 || right_count[b+1] == 0 )
+          continue;
+        const float cost = acc.halfArea() * numPackets( n ) + right_area[b+1] * numPackets( right_count[b+1] );
+        if( cost < best_cost )
+        {
+          best_cost = cost;
+          best_axis = axis;
+          best_bin  = b;
+        }
+      }
+    }
+  }
+
+  const float area = box.halfArea();
+  const float split_cost = area > 0.0f ? TRAVERSAL_COST + best_cost / area : TRAVERSAL_COST + leaf_cost;
+
+  //
+  // Partition, or fall back to a median split for large ranges of coincident
+  // centroids
+  //
+  uint32_t mid = begin;
+  if( best_axis >= 0 && ( split_cost < leaf_cost || count > MAX_LEAF_SIZE ) )
+  {
+    const float extent = cbox.hi[best_axis] - cbox.lo[best_axis];
+    const float scale  = NUM_BINS / extent * 0.9999f;
+    mid = static_cast<uint32_t>( std::partition( s.refs.begin() + begin, s.refs.begin() + end, [&]( uint32_t t )
+    {
+      const int b = std::min( NUM_BINS - 1, static_cast<int>( ( s.centroids[3*t + best_axis] - cbox.lo[best_axis] ) * scale ) );
+      return b <= best_bin;
+    } ) - s.refs.begin() );
+  }
+  else if( count > MAX_LEAF_SIZE && depth < MAX_DEPTH )
+    mid = begin + count / 2;
+
+  if( mid == begin || mid == end )
+  {
+    node.offset = begin;
+    node.count  = count;
+    return;
+  }
+
+  const uint32_t left = static_cast<uint32_t>( nodes.size() );
+  node.offset = left;
+  node.count  = 0;
+  nodes.resize( nodes.size() + 2 );   // Invalidates 'node'
+
+  buildNode( s, nodes, left,     begin, mid, depth + 1, tasks, task_size );
+  buildNode( s, nodes, left + 1, mid,   end, depth + 1, tasks, task_size );
+}
+
+
+inline float dot3( const float* a, const float* b )
+{
+  return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+}
+
+
+inline void cross3( const float* a, const float* b, float* c )
+{
+  c[0] = a[1]*b[2] - a[2]*b[1];
+  c[1] = a[2]*b[0] - a[0]*b[2];
+  c[2] = a[0]*b[1] - a[1]*b[0];
+}
+
+
+// Slab test, returns the entry distance or +inf on a miss
+inline float intersectBox( const MeshBVH::Node& node, const float* origin, const float* inv_dir, float tmin, float tmax )
+{
+  for( int k = 0; k < 3; ++k )
+  {
+    float t0 = ( node.bbox_min[k] - origin[k] ) * inv_dir[k];
+    float t1 = ( node.bbox_max[k] - origin[k] ) * inv_dir[k];
+    if( t0 > t1 )
+      std::swap( t0, t1 );
+    // Written so that NaNs (0 * inf) leave the interval unchanged
+    tmin = t0 > tmin ? t0 : tmin;
+    tmax = t1 < tmax ? t1 : tmax;
+  }
+  return tmin <= tmax ? tmin : std::numeric_limits<float>::infinity();
+}
+
+} // namespace
+
+
+//------------------------------------------------------------------------------
+//
+// MeshBVH class definition
+//
+//------------------------------------------------------------------------------
+
+MeshBVH::MeshBVH( const Mesh& mesh )
+  : m_build_time( 0.0 )
+{
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  const uint32_t num_triangles = static_cast<uint32_t>( std::max( mesh.num_triangles, 0 ) );
+  if( num_triangles == 0 )
+    return;
+
+  BuildState s;
+  s.boxes.resize( num_triangles );
+  s.centroids.resize( 3 * static_cast<size_t>( num_triangles ) );
+  s.refs.resize( num_triangles );
+
+  const size_t block_size = 1u << 14;
+  const size_t num_blocks = ( num_triangles + block_size - 1 ) / block_size;
+  sutil::parallelFor( num_blocks, [&]( size_t b )
+  {
+    const uint32_t end = static_cast<uint32_t>( std::min<size_t>( num_triangles, ( b + 1 ) * block_size ) );
+    for( uint32_t t = static_cast<uint32_t>( b * block_size ); t < end; ++t )
+    {
+      Box& box = s.boxes[t];
+      box.reset();
+      for( int j = 0; j < 3; ++j )
+        box.grow( mesh.positions + 3 * static_cast<size_t>( mesh.tri_indices[3*t + j] ) );
+      for( int k = 0; k < 3; ++k )
+        s.centroids[3*t + k] = 0.5f * ( box.lo[k] + box.hi[k] );
+      s.refs[t] = t;
+    }
+  } );
+
+  //
+  // Build the top of the tree here and hand smaller subtrees to worker
+  // threads, each building into its own node array
+  //
+  const uint32_t task_size = std::max<uint32_t>( 4096, num_triangles / ( sutil::numWorkerThreads() * 8 ) );
+  std::vector<Task> tasks;
+  m_nodes.reserve( 2 * num_triangles / PACKET_SIZE + 1 );
+  m_nodes.resize( 1 );
+  buildNode( s, m_nodes, 0, 0, num_triangles, 0, &tasks, task_size );
+
+  // Largest first for better load balance
+  std::sort( tasks.begin(), tasks.end(), []( const Task& a, const Task& b ) { return a.end - a.begin > b.end - b.begin; } );
+  std::vector< std::vector<Node> > subtrees( tasks.size() );
+  sutil::parallelFor( tasks.size(), [&]( size_t i )
+  {
+    subtrees[i].reserve( 2 * ( tasks[i].end - tasks[i].begin ) / PACKET_SIZE + 1 );
+    subtrees[i].resize( 1 );
+    buildNode( s, subtrees[i], 0, tasks[i].begin, tasks[i].end, tasks[i].depth, 0, 0 );
+  } );
+
+  // Splice subtrees in, their roots replace the placeholder nodes
+  for( size_t i = 0; i < tasks.size(); ++i )
+  {
+    const std::vector<Node>& subtree = subtrees[i];
+    const uint32_t base = static_cast<uint32_t>( m_nodes.size() ) - 1;
+    for( size_t n = 0; n < subtree.size(); ++n )
+    {
+      Node node = subtree[n];
+      if( node.count == 0 )
+        node.offset += base;
+      if( n == 0 )
+        m_nodes[ tasks[i].node ] = node;
+      else
+        m_nodes.push_back( node );
+    }
+  }
+
+  //
+  // Gather leaf triangles into packets
+  //
+  std::vector<uint32_t> first_packet( m_nodes.size(), 0 );
+  uint32_t num_packets = 0;
+  for( size_t n = 0; n < m_nodes.size(); ++n )
+  {
+    if( m_nodes[n].count == 0 )
+      continue;
+    first_packet[n] = num_packets;
+    num_packets += numPackets( m_nodes[n].count );
+  }
+  m_packets.resize( num_packets );
+
+  sutil::parallelFor( ( m_nodes.size() + 1023 ) / 1024, [&]( size_t b )
+  {
+    const size_t end = std::min( m_nodes.size(), ( b + 1 ) * 1024 );
+    for( size_t n = b * 1024; n < end; ++n )
+    {
+      Node& node = m_nodes[n];
+      if( node.count == 0 )
+        continue;
+
+      for( uint32_t i = 0; i < numPackets( node.count ) * PACKET_SIZE; ++i )
+      {
+        Packet& packet = m_packets[ first_packet[n] + i / PACKET_SIZE ];
+        const uint32_t lane = i % PACKET_SIZE;
+        if( i >= node.count )
+        {
+          for( int k = 0; k < 3; ++k )
+            packet.v0[k][lane] = packet.e1[k][lane] = packet.e2[k][lane] = 0.0f;
+          packet.triangle[lane] = -1;
+          continue;
+        }
+
+        const uint32_t t  = s.refs[ node.offset + i ];
+        const float*   p0 = mesh.positions + 3 * static_cast<size_t>( mesh.tri_indices[3*t+0] );
+        const float*   p1 = mesh.positions + 3 * static_cast<size_t>( mesh.tri_indices[3*t+1] );
+        const float*   p2 = mesh.positions + 3 * static_cast<size_t>( mesh.tri_indices[3*t+2] );
+        for( int k = 0; k < 3; ++k )
+        {
+          packet.v0[k][lane] = p0[k];
+          packet.e1[k][lane] = p1[k] - p0[k];
+          packet.e2[k][lane] = p2[k] - p0[k];
+        }
+        packet.triangle[lane] = static_cast<int32_t>( t );
+      }
+      node.offset = first_packet[n];
+    }
+  } );
+
+  m_build_time = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+}
+
+
+bool MeshBVH::intersect( const float* origin, const float* direction, float tmin, float tmax, MeshRayHit& hit )const
+{
+  return traverse<false>( origin, direction, tmin, tmax, hit );
+}
+
+
+bool MeshBVH::occluded( const float* origin, const float* direction, float tmin, float tmax )const
+{
+  MeshRayHit hit;
+  return traverse<true>( origin, direction, tmin, tmax, hit );
+}
+
+
+template<bool ANY_HIT>
+bool MeshBVH::traverse( const float* origin, const float* direction, float tmin, float tmax, MeshRayHit& hit )const
+{
+  if( m_nodes.empty() )
+    return false;
+
+  float inv_dir[3];
+  for( int k = 0; k < 3; ++k )
+    inv_dir[k] = 1.0f / direction[k];
+
+  bool found = false;
+  hit.t        = tmax;
+  hit.triangle = -1;
+
+#if defined(MESH_BVH_SSE)
+  const __m128 o[3]  = { _mm_set1_ps( origin[0] ),    _mm_set1_ps( origin[1] ),    _mm_set1_ps( origin[2] ) };
+  const __m128 d[3]  = { _mm_set1_ps( direction[0] ), _mm_set1_ps( direction[1] ), _mm_set1_ps( direction[2] ) };
+  const __m128 zero  = _mm_setzero_ps();
+  const __m128 one   = _mm_set1_ps( 1.0f );
+  const __m128 t_min = _mm_set1_ps( tmin );
+#endif
+
+  uint32_t stack[64];
+  uint32_t stack_size = 0;
+  uint32_t index      = 0;
+  if( intersectBox( m_nodes[0], origin, inv_dir, tmin, tmax ) == std::numeric_limits<float>::infinity() )
+    return false;
+
+  for( ;; )
+  {
+    const Node& node = m_nodes[index];
+    if( node.count )
+    {
+      const Packet* packet = &m_packets[node.offset];
+      const Packet* last   = packet + numPackets( node.count );
+      for( ; packet != last; ++packet )
+      {
+#if defined(MESH_BVH_SSE)
+        // Moller-Trumbore on four triangles at once
+        const __m128 e1[3] = { _mm_loadu_ps( packet->e1[0] ), _mm_loadu_ps( packet->e1[1] ), _mm_loadu_ps( packet->e1[2] ) };
+        const __m128 e2[3] = { _mm_loadu_ps( packet->e2[0] ), _mm_loadu_ps( packet->e2[1] ), _mm_loadu_ps( packet->e2[2] ) };
+        const __m128 s[3]  = { _mm_sub_ps( o[0], _mm_loadu_ps( packet->v0[0] ) ),
+                               _mm_sub_ps( o[1], _mm_loadu_ps( packet->v0[1] ) ),
+                               _mm_sub_ps( o[2], _mm_loadu_ps( packet->v0[2] ) ) };
+
+        const __m128 p[3]  = { _mm_sub_ps( _mm_mul_ps( d[1], e2[2] ), _mm_mul_ps( d[2], e2[1] ) ),
+                               _mm_sub_ps( _mm_mul_ps( d[2], e2[0] ), _mm_mul_ps( d[0], e2[2] ) ),
+                               _mm_sub_ps( _mm_mul_ps( d[0], e2[1] ), _mm_mul_ps( d[1], e2[0] ) ) };
+        const __m128 q[3]  = { _mm_sub_ps( _mm_mul_ps( s[1], e1[2] ), _mm_mul_ps( s[2], e1[1] ) ),
+                               _mm_sub_ps( _mm_mul_ps( s[2], e1[0] ), _mm_mul_ps( s[0], e1[2] ) ),
+                               _mm_sub_ps( _mm_mul_ps( s[0], e1[1] ), _mm_mul_ps( s[1], e1[0] ) ) };
+
+        const __m128 det   = _mm_add_ps( _mm_add_ps( _mm_mul_ps( e1[0], p[0] ), _mm_mul_ps( e1[1], p[1] ) ), _mm_mul_ps( e1[2], p[2] ) );
+        const __m128 inv   = _mm_div_ps( one, det );
+        const __m128 u     = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( s[0], p[0] ), _mm_mul_ps( s[1], p[1] ) ), _mm_mul_ps( s[2], p[2] ) ), inv );
+        const __m128 v     = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( d[0], q[0] ), _mm_mul_ps( d[1], q[1] ) ), _mm_mul_ps( d[2], q[2] ) ), inv );
+        const __m128 t     = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( e2[0], q[0] ), _mm_mul_ps( e2[1], q[1] ) ), _mm_mul_ps( e2[2], q[2] ) ), inv );
+
+        // Comparisons against NaN (det == 0) are false, so degenerate lanes drop out
+        __m128 mask = _mm_and_ps( _mm_cmpge_ps( u, zero ), _mm_cmpge_ps( v, zero ) );
+        mask = _mm_and_ps( mask, _mm_cmple_ps( _mm_add_ps( u, v ), one ) );
+        mask = _mm_and_ps( mask, _mm_cmpgt_ps( t, t_min ) );
+        mask = _mm_and_ps( mask, _mm_cmplt_ps( t, _mm_set1_ps( hit.t ) ) );
+        int bits = _mm_movemask_ps( mask );
+        if( !bits )
+          continue;
+        if( ANY_HIT )
+          return true;
+
+        float ts[4], us[4], vs[4];
+        _mm_storeu_ps( ts, t );
+        _mm_storeu_ps( us, u );
+        _mm_storeu_ps( vs, v );
+        for( int lane = 0; lane < 4; ++lane )
+        {
+          if( ( bits & ( 1 << lane ) ) && ts[lane] < hit.t )
+          {
+            hit.t        = ts[lane];
+            hit.u        = us[lane];
+            hit.v        = vs[lane];
+            hit.triangle = packet->triangle[lane];
+            found        = true;
+          }
+        }
+#else
+        for( int lane = 0; lane < 4; ++lane )
+        {
+          const float e1[3] = { packet->e1[0][lane], packet->e1[1][lane], packet->e1[2][lane] };
+          const float e2[3] = { packet->e2[0][lane], packet->e2[1][lane], packet->e2[2][lane] };
+          const float s[3]  = { origin[0] - packet->v0[0][lane], origin[1] - packet->v0[1][lane], origin[2] - packet->v0[2][lane] };
+          float p[3], q[3];
+          cross3( direction, e2, p );
+          cross3( s, e1, q );
+          const float inv = 1.0f / dot3( e1, p );
+          const float u   = dot3( s, p ) * inv;
+          const float v   = dot3( direction, q ) * inv;
+          const float t   = dot3( e2, q ) * inv;
+          if( !( u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t > tmin && t < hit.t ) )
+            continue;
+          if( ANY_HIT )
+            return true;
+          hit.t        = t;
+          hit.u        = u;
+          hit.v        = v;
+          hit.triangle = packet->triangle[lane];
+          found        = true;
+        }
+#endif
+      }
+    }
+    else
+    {
+      // Visit the nearer child first
+      uint32_t near_child = node.offset;
+      uint32_t far_child  = node.offset + 1;
+      float t_near = intersectBox( m_nodes[near_child], origin, inv_dir, tmin, hit.t );
+      float t_far  = intersectBox( m_nodes[far_child],  origin, inv_dir, tmin, hit.t );
+      if( t_far < t_near )
+      {
+        std::swap( near_child, far_child );
+        std::swap( t_near, t_far );
+      }
+      if( t_near != std::numeric_limits<float>::infinity() )
+      {
+        if( t_far != std::numeric_limits<float>::infinity() )
+          stack[stack_size++] = far_child;
+        index = near_child;
+        continue;
+      }
+    }
+
+    if( stack_size == 0 )
+      break;
+    index = stack[--stack_size];
+  }
+
+  return found;
+}
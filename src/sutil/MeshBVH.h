@@ -0,0 +1,106 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Mesh.h"
+
+#include <sutilapi.h>
+
+#include <stdint.h>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+//
+// Host side BVH over the triangles of a Mesh, for CPU ray queries such as
+// picking, culling and headless validation.  Built top-down with binned SAH on
+// worker threads.  Leaves hold triangles in packets of four which are tested
+// together with SSE when available.
+//
+// The BVH keeps its own copy of the triangle data, so the Mesh may be freed
+// after construction.  Queries are const and may run concurrently.
+//
+//------------------------------------------------------------------------------
+
+struct MeshRayHit
+{
+  float               t;
+  int32_t             triangle;      // Index into mesh.tri_indices / 3
+  float               u;             // Barycentrics of vertex 1 and 2
+  float               v;
+};
+
+
+class MeshBVH
+{
+public:
+  // 32 byte node.  Inner nodes have count 0 and their children at offset and
+  // offset+1; leaves reference count triangles starting at packet offset.
+  struct Node
+  {
+    float             bbox_min[3];
+    uint32_t          offset;
+    float             bbox_max[3];
+    uint32_t          count;
+  };
+
+  SUTILAPI MeshBVH( const Mesh& mesh );
+
+  // Note: using generic float* rather than float3, as in sutil::Camera.
+  // Closest intersection with t in (tmin, tmax), returns false on a miss.
+  SUTILAPI bool intersect( const float* origin, const float* direction, float tmin, float tmax,
+                           MeshRayHit& hit )const;
+
+  // True if any triangle is hit with t in (tmin, tmax)
+  SUTILAPI bool occluded( const float* origin, const float* direction, float tmin, float tmax )const;
+
+  SUTILAPI const std::vector<Node>& nodes()const    { return m_nodes; }
+  SUTILAPI double                   buildTime()const { return m_build_time; }
+
+private:
+  // Four triangles as vertex 0 and the two edges from it, one lane each.
+  // Unused lanes have zero edges and never hit.
+  struct Packet
+  {
+    float             v0[3][4];
+    float             e1[3][4];
+    float             e2[3][4];
+    int32_t           triangle[4];
+  };
+
+  MeshBVH( const MeshBVH& );
+  MeshBVH& operator=( const MeshBVH& );
+
+  template<bool ANY_HIT>
+  bool traverse( const float* origin, const float* direction, float tmin, float tmax, MeshRayHit& hit )const;
+
+  std::vector<Node>      m_nodes;
+  std::vector<Packet>    m_packets;
+  double                 m_build_time;    // Seconds
+};
@@ -0,0 +1,459 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "MeshCache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <vector>
+
+//------------------------------------------------------------------------------
+//
+// Helpers 
+//
+//------------------------------------------------------------------------------
+
+namespace
+{
+
+// Bump whenever the layout of the cache file changes
+const uint32_t MESH_CACHE_VERSION   = 2u;
+const char     MESH_CACHE_MAGIC[8]  = { 'S', 'U', 'T', 'I', 'L', 'M', 'S', 'H' };
+
+// Array data is aligned so the mapping could be handed out directly
+const uint64_t MESH_CACHE_ALIGNMENT = 64u;
+
+enum MeshCacheFlags
+{
+  MESH_CACHE_NORMALS   = 1u << 0,
+  MESH_CACHE_TEXCOORDS = 1u << 1
+};
+
+
+struct MeshCacheHeader
+{
+  char                magic[8];
+  uint32_t            version;
+  uint32_t            header_size;      // sizeof( MeshCacheHeader ), guards against padding changes
+
+  uint64_t            source_size;      // Key: size of the source file in bytes
+  int64_t             source_mtime;     // Key: modification time of the source file in ns
+
+  int32_t             num_vertices;
+  int32_t             num_triangles;
+  int32_t             num_materials;
+  uint32_t            flags;            // MeshCacheFlags
+
+  float               bbox_min[3];
+  float               bbox_max[3];
+
+  uint64_t            path_offset;      // Key: source path as passed to MeshLoader
+  uint64_t            path_size;
+  uint64_t            positions_offset;
+  uint64_t            normals_offset;
+  uint64_t            texcoords_offset;
+  uint64_t            tri_indices_offset;
+  uint64_t            mat_indices_offset;
+  uint64_t            materials_offset;
+  uint64_t            materials_size;
+  uint64_t            dependencies_offset;  // Key: path, size and mtime of each file the mesh was loaded from
+  uint64_t            dependencies_size;
+  uint32_t            num_dependencies;
+  uint32_t            padding;
+  uint64_t            file_size;
+};
+
+
+bool statSourceFile( const std::string& filename, uint64_t& size, int64_t& mtime )
+{
+#if defined(_WIN32)
+  struct _stat64 st;
+  if( _stat64( filename.c_str(), &st ) != 0 )
+    return false;
+#else
+  struct stat st;
+  if( stat( filename.c_str(), &st ) != 0 )
+    return false;
+#endif
+  size  = static_cast<uint64_t>( st.st_size );
+#if defined(_WIN32)
+  mtime = static_cast<int64_t>( st.st_mtime ) * 1000000000;
+#elif defined(__APPLE__)
+  mtime = static_cast<int64_t>( st.st_mtimespec.tv_sec ) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+  mtime = static_cast<int64_t>( st.st_mtim.tv_sec ) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+  return true;
+}
+
+
+uint64_t alignUp( uint64_t offset )
+{
+  return ( offset + MESH_CACHE_ALIGNMENT - 1 ) & ~( MESH_CACHE_ALIGNMENT - 1 );
+}
+
+
+void appendBytes( std::vector<char>& blob, const void* data, size_t size )
+{
+  const char* bytes = static_cast<const char*>( data );
+  blob.insert( blob.end(), bytes, bytes + size );
+}
+
+
+void appendString( std::vector<char>& blob, const std::string& s )
+{
+  const uint32_t size = static_cast<uint32_t>( s.size() );
+  appendBytes( blob, &size, sizeof( size ) );
+  appendBytes( blob, s.data(), s.size() );
+}
+
+
+// Bounds checked reads from the mapped materials section
+bool readBytes( const char*& cur, const char* end, void* dst, size_t size )
+{
+  if( static_cast<size_t>( end - cur ) < size )
+    return false;
+  memcpy( dst, cur, size );
+  cur += size;
+  return true;
+}
+
+
+bool readString( const char*& cur, const char* end, std::string& s )
+{
+  uint32_t size;
+  if( !readBytes( cur, end, &size, sizeof( size ) ) || static_cast<size_t>( end - cur ) < size )
+    return false;
+  s.assign( cur, size );
+  cur += size;
+  return true;
+}
+
+
+void serializeMaterials( const Mesh& mesh, std::vector<char>& blob )
+{
+  for( int32_t i = 0; i < mesh.num_materials; ++i )
+  {
+    const MaterialParams& mat = mesh.mat_params[i];
+    appendString( blob, mat.name );
+    appendString( blob, mat.Kd_map );
+    appendBytes( blob, mat.Kd,   sizeof( mat.Kd ) );
+    appendBytes( blob, mat.Ks,   sizeof( mat.Ks ) );
+    appendBytes( blob, mat.Kr,   sizeof( mat.Kr ) );
+    appendBytes( blob, mat.Ka,   sizeof( mat.Ka ) );
+    appendBytes( blob, &mat.exp, sizeof( mat.exp ) );
+  }
+}
+
+
+bool deserializeMaterials( const char* cur, const char* end, int32_t num_materials, std::vector<MaterialParams>& materials )
+{
+  materials.resize( num_materials );
+  for( int32_t i = 0; i < num_materials; ++i )
+  {
+    MaterialParams& mat = materials[i];
+    if( !readString( cur, end, mat.name )                  ||
+        !readString( cur, end, mat.Kd_map )                ||
+        !readBytes( cur, end, mat.Kd,   sizeof( mat.Kd ) ) ||
+        !readBytes( cur, end, mat.Ks,   sizeof( mat.Ks ) ) ||
+        !readBytes( cur, end, mat.Kr,   sizeof( mat.Kr ) ) ||
+        !readBytes( cur, end, mat.Ka,   sizeof( mat.Ka ) ) ||
+        !readBytes( cur, end, &mat.exp, sizeof( mat.exp ) ) )
+      return false;
+  }
+  return true;
+}
+
+
+void serializeDependencies( const std::vector<std::string>& dependencies, std::vector<char>& blob,
+                            int64_t& latest_mtime, bool& ok )
+{
+  for( size_t i = 0; i < dependencies.size(); ++i )
+  {
+    uint64_t size;
+    int64_t  mtime;
+    if( !statSourceFile( dependencies[i], size, mtime ) )
+    {
+      ok = false;
+      return;
+    }
+    appendString( blob, dependencies[i] );
+    appendBytes( blob, &size,  sizeof( size ) );
+    appendBytes( blob, &mtime, sizeof( mtime ) );
+    latest_mtime = std::max( latest_mtime, mtime );
+  }
+}
+
+
+// True if every dependency still has the size and mtime it was cached with
+bool checkDependencies( const char* cur, const char* end, uint32_t num_dependencies )
+{
+  for( uint32_t i = 0; i < num_dependencies; ++i )
+  {
+    std::string path;
+    uint64_t    size, current_size;
+    int64_t     mtime, current_mtime;
+    if( !readString( cur, end, path )                  ||
+        !readBytes( cur, end, &size,  sizeof( size ) ) ||
+        !readBytes( cur, end, &mtime, sizeof( mtime ) ) )
+      return false;
+    if( !statSourceFile( path, current_size, current_mtime ) || current_size != size || current_mtime != mtime )
+      return false;
+  }
+  return true;
+}
+
+
+bool writePadded( FILE* fp, const void* data, uint64_t size, uint64_t& offset, uint64_t target_offset )
+{
+  static const char zeros[MESH_CACHE_ALIGNMENT] = { 0 };
+  if( target_offset > offset &&
+      fwrite( zeros, 1, static_cast<size_t>( target_offset - offset ), fp ) != target_offset - offset )
+    return false;
+  offset = target_offset;
+
+  if( size && fwrite( data, 1, static_cast<size_t>( size ), fp ) != size )
+    return false;
+  offset += size;
+  return true;
+}
+
+
+const MeshCacheHeader& header( const MappedFile& file )
+{
+  return *reinterpret_cast<const MeshCacheHeader*>( file.data() );
+}
+
+} // namespace
+
+
+//------------------------------------------------------------------------------
+//
+// Cache writing
+//
+//------------------------------------------------------------------------------
+
+std::string meshCacheFilename( const std::string& filename )
+{
+  return filename + ".meshcache";
+}
+
+
+bool writeMeshCache( const std::string& filename, const Mesh& mesh, const std::vector<std::string>& dependencies )
+{
+  MeshCacheHeader hdr;
+  memset( &hdr, 0, sizeof( hdr ) );
+  memcpy( hdr.magic, MESH_CACHE_MAGIC, sizeof( hdr.magic ) );
+  hdr.version     = MESH_CACHE_VERSION;
+  hdr.header_size = sizeof( MeshCacheHeader );
+
+  if( !statSourceFile( filename, hdr.source_size, hdr.source_mtime ) )
+    return false;
+
+  hdr.num_vertices  = mesh.num_vertices;
+  hdr.num_triangles = mesh.num_triangles;
+  hdr.num_materials = mesh.num_materials;
+  hdr.flags         = ( mesh.has_normals   ? MESH_CACHE_NORMALS   : 0u ) |
+                      ( mesh.has_texcoords ? MESH_CACHE_TEXCOORDS : 0u );
+  memcpy( hdr.bbox_min, mesh.bbox_min, sizeof( hdr.bbox_min ) );
+  memcpy( hdr.bbox_max, mesh.bbox_max, sizeof( hdr.bbox_max ) );
+
+  std::vector<char> materials;
+  serializeMaterials( mesh, materials );
+
+  int64_t latest_mtime = hdr.source_mtime;
+  bool    dependencies_ok = true;
+  std::vector<char> dependency_keys;
+  serializeDependencies( dependencies, dependency_keys, latest_mtime, dependencies_ok );
+  if( !dependencies_ok )
+    return false;
+
+  const uint64_t positions_size   = sizeof( float )   * 3 * static_cast<uint64_t>( mesh.num_vertices );
+  const uint64_t normals_size     = mesh.has_normals   ? positions_size : 0;
+  const uint64_t texcoords_size   = mesh.has_texcoords ? sizeof( float ) * 2 * static_cast<uint64_t>( mesh.num_vertices ) : 0;
+  const uint64_t tri_indices_size = sizeof( int32_t ) * 3 * static_cast<uint64_t>( mesh.num_triangles );
+  const uint64_t mat_indices_size = sizeof( int32_t ) * 1 * static_cast<uint64_t>( mesh.num_triangles );
+
+  hdr.path_offset        = sizeof( MeshCacheHeader );
+  hdr.path_size          = filename.size();
+  hdr.positions_offset   = alignUp( hdr.path_offset        + hdr.path_size  );
+  hdr.normals_offset     = alignUp( hdr.positions_offset   + positions_size );
+  hdr.texcoords_offset   = alignUp( hdr.normals_offset     + normals_size );
+  hdr.tri_indices_offset = alignUp( hdr.texcoords_offset   + texcoords_size );
+  hdr.mat_indices_offset = alignUp( hdr.tri_indices_offset + tri_indices_size );
+  hdr.materials_offset   = alignUp( hdr.mat_indices_offset + mat_indices_size );
+  hdr.materials_size     = materials.size();
+  hdr.dependencies_offset = hdr.materials_offset + hdr.materials_size;
+  hdr.dependencies_size   = dependency_keys.size();
+  hdr.num_dependencies    = static_cast<uint32_t>( dependencies.size() );
+  hdr.file_size          = hdr.dependencies_offset + hdr.dependencies_size;
+
+  // Write to a temporary file first so a concurrent reader never sees a partial cache
+  const std::string cache_filename = meshCacheFilename( filename );
+  const std::string temp_filename  = cache_filename + ".tmp";
+  FILE* fp = fopen( temp_filename.c_str(), "wb" );
+  if( !fp )
+    return false;
+
+  uint64_t offset = 0;
+  bool ok = writePadded( fp, &hdr,             sizeof( hdr ),    offset, 0 )                      &&
+            writePadded( fp, filename.data(),  hdr.path_size,    offset, hdr.path_offset )        &&
+            writePadded( fp, mesh.positions,   positions_size,   offset, hdr.positions_offset )   &&
+            writePadded( fp, mesh.normals,     normals_size,     offset, hdr.normals_offset )     &&
+            writePadded( fp, mesh.texcoords,   texcoords_size,   offset, hdr.texcoords_offset )   &&
+            writePadded( fp, mesh.tri_indices, tri_indices_size, offset, hdr.tri_indices_offset ) &&
+            writePadded( fp, mesh.mat_indices, mat_indices_size, offset, hdr.mat_indices_offset ) &&
+            writePadded( fp, materials.empty() ? 0 : &materials[0],
+                         hdr.materials_size, offset, hdr.materials_offset ) &&
+            writePadded( fp, dependency_keys.empty() ? 0 : &dependency_keys[0],
+                         hdr.dependencies_size, offset, hdr.dependencies_offset );
+  ok = ( fclose( fp ) == 0 ) && ok;
+
+  // A keyed file modified in the same timestamp tick as the cache could be
+  // changed again without its mtime changing; cache it on a later load
+  uint64_t cache_size;
+  int64_t  cache_mtime;
+  if( ok && ( !statSourceFile( temp_filename, cache_size, cache_mtime ) || cache_mtime <= latest_mtime ) )
+  {
+    remove( temp_filename.c_str() );
+    return true;
+  }
+
+  if( ok )
+  {
+    remove( cache_filename.c_str() );
+    ok = rename( temp_filename.c_str(), cache_filename.c_str() ) == 0;
+  }
+  if( !ok )
+    remove( temp_filename.c_str() );
+
+  return ok;
+}
+
+
+//------------------------------------------------------------------------------
+//
+// MeshCache class definition
+//
+//------------------------------------------------------------------------------
+
+MeshCache::MeshCache( const std::string& filename )
+  : m_file( meshCacheFilename( filename ) ), m_valid( false )
+{
+  if( m_file.failed() || m_file.size() < sizeof( MeshCacheHeader ) )
+    return;
+
+  const MeshCacheHeader& hdr = header( m_file );
+  if( memcmp( hdr.magic, MESH_CACHE_MAGIC, sizeof( hdr.magic ) ) != 0 ||
+      hdr.version     != MESH_CACHE_VERSION                           ||
+      hdr.header_size != sizeof( MeshCacheHeader )                    ||
+      hdr.file_size   != m_file.size() )
+    return;
+
+  // Key check against the current state of the source file
+  uint64_t source_size;
+  int64_t  source_mtime;
+  if( !statSourceFile( filename, source_size, source_mtime ) ||
+      source_size  != hdr.source_size                        ||
+      source_mtime != hdr.source_mtime                       ||
+      hdr.path_size != filename.size()                       ||
+      hdr.path_offset + hdr.path_size > m_file.size()        ||
+      filename.compare( 0, filename.size(), m_file.data() + hdr.path_offset, hdr.path_size ) != 0 )
+    return;
+
+  // Meshes without materials are valid, as for the parsers
+  if( hdr.num_vertices <= 0 || hdr.num_triangles <= 0 || hdr.num_materials < 0 )
+    return;
+
+  const uint64_t num_vertices  = static_cast<uint64_t>( hdr.num_vertices );
+  const uint64_t num_triangles = static_cast<uint64_t>( hdr.num_triangles );
+  const uint64_t num_normals   = ( hdr.flags & MESH_CACHE_NORMALS   ) ? num_vertices : 0;
+  const uint64_t num_texcoords = ( hdr.flags & MESH_CACHE_TEXCOORDS ) ? num_vertices : 0;
+  const uint64_t file_size     = m_file.size();
+  if( hdr.positions_offset   + sizeof( float )   * 3 * num_vertices  > file_size ||
+      hdr.normals_offset     + sizeof( float )   * 3 * num_normals   > file_size ||
+      hdr.texcoords_offset   + sizeof( float )   * 2 * num_texcoords > file_size ||
+      hdr.tri_indices_offset + sizeof( int32_t ) * 3 * num_triangles > file_size ||
+      hdr.mat_indices_offset + sizeof( int32_t ) * 1 * num_triangles > file_size ||
+      hdr.materials_offset   + hdr.materials_size                    > file_size ||
+      hdr.dependencies_offset + hdr.dependencies_size                > file_size )
+    return;
+
+  const char* dependencies = m_file.data() + hdr.dependencies_offset;
+  if( !checkDependencies( dependencies, dependencies + hdr.dependencies_size, hdr.num_dependencies ) )
+    return;
+
+  const char* materials = m_file.data() + hdr.materials_offset;
+  if( !deserializeMaterials( materials, materials + hdr.materials_size, hdr.num_materials, m_materials ) )
+    return;
+
+  m_valid = true;
+}
+
+
+bool MeshCache::valid()const
+{
+  return m_valid;
+}
+
+
+void MeshCache::scanMesh( Mesh& mesh )const
+{
+  const MeshCacheHeader& hdr = header( m_file );
+  mesh.num_vertices  = hdr.num_vertices;
+  mesh.num_triangles = hdr.num_triangles;
+  mesh.num_materials = hdr.num_materials;
+  mesh.has_normals   = ( hdr.flags & MESH_CACHE_NORMALS   ) != 0;
+  mesh.has_texcoords = ( hdr.flags & MESH_CACHE_TEXCOORDS ) != 0;
+}
+
+
+void MeshCache::loadMesh( Mesh& mesh )const
+{
+  const MeshCacheHeader& hdr  = header( m_file );
+  const char*            base = m_file.data();
+
+  const size_t num_vertices  = static_cast<size_t>( hdr.num_vertices );
+  const size_t num_triangles = static_cast<size_t>( hdr.num_triangles );
+
+  memcpy( mesh.positions, base + hdr.positions_offset, sizeof( float ) * 3 * num_vertices );
+  if( mesh.has_normals )
+    memcpy( mesh.normals, base + hdr.normals_offset, sizeof( float ) * 3 * num_vertices );
+  if( mesh.has_texcoords )
+    memcpy( mesh.texcoords, base + hdr.texcoords_offset, sizeof( float ) * 2 * num_vertices );
+  memcpy( mesh.tri_indices, base + hdr.tri_indices_offset, sizeof( int32_t ) * 3 * num_triangles );
+  memcpy( mesh.mat_indices, base + hdr.mat_indices_offset, sizeof( int32_t ) * 1 * num_triangles );
+
+  memcpy( mesh.bbox_min, hdr.bbox_min, sizeof( mesh.bbox_min ) );
+  memcpy( mesh.bbox_max, hdr.bbox_max, sizeof( mesh.bbox_max ) );
+
+  std::copy( m_materials.begin(), m_materials.end(), mesh.mat_params );
+}
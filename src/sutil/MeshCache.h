@@ -0,0 +1,81 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Mesh.h"
+#include "MappedFile.h"
+
+#include <string>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+//
+// Binary mesh cache.  After a mesh has been parsed once, MeshLoader writes its
+// arrays to a sidecar file next to the source ("<filename>.meshcache").  The
+// sidecar is keyed by the path, size and modification time of the source and
+// of the files it depends on, such as the material libraries of an OBJ, so
+// later loads of unchanged files map it and fill the Mesh by bulk copies
+// instead of parsing the text again.
+//
+// Modification times are compared with the resolution of the file system.
+// A cache is only written once its own modification time is later than that
+// of every keyed file, so a file rewritten within the same timestamp tick as
+// the cache can't go unnoticed.
+//
+//------------------------------------------------------------------------------
+
+// Returns the name of the cache sidecar for the given source mesh file.
+std::string meshCacheFilename( const std::string& filename );
+
+// Writes the cache sidecar for the given source file and the files it was
+// loaded from besides it.  mesh must be fully loaded and not yet transformed.
+// Returns false if the file can't be written, and true without writing it if
+// a keyed file is too recent to tell later changes apart.
+bool writeMeshCache( const std::string& filename, const Mesh& mesh,
+                     const std::vector<std::string>& dependencies );
+
+
+class MeshCache
+{
+public:
+  MeshCache( const std::string& filename );
+
+  // True if the sidecar exists, has the current version and matches the source file
+  bool valid()const;
+
+  // Same contract as MeshLoader::scanMesh/loadMesh (without the load transform)
+  void scanMesh( Mesh& mesh )const;
+  void loadMesh( Mesh& mesh )const;
+
+private:
+  MappedFile                    m_file;
+  bool                          m_valid;
+  std::vector<MaterialParams>   m_materials;
+};
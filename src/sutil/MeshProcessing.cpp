@@ -0,0 +1,487 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "MeshProcessing.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+//
+// Helpers
+//
+//------------------------------------------------------------------------------
+
+namespace
+{
+
+// Number of vertices or triangles per parallel task
+const size_t BLOCK_SIZE = 1u << 16;
+
+
+// Vertex attributes viewed as one tuple of floats
+struct VertexTuple
+{
+  const Mesh& mesh;
+
+  int size()const
+  {
+    return 3 + ( mesh.has_normals ? 3 : 0 ) + ( mesh.has_texcoords ? 2 : 0 );
+  }
+
+  void get( int32_t v, float* t )const
+  {
+    int n = 0;
+    for( int k = 0; k < 3; ++k )
+      t[n++] = mesh.positions[3*v+k];
+    if( mesh.has_normals )
+      for( int k = 0; k < 3; ++k )
+        t[n++] = mesh.normals[3*v+k];
+    if( mesh.has_texcoords )
+      for( int k = 0; k < 2; ++k )
+        t[n++] = mesh.texcoords[2*v+k];
+  }
+};
+
+
+uint64_t vertexBytes( const Mesh& mesh, int32_t num_vertices )
+{
+  const VertexTuple tuple = { mesh };
+  return static_cast<uint64_t>( num_vertices ) * sizeof( float ) * tuple.size();
+}
+
+
+inline uint32_t hashFloats( const float* t, int n )
+{
+  // FNV-1a over the bits.  Adding 0.0f maps -0 to +0 so that values which
+  // compare equal hash equally.
+  uint32_t h = 2166136261u;
+  for( int i = 0; i < n; ++i )
+  {
+    const float f = t[i] + 0.0f;
+    uint32_t bits;
+    memcpy( &bits, &f, sizeof( bits ) );
+    h = ( h ^ bits ) * 16777619u;
+  }
+  return h;
+}
+
+
+// Maps each vertex to the earliest equal vertex, or to itself
+void findExactDuplicates( const Mesh& mesh, std::vector<int32_t>& rep )
+{
+  const VertexTuple tuple = { mesh };
+  const int         n     = tuple.size();
+  const size_t      count = static_cast<size_t>( mesh.num_vertices );
+
+  std::vector<uint32_t> hashes( count );
+  sutil::parallelFor( ( count + BLOCK_SIZE - 1 ) / BLOCK_SIZE, [&]( size_t b )
+  {
+    float t[8];
+    const size_t end = std::min( count, ( b + 1 ) * BLOCK_SIZE );
+    for( size_t v = b * BLOCK_SIZE; v < end; ++v )
+    {
+      tuple.get( static_cast<int32_t>( v ), t );
+      hashes[v] = hashFloats( t, n );
+    }
+  } );
+
+  // Open addressing table of representative vertices
+  size_t table_size = 16;
+  while( table_size < 2 * count )
+    table_size *= 2;
+  std::vector<int32_t> table( table_size, -1 );
+
+  float a[8], b[8];
+  for( size_t v = 0; v < count; ++v )
+  {
+    tuple.get( static_cast<int32_t>( v ), a );
+    rep[v] = static_cast<int32_t>( v );
+    for( size_t slot = hashes[v] & ( table_size - 1 );; slot = ( slot + 1 ) & ( table_size - 1 ) )
+    {
+      const int32_t other = table[slot];
+      if( other < 0 )
+      {
+        table[slot] = static_cast<int32_t>( v );
+        break;
+      }
+      if( hashes[other] != hashes[v] )
+        continue;
+
+      tuple.get( other, b );
+      if( std::equal( a, a + n, b ) )
+      {
+        rep[v] = other;
+        break;
+      }
+    }
+  }
+}
+
+
+// Maps each vertex to the earliest vertex within epsilon that is itself a
+// representative, or to itself
+void findNearDuplicates( const Mesh& mesh, float epsilon, std::vector<int32_t>& rep )
+{
+  struct Cell
+  {
+    int64_t x, y, z;
+    bool operator==( const Cell& o )const { return x == o.x && y == o.y && z == o.z; }
+  };
+  struct CellHash
+  {
+    size_t operator()( const Cell& c )const
+    {
+      return static_cast<size_t>( static_cast<uint64_t>( c.x ) * 73856093u ^
+                                  static_cast<uint64_t>( c.y ) * 19349663u ^
+                                  static_cast<uint64_t>( c.z ) * 83492791u );
+    }
+  };
+
+  const VertexTuple tuple = { mesh };
+  const int         n     = tuple.size();
+
+  // Cells are 2*epsilon wide, so a match lies in one of the 8 cells touched by
+  // the epsilon box around the vertex
+  const float inv_cell_size = 0.5f / epsilon;
+  std::unordered_map<Cell, std::vector<int32_t>, CellHash> grid;
+  grid.reserve( static_cast<size_t>( mesh.num_vertices ) );
+
+  float a[8], b[8];
+  for( int32_t v = 0; v < mesh.num_vertices; ++v )
+  {
+    tuple.get( v, a );
+    int64_t cell[3];
+    int     side[3];
+    for( int k = 0; k < 3; ++k )
+    {
+      const float c = a[k] * inv_cell_size;
+      const float f = floorf( c );
+      cell[k] = static_cast<int64_t>( f );
+      side[k] = c - f < 0.5f ? -1 : 1;
+    }
+
+    int32_t found = -1;
+    for( int corner = 0; corner < 8; ++corner )
+    {
+      const Cell neighbour = { cell[0] + ( corner & 1 ? side[0] : 0 ),
+                               cell[1] + ( corner & 2 ? side[1] : 0 ),
+                               cell[2] + ( corner & 4 ? side[2] : 0 ) };
+      std::unordered_map<Cell, std::vector<int32_t>, CellHash>::const_iterator it = grid.find( neighbour );
+      if( it == grid.end() )
+        continue;
+      for( size_t i = 0; i < it->second.size(); ++i )
+      {
+        const int32_t other = it->second[i];
+        if( found >= 0 && other > found )
+          continue;
+        tuple.get( other, b );
+        bool close = true;
+        for( int k = 0; k < n && close; ++k )
+          close = fabsf( a[k] - b[k] ) <= epsilon;
+        if( close )
+          found = other;
+      }
+    }
+
+    if( found >= 0 )
+      rep[v] = found;
+    else
+    {
+      const Cell home = { cell[0], cell[1], cell[2] };
+      rep[v] = v;
+      grid[home].push_back( v );
+    }
+  }
+}
+
+
+// Spreads the lower 10 bits of v to every third bit
+inline uint32_t expandBits( uint32_t v )
+{
+  v = ( v * 0x00010001u ) & 0xFF0000FFu;
+  v = ( v * 0x00000101u ) & 0x0F00F00Fu;
+  v = ( v * 0x00000011u ) & 0xC30C30C3u;
+  v = ( v * 0x00000005u ) & 0x49249249u;
+  return v;
+}
+
+
+// 30 bit Morton code of a point given in [0,1]^3
+inline uint32_t morton3D( float x, float y, float z )
+{
+  const uint32_t xi = static_cast<uint32_t>( std::min( std::max( x * 1024.0f, 0.0f ), 1023.0f ) );
+  const uint32_t yi = static_cast<uint32_t>( std::min( std::max( y * 1024.0f, 0.0f ), 1023.0f ) );
+  const uint32_t zi = static_cast<uint32_t>( std::min( std::max( z * 1024.0f, 0.0f ), 1023.0f ) );
+  return ( expandBits( xi ) << 2 ) | ( expandBits( yi ) << 1 ) | expandBits( zi );
+}
+
+
+// Applies dst[i] = src[order[i]] for arrays of 'width' elements per entry
+template<typename T>
+void permute( T* data, int width, const std::vector<int32_t>& order )
+{
+  std::vector<T> src( data, data + order.size() * width );
+  sutil::parallelFor( ( order.size() + BLOCK_SIZE - 1 ) / BLOCK_SIZE, [&]( size_t b )
+  {
+    const size_t end = std::min( order.size(), ( b + 1 ) * BLOCK_SIZE );
+    for( size_t i = b * BLOCK_SIZE; i < end; ++i )
+      for( int k = 0; k < width; ++k )
+        data[i*width + k] = src[ static_cast<size_t>( order[i] ) * width + k ];
+  } );
+}
+
+} // namespace
+
+
+//------------------------------------------------------------------------------
+//
+// Mesh processing functions
+//
+//------------------------------------------------------------------------------
+
+MeshWeldStats weldMesh( Mesh& mesh, float epsilon )
+{
+  MeshWeldStats stats;
+  stats.num_vertices_before = mesh.num_vertices;
+  stats.num_vertices_after  = mesh.num_vertices;
+  stats.bytes_before        = vertexBytes( mesh, mesh.num_vertices );
+  stats.bytes_after         = stats.bytes_before;
+  if( mesh.num_vertices == 0 )
+    return stats;
+
+  std::vector<int32_t> rep( mesh.num_vertices );
+  if( epsilon > 0.0f )
+    findNearDuplicates( mesh, epsilon, rep );
+  else
+    findExactDuplicates( mesh, rep );
+
+  //
+  // Compact the surviving vertices in order.  New indices never exceed old
+  // ones, so the arrays can be rewritten in place.
+  //
+  std::vector<int32_t> remap( mesh.num_vertices );
+  int32_t num_vertices = 0;
+  for( int32_t v = 0; v < mesh.num_vertices; ++v )
+  {
+    if( rep[v] != v )
+    {
+      remap[v] = remap[ rep[v] ];
+      continue;
+    }
+
+    remap[v] = num_vertices;
+    if( num_vertices != v )
+    {
+      memcpy( mesh.positions + 3*num_vertices, mesh.positions + 3*v, 3*sizeof( float ) );
+      if( mesh.has_normals )
+        memcpy( mesh.normals + 3*num_vertices, mesh.normals + 3*v, 3*sizeof( float ) );
+      if( mesh.has_texcoords )
+        memcpy( mesh.texcoords + 2*num_vertices, mesh.texcoords + 2*v, 2*sizeof( float ) );
+    }
+    ++num_vertices;
+  }
+
+  const size_t num_indices = 3 * static_cast<size_t>( mesh.num_triangles );
+  sutil::parallelFor( ( num_indices + BLOCK_SIZE - 1 ) / BLOCK_SIZE, [&]( size_t b )
+  {
+    const size_t end = std::min( num_indices, ( b + 1 ) * BLOCK_SIZE );
+    for( size_t i = b * BLOCK_SIZE; i < end; ++i )
+      mesh.tri_indices[i] = remap[ mesh.tri_indices[i] ];
+  } );
+
+  mesh.num_vertices = num_vertices;
+
+  if( epsilon > 0.0f )
+  {
+    mesh.bbox_min[0] = mesh.bbox_min[1] = mesh.bbox_min[2] =  1e16f;
+    mesh.bbox_max[0] = mesh.bbox_max[1] = mesh.bbox_max[2] = -1e16f;
+    for( int32_t v = 0; v < num_vertices; ++v )
+    {
+      for( int k = 0; k < 3; ++k )
+      {
+        mesh.bbox_min[k] = std::min( mesh.bbox_min[k], mesh.positions[3*v+k] );
+        mesh.bbox_max[k] = std::max( mesh.bbox_max[k], mesh.positions[3*v+k] );
+      }
+    }
+  }
+
+  stats.num_vertices_after = num_vertices;
+  stats.bytes_after        = vertexBytes( mesh, num_vertices );
+  return stats;
+}
+
+
+void printMeshWeldStats( const MeshWeldStats& stats, std::ostream& out )
+{
+  const uint64_t saved = stats.bytes_before - stats.bytes_after;
+  out << "Welded " << stats.num_vertices_before << " -> " << stats.num_vertices_after
+      << " vertices, saved " << saved / 1024 << " KB of vertex data ("
+      << ( stats.bytes_before ? 100 * saved / stats.bytes_before : 0 ) << "%)" << std::endl;
+}
+
+
+MeshLocalityStats computeMeshLocality( const Mesh& mesh )
+{
+  const int     LINE_SIZE = 64;
+  const int     NUM_SETS  = 64;
+  const int     NUM_WAYS  = 8;
+
+  // Tag and last use per way
+  std::vector<int64_t>  tags( NUM_SETS * NUM_WAYS, -1 );
+  std::vector<uint64_t> used( NUM_SETS * NUM_WAYS, 0 );
+
+  uint64_t time     = 0;
+  uint64_t misses   = 0;
+  double   distance = 0.0;
+  const size_t num_indices = 3 * static_cast<size_t>( mesh.num_triangles );
+  for( size_t i = 0; i < num_indices; ++i )
+  {
+    const int32_t v = mesh.tri_indices[i];
+    if( i > 0 )
+      distance += std::abs( static_cast<double>( v ) - mesh.tri_indices[i-1] );
+
+    // A position may straddle two lines
+    const int64_t first = static_cast<int64_t>( v ) * 3 * sizeof( float ) / LINE_SIZE;
+    const int64_t last  = ( static_cast<int64_t>( v ) * 3 * sizeof( float ) + 3 * sizeof( float ) - 1 ) / LINE_SIZE;
+    for( int64_t line = first; line <= last; ++line )
+    {
+      int64_t*  set_tags = &tags[ ( line % NUM_SETS ) * NUM_WAYS ];
+      uint64_t* set_used = &used[ ( line % NUM_SETS ) * NUM_WAYS ];
+      int way = 0;
+      for( int w = 0; w < NUM_WAYS; ++w )
+      {
+        if( set_tags[w] == line )
+        {
+          way = w;
+          break;
+        }
+        if( set_used[w] < set_used[way] )
+          way = w;
+      }
+      if( set_tags[way] != line )
+      {
+        set_tags[way] = line;
+        ++misses;
+      }
+      set_used[way] = ++time;
+    }
+  }
+
+  MeshLocalityStats stats;
+  stats.avg_index_distance  = num_indices > 1 ? distance / ( num_indices - 1 ) : 0.0;
+  stats.misses_per_triangle = mesh.num_triangles ? static_cast<double>( misses ) / mesh.num_triangles : 0.0;
+  return stats;
+}
+
+
+void printMeshLocalityStats( const MeshLocalityStats& stats, std::ostream& out )
+{
+  out << "avg index distance " << stats.avg_index_distance
+      << ", modelled cache misses per triangle " << stats.misses_per_triangle << std::endl;
+}
+
+
+void reorderMesh( Mesh& mesh )
+{
+  if( mesh.num_triangles == 0 )
+    return;
+
+  //
+  // Sort triangles by the Morton code of their centroid within the bbox
+  //
+  const size_t num_triangles = static_cast<size_t>( mesh.num_triangles );
+  float scale[3];
+  for( int k = 0; k < 3; ++k )
+  {
+    const float extent = mesh.bbox_max[k] - mesh.bbox_min[k];
+    scale[k] = extent > 0.0f ? 1.0f / extent : 0.0f;
+  }
+
+  std::vector<uint64_t> keys( num_triangles );
+  sutil::parallelFor( ( num_triangles + BLOCK_SIZE - 1 ) / BLOCK_SIZE, [&]( size_t b )
+  {
+    const size_t end = std::min( num_triangles, ( b + 1 ) * BLOCK_SIZE );
+    for( size_t t = b * BLOCK_SIZE; t < end; ++t )
+    {
+      float c[3] = { 0.0f, 0.0f, 0.0f };
+      for( int j = 0; j < 3; ++j )
+        for( int k = 0; k < 3; ++k )
+          c[k] += mesh.positions[ 3*mesh.tri_indices[3*t+j] + k ];
+      for( int k = 0; k < 3; ++k )
+        c[k] = ( c[k] / 3.0f - mesh.bbox_min[k] ) * scale[k];
+
+      // Triangle index in the low bits keeps the order deterministic
+      keys[t] = static_cast<uint64_t>( morton3D( c[0], c[1], c[2] ) ) << 32 | t;
+    }
+  } );
+  std::sort( keys.begin(), keys.end() );
+
+  std::vector<int32_t> tri_order( num_triangles );
+  for( size_t t = 0; t < num_triangles; ++t )
+    tri_order[t] = static_cast<int32_t>( keys[t] & 0xffffffffu );
+  permute( mesh.tri_indices, 3, tri_order );
+  permute( mesh.mat_indices, 1, tri_order );
+
+  //
+  // Renumber vertices in order of first use
+  //
+  std::vector<int32_t> remap( mesh.num_vertices, -1 );
+  std::vector<int32_t> vertex_order;
+  vertex_order.reserve( mesh.num_vertices );
+  for( size_t i = 0; i < 3*num_triangles; ++i )
+  {
+    const int32_t v = mesh.tri_indices[i];
+    if( remap[v] < 0 )
+    {
+      remap[v] = static_cast<int32_t>( vertex_order.size() );
+      vertex_order.push_back( v );
+    }
+  }
+  for( int32_t v = 0; v < mesh.num_vertices; ++v )
+  {
+    if( remap[v] < 0 )
+    {
+      remap[v] = static_cast<int32_t>( vertex_order.size() );
+      vertex_order.push_back( v );
+    }
+  }
+
+  permute( mesh.positions, 3, vertex_order );
+  if( mesh.has_normals )
+    permute( mesh.normals, 3, vertex_order );
+  if( mesh.has_texcoords )
+    permute( mesh.texcoords, 2, vertex_order );
+  for( size_t i = 0; i < 3*num_triangles; ++i )
+    mesh.tri_indices[i] = remap[ mesh.tri_indices[i] ];
+}
@@ -0,0 +1,83 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Mesh.h"
+
+#include <sutilapi.h>
+
+#include <iostream>
+#include <stdint.h>
+
+
+//------------------------------------------------------------------------------
+//
+// Post-load passes over a fully loaded Mesh.  They rewrite the arrays in
+// place and never reallocate them, so they work on meshes from allocMesh()
+// as well as on caller owned storage.  The loadMesh convenience functions
+// run them when asked to through MeshLoadFlags.
+//
+//------------------------------------------------------------------------------
+
+struct MeshWeldStats
+{
+  int32_t             num_vertices_before;
+  int32_t             num_vertices_after;
+  uint64_t            bytes_before;   // Size of positions, normals and texcoords
+  uint64_t            bytes_after;
+};
+
+
+// Merges vertices whose position, normal and texcoord (as far as present) are
+// equal, across shapes, and rewrites tri_indices.  With epsilon > 0 vertices
+// are merged into the first earlier vertex whose attributes all lie within
+// epsilon, and the bbox is recomputed.  Surviving vertices keep their order.
+SUTILAPI MeshWeldStats weldMesh( Mesh& mesh, float epsilon = 0.0f );
+
+SUTILAPI void printMeshWeldStats( const MeshWeldStats& stats, std::ostream& out = std::cout );
+
+
+// Memory locality of the vertex fetches made when visiting triangles in order,
+// as the bounding box and attribute programs in triangle_mesh.cu do.
+struct MeshLocalityStats
+{
+  double              avg_index_distance;   // Mean |index - previous index| over the index stream
+  double              misses_per_triangle;  // Modelled cache line misses on positions per triangle
+};
+
+// Cache model used by computeMeshLocality: 64 byte lines, 8-way LRU, 32 KB
+SUTILAPI MeshLocalityStats computeMeshLocality( const Mesh& mesh );
+
+SUTILAPI void printMeshLocalityStats( const MeshLocalityStats& stats, std::ostream& out = std::cout );
+
+
+// Sorts triangles by the Morton code of their centroid and renumbers vertices
+// in order of first use.  Unreferenced vertices move to the end.  Permutes
+// tri_indices, mat_indices, positions, normals and texcoords accordingly.
+SUTILAPI void reorderMesh( Mesh& mesh );
@@ -0,0 +1,916 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ObjParser.h"
+#include "MappedFile.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <unordered_map>
+
+//------------------------------------------------------------------------------
+//
+// Helpers
+//
+//------------------------------------------------------------------------------
+
+namespace
+{
+
+// Files are split into chunks of at least this size, CHUNKS_PER_THREAD per
+// worker thread so uneven chunks still balance.
+const size_t   MIN_CHUNK_SIZE    = 1u << 18;
+const size_t   CHUNKS_PER_THREAD = 8u;
+
+// Marks a segment vertex that is the first use of its (v, vt, vn) in the shape
+const uint64_t NEW_VERTEX        = ~0ull;
+
+
+enum LineType
+{
+  LINE_OTHER = 0,
+  LINE_V,
+  LINE_VN,
+  LINE_VT,
+  LINE_F,
+  LINE_USEMTL,
+  LINE_MTLLIB,
+  LINE_G,
+  LINE_O
+};
+
+
+// Same as tinyobj's vertex_index: zero based, -1 if not given
+struct VertexKey
+{
+  int32_t v;
+  int32_t vt;
+  int32_t vn;
+
+  bool operator==( const VertexKey& other )const
+  {
+    return v == other.v && vt == other.vt && vn == other.vn;
+  }
+};
+
+
+struct ShapeVertexKey
+{
+  uint32_t  shape;
+  VertexKey key;
+
+  bool operator==( const ShapeVertexKey& other )const
+  {
+    return shape == other.shape && key == other.key;
+  }
+};
+
+
+inline uint32_t hashKey( const VertexKey& k )
+{
+  uint32_t h = static_cast<uint32_t>( k.v ) * 0x9e3779b1u;
+  h ^= static_cast<uint32_t>( k.vt ) * 0x85ebca77u + ( h << 6 ) + ( h >> 2 );
+  h ^= static_cast<uint32_t>( k.vn ) * 0xc2b2ae3du + ( h << 6 ) + ( h >> 2 );
+  return h;
+}
+
+
+struct VertexKeyHash
+{
+  size_t operator()( const VertexKey& k )const { return hashKey( k ); }
+};
+
+
+struct ShapeVertexKeyHash
+{
+  size_t operator()( const ShapeVertexKey& k )const { return hashKey( k.key ) ^ ( k.shape * 0x27d4eb2du ); }
+};
+
+
+inline bool isSpace( char c )
+{
+  return c == ' ' || c == '\t';
+}
+
+
+inline bool isDigit( char c )
+{
+  return c >= '0' && c <= '9';
+}
+
+
+// Iterates over the lines of [cur, end).  Lines are returned with leading
+// blanks skipped and a trailing '\r' removed, as tinyobj sees them.
+struct LineReader
+{
+  const char* cur;
+  const char* end;
+
+  bool next( const char*& line, const char*& line_end )
+  {
+    if( cur >= end )
+      return false;
+
+    const char* nl = static_cast<const char*>( memchr( cur, '\n', static_cast<size_t>( end - cur ) ) );
+    const char* e  = nl ? nl : end;
+    line = cur;
+    cur  = nl ? nl + 1 : end;
+
+    if( e > line && e[-1] == '\r' )
+      --e;
+    while( line < e && isSpace( *line ) )
+      ++line;
+    line_end = e;
+    return true;
+  }
+};
+
+
+LineType classifyLine( const char* line, const char* end )
+{
+  const size_t n = static_cast<size_t>( end - line );
+  if( n < 2 || line[0] == '#' )
+    return LINE_OTHER;
+
+  if( line[0] == 'v' )
+  {
+    if( isSpace( line[1] ) )                                return LINE_V;
+    if( n > 2 && line[1] == 'n' && isSpace( line[2] ) )     return LINE_VN;
+    if( n > 2 && line[1] == 't' && isSpace( line[2] ) )     return LINE_VT;
+    return LINE_OTHER;
+  }
+  if( line[0] == 'f' && isSpace( line[1] ) )                return LINE_F;
+  if( line[0] == 'g' && isSpace( line[1] ) )                return LINE_G;
+  if( line[0] == 'o' && isSpace( line[1] ) )                return LINE_O;
+  if( n > 6 && strncmp( line, "usemtl", 6 ) == 0 && isSpace( line[6] ) ) return LINE_USEMTL;
+  if( n > 6 && strncmp( line, "mtllib", 6 ) == 0 && isSpace( line[6] ) ) return LINE_MTLLIB;
+  return LINE_OTHER;
+}
+
+
+// Powers of ten used by tinyobj's float parser, computed with the same pow()
+// calls so that parsed values are bit identical.
+const double* negativePowersOfTen()
+{
+  static const struct Table
+  {
+    double p[32];
+    Table() { for( int i = 0; i < 32; ++i ) p[i] = pow( 10.0, -i ); }
+  } table;
+  return table.p;
+}
+
+
+// Bounded version of tinyobj's tryParseDouble.  Same grammar and arithmetic.
+bool tryParseDouble( const char* s, const char* s_end, double* result )
+{
+  if( s >= s_end )
+    return false;
+
+  const double* pow10 = negativePowersOfTen();
+
+  double mantissa = 0.0;
+  int    exponent = 0;
+  char   sign     = '+';
+  char   exp_sign = '+';
+  const char* curr = s;
+  int    read     = 0;
+
+  if( *curr == '+' || *curr == '-' )
+  {
+    sign = *curr;
+    curr++;
+  }
+  else if( !isDigit( *curr ) )
+    return false;
+
+  while( curr != s_end && isDigit( *curr ) )
+  {
+    mantissa *= 10;
+    mantissa += static_cast<int>( *curr - 0x30 );
+    curr++; read++;
+  }
+  if( read == 0 )
+    return false;
+  if( curr == s_end )
+    goto assemble;
+
+  if( *curr == '.' )
+  {
+    curr++;
+    read = 1;
+    while( curr != s_end && isDigit( *curr ) )
+    {
+      mantissa += static_cast<int>( *curr - 0x30 ) * ( read < 32 ? pow10[read] : pow( 10.0, -read ) );
+      read++; curr++;
+    }
+  }
+  else if( *curr != 'e' && *curr != 'E' )
+    goto assemble;
+
+  if( curr == s_end )
+    goto assemble;
+
+  if( *curr == 'e' || *curr == 'E' )
+  {
+    curr++;
+    if( curr != s_end && ( *curr == '+' || *curr == '-' ) )
+    {
+      exp_sign = *curr;
+      curr++;
+    }
+    else if( curr == s_end || !isDigit( *curr ) )
+      return false;
+
+    read = 0;
+    while( curr != s_end && isDigit( *curr ) )
+    {
+      exponent *= 10;
+      exponent += static_cast<int>( *curr - 0x30 );
+      curr++; read++;
+    }
+    exponent *= ( exp_sign == '+' ? 1 : -1 );
+    if( read == 0 )
+      return false;
+  }
+
+assemble:
+  *result = ( sign == '+' ? 1 : -1 ) * ldexp( mantissa * pow( 5.0, exponent ), exponent );
+  return true;
+}
+
+
+inline float parseFloat( const char*& token, const char* end )
+{
+  while( token < end && isSpace( *token ) )
+    ++token;
+  const char* e = token;
+  while( e < end && !isSpace( *e ) && *e != '\r' )
+    ++e;
+
+  double val = 0.0;
+  tryParseDouble( token, e, &val );
+  token = e;
+  return static_cast<float>( val );
+}
+
+
+// atoi() restricted to [p, end)
+inline int parseInt( const char* p, const char* end )
+{
+  while( p < end && isspace( static_cast<unsigned char>( *p ) ) )
+    ++p;
+  bool negative = false;
+  if( p < end && ( *p == '+' || *p == '-' ) )
+    negative = *p++ == '-';
+  int value = 0;
+  while( p < end && isDigit( *p ) )
+    value = value * 10 + ( *p++ - '0' );
+  return negative ? -value : value;
+}
+
+
+inline const char* skipIndex( const char* token, const char* end )
+{
+  while( token < end && *token != '/' && !isSpace( *token ) && *token != '\r' )
+    ++token;
+  return token;
+}
+
+
+// Make index zero-base, and also support relative index (as in tinyobj)
+inline int32_t fixIndex( int idx, int64_t n )
+{
+  if( idx > 0 ) return idx - 1;
+  if( idx == 0 ) return 0;
+  return static_cast<int32_t>( n + idx );
+}
+
+
+// Parse triples: i, i/j/k, i//k, i/j
+VertexKey parseTriple( const char*& token, const char* end, int64_t vsize, int64_t vnsize, int64_t vtsize )
+{
+  VertexKey vi = { -1, -1, -1 };
+
+  vi.v  = fixIndex( parseInt( token, end ), vsize );
+  token = skipIndex( token, end );
+  if( token == end || *token != '/' )
+    return vi;
+  token++;
+
+  // i//k
+  if( token < end && *token == '/' )
+  {
+    token++;
+    vi.vn = fixIndex( parseInt( token, end ), vnsize );
+    token = skipIndex( token, end );
+    return vi;
+  }
+
+  // i/j/k or i/j
+  vi.vt = fixIndex( parseInt( token, end ), vtsize );
+  token = skipIndex( token, end );
+  if( token == end || *token != '/' )
+    return vi;
+
+  // i/j/k
+  token++;
+  vi.vn = fixIndex( parseInt( token, end ), vnsize );
+  token = skipIndex( token, end );
+  return vi;
+}
+
+
+// First whitespace separated word after a statement keyword, like sscanf( "%s" )
+std::string parseName( const char* token, const char* end )
+{
+  while( token < end && isspace( static_cast<unsigned char>( *token ) ) )
+    ++token;
+  const char* e = token;
+  while( e < end && !isspace( static_cast<unsigned char>( *e ) ) )
+    ++e;
+  return std::string( token, e );
+}
+
+
+// Matches tinyobj's InitMaterial, used when the file references no materials
+tinyobj::material_t defaultMaterial()
+{
+  tinyobj::material_t mat;
+  for( int i = 0; i < 3; ++i )
+  {
+    mat.diffuse[i]       = 0.7f;
+    mat.ambient[i]       = 0.0f;
+    mat.specular[i]      = 0.0f;
+    mat.transmittance[i] = 0.0f;
+    mat.emission[i]      = 0.0f;
+  }
+  mat.illum     = 0;
+  mat.dissolve  = 1.0f;
+  mat.shininess = 1.0f;
+  mat.ior       = 1.0f;
+  mat.dummy     = 0;
+  return mat;
+}
+
+} // namespace
+
+
+//------------------------------------------------------------------------------
+//
+// Per chunk parse results
+//
+//------------------------------------------------------------------------------
+
+// Run of faces within one chunk that belongs to a single shape
+struct ObjParser::Segment
+{
+  Segment() : num_faces( 0 ), shape( 0 ), num_new( 0 ), num_new_normals( 0 ), num_new_texcoords( 0 ),
+              vertex_base( 0 ), normal_base( 0 ), texcoord_base( 0 ), tri_base( 0 ) {}
+
+  uint64_t                  num_faces;
+  std::vector<VertexKey>    keys;          // Unique vertices in first-use order
+  std::vector<uint32_t>     hashes;        // hashKey( keys[i] )
+  std::vector<uint32_t>     corners;       // Indices into keys, 3 per triangle
+
+  // Filled in when stitching
+  uint32_t                  shape;
+  std::vector<uint64_t>     first;         // NEW_VERTEX or ( segment << 32 | key ) of first use in
+                                           // shape.  Empty if the shape has no other segments.
+  std::vector<uint32_t>     remap;         // Key -> vertex index within shape
+  uint32_t                  num_new;
+  uint32_t                  num_new_normals;
+  uint32_t                  num_new_texcoords;
+  uint32_t                  vertex_base;   // Offsets of this segment's data within its shape
+  uint32_t                  normal_base;
+  uint32_t                  texcoord_base;
+  uint32_t                  tri_base;
+
+  bool isNew( size_t key )const { return first.empty() || first[key] == NEW_VERTEX; }
+};
+
+
+// Statement that affects grouping or materials.  Statements follow the
+// segment with index 'segment'; g, o and usemtl start the next segment.
+struct ObjStatement
+{
+  LineType                  type;
+  std::string               name;
+  size_t                    segment;
+};
+
+
+struct ObjParser::Chunk
+{
+  const char*                 begin;
+  const char*                 end;
+  int64_t                     num_v;
+  int64_t                     num_vn;
+  int64_t                     num_vt;
+  int64_t                     v_base;
+  int64_t                     vn_base;
+  int64_t                     vt_base;
+  std::vector<Segment>        segments;
+  std::vector<ObjStatement>   statements;
+
+  void count();
+  void parse( float* v, float* vn, float* vt, int64_t total_v, int64_t total_vn, int64_t total_vt );
+};
+
+
+void ObjParser::Chunk::count()
+{
+  num_v = num_vn = num_vt = 0;
+
+  LineReader reader = { begin, end };
+  const char* line;
+  const char* line_end;
+  while( reader.next( line, line_end ) )
+  {
+    switch( classifyLine( line, line_end ) )
+    {
+      case LINE_V:  ++num_v;  break;
+      case LINE_VN: ++num_vn; break;
+      case LINE_VT: ++num_vt; break;
+      default: break;
+    }
+  }
+}
+
+
+void ObjParser::Chunk::parse( float* v, float* vn, float* vt, int64_t total_v, int64_t total_vn, int64_t total_vt )
+{
+  int64_t cur_v  = v_base;
+  int64_t cur_vn = vn_base;
+  int64_t cur_vt = vt_base;
+
+  segments.resize( 1 );
+  std::unordered_map<VertexKey, uint32_t, VertexKeyHash> cache;
+  std::vector<VertexKey> face;
+
+  // Per shape vertex dedup, same as tinyobj's updateVertex
+  auto addVertex = [&]( Segment& seg, const VertexKey& k )
+  {
+    if( k.v < 0 || k.v >= total_v || k.vn >= total_vn || k.vt >= total_vt )
+      throw std::runtime_error( "ObjParser: face index out of range" );
+
+    std::pair<std::unordered_map<VertexKey, uint32_t, VertexKeyHash>::iterator, bool> it =
+      cache.insert( std::make_pair( k, static_cast<uint32_t>( seg.keys.size() ) ) );
+    if( it.second )
+    {
+      seg.keys.push_back( k );
+      seg.hashes.push_back( hashKey( k ) );
+    }
+    seg.corners.push_back( it.first->second );
+  };
+
+  LineReader reader = { begin, end };
+  const char* line;
+  const char* line_end;
+  while( reader.next( line, line_end ) )
+  {
+    const char* token = line;
+    const LineType type = classifyLine( line, line_end );
+    switch( type )
+    {
+      case LINE_V:
+      {
+        token += 2;
+        float* p = v + 3*cur_v++;
+        p[0] = parseFloat( token, line_end );
+        p[1] = parseFloat( token, line_end );
+        p[2] = parseFloat( token, line_end );
+        break;
+      }
+      case LINE_VN:
+      {
+        token += 3;
+        float* p = vn + 3*cur_vn++;
+        p[0] = parseFloat( token, line_end );
+        p[1] = parseFloat( token, line_end );
+        p[2] = parseFloat( token, line_end );
+        break;
+      }
+      case LINE_VT:
+      {
+        token += 3;
+        float* p = vt + 2*cur_vt++;
+        p[0] = parseFloat( token, line_end );
+        p[1] = parseFloat( token, line_end );
+        break;
+      }
+      case LINE_F:
+      {
+        token += 2;
+        while( token < line_end && isSpace( *token ) )
+          ++token;
+
+        face.clear();
+        while( token < line_end && *token != '\r' )
+        {
+          face.push_back( parseTriple( token, line_end, cur_v, cur_vn, cur_vt ) );
+          while( token < line_end && ( isSpace( *token ) || *token == '\r' ) )
+            ++token;
+        }
+
+        // Polygon -> triangle fan conversion
+        Segment& seg = segments.back();
+        ++seg.num_faces;
+        for( size_t k = 2; k < face.size(); ++k )
+        {
+          addVertex( seg, face[0] );
+          addVertex( seg, face[k-1] );
+          addVertex( seg, face[k] );
+        }
+        break;
+      }
+      case LINE_USEMTL:
+      case LINE_MTLLIB:
+      case LINE_G:
+      case LINE_O:
+      {
+        ObjStatement statement;
+        statement.type    = type;
+        statement.name    = parseName( token + ( type == LINE_USEMTL || type == LINE_MTLLIB ? 7 : 2 ), line_end );
+        statement.segment = segments.size() - 1;
+        statements.push_back( statement );
+
+        if( type != LINE_MTLLIB )
+        {
+          segments.push_back( Segment() );
+          cache.clear();
+        }
+        break;
+      }
+      default:
+        break;
+    }
+  }
+}
+
+
+//------------------------------------------------------------------------------
+//
+// ObjParser class definition
+//
+//------------------------------------------------------------------------------
+
+ObjParser::ObjParser( const std::string& filename, const std::string& mtl_basepath )
+  : m_filename( filename ), m_mtl_basepath( mtl_basepath )
+{
+}
+
+
+ObjParser::~ObjParser()
+{
+  for( size_t i = 0; i < m_chunks.size(); ++i )
+    delete m_chunks[i];
+}
+
+
+bool ObjParser::parse( std::string& err )
+{
+  MappedFile file( m_filename );
+  if( file.failed() )
+  {
+    err = "Cannot open file [" + m_filename + "]\n";
+    return false;
+  }
+
+  //
+  // Split into line aligned chunks
+  //
+  const size_t num_chunks = std::max<size_t>( 1, std::min( sutil::numWorkerThreads() * CHUNKS_PER_THREAD,
+                                                           file.size() / MIN_CHUNK_SIZE ) );
+  const char* file_end = file.data() + file.size();
+  const char* begin    = file.data();
+  for( size_t i = 0; i < num_chunks && begin < file_end; ++i )
+  {
+    const char* end = i + 1 == num_chunks ? file_end : file.data() + file.size() / num_chunks * ( i + 1 );
+    if( end <= begin )
+      continue;
+    const char* nl = static_cast<const char*>( memchr( end - 1, '\n', static_cast<size_t>( file_end - end + 1 ) ) );
+    end = nl ? nl + 1 : file_end;
+
+    Chunk* chunk = new Chunk();
+    chunk->begin = begin;
+    chunk->end   = end;
+    m_chunks.push_back( chunk );
+    begin = end;
+  }
+
+  //
+  // Count vertex attributes per chunk so that relative indices and attribute
+  // storage can be resolved while parsing
+  //
+  sutil::parallelFor( m_chunks.size(), [&]( size_t i ) { m_chunks[i]->count(); } );
+
+  int64_t total_v = 0, total_vn = 0, total_vt = 0;
+  for( size_t i = 0; i < m_chunks.size(); ++i )
+  {
+    m_chunks[i]->v_base  = total_v;
+    m_chunks[i]->vn_base = total_vn;
+    m_chunks[i]->vt_base = total_vt;
+    total_v  += m_chunks[i]->num_v;
+    total_vn += m_chunks[i]->num_vn;
+    total_vt += m_chunks[i]->num_vt;
+  }
+  m_v.resize ( 3*total_v  );
+  m_vn.resize( 3*total_vn );
+  m_vt.resize( 2*total_vt );
+
+  float* v  = m_v.empty()  ? 0 : &m_v[0];
+  float* vn = m_vn.empty() ? 0 : &m_vn[0];
+  float* vt = m_vt.empty() ? 0 : &m_vt[0];
+  try
+  {
+    sutil::parallelFor( m_chunks.size(), [&]( size_t i ) {
+        m_chunks[i]->parse( v, vn, vt, total_v, total_vn, total_vt ); } );
+  }
+  catch( std::exception& e )
+  {
+    err = std::string( e.what() ) + " [" + m_filename + "]\n";
+    return false;
+  }
+
+  if( !stitch( err ) )
+    return false;
+
+  mergeVertices();
+  return true;
+}
+
+
+bool ObjParser::stitch( std::string& err )
+{
+  std::map<std::string, int>  material_map;
+  tinyobj::MaterialFileReader read_materials( m_mtl_basepath );
+  int                         material = -1;
+
+  Shape    shape       = Shape();
+  uint64_t shape_faces = 0;
+
+  for( size_t c = 0; c < m_chunks.size(); ++c )
+  {
+    Chunk& chunk = *m_chunks[c];
+    size_t st = 0;
+    for( size_t s = 0; s < chunk.segments.size(); ++s )
+    {
+      Segment& seg = chunk.segments[s];
+      if( seg.num_faces )
+      {
+        seg.shape = static_cast<uint32_t>( m_shapes.size() );
+        shape_faces += seg.num_faces;
+        m_segments.push_back( &seg );
+      }
+
+      for( ; st < chunk.statements.size() && chunk.statements[st].segment == s; ++st )
+      {
+        const ObjStatement& statement = chunk.statements[st];
+        if( statement.type == LINE_MTLLIB )
+        {
+          // Same path as MaterialFileReader opens
+          m_mtllibs.push_back( m_mtl_basepath + statement.name );
+          std::string err_mtl;
+          const bool ok = read_materials( statement.name, m_materials, material_map, err_mtl );
+          err += err_mtl;
+          if( !ok )
+            return false;
+          continue;
+        }
+
+        // Create face group per g, o and usemtl
+        if( shape_faces )
+        {
+          shape.material = material;
+          m_shapes.push_back( shape );
+        }
+        shape       = Shape();
+        shape_faces = 0;
+
+        if( statement.type == LINE_USEMTL )
+        {
+          std::map<std::string, int>::const_iterator it = material_map.find( statement.name );
+          material = it != material_map.end() ? it->second : -1;
+        }
+      }
+    }
+  }
+  if( shape_faces )
+  {
+    shape.material = material;
+    m_shapes.push_back( shape );
+  }
+
+  if( m_materials.empty() )
+    m_materials.push_back( defaultMaterial() );
+
+  return true;
+}
+
+
+void ObjParser::mergeVertices()
+{
+  //
+  // Segments are already deduplicated, so only shapes spanning several
+  // segments (i.e. crossing chunk boundaries) need merging.  For those, find
+  // the first use of every (shape, v, vt, vn).  Keys are partitioned by hash
+  // so each partition can be processed independently, visiting segments in
+  // file order.
+  //
+  std::vector<uint32_t> segments_per_shape( m_shapes.size(), 0 );
+  for( size_t s = 0; s < m_segments.size(); ++s )
+    ++segments_per_shape[ m_segments[s]->shape ];
+
+  std::vector<size_t> shared;
+  for( size_t s = 0; s < m_segments.size(); ++s )
+  {
+    if( segments_per_shape[ m_segments[s]->shape ] > 1 )
+    {
+      m_segments[s]->first.resize( m_segments[s]->keys.size() );
+      shared.push_back( s );
+    }
+  }
+
+  const size_t num_partitions = shared.empty() ? 0 : sutil::numWorkerThreads() * 4;
+  sutil::parallelFor( num_partitions, [&]( size_t p )
+  {
+    std::unordered_map<ShapeVertexKey, uint64_t, ShapeVertexKeyHash> first;
+    for( size_t j = 0; j < shared.size(); ++j )
+    {
+      const size_t s   = shared[j];
+      Segment&     seg = *m_segments[s];
+      for( size_t i = 0; i < seg.keys.size(); ++i )
+      {
+        if( seg.hashes[i] % num_partitions != p )
+          continue;
+
+        const ShapeVertexKey key = { seg.shape, seg.keys[i] };
+        std::pair<std::unordered_map<ShapeVertexKey, uint64_t, ShapeVertexKeyHash>::iterator, bool> it =
+          first.insert( std::make_pair( key, static_cast<uint64_t>( s ) << 32 | i ) );
+        seg.first[i] = it.second ? NEW_VERTEX : it.first->second;
+      }
+    }
+  } );
+
+  sutil::parallelFor( m_segments.size(), [&]( size_t s )
+  {
+    Segment& seg = *m_segments[s];
+    for( size_t i = 0; i < seg.keys.size(); ++i )
+    {
+      if( !seg.isNew( i ) )
+        continue;
+      ++seg.num_new;
+      if( seg.keys[i].vn >= 0 ) ++seg.num_new_normals;
+      if( seg.keys[i].vt >= 0 ) ++seg.num_new_texcoords;
+    }
+  } );
+
+  // Prefix sums within shapes
+  for( size_t s = 0; s < m_segments.size(); ++s )
+  {
+    Segment& seg = *m_segments[s];
+    Shape&   sh  = m_shapes[seg.shape];
+    seg.vertex_base    = sh.num_vertices;
+    seg.normal_base    = sh.num_normals;
+    seg.texcoord_base  = sh.num_texcoords;
+    seg.tri_base       = sh.num_triangles;
+    sh.num_vertices   += seg.num_new;
+    sh.num_normals    += seg.num_new_normals;
+    sh.num_texcoords  += seg.num_new_texcoords;
+    sh.num_triangles  += static_cast<uint32_t>( seg.corners.size() / 3 );
+  }
+
+  // Number first uses in order, then point repeated uses at them
+  sutil::parallelFor( m_segments.size(), [&]( size_t s )
+  {
+    Segment& seg = *m_segments[s];
+    seg.remap.resize( seg.keys.size() );
+    uint32_t next = seg.vertex_base;
+    for( size_t i = 0; i < seg.keys.size(); ++i )
+      if( seg.isNew( i ) )
+        seg.remap[i] = next++;
+  } );
+
+  sutil::parallelFor( m_segments.size(), [&]( size_t s )
+  {
+    Segment& seg = *m_segments[s];
+    for( size_t i = 0; i < seg.keys.size(); ++i )
+      if( !seg.isNew( i ) )
+        seg.remap[i] = m_segments[seg.first[i] >> 32]->remap[seg.first[i] & 0xffffffffu];
+  } );
+}
+
+
+void ObjParser::loadMesh( Mesh& mesh )const
+{
+  std::vector<uint32_t> vertex_offsets( m_shapes.size() );
+  std::vector<uint32_t> tri_offsets( m_shapes.size() );
+  uint32_t vrt_offset = 0;
+  uint32_t tri_offset = 0;
+  for( size_t i = 0; i < m_shapes.size(); ++i )
+  {
+    vertex_offsets[i] = vrt_offset;
+    tri_offsets[i]    = tri_offset;
+    vrt_offset += m_shapes[i].num_vertices;
+    tri_offset += m_shapes[i].num_triangles;
+  }
+
+  std::vector<float> bbox( 6*m_segments.size() );
+
+  sutil::parallelFor( m_segments.size(), [&]( size_t s )
+  {
+    const Segment& seg   = *m_segments[s];
+    const Shape&   shape = m_shapes[seg.shape];
+    const uint32_t vo    = vertex_offsets[seg.shape];
+
+    float bbox_min[3] = {  1e16f,  1e16f,  1e16f };
+    float bbox_max[3] = { -1e16f, -1e16f, -1e16f };
+
+    uint32_t normal   = vo + seg.normal_base;
+    uint32_t texcoord = vo + seg.texcoord_base;
+    for( size_t i = 0; i < seg.keys.size(); ++i )
+    {
+      if( !seg.isNew( i ) )
+        continue;
+
+      const VertexKey& k   = seg.keys[i];
+      const float*     pos = &m_v[ 3*static_cast<size_t>( k.v ) ];
+      float*           dst = mesh.positions + 3*static_cast<size_t>( vo + seg.remap[i] );
+      for( int j = 0; j < 3; ++j )
+      {
+        dst[j]      = pos[j];
+        bbox_min[j] = std::min<float>( bbox_min[j], pos[j] );
+        bbox_max[j] = std::max<float>( bbox_max[j], pos[j] );
+      }
+
+      // Like tinyobj, normals and texcoords are packed in the order of the
+      // vertices that have them.
+      if( k.vn >= 0 )
+      {
+        if( mesh.has_normals )
+          memcpy( mesh.normals + 3*static_cast<size_t>( normal ), &m_vn[ 3*static_cast<size_t>( k.vn ) ], 3*sizeof( float ) );
+        ++normal;
+      }
+      if( k.vt >= 0 )
+      {
+        if( mesh.has_texcoords )
+          memcpy( mesh.texcoords + 2*static_cast<size_t>( texcoord ), &m_vt[ 2*static_cast<size_t>( k.vt ) ], 2*sizeof( float ) );
+        ++texcoord;
+      }
+    }
+
+    int32_t*      tri_indices = mesh.tri_indices + 3*static_cast<size_t>( tri_offsets[seg.shape] + seg.tri_base );
+    int32_t*      mat_indices = mesh.mat_indices +   static_cast<size_t>( tri_offsets[seg.shape] + seg.tri_base );
+    const int32_t material    = shape.material >= 0 ? shape.material : 0;
+    for( size_t i = 0; i < seg.corners.size(); ++i )
+      tri_indices[i] = static_cast<int32_t>( seg.remap[ seg.corners[i] ] + vo );
+    for( size_t i = 0; i < seg.corners.size() / 3; ++i )
+      mat_indices[i] = material;
+
+    for( int j = 0; j < 3; ++j )
+    {
+      bbox[6*s + j]     = bbox_min[j];
+      bbox[6*s + 3 + j] = bbox_max[j];
+    }
+  } );
+
+  for( size_t s = 0; s < m_segments.size(); ++s )
+  {
+    for( int j = 0; j < 3; ++j )
+    {
+      mesh.bbox_min[j] = std::min<float>( mesh.bbox_min[j], bbox[6*s + j] );
+      mesh.bbox_max[j] = std::max<float>( mesh.bbox_max[j], bbox[6*s + 3 + j] );
+    }
+  }
+}
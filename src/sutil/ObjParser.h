@@ -0,0 +1,102 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Mesh.h"
+#include "tinyobjloader/tiny_obj_loader.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+//
+// Multithreaded OBJ parser used by MeshLoader.
+//
+// The file is mapped and split into line aligned chunks which are parsed on
+// worker threads.  The per chunk results are stitched together with prefix
+// sums, reproducing what tinyobj::LoadObj followed by MeshLoader's copy loop
+// produces: one shape per g/o/usemtl face group, vertices deduplicated per
+// shape by (v, vt, vn) in first-use order, polygons fan triangulated.
+//
+//------------------------------------------------------------------------------
+class ObjParser
+{
+public:
+  struct Shape
+  {
+    int32_t           material;         // Material id, -1 if none
+    uint32_t          num_vertices;
+    uint32_t          num_normals;      // Vertices with a normal index
+    uint32_t          num_texcoords;    // Vertices with a texcoord index
+    uint32_t          num_triangles;
+  };
+
+  ObjParser( const std::string& filename, const std::string& mtl_basepath );
+  ~ObjParser();
+
+  // Parse the file.  Returns false on failure, err receives errors and warnings.
+  bool parse( std::string& err );
+
+  const std::vector<Shape>&                  shapes()const    { return m_shapes; }
+  const std::vector<tinyobj::material_t>&    materials()const { return m_materials; }
+
+  // Paths of the material libraries named by mtllib statements, in file order
+  const std::vector<std::string>&            mtllibs()const   { return m_mtllibs; }
+
+  // Fills positions, normals, texcoords, tri_indices, mat_indices and the bbox
+  // of a mesh allocated from the shape counts.  Shapes are concatenated in
+  // order, normals and texcoords are only written if mesh.has_normals and
+  // mesh.has_texcoords are set.
+  void loadMesh( Mesh& mesh )const;
+
+private:
+  struct Chunk;
+  struct Segment;
+
+  ObjParser( const ObjParser& );
+  ObjParser& operator=( const ObjParser& );
+
+  bool stitch( std::string& err );
+  void mergeVertices();
+
+  std::string                        m_filename;
+  std::string                        m_mtl_basepath;
+
+  std::vector<float>                 m_v;
+  std::vector<float>                 m_vn;
+  std::vector<float>                 m_vt;
+
+  std::vector<Chunk*>                m_chunks;
+  std::vector<Segment*>              m_segments;       // Non-empty segments in file order
+  std::vector<Shape>                 m_shapes;
+  std::vector<tinyobj::material_t>   m_materials;
+  std::vector<std::string>           m_mtllibs;
+};
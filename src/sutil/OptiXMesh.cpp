@@ -80,6 +80,20 @@ void setupMeshLoaderInputs(
 }
 
 
+// Copies vertex, index and material data between meshes of equal sizes
+void copyMeshArrays( const Mesh& src, Mesh& dst )
+{
+  memcpy( dst.positions,   src.positions,   3*src.num_vertices *sizeof(float) );
+  if( src.has_normals )
+    memcpy( dst.normals,   src.normals,     3*src.num_vertices *sizeof(float) );
+  if( src.has_texcoords )
+    memcpy( dst.texcoords, src.texcoords,   2*src.num_vertices *sizeof(float) );
+  memcpy( dst.tri_indices, src.tri_indices, 3*src.num_triangles*sizeof(int32_t) );
+  memcpy( dst.mat_indices, src.mat_indices,   src.num_triangles*sizeof(int32_t) );
+  std::copy( src.mat_params, src.mat_params + src.num_materials, dst.mat_params );
+}
+
+
 void unmap( MeshBuffers& buffers, Mesh& mesh )
 {
   buffers.tri_indices->unmap();
@@ -232,7 +246,8 @@ void translateMeshToOptiX(
 void loadMesh(
     const std::string&          filename,
     OptiXMesh&                  optix_mesh, 
-    const optix::Matrix4x4&     load_xform
+    const optix::Matrix4x4&     load_xform,
+    unsigned int                flags
     )
 {
   if( !optix_mesh.context )
@@ -243,13 +258,29 @@ void loadMesh(
   optix::Context context = optix_mesh.context;
 
   Mesh mesh;
-  MeshLoader loader( filename );
-  loader.scanMesh( mesh );
-
   MeshBuffers buffers;
-  setupMeshLoaderInputs( context, buffers, mesh );
+  if( flags == MESH_LOAD_DEFAULT )
+  {
+    MeshLoader loader( filename );
+    loader.scanMesh( mesh );
+
+    setupMeshLoaderInputs( context, buffers, mesh );
 
-  loader.loadMesh( mesh, load_xform.getData() );
+    loader.loadMesh( mesh, load_xform.getData() );
+  }
+  else
+  {
+    // Post-load passes change the vertex count, so the buffers can only be
+    // sized once the host mesh is final
+    HostMesh host_mesh( filename, load_xform.getData(), flags );
+    mesh = host_mesh;
+    mesh.arena      = 0;
+    mesh.arena_size = 0;
+
+    setupMeshLoaderInputs( context, buffers, mesh );
+
+    copyMeshArrays( host_mesh, mesh );
+  }
 
   translateMeshToOptiX( mesh, buffers, optix_mesh );
 
@@ -69,8 +69,12 @@ struct OptiXMesh
 };
 
 
+// flags is a combination of MeshLoadFlags.  Without flags the mesh is loaded
+// straight into mapped OptiX buffers, otherwise it is processed on the host
+// first and then copied.
 SUTILAPI void loadMesh(
     const std::string&        filename,
     OptiXMesh&                mesh, 
-    const optix::Matrix4x4&   load_xform = optix::Matrix4x4::identity()
+    const optix::Matrix4x4&   load_xform = optix::Matrix4x4::identity(),
+    unsigned int              flags = MESH_LOAD_DEFAULT
     );
@@ -0,0 +1,98 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace sutil
+{
+
+// Number of threads used by the host-side parallel helpers.
+inline unsigned int numWorkerThreads()
+{
+  const unsigned int n = std::thread::hardware_concurrency();
+  return n ? n : 1u;
+}
+
+
+// Calls fn( i ) for every i in [0, count).  Indices are handed out one at a
+// time to up to numWorkerThreads() threads (including the caller), so items
+// should be coarse, e.g. a chunk of a file or a block of a few thousand
+// elements.  If fn throws, the first exception is rethrown once all threads
+// have finished.
+template<typename Fn>
+void parallelFor( size_t count, Fn fn )
+{
+  const size_t num_threads = std::min<size_t>( numWorkerThreads(), count );
+  if( num_threads <= 1 )
+  {
+    for( size_t i = 0; i < count; ++i )
+      fn( i );
+    return;
+  }
+
+  std::atomic<size_t> next( 0 );
+  std::exception_ptr  error;
+  std::mutex          error_mutex;
+
+  auto worker = [&]()
+  {
+    try
+    {
+      for( size_t i = next++; i < count; i = next++ )
+        fn( i );
+    }
+    catch( ... )
+    {
+      std::lock_guard<std::mutex> lock( error_mutex );
+      if( !error )
+        error = std::current_exception();
+      next = count;
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for( size_t t = 1; t < num_threads; ++t )
+    threads.push_back( std::thread( worker ) );
+  worker();
+  for( size_t t = 0; t < threads.size(); ++t )
+    threads[t].join();
+
+  if( error )
+    std::rethrow_exception( error );
+}
+
+} // end namespace sutil
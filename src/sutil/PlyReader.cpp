@@ -0,0 +1,526 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "PlyReader.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <stdint.h>
+
+
+//------------------------------------------------------------------------------
+//
+// Helpers
+//
+//------------------------------------------------------------------------------
+
+namespace
+{
+
+// Number of vertices or faces converted per parallel task
+const size_t BLOCK_SIZE = 1u << 16;
+
+
+bool hostIsBigEndian()
+{
+  const uint16_t one = 1;
+  unsigned char  first;
+  memcpy( &first, &one, 1 );
+  return first == 0;
+}
+
+
+// Unaligned load of a T stored at p, byte swapped if requested
+template<typename T>
+inline T loadScalar( const char* p, bool swap )
+{
+  unsigned char bytes[ sizeof( T ) ];
+  memcpy( bytes, p, sizeof( T ) );
+  if( swap )
+    std::reverse( bytes, bytes + sizeof( T ) );
+  T value;
+  memcpy( &value, bytes, sizeof( T ) );
+  return value;
+}
+
+
+// Type ids follow PlyReader::Type
+size_t typeSize( int type )
+{
+  static const size_t sizes[] = { 0, 1, 1, 2, 2, 4, 4, 4, 8 };
+  return sizes[type];
+}
+
+
+int parseType( const std::string& name )
+{
+  static const char* names[]   = { "", "int8", "uint8", "int16", "uint16", "int32", "uint32", "float32", "float64" };
+  static const char* aliases[] = { "", "char", "uchar", "short", "ushort", "int",   "uint",   "float",   "double"  };
+  for( int t = 1; t < 9; ++t )
+    if( name == names[t] || name == aliases[t] )
+      return t;
+  return 0;
+}
+
+
+// Reads an integer of the given type, as used for list counts and indices
+int64_t readInteger( int type, const char* p, bool swap )
+{
+  switch( type )
+  {
+    case 1:  return loadScalar<int8_t>  ( p, swap );
+    case 2:  return loadScalar<uint8_t> ( p, swap );
+    case 3:  return loadScalar<int16_t> ( p, swap );
+    case 4:  return loadScalar<uint16_t>( p, swap );
+    case 5:  return loadScalar<int32_t> ( p, swap );
+    case 6:  return loadScalar<uint32_t>( p, swap );
+    default: return 0;
+  }
+}
+
+
+template<typename T>
+void extractColumn( const char* src, size_t stride, size_t count, bool swap, float* dst, size_t dst_stride )
+{
+  // Keep the swap test out of the loop so the common case is a plain strided copy
+  if( swap )
+    for( size_t i = 0; i < count; ++i )
+      dst[i*dst_stride] = static_cast<float>( loadScalar<T>( src + i*stride, true ) );
+  else
+    for( size_t i = 0; i < count; ++i )
+      dst[i*dst_stride] = static_cast<float>( loadScalar<T>( src + i*stride, false ) );
+}
+
+
+template<typename T>
+void extractIndices( const char* src, size_t stride, size_t count, bool swap, int32_t* dst )
+{
+  for( size_t i = 0; i < count; ++i )
+  {
+    const char* p = src + i*stride;
+    dst[3*i+0] = static_cast<int32_t>( loadScalar<T>( p,                 swap ) );
+    dst[3*i+1] = static_cast<int32_t>( loadScalar<T>( p +   sizeof( T ), swap ) );
+    dst[3*i+2] = static_cast<int32_t>( loadScalar<T>( p + 2*sizeof( T ), swap ) );
+  }
+}
+
+} // namespace
+
+
+//------------------------------------------------------------------------------
+//
+// PlyReader class definition
+//
+//------------------------------------------------------------------------------
+
+PlyReader::PlyReader( const std::string& filename )
+  : m_file( filename ),
+    m_valid( false ),
+    m_swap( false ),
+    m_data_offset( 0 ),
+    m_vertex( -1 ),
+    m_face( -1 ),
+    m_vertex_offset( 0 ),
+    m_face_offset( 0 )
+{
+  if( m_file.failed() )
+    return;
+
+  m_valid = readHeader() && locateElements();
+}
+
+
+bool PlyReader::valid()const
+{
+  return m_valid;
+}
+
+
+bool PlyReader::readHeader()
+{
+  static const char END_HEADER[] = "end_header";
+
+  const char* data = m_file.data();
+  const size_t size = m_file.size();
+  if( size < 4 || strncmp( data, "ply", 3 ) != 0 )
+    return false;
+
+  // Find the end of the header, which is followed by the first element's data
+  const char* end = data;
+  for( ;; )
+  {
+    end = static_cast<const char*>( memchr( end, '\n', size - ( end - data ) ) );
+    if( !end )
+      return false;
+    ++end;
+    if( static_cast<size_t>( data + size - end ) >= sizeof( END_HEADER ) - 1 &&
+        strncmp( end, END_HEADER, sizeof( END_HEADER ) - 1 ) == 0 )
+      break;
+  }
+  const char* data_start = static_cast<const char*>( memchr( end, '\n', size - ( end - data ) ) );
+  if( !data_start )
+    return false;
+  m_data_offset = data_start + 1 - data;
+
+  std::istringstream header( std::string( data, end ) );
+  std::string line;
+  std::getline( header, line );   // "ply"
+
+  bool binary = false;
+  while( std::getline( header, line ) )
+  {
+    std::istringstream tokens( line );
+    std::string keyword;
+    tokens >> keyword;
+
+    if( keyword == "format" )
+    {
+      std::string format;
+      tokens >> format;
+      if( format == "binary_little_endian" )
+        m_swap = hostIsBigEndian();
+      else if( format == "binary_big_endian" )
+        m_swap = !hostIsBigEndian();
+      else
+        return false;   // ascii
+      binary = true;
+    }
+    else if( keyword == "element" )
+    {
+      Element element;
+      if( !( tokens >> element.name >> element.count ) )
+        return false;
+      element.stride = 0;
+      m_elements.push_back( element );
+    }
+    else if( keyword == "property" )
+    {
+      if( m_elements.empty() )
+        return false;
+
+      Property property;
+      std::string type;
+      tokens >> type;
+      property.count_type = TYPE_NONE;
+      if( type == "list" )
+      {
+        tokens >> type;
+        property.count_type = static_cast<Type>( parseType( type ) );
+        tokens >> type;
+        if( property.count_type == TYPE_NONE || property.count_type >= TYPE_FLOAT32 )
+          return false;
+      }
+      property.type = static_cast<Type>( parseType( type ) );
+      if( property.type == TYPE_NONE || !( tokens >> property.name ) )
+        return false;
+      property.offset = 0;
+      m_elements.back().properties.push_back( property );
+    }
+    else if( keyword != "comment" && keyword != "obj_info" && !keyword.empty() )
+      return false;
+  }
+  if( !binary )
+    return false;
+
+  // Fixed element sizes and property offsets
+  for( size_t i = 0; i < m_elements.size(); ++i )
+  {
+    Element& element = m_elements[i];
+    size_t offset = 0;
+    for( size_t j = 0; j < element.properties.size() && offset != ~size_t( 0 ); ++j )
+    {
+      element.properties[j].offset = offset;
+      offset = element.properties[j].count_type == TYPE_NONE ? offset + typeSize( element.properties[j].type ) : ~size_t( 0 );
+    }
+    element.stride = offset != ~size_t( 0 ) ? offset : 0;
+
+    if( element.name == "vertex" && m_vertex < 0 )
+      m_vertex = static_cast<int>( i );
+    else if( element.name == "face" && m_face < 0 )
+      m_face = static_cast<int>( i );
+  }
+
+  //
+  // Check for the supported layout
+  //
+  if( m_vertex < 0 || m_elements[m_vertex].stride == 0 )
+    return false;
+
+  int found = 0;
+  const Element& vertex = m_elements[m_vertex];
+  for( size_t j = 0; j < vertex.properties.size(); ++j )
+  {
+    const std::string& name = vertex.properties[j].name;
+    if( name == "x" )  found |= 1;
+    if( name == "y" )  found |= 2;
+    if( name == "z" )  found |= 4;
+    if( name == "nx" ) found |= 8;
+    if( name == "ny" ) found |= 16;
+    if( name == "nz" ) found |= 32;
+  }
+  if( ( found & 7 ) != 7 || ( ( found & 8 ) && ( found & 56 ) != 56 ) )
+    return false;
+
+  if( m_face >= 0 )
+  {
+    const Element& face = m_elements[m_face];
+    if( face.properties.size() != 1 ||
+        face.properties[0].name != "vertex_indices" ||
+        face.properties[0].count_type == TYPE_NONE ||
+        face.properties[0].type >= TYPE_FLOAT32 )
+      return false;
+  }
+
+  return true;
+}
+
+
+bool PlyReader::locateElements()
+{
+  const char*  data   = m_file.data();
+  const size_t size   = m_file.size();
+  const int    last   = std::max( m_vertex, m_face );
+  size_t       offset = m_data_offset;
+
+  for( int i = 0; i <= last; ++i )
+  {
+    if( i == m_vertex ) m_vertex_offset = offset;
+    if( i == m_face )   m_face_offset   = offset;
+    if( i == last )
+      break;
+
+    const Element& element = m_elements[i];
+    if( element.stride )
+    {
+      if( element.count > ( size - offset ) / element.stride )
+        return false;
+      offset += element.count * element.stride;
+      continue;
+    }
+
+    // Elements with lists have to be walked
+    for( size_t k = 0; k < element.count; ++k )
+    {
+      for( size_t j = 0; j < element.properties.size(); ++j )
+      {
+        const Property& property = element.properties[j];
+        size_t length = typeSize( property.type );
+        if( property.count_type != TYPE_NONE )
+        {
+          const size_t count_size = typeSize( property.count_type );
+          if( offset + count_size > size )
+            return false;
+
+          const int64_t count = readInteger( property.count_type, data + offset, m_swap );
+          if( count < 0 || static_cast<uint64_t>( count ) > size )
+            return false;
+          length = count_size + static_cast<size_t>( count ) * length;
+        }
+        if( offset + length > size )
+          return false;
+        offset += length;
+      }
+    }
+  }
+
+  const Element& vertex = m_elements[m_vertex];
+  return vertex.count <= ( size - m_vertex_offset ) / vertex.stride;
+}
+
+
+void PlyReader::scanMesh( Mesh& mesh )const
+{
+  // Same counts as rply reports when setting the read callbacks
+  const Element& vertex = m_elements[m_vertex];
+  mesh.num_vertices  = static_cast<int32_t>( vertex.count );
+  mesh.num_triangles = m_face >= 0 ? static_cast<int32_t>( m_elements[m_face].count ) : 0;
+
+  mesh.has_normals = false;
+  for( size_t j = 0; j < vertex.properties.size(); ++j )
+    if( vertex.properties[j].name == "nx" )
+      mesh.has_normals = vertex.count != 0;
+
+  mesh.has_texcoords = false;
+  mesh.num_materials = 1; // default material
+}
+
+
+bool PlyReader::loadMesh( Mesh& mesh )const
+{
+  if( !loadFaces( mesh ) )
+    return false;
+  loadVertices( mesh );
+  return true;
+}
+
+
+bool PlyReader::loadFaces( Mesh& mesh )const
+{
+  if( m_face < 0 )
+    return true;
+
+  const Element&  face       = m_elements[m_face];
+  const Property& indices    = face.properties[0];
+  const char*     data       = m_file.data();
+  const size_t    size       = m_file.size();
+  const size_t    count_size = typeSize( indices.count_type );
+  const size_t    index_size = typeSize( indices.type );
+
+  auto extract = [&]( const char* src, size_t stride, size_t count, int32_t* dst )
+  {
+    switch( indices.type )
+    {
+      case TYPE_INT8:   extractIndices<int8_t>  ( src, stride, count, m_swap, dst ); break;
+      case TYPE_UINT8:  extractIndices<uint8_t> ( src, stride, count, m_swap, dst ); break;
+      case TYPE_INT16:  extractIndices<int16_t> ( src, stride, count, m_swap, dst ); break;
+      case TYPE_UINT16: extractIndices<uint16_t>( src, stride, count, m_swap, dst ); break;
+      case TYPE_INT32:  extractIndices<int32_t> ( src, stride, count, m_swap, dst ); break;
+      case TYPE_UINT32: extractIndices<uint32_t>( src, stride, count, m_swap, dst ); break;
+      default: break;
+    }
+  };
+
+  //
+  // Pure triangle meshes have a fixed face size and are converted in parallel.
+  // Checking every block at its assumed position is enough: if all counts are
+  // three, all positions are right.
+  //
+  const size_t stride     = count_size + 3*index_size;
+  const size_t num_blocks = ( face.count + BLOCK_SIZE - 1 ) / BLOCK_SIZE;
+  bool         fixed      = face.count <= ( size - m_face_offset ) / stride;
+  if( fixed )
+  {
+    std::vector<char> block_ok( num_blocks, 0 );
+    sutil::parallelFor( num_blocks, [&]( size_t b )
+    {
+      const size_t end = std::min( face.count, ( b + 1 ) * BLOCK_SIZE );
+      for( size_t i = b * BLOCK_SIZE; i < end; ++i )
+        if( readInteger( indices.count_type, data + m_face_offset + i*stride, m_swap ) != 3 )
+          return;
+      block_ok[b] = 1;
+    } );
+    fixed = std::find( block_ok.begin(), block_ok.end(), 0 ) == block_ok.end();
+  }
+
+  if( fixed )
+  {
+    sutil::parallelFor( num_blocks, [&]( size_t b )
+    {
+      const size_t begin = b * BLOCK_SIZE;
+      const size_t end   = std::min( face.count, begin + BLOCK_SIZE );
+      extract( data + m_face_offset + begin*stride + count_size, stride, end - begin, mesh.tri_indices + 3*begin );
+    } );
+    return true;
+  }
+
+  //
+  // Polygons: walk the faces and keep the first triangle of each, as the
+  // rply path does
+  //
+  size_t offset = m_face_offset;
+  for( size_t i = 0; i < face.count; ++i )
+  {
+    if( offset + count_size > size )
+      return false;
+    const int64_t n = readInteger( indices.count_type, data + offset, m_swap );
+    if( n < 3 || static_cast<uint64_t>( n ) > ( size - offset - count_size ) / index_size )
+      return false;
+
+    extract( data + offset + count_size, 0, 1, mesh.tri_indices + 3*i );
+    offset += count_size + static_cast<size_t>( n ) * index_size;
+  }
+  return true;
+}
+
+
+void PlyReader::loadVertices( Mesh& mesh )const
+{
+  const Element& vertex     = m_elements[m_vertex];
+  const char*    src        = m_file.data() + m_vertex_offset;
+  const size_t   num_blocks = ( vertex.count + BLOCK_SIZE - 1 ) / BLOCK_SIZE;
+
+  std::vector<float> bbox( 6*num_blocks );
+  sutil::parallelFor( num_blocks, [&]( size_t b )
+  {
+    const size_t begin = b * BLOCK_SIZE;
+    const size_t count = std::min( vertex.count, begin + BLOCK_SIZE ) - begin;
+
+    for( size_t j = 0; j < vertex.properties.size(); ++j )
+    {
+      const Property&    property = vertex.properties[j];
+      const std::string& name     = property.name;
+
+      float* dst = 0;
+      if( name == "x" || name == "y" || name == "z" )
+        dst = mesh.positions + 3*begin + ( name[0] - 'x' );
+      else if( mesh.has_normals && ( name == "nx" || name == "ny" || name == "nz" ) )
+        dst = mesh.normals + 3*begin + ( name[1] - 'x' );
+      if( !dst )
+        continue;
+
+      const char* column = src + begin*vertex.stride + property.offset;
+      switch( property.type )
+      {
+        case TYPE_INT8:    extractColumn<int8_t>  ( column, vertex.stride, count, m_swap, dst, 3 ); break;
+        case TYPE_UINT8:   extractColumn<uint8_t> ( column, vertex.stride, count, m_swap, dst, 3 ); break;
+        case TYPE_INT16:   extractColumn<int16_t> ( column, vertex.stride, count, m_swap, dst, 3 ); break;
+        case TYPE_UINT16:  extractColumn<uint16_t>( column, vertex.stride, count, m_swap, dst, 3 ); break;
+        case TYPE_INT32:   extractColumn<int32_t> ( column, vertex.stride, count, m_swap, dst, 3 ); break;
+        case TYPE_UINT32:  extractColumn<uint32_t>( column, vertex.stride, count, m_swap, dst, 3 ); break;
+        case TYPE_FLOAT32: extractColumn<float>   ( column, vertex.stride, count, m_swap, dst, 3 ); break;
+        case TYPE_FLOAT64: extractColumn<double>  ( column, vertex.stride, count, m_swap, dst, 3 ); break;
+        default: break;
+      }
+    }
+
+    float* bbox_min = &bbox[6*b];
+    float* bbox_max = &bbox[6*b + 3];
+    bbox_min[0] = bbox_min[1] = bbox_min[2] =  1e16f;
+    bbox_max[0] = bbox_max[1] = bbox_max[2] = -1e16f;
+    for( size_t i = 0; i < count; ++i )
+    {
+      const float* p = mesh.positions + 3*( begin + i );
+      for( int k = 0; k < 3; ++k )
+      {
+        bbox_min[k] = std::min( bbox_min[k], p[k] );
+        bbox_max[k] = std::max( bbox_max[k], p[k] );
+      }
+    }
+  } );
+
+  for( size_t b = 0; b < num_blocks; ++b )
+  {
+    for( int k = 0; k < 3; ++k )
+    {
+      mesh.bbox_min[k] = std::min( mesh.bbox_min[k], bbox[6*b + k] );
+      mesh.bbox_max[k] = std::max( mesh.bbox_max[k], bbox[6*b + 3 + k] );
+    }
+  }
+}
@@ -0,0 +1,108 @@
+/* 
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Mesh.h"
+#include "MappedFile.h"
+
+#include <string>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+//
+// Native reader for binary PLY files with a plain layout: a vertex element of
+// scalar properties with x, y, z (and optionally nx, ny, nz) and a face
+// element holding only a vertex_indices list.  The file is mapped and whole
+// element blocks are converted column by column, so there is no per scalar
+// callback as with rply.  MeshLoader falls back to rply for ascii files and
+// any other layout.
+//
+//------------------------------------------------------------------------------
+class PlyReader
+{
+public:
+  PlyReader( const std::string& filename );
+
+  // True if the header was read and the layout is supported
+  bool valid()const;
+
+  // Same contract as MeshLoader::scanMesh/loadMesh (without the load transform).
+  // loadMesh returns false without touching the vertex data if the faces turn
+  // out to be unsupported (fewer than three indices); the caller should then
+  // fall back to rply.
+  void scanMesh( Mesh& mesh )const;
+  bool loadMesh( Mesh& mesh )const;
+
+private:
+  enum Type
+  {
+    TYPE_NONE = 0,
+    TYPE_INT8,
+    TYPE_UINT8,
+    TYPE_INT16,
+    TYPE_UINT16,
+    TYPE_INT32,
+    TYPE_UINT32,
+    TYPE_FLOAT32,
+    TYPE_FLOAT64
+  };
+
+  struct Property
+  {
+    std::string   name;
+    Type          type;          // Scalar type, or item type of a list
+    Type          count_type;    // TYPE_NONE unless this is a list
+    size_t        offset;        // Byte offset within an element of fixed size
+  };
+
+  struct Element
+  {
+    std::string             name;
+    size_t                  count;
+    std::vector<Property>   properties;
+    size_t                  stride;   // Size of one element, 0 if it has lists
+  };
+
+  bool readHeader();
+  bool locateElements();
+  bool loadFaces( Mesh& mesh )const;
+  void loadVertices( Mesh& mesh )const;
+
+  MappedFile                m_file;
+  bool                      m_valid;
+  bool                      m_swap;           // File endianness differs from the host
+
+  std::vector<Element>      m_elements;
+  size_t                    m_data_offset;    // Start of the element data
+  int                       m_vertex;         // Index into m_elements, -1 if absent
+  int                       m_face;
+  size_t                    m_vertex_offset;  // Start of vertex / face data in the file
+  size_t                    m_face_offset;
+};